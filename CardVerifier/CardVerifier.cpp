@@ -0,0 +1,300 @@
+/*********************************************************************************************/
+/*
+ * Card verifier PC library
+ * 
+ *  This library verifies in PC the punches of raw card images dumped by the Master, using
+ *	the station keys exported by the Master once per event.
+*/
+/*********************************************************************************************/
+
+
+#include "CardVerifier.h"
+#include "MultiBlake2s.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+
+// Class constructor
+CardVerifier::CardVerifier () : numStations(0), multi(new MultiBlake2s()) {
+	memset (keysDigest, 0, sizeof(keysDigest));
+}
+
+
+// Class destructor. Keys are cleaned from memory
+CardVerifier::~CardVerifier () {
+	memset (keys, 0, sizeof(keys));
+}
+
+
+// Loads the payload of MSG_KEY_TABLE: number of stations & 32 bytes key of each one
+bool CardVerifier::loadKeyTable (const uint8_t *table, size_t len) {
+
+	if (len < 1 || len != 1 + (size_t)table[0] * STATION_REC_SIZE) {
+		return false;
+	}
+
+	numStations = table[0];
+	memcpy (keys, &table[1], numStations * STATION_REC_SIZE);
+	multi->setKeys (keys, numStations);
+
+	blake.reset (PREFIX_DIGEST_SIZE);
+	blake.update (table, len);
+	blake.finalize (keysDigest, PREFIX_DIGEST_SIZE);
+
+	return true;
+
+}
+
+
+// Loads a key table saved in a file by PC script
+bool CardVerifier::loadKeyTableFile (const char *path) {
+
+	uint8_t table [1 + MAX_STATIONS * STATION_REC_SIZE];	// Content of the file
+	size_t len;							// Bytes read
+	FILE *file;
+	bool ok;
+
+	file = fopen (path, "rb");
+	if (file == NULL) {
+		return false;
+	}
+	len = fread (table, 1, sizeof(table), file);
+	fclose (file);
+
+	ok = loadKeyTable (table, len);
+	memset (table, 0, sizeof(table));	// Cleans keys from memory
+
+	return ok;
+
+}
+
+
+/* Verifies all the punches of a raw card image like Master does in readPunches: the MAC of
+each punch is BLAKE2s with the key of the station over UID, IDS, time & previous block (with
+NB set to 0 for the first punch). With a cache, punches of the verified prefix take the
+result of the previous readout. Returns false if image isn't a valid card image */
+bool CardVerifier::verify (const uint8_t *image, size_t len, CardResult &result,
+	PrefixCache *cache) {
+
+	MacInput inputs [MAX_PUNCHES];		// Message of MAC of each punch
+	uint8_t mac [AUTH_IN_CARD_SIZE];	// Generated MAC for compare with auth code in card
+	uint8_t digest [PREFIX_DIGEST_SIZE];	// Of all punch blocks, for next readout
+	uint8_t known = 0;					// Punches with result in cache
+	uint32_t uid;
+	std::chrono::steady_clock::time_point start;
+
+	if (len != CARD_IMAGE_SIZE || !parse (image, result, inputs)) {
+		return false;
+	}
+
+	uid = ((uint32_t)result.uid[0] << 24) | (result.uid[1] << 16) | (result.uid[2] << 8) |
+		result.uid[3];
+	if (cache != NULL) {
+		known = cachedPunches (image, result, cache->find (uid, keysDigest), digest);
+	}
+
+	start = std::chrono::steady_clock::now();
+	for (uint8_t i = known; i < result.numPunches; i++) {
+		PunchResult &punch = result.punches[i];
+		if (punch.ids < numStations) {
+			blake.reset (keys[punch.ids], STATION_REC_SIZE, AUTH_IN_CARD_SIZE);
+			blake.update (inputs[i].message, MAC_MESSAGE_SIZE);
+			blake.finalize (mac, AUTH_IN_CARD_SIZE);
+			punch.valid = (memcmp (mac, &image[UID_LENGTH + punch.block * MIFARE_BLOCK_SIZE + 5],
+				AUTH_IN_CARD_SIZE) == 0);
+			result.numValid += punch.valid;
+		}
+	}
+
+	if (cache != NULL) {
+		PrefixCache::Entry entry;
+		entry.valid = 0;
+		for (uint8_t i = 0; i < result.numPunches; i++) {
+			entry.valid |= (uint64_t)result.punches[i].valid << i;
+		}
+		entry.numPunches = result.numPunches;
+		entry.block = result.numPunches > 0 ? result.punches[result.numPunches - 1].block : 0;
+		memcpy (entry.digest, digest, PREFIX_DIGEST_SIZE);
+		cache->store (uid, entry);
+		cache->count (known > 0, known, result.numPunches - known,
+			std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+
+	return true;
+
+}
+
+
+/* Hashes block 1 (without NB, that changes with each punch) & the punch blocks. If the
+digest of the blocks up to the last verified one is the one in cache, the results of those
+punches are copied from it. Digest of all blocks is returned for saving it in cache */
+uint8_t CardVerifier::cachedPunches (const uint8_t *image, CardResult &result,
+	const PrefixCache::Entry *entry, uint8_t *digest) {
+
+	const uint8_t *blocks = &image[UID_LENGTH];
+	uint8_t header [MIFARE_BLOCK_SIZE];
+	uint8_t known = 0;
+
+	memcpy (header, &blocks[NB_CAT_BLOCK * MIFARE_BLOCK_SIZE], sizeof(header));
+	header[0] = 0;
+	blake.reset (PREFIX_DIGEST_SIZE);
+	blake.update (header, sizeof(header));
+
+	for (uint8_t i = 0; i < result.numPunches; i++) {
+		blake.update (&blocks[result.punches[i].block * MIFARE_BLOCK_SIZE], MIFARE_BLOCK_SIZE);
+		if (entry != NULL && i + 1 == entry->numPunches && result.punches[i].block == entry->block) {
+			BLAKE2s prefix (blake);		// Digest up to here, going on with the rest
+			prefix.finalize (digest, PREFIX_DIGEST_SIZE);
+			if (memcmp (digest, entry->digest, PREFIX_DIGEST_SIZE) == 0) {
+				known = entry->numPunches;
+			}
+		}
+	}
+	blake.finalize (digest, PREFIX_DIGEST_SIZE);
+
+	// Results of verified prefix
+	for (uint8_t i = 0; i < known; i++) {
+		result.punches[i].valid = (entry->valid >> i) & 1;
+		result.numValid += result.punches[i].valid;
+	}
+
+	return known;
+
+}
+
+
+/* Verifies several card images. MACs of all their punches are computed at once with
+multi-buffer BLAKE2s, so results are the same as verify() ones. Images of cards that weren't
+detected by Master get 0 punches */
+size_t CardVerifier::verifyBatch (const uint8_t *const *images, size_t count,
+	CardResult *results) const {
+
+	std::vector<MacInput> inputs (count * MAX_PUNCHES);
+	std::vector<PunchResult *> punches;		// Punch of each MAC computed
+	std::vector<const uint8_t *> codes;		// MAC in card of each one
+	size_t valid = 0;
+
+	punches.reserve (inputs.size());
+	codes.reserve (inputs.size());
+
+	for (size_t c = 0; c < count; c++) {
+		CardResult &result = results[c];
+		if (!parse (images[c], result, &inputs[punches.size()])) {
+			result.numPunches = 0;
+			continue;
+		}
+		valid++;
+		// Punches of unknown stations aren't computed
+		MacInput *cardInputs = &inputs[punches.size()];
+		for (uint8_t i = 0; i < result.numPunches; i++) {
+			if (result.punches[i].ids < numStations) {
+				inputs[punches.size()] = cardInputs[i];
+				codes.push_back (&images[c][UID_LENGTH +
+					result.punches[i].block * MIFARE_BLOCK_SIZE + 5]);
+				punches.push_back (&result.punches[i]);
+			}
+		}
+	}
+
+	std::vector<uint8_t> macs (punches.size() * AUTH_IN_CARD_SIZE);
+	multi->computeMacs (inputs.data(), punches.size(),
+		(uint8_t (*)[AUTH_IN_CARD_SIZE])macs.data());
+
+	for (size_t i = 0; i < punches.size(); i++) {
+		punches[i]->valid = (memcmp (&macs[i * AUTH_IN_CARD_SIZE], codes[i],
+			AUTH_IN_CARD_SIZE) == 0);
+	}
+	for (size_t c = 0; c < count; c++) {
+		for (uint8_t i = 0; i < results[c].numPunches; i++) {
+			results[c].numValid += results[c].punches[i].valid;
+		}
+	}
+
+	return valid;
+
+}
+
+
+/* Reads card header & punches of an image, with their MAC messages (UID, IDS, time &
+previous block). Punches are left not valid. Returns false if card wasn't detected */
+bool CardVerifier::parse (const uint8_t *image, CardResult &result, MacInput *inputs) const {
+
+	const uint8_t *blocks;				// First block of card in image
+	uint8_t lastBlock;					// Next free block in card
+	uint8_t block;						// Block of current punch
+	static const uint8_t zeroUid [UID_LENGTH] = { 0 };
+
+	if (memcmp (image, zeroUid, UID_LENGTH) == 0) {
+		return false;					// Card wasn't detected by Master
+	}
+
+	blocks = &image[UID_LENGTH];
+
+	// Card header
+	memcpy (result.uid, image, UID_LENGTH);
+	lastBlock = blocks[NB_CAT_BLOCK * MIFARE_BLOCK_SIZE];
+	memcpy (result.category, &blocks[NB_CAT_BLOCK * MIFARE_BLOCK_SIZE + 1], CAT_SIZE);
+	result.category[CAT_SIZE] = '\0';
+	memcpy (result.name, &blocks[NAME_BLOCK * MIFARE_BLOCK_SIZE], NAME_SIZE);
+	result.name[NAME_SIZE] = '\0';
+	result.numPunches = 0;
+	result.numValid = 0;
+
+	// Punches. Stops at LAST_PUNCH_BLOCK if NB is corrupted
+	for (block = FIRST_PUNCH_BLOCK; block < lastBlock && block < LAST_PUNCH_BLOCK;
+		block = nextFreeBlock(block)) {
+
+		const uint8_t *data = &blocks[block * MIFARE_BLOCK_SIZE];
+		MacInput &input = inputs[result.numPunches];
+		PunchResult &punch = result.punches[result.numPunches++];
+
+		punch.block = block;
+		punch.ids = data[0];
+		punch.time = (uint32_t)data[1] | ((uint32_t)data[2] << 8) |
+			((uint32_t)data[3] << 16) | ((uint32_t)data[4] << 24);
+		punch.valid = false;
+
+		input.station = punch.ids;
+		memcpy (&input.message[0], result.uid, UID_LENGTH);
+		memcpy (&input.message[UID_LENGTH], data, 5);	// IDS & time, little endian like in AVR
+		memcpy (&input.message[UID_LENGTH + 5], &blocks[previousBlock(block) *
+			MIFARE_BLOCK_SIZE], MIFARE_BLOCK_SIZE);
+		if (block == FIRST_PUNCH_BLOCK) {
+			input.message[UID_LENGTH + 5] = 0;	// NB changes along punches, so it's 0 in MAC
+		}
+	}
+
+	return true;
+
+}
+
+
+// Return the following free block of card avoiding sector trailer's blocks
+uint8_t CardVerifier::nextFreeBlock (uint8_t cardBlock) {
+
+	if (cardBlock >= LAST_PUNCH_BLOCK) {
+		return LAST_PUNCH_BLOCK;
+	} else if (((cardBlock + 2) % 4) == 0) {
+		return cardBlock + 2;
+	} else {
+		return cardBlock + 1;
+	}
+
+}
+
+
+// Return the last written block of user's card avoiding sector trailer's blocks
+uint8_t CardVerifier::previousBlock (uint8_t cardBlock) {
+
+	if (cardBlock <= FIRST_PUNCH_BLOCK) {
+		return NB_CAT_BLOCK;
+	} else if ((cardBlock % 4) == 0) {
+		return cardBlock - 2;
+	} else {
+		return cardBlock - 1;
+	}
+
+}
@@ -0,0 +1,105 @@
+/*********************************************************************************************/
+/*
+ * Card verifier PC library
+ * 
+ *  This library verifies in PC the punches of raw card images dumped by the Master (choice
+ *	'6' of Master menu), using the station keys exported by the Master once per event
+ *	(choice '7'). It does the same checks as PlayerCard::readPunches does in the Master:
+ *	for each punch, BLAKE2s MAC over UID, station ID, time & previous block.
+ *
+ *	Card image file: UID (4 bytes) & 64 blocks of 16 bytes (payload of MSG_CARD_IMAGE).
+ *	Key table file: number of stations (1 byte) & 32 bytes key of each station (payload of
+ *	MSG_KEY_TABLE).
+ *
+ *	verifyBatch() gives the same results for many cards at once, computing their MACs with
+ *	multi-buffer BLAKE2s (see MultiBlake2s.h). It can be called from several threads.
+ *
+ *	When verify() is given a PrefixCache, punches verified in a previous readout of the card
+ *	aren't verified again while the blocks before them are the same (see PrefixCache.h).
+ *
+ *	BLAKE2s implementation is the one of Crypto library, so build with (see VerifyCards.cpp):
+ *
+ *	g++ -O2 -std=c++11 -pthread -I../libraries/Crypto VerifyCards.cpp CardVerifier.cpp 
+ *		MultiBlake2s.cpp WorkPool.cpp PrefixCache.cpp ../libraries/Crypto/BLAKE2s.cpp 
+ *		../libraries/Crypto/Hash.cpp ../libraries/Crypto/Crypto.cpp -o VerifyCards
+*/
+/*********************************************************************************************/
+
+
+#ifndef __CARDVERIFIER_H__
+#define __CARDVERIFIER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <BLAKE2s.h>
+#include "PrefixCache.h"
+
+
+#define UID_LENGTH			4			// Length of UID in Mifare Classic 1k cards
+#define MIFARE_BLOCK_SIZE	16			// Size of each block on Mifare Classic 1k Card
+#define CARD_BLOCKS			64			// Number of blocks of Mifare Classic 1k Card
+#define CARD_IMAGE_SIZE		(UID_LENGTH + CARD_BLOCKS * MIFARE_BLOCK_SIZE)	// Size of image
+#define NB_CAT_BLOCK		1			// Block number of Next Block and Category in user card
+#define NAME_BLOCK			2			// Block number of User Name in user card
+#define FIRST_PUNCH_BLOCK	4			// Block number of first punch block in user card
+#define LAST_PUNCH_BLOCK	62			// Block number of last block that can be written
+#define MAX_PUNCHES			45			// Punches of a full card
+#define CAT_SIZE			15			// Size in bytes of category field in card
+#define NAME_SIZE			16			// Size in bytes of player name field in card
+#define AUTH_IN_CARD_SIZE	11			// Size of MAC in each punch record in user's card
+#define STATION_REC_SIZE	32			// Size in bytes of each station key
+#define MAX_STATIONS		256			// Max number of stations of an event
+
+
+// Result of verifying one punch
+struct PunchResult {
+	uint8_t block;						// Card block where punch is saved
+	uint8_t ids;						// Station identifier
+	uint32_t time;						// Unix time of punch
+	bool valid;							// True if MAC is correct
+};
+
+
+class MultiBlake2s;
+struct MacInput;
+
+
+// Result of verifying one card
+struct CardResult {
+	uint8_t uid [UID_LENGTH];			// UID of user's card
+	char name [NAME_SIZE + 1];			// Player name, null terminated
+	char category [CAT_SIZE + 1];		// Player category, null terminated
+	uint8_t numPunches;					// Number of punches in card
+	uint8_t numValid;					// Number of punches with correct MAC
+	PunchResult punches [MAX_PUNCHES];	// Punches in card order
+};
+
+
+class CardVerifier {
+public:
+	CardVerifier ();
+	~CardVerifier ();
+	bool loadKeyTable (const uint8_t *table, size_t len);	// Loads MSG_KEY_TABLE payload
+	bool loadKeyTableFile (const char *path);	// Loads key table saved in a file
+	bool verify (const uint8_t *image, size_t len, CardResult &result,
+		PrefixCache *cache = NULL);		// Verifies card
+	size_t verifyBatch (const uint8_t *const *images, size_t count,
+		CardResult *results) const;		// Verifies CARD_IMAGE_SIZE images. Returns valid ones
+
+private:
+	BLAKE2s blake;						// Object that manages Blake2s crypto functionalities
+	uint16_t numStations;				// Number of stations in key table
+	uint8_t keys [MAX_STATIONS][STATION_REC_SIZE];	// Key of each station
+	std::unique_ptr<MultiBlake2s> multi;	// Station midstates for verifyBatch
+	uint8_t keysDigest [PREFIX_DIGEST_SIZE];	// Identifies key table in PrefixCache
+
+	bool parse (const uint8_t *image, CardResult &result, MacInput *inputs) const;
+	uint8_t cachedPunches (const uint8_t *image, CardResult &result,
+		const PrefixCache::Entry *entry, uint8_t *digest);	// Punches of verified prefix
+
+	static uint8_t nextFreeBlock (uint8_t cardBlock);	// Same as PlayerCard
+	static uint8_t previousBlock (uint8_t cardBlock);	// Same as PlayerCard
+};
+
+#endif
@@ -0,0 +1,236 @@
+/*********************************************************************************************/
+/*
+ * Multi-buffer BLAKE2s PC library
+ * 
+ *  This library computes punch MACs in the lanes of SIMD registers.
+*/
+/*********************************************************************************************/
+
+
+#include "MultiBlake2s.h"
+
+#include <string.h>
+
+
+#define BLAKE2S_BLOCK		64			// Bytes of a BLAKE2s block
+#define LANES_AVX2			8
+#define LANES_SIMD			4			// SSE2 or NEON
+
+#define ALWAYS_INLINE		inline __attribute__((always_inline))
+#define ROTATE(x, bits)		(((x) >> (bits)) | ((x) << (32 - (bits))))	// Of each lane
+
+
+typedef uint32_t Lanes4 __attribute__((vector_size(16)));
+typedef uint32_t Lanes8 __attribute__((vector_size(32)));
+
+
+// Initialization vector of BLAKE2s
+static const uint32_t iv [8] = { 0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F,
+	0x9B05688C, 0x1F83D9AB, 0x5BE0CD19 };
+
+// Permutation on the message input state for BLAKE2s
+static const uint8_t sigma [10][16] = {
+	{ 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15},
+	{14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3},
+	{11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4},
+	{ 7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8},
+	{ 9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13},
+	{ 2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9},
+	{12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11},
+	{13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10},
+	{ 6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5},
+	{10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13 , 0}
+};
+
+
+// BLAKE2s quarter round on lanes
+template <typename V> static ALWAYS_INLINE void quarterRound (V &a, V &b, V &c, V &d,
+	const V &x, const V &y) {
+	a += b + x;
+	d ^= a;
+	d = ROTATE (d, 16);
+	c += d;
+	b ^= c;
+	b = ROTATE (b, 12);
+	a += b + y;
+	d ^= a;
+	d = ROTATE (d, 8);
+	c += d;
+	b ^= c;
+	b = ROTATE (b, 7);
+}
+
+
+/* Compression of one block in each lane, like BLAKE2s::processChunk. All lanes have the
+same length & f0. V is uint32_t (1 lane) or a vector of lanes */
+template <typename V> static ALWAYS_INLINE void compress (V h [8], const V m [16],
+	uint32_t length, uint32_t f0) {
+
+	V v [16];
+	V zero = V();
+
+	for (int i = 0; i < 8; i++) {
+		v[i] = h[i];
+		v[i + 8] = zero + iv[i];
+	}
+	v[12] ^= length;
+	v[14] ^= f0;
+
+	for (int r = 0; r < 10; r++) {
+		const uint8_t *s = sigma[r];
+		// Column round
+		quarterRound (v[0], v[4], v[8],  v[12], m[s[0]],  m[s[1]]);
+		quarterRound (v[1], v[5], v[9],  v[13], m[s[2]],  m[s[3]]);
+		quarterRound (v[2], v[6], v[10], v[14], m[s[4]],  m[s[5]]);
+		quarterRound (v[3], v[7], v[11], v[15], m[s[6]],  m[s[7]]);
+		// Diagonal round
+		quarterRound (v[0], v[5], v[10], v[15], m[s[8]],  m[s[9]]);
+		quarterRound (v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+		quarterRound (v[2], v[7], v[8],  v[13], m[s[12]], m[s[13]]);
+		quarterRound (v[3], v[4], v[9],  v[14], m[s[14]], m[s[15]]);
+	}
+
+	for (int i = 0; i < 8; i++) {
+		h[i] ^= v[i] ^ v[i + 8];
+	}
+
+}
+
+
+// Little endian word of a byte array
+static inline uint32_t word (const uint8_t *bytes) {
+	return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) |
+		((uint32_t)bytes[3] << 24);
+}
+
+
+/* Computes L MACs: transposes messages & midstates to lanes, compresses the message block
+(last one, so f0 is set) & takes 11 bytes of the hash of each lane */
+template <typename V, unsigned L> static ALWAYS_INLINE void macLanes (
+	const uint32_t midstates [][8], const MacInput *inputs, uint8_t macs [][AUTH_IN_CARD_SIZE]) {
+
+	uint32_t words [16][L];
+	uint32_t states [8][L];
+	uint8_t block [BLAKE2S_BLOCK] = { 0 };
+	V h [8];
+	V m [16];
+
+	for (unsigned l = 0; l < L; l++) {
+		memcpy (block, inputs[l].message, MAC_MESSAGE_SIZE);	// Rest is padding
+		for (int w = 0; w < 16; w++) {
+			words[w][l] = word (&block[4 * w]);
+		}
+		for (int i = 0; i < 8; i++) {
+			states[i][l] = midstates[inputs[l].station][i];
+		}
+	}
+	memcpy (m, words, sizeof(m));
+	memcpy (h, states, sizeof(h));
+
+	compress (h, m, BLAKE2S_BLOCK + MAC_MESSAGE_SIZE, 0xFFFFFFFF);
+
+	memcpy (states, h, sizeof(h));
+	for (unsigned l = 0; l < L; l++) {
+		for (int i = 0; i < AUTH_IN_CARD_SIZE; i++) {
+			macs[l][i] = states[i / 4][l] >> (8 * (i % 4));
+		}
+	}
+
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static size_t macsAvx2 (const uint32_t midstates [][8], const MacInput *inputs, size_t count,
+	uint8_t macs [][AUTH_IN_CARD_SIZE]) {
+	size_t i;
+	for (i = 0; i + LANES_AVX2 <= count; i += LANES_AVX2) {
+		macLanes<Lanes8, LANES_AVX2> (midstates, &inputs[i], &macs[i]);
+	}
+	return i;
+}
+#endif
+
+
+static size_t macsSimd (const uint32_t midstates [][8], const MacInput *inputs, size_t count,
+	uint8_t macs [][AUTH_IN_CARD_SIZE]) {
+	size_t i;
+	for (i = 0; i + LANES_SIMD <= count; i += LANES_SIMD) {
+		macLanes<Lanes4, LANES_SIMD> (midstates, &inputs[i], &macs[i]);
+	}
+	return i;
+}
+
+
+// Class constructor
+MultiBlake2s::MultiBlake2s () {
+	memset (midstates, 0, sizeof(midstates));
+}
+
+
+// Class destructor. Midstates are cleaned like keys, since they allow computing MACs
+MultiBlake2s::~MultiBlake2s () {
+	memset (midstates, 0, sizeof(midstates));
+}
+
+
+// Computes the midstate of each station: keyed BLAKE2s state after the key block
+void MultiBlake2s::setKeys (const uint8_t keys [][STATION_REC_SIZE], uint16_t numStations) {
+
+	uint8_t block [BLAKE2S_BLOCK] = { 0 };
+	uint32_t m [16];
+
+	for (uint16_t s = 0; s < numStations && s < MAX_STATIONS; s++) {
+		uint32_t *h = midstates[s];
+		memcpy (h, iv, sizeof(iv));
+		h[0] ^= 0x01010000 ^ (STATION_REC_SIZE << 8) ^ AUTH_IN_CARD_SIZE;
+		memcpy (block, keys[s], STATION_REC_SIZE);
+		for (int w = 0; w < 16; w++) {
+			m[w] = word (&block[4 * w]);
+		}
+		compress (h, m, BLAKE2S_BLOCK, 0);
+	}
+	memset (block, 0, sizeof(block));
+	memset (m, 0, sizeof(m));
+
+}
+
+
+// Computes the MACs of the inputs, as many at once as lanes. Remaining ones one by one
+void MultiBlake2s::computeMacs (const MacInput *inputs, size_t count,
+	uint8_t macs [][AUTH_IN_CARD_SIZE]) const {
+
+	size_t done = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports ("avx2")) {
+		done = macsAvx2 (midstates, inputs, count, macs);
+	}
+#endif
+	done += macsSimd (midstates, &inputs[done], count - done, &macs[done]);
+	for (; done < count; done++) {
+		macLanes<uint32_t, 1> (midstates, &inputs[done], &macs[done]);
+	}
+
+}
+
+
+unsigned MultiBlake2s::lanes () {
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports ("avx2")) {
+		return LANES_AVX2;
+	}
+#endif
+	return LANES_SIMD;
+}
+
+
+const char *MultiBlake2s::backend () {
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_cpu_supports ("avx2") ? "AVX2" : "SSE2";
+#elif defined(__ARM_NEON)
+	return "NEON";
+#else
+	return "generic";
+#endif
+}
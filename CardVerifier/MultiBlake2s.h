@@ -0,0 +1,49 @@
+/*********************************************************************************************/
+/*
+ * Multi-buffer BLAKE2s PC library
+ * 
+ *  Computes many punch MACs at once. Each MAC is BLAKE2s keyed with the station key over 25
+ *	bytes (UID, IDS, time & previous block) with 11 bytes of output, like
+ *	PlayerCard::generateMac. Since the key is the first block of keyed BLAKE2s, the state
+ *	after it (midstate) is computed once per station, so each MAC only needs the
+ *	compression of its message block.
+ *
+ *	Compressions of different MACs are independent, so they run in the lanes of SIMD
+ *	registers: 8 lanes with AVX2 (chosen at run time) or 4 with SSE2 or NEON. The compression
+ *	function is the one of BLAKE2s.cpp of Crypto library, written once for any lane type
+ *	with GCC vector extensions.
+*/
+/*********************************************************************************************/
+
+
+#ifndef __MULTIBLAKE2S_H__
+#define __MULTIBLAKE2S_H__
+
+#include "CardVerifier.h"
+
+
+#define MAC_MESSAGE_SIZE	25			// UID, IDS, time & previous block
+
+
+// Message of a punch MAC
+struct MacInput {
+	uint8_t station;					// IDS, for choosing the key
+	uint8_t message [MAC_MESSAGE_SIZE];
+};
+
+
+class MultiBlake2s {
+public:
+	MultiBlake2s ();
+	~MultiBlake2s ();
+	void setKeys (const uint8_t keys [][STATION_REC_SIZE], uint16_t numStations);
+	void computeMacs (const MacInput *inputs, size_t count,
+		uint8_t macs [][AUTH_IN_CARD_SIZE]) const;	// Stations must have a key
+	static unsigned lanes ();			// MACs computed at once
+	static const char *backend ();		// Name of SIMD instructions used
+
+private:
+	uint32_t midstates [MAX_STATIONS][8];	// State after key block of each station
+};
+
+#endif
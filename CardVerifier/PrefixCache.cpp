@@ -0,0 +1,145 @@
+/*********************************************************************************************/
+/*
+ * Verified-prefix cache PC library
+ * 
+ *  This library saves the punches already verified of each card.
+*/
+/*********************************************************************************************/
+
+
+#include "PrefixCache.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+#define RECORD_SIZE			(4 + 2 + 8 + PREFIX_DIGEST_SIZE)	// Bytes of each card in file
+
+
+PrefixCache::PrefixCache () : numReadouts(0), numHits(0), numSkipped(0), numVerified(0),
+	macTime(0) {
+	memset (keys, 0, sizeof(keys));
+}
+
+
+bool PrefixCache::load (const char *path) {
+
+	uint8_t record [RECORD_SIZE];
+	FILE *file = fopen (path, "rb");
+
+	entries.clear ();
+	if (file == NULL) {
+		return false;
+	}
+	if (fread (keys, 1, sizeof(keys), file) != sizeof(keys)) {
+		fclose (file);
+		return false;
+	}
+	while (fread (record, 1, sizeof(record), file) == sizeof(record)) {
+		Entry entry;
+		uint32_t uid = 0;
+		entry.valid = 0;
+		for (int i = 0; i < 4; i++) {
+			uid = (uid << 8) | record[i];
+		}
+		entry.block = record[4];
+		entry.numPunches = record[5];
+		for (int i = 0; i < 8; i++) {
+			entry.valid |= (uint64_t)record[6 + i] << (8 * i);
+		}
+		memcpy (entry.digest, &record[14], PREFIX_DIGEST_SIZE);
+		entries[uid] = entry;
+	}
+	fclose (file);
+
+	return true;
+
+}
+
+
+bool PrefixCache::save (const char *path) const {
+
+	uint8_t record [RECORD_SIZE];
+	FILE *file = fopen (path, "wb");
+	bool ok;
+
+	if (file == NULL) {
+		return false;
+	}
+	ok = fwrite (keys, 1, sizeof(keys), file) == sizeof(keys);
+	for (std::unordered_map<uint32_t, Entry>::const_iterator i = entries.begin();
+		i != entries.end() && ok; ++i) {
+		for (int b = 0; b < 4; b++) {
+			record[b] = i->first >> (8 * (3 - b));
+		}
+		record[4] = i->second.block;
+		record[5] = i->second.numPunches;
+		for (int b = 0; b < 8; b++) {
+			record[6 + b] = i->second.valid >> (8 * b);
+		}
+		memcpy (&record[14], i->second.digest, PREFIX_DIGEST_SIZE);
+		ok = fwrite (record, 1, sizeof(record), file) == sizeof(record);
+	}
+
+	return fclose (file) == 0 && ok;
+
+}
+
+
+void PrefixCache::clear () {
+	entries.clear ();
+}
+
+
+size_t PrefixCache::size () const {
+	return entries.size();
+}
+
+
+// Entry of a card. Entries verified with other key table are removed
+const PrefixCache::Entry *PrefixCache::find (uint32_t uid, const uint8_t *keysDigest) {
+
+	if (memcmp (keys, keysDigest, sizeof(keys)) != 0) {
+		entries.clear ();
+		memcpy (keys, keysDigest, sizeof(keys));
+		return NULL;
+	}
+
+	std::unordered_map<uint32_t, Entry>::const_iterator i = entries.find (uid);
+	return i != entries.end() ? &i->second : NULL;
+
+}
+
+
+void PrefixCache::store (uint32_t uid, const Entry &entry) {
+	entries[uid] = entry;
+}
+
+
+void PrefixCache::count (bool hit, uint8_t skipped, uint8_t verified, double macSeconds) {
+	numReadouts++;
+	numHits += hit;
+	numSkipped += skipped;
+	numVerified += verified;
+	macTime += macSeconds;
+}
+
+
+unsigned long PrefixCache::readouts () const {
+	return numReadouts;
+}
+
+
+unsigned long PrefixCache::hits () const {
+	return numHits;
+}
+
+
+unsigned long PrefixCache::skipped () const {
+	return numSkipped;
+}
+
+
+double PrefixCache::savedSeconds () const {
+	return numVerified > 0 ? numSkipped * macTime / numVerified : 0;
+}
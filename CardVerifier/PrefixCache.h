@@ -0,0 +1,70 @@
+/*********************************************************************************************/
+/*
+ * Verified-prefix cache PC library
+ * 
+ *  Cards are usually read more than once (check read at start, read-outs during the event
+ *	& final readout), and punches are only appended. Each MAC covers the previous block, so
+ *	punches verified in a readout keep their result while the blocks before them don't
+ *	change. This cache saves, for each UID, the last verified punch block, the result of
+ *	each punch up to it and a BLAKE2s digest of those blocks (block 1 without NB & punch
+ *	blocks). CardVerifier::verify() computes the digest of the same blocks in the new image
+ *	(one compression each 4 blocks) and, if it matches, only verifies the new punches.
+ *
+ *	The cache belongs to one key table: it's emptied when it's used with another one. It can
+ *	be saved in a file, so it lasts between runs of VerifyCards:
+ *
+ *	File: digest of key table (16 bytes) & one record per card: UID (4 bytes), last block,
+ *	number of punches, results (8 bytes, bit i is punch i) & digest (16 bytes).
+*/
+/*********************************************************************************************/
+
+
+#ifndef __PREFIXCACHE_H__
+#define __PREFIXCACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+
+
+#define PREFIX_DIGEST_SIZE	16			// Bytes of BLAKE2s digest of verified blocks
+
+
+class PrefixCache {
+public:
+	// Verified prefix of a card
+	struct Entry {
+		uint8_t block;					// Block of last verified punch
+		uint8_t numPunches;				// Punches verified
+		uint64_t valid;					// Bit i set if punch i has a correct MAC
+		uint8_t digest [PREFIX_DIGEST_SIZE];	// Of block 1 (NB = 0) & punch blocks
+	};
+
+	PrefixCache ();
+	bool load (const char *path);		// False if file can't be read (cache is empty)
+	bool save (const char *path) const;
+	void clear ();
+	size_t size () const;				// Cards in cache
+
+	// Used by CardVerifier
+	const Entry *find (uint32_t uid, const uint8_t *keysDigest);	// Empties it if other keys
+	void store (uint32_t uid, const Entry &entry);
+	void count (bool hit, uint8_t skipped, uint8_t verified, double macSeconds);
+
+	// Statistics since creation
+	unsigned long readouts () const;	// Cards verified with the cache
+	unsigned long hits () const;		// Readouts that reused a verified prefix
+	unsigned long skipped () const;		// Punches not verified again
+	double savedSeconds () const;		// Skipped punches by mean MAC time, without digests
+
+private:
+	std::unordered_map<uint32_t, Entry> entries;	// By UID
+	uint8_t keys [PREFIX_DIGEST_SIZE];	// Digest of key table of entries
+	unsigned long numReadouts;
+	unsigned long numHits;
+	unsigned long numSkipped;
+	unsigned long numVerified;			// MACs computed
+	double macTime;						// Seconds computing them
+};
+
+#endif
@@ -0,0 +1,277 @@
+/*********************************************************************************************/
+/*
+ * VerifyCards
+ * 
+ *  This PC program verifies the punches of card images dumped by the Master with the key
+ *	table exported by the Master. It prints the punches of each card like the serial
+ *	interface script does. With -b N it verifies the cards N times and prints how many
+ *	cards per second can be verified, first one by one with Crypto BLAKE2s and then in
+ *	batches of BATCH_CARDS cards with multi-buffer BLAKE2s in -t threads (one per core by
+ *	default). Results of both ways are compared, and MACs per second per core are printed.
+ *	At last, each card is verified READS_PER_CARD times growing (like readouts along the
+ *	event) with & without a PrefixCache, and the time saved per readout is printed.
+ *
+ *	With -c, punches verified in previous runs with the same cache file aren't verified
+ *	again (see PrefixCache.h). Hit rate & time saved are printed at the end.
+ *
+ *	Usage: VerifyCards [-b N] [-t threads] [-c cache.bin] keys.bin card1.bin [card2.bin ...]
+ *
+ *	Build: g++ -O2 -std=c++11 -pthread -I../libraries/Crypto VerifyCards.cpp CardVerifier.cpp 
+ *		MultiBlake2s.cpp WorkPool.cpp PrefixCache.cpp ../libraries/Crypto/BLAKE2s.cpp 
+ *		../libraries/Crypto/Hash.cpp ../libraries/Crypto/Crypto.cpp -o VerifyCards
+*/
+/*********************************************************************************************/
+
+
+#include "CardVerifier.h"
+#include "MultiBlake2s.h"
+#include "WorkPool.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+
+#define BATCH_CARDS			64			// Cards of each task of the thread pool
+#define READS_PER_CARD		3			// Check read, read-out during event & final one
+
+
+typedef std::chrono::steady_clock Clock;
+
+
+// Reads a card image file. Returns false if it can't be read
+static bool readImage (const char *path, std::vector<uint8_t> &image) {
+
+	FILE *file = fopen (path, "rb");
+	if (file == NULL) {
+		return false;
+	}
+	image.resize (CARD_IMAGE_SIZE + 1);	// One more byte for detecting longer files
+	image.resize (fread (image.data(), 1, image.size(), file));
+	fclose (file);
+
+	return true;
+
+}
+
+
+// Prints the punches of a card
+static void printCard (const char *path, const CardResult &result) {
+
+	printf (" --------------------------------\n");
+	printf (" File: %s\n", path);
+	printf (" User ID: %02X%02X%02X%02X\n", result.uid[0], result.uid[1], result.uid[2],
+		result.uid[3]);
+	printf (" Name: %s\n", result.name);
+	printf (" Category: %s\n", result.category);
+	printf (" --------------------------------\n");
+	printf (" IDS \tPunch Time \tValidated?\n");
+
+	for (uint8_t i = 0; i < result.numPunches; i++) {
+		const PunchResult &punch = result.punches[i];
+		printf (" %u \t%02u:%02u:%02u        %s\n", punch.ids, (punch.time / 3600) % 24,
+			(punch.time / 60) % 60, punch.time % 60, punch.valid ? "Ok!" : "Error!");
+	}
+	printf (" %u of %u punches validated\n\n", result.numValid, result.numPunches);
+
+}
+
+
+// Verifies the cards rounds times in batches, spread over the threads of the pool
+static void benchmarkBatch (const CardVerifier &verifier, const std::vector<
+	std::vector<uint8_t> > &images, const std::vector<CardResult> &expected, long rounds,
+	unsigned threads) {
+
+	WorkPool pool (threads);
+	size_t cards = rounds * images.size();
+	std::vector< std::vector<CardResult> > results (pool.size(),
+		std::vector<CardResult> (BATCH_CARDS));	// Of each worker
+	std::vector<unsigned long> macs (pool.size(), 0);	// MACs verified by each worker
+	std::vector<unsigned long> mismatches (pool.size(), 0);	// Different from verify()
+	unsigned long totalMacs = 0;
+	unsigned long totalMismatches = 0;
+	unsigned cores = std::thread::hardware_concurrency ();	// Used by the pool
+
+	if (cores == 0 || cores > pool.size()) {
+		cores = pool.size();
+	}
+
+	Clock::time_point start = Clock::now();
+	pool.run ((cards + BATCH_CARDS - 1) / BATCH_CARDS, [&] (size_t task, unsigned worker) {
+		const uint8_t *batch [BATCH_CARDS] = { NULL };
+		size_t first = task * BATCH_CARDS;
+		size_t count = cards - first < BATCH_CARDS ? cards - first : BATCH_CARDS;
+		CardResult *result = results[worker].data();
+
+		for (size_t i = 0; i < count; i++) {
+			batch[i] = images[(first + i) % images.size()].data();
+		}
+		verifier.verifyBatch (batch, count, result);
+		for (size_t i = 0; i < count; i++) {
+			const CardResult &same = expected[(first + i) % images.size()];
+			macs[worker] += result[i].numPunches;
+			for (uint8_t p = 0; p < result[i].numPunches; p++) {
+				mismatches[worker] += result[i].punches[p].valid != same.punches[p].valid;
+			}
+		}
+	});
+	double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+	for (unsigned i = 0; i < pool.size(); i++) {
+		totalMacs += macs[i];
+		totalMismatches += mismatches[i];
+	}
+	printf ("%s x%u, %u threads: %zu cards in %.3f s: %.0f cards/s, %.0f MACs/s, "
+		"%.0f MACs/s per core (%lu batches stolen)\n", MultiBlake2s::backend(),
+		MultiBlake2s::lanes(), pool.size(), cards, elapsed, cards / elapsed,
+		totalMacs / elapsed, totalMacs / elapsed / cores, pool.steals());
+	if (totalMismatches > 0) {
+		printf ("%lu punches verified different than one by one!\n", totalMismatches);
+	}
+
+}
+
+
+// Prints hit rate & time saved by a prefix cache
+static void printCache (const char *title, const PrefixCache &cache) {
+	printf ("%s: %lu of %lu readouts hit (%.1f %%), %lu punches not verified again, "
+		"%.3f ms saved (%.1f us per readout)\n", title, cache.hits(), cache.readouts(),
+		cache.readouts() > 0 ? 100.0 * cache.hits() / cache.readouts() : 0.0, cache.skipped(),
+		cache.savedSeconds() * 1000, cache.readouts() > 0 ?
+		cache.savedSeconds() * 1e6 / cache.readouts() : 0.0);
+}
+
+
+/* Verifies each card READS_PER_CARD times, with a part of its punches in each readout (NB
+moved back), without & with prefix cache. Cache is emptied each round */
+static void benchmarkCache (CardVerifier &verifier, const std::vector<
+	std::vector<uint8_t> > &images, const std::vector<CardResult> &expected, long rounds) {
+
+	std::vector< std::vector<uint8_t> > reads;	// Images of all readouts, in order
+	PrefixCache cache;
+	CardResult result;
+	unsigned long mismatches = 0;
+	double elapsed [2];
+
+	for (size_t i = 0; i < images.size(); i++) {
+		for (uint8_t r = 1; r <= READS_PER_CARD; r++) {
+			uint8_t punches = expected[i].numPunches * r / READS_PER_CARD;
+			reads.push_back (images[i]);
+			if (punches < expected[i].numPunches) {
+				reads.back()[UID_LENGTH + NB_CAT_BLOCK * MIFARE_BLOCK_SIZE] =
+					expected[i].punches[punches].block;
+			}
+		}
+	}
+
+	for (int cached = 0; cached < 2; cached++) {
+		Clock::time_point start = Clock::now();
+		for (long r = 0; r < rounds; r++) {
+			cache.clear ();
+			for (size_t i = 0; i < reads.size(); i++) {
+				verifier.verify (reads[i].data(), reads[i].size(), result, cached ? &cache : NULL);
+				if (i % READS_PER_CARD == READS_PER_CARD - 1) {
+					const CardResult &same = expected[i / READS_PER_CARD];
+					for (uint8_t p = 0; p < result.numPunches; p++) {
+						mismatches += result.punches[p].valid != same.punches[p].valid;
+					}
+				}
+			}
+		}
+		elapsed[cached] = std::chrono::duration<double>(Clock::now() - start).count();
+	}
+
+	printf ("%u readouts per card: %.2f us per readout without cache, %.2f us with it, "
+		"%.2f us saved\n", READS_PER_CARD, elapsed[0] * 1e6 / (rounds * reads.size()),
+		elapsed[1] * 1e6 / (rounds * reads.size()),
+		(elapsed[0] - elapsed[1]) * 1e6 / (rounds * reads.size()));
+	printCache ("Prefix cache", cache);
+	if (mismatches > 0) {
+		printf ("%lu punches verified different with cache!\n", mismatches);
+	}
+
+}
+
+
+int main (int argc, char *argv[]) {
+
+	CardVerifier verifier;
+	CardResult result;
+	std::vector< std::vector<uint8_t> > images;	// Content of card image files
+	std::vector<CardResult> results;	// Of each image, for comparing benchmarks
+	long rounds = 0;					// Benchmark rounds (0 is no benchmark)
+	unsigned threads = 0;				// Threads of batch benchmark (0 is one per core)
+	const char *cachePath = NULL;		// Prefix cache file
+	PrefixCache cache;
+	int arg;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "b:t:c:")) != -1) {
+		switch (opt) {
+			case 'b': rounds = atol (optarg); break;
+			case 't': threads = strtoul (optarg, NULL, 10); break;
+			case 'c': cachePath = optarg; break;
+			default: optind = argc; break;
+		}
+	}
+	arg = optind;
+	if (argc - arg < 2) {
+		fprintf (stderr, "Usage: %s [-b N] [-t threads] [-c cache.bin] keys.bin card1.bin "
+			"[card2.bin ...]\n", argv[0]);
+		return 2;
+	}
+
+	if (!verifier.loadKeyTableFile (argv[arg])) {
+		fprintf (stderr, "Wrong key table: %s\n", argv[arg]);
+		return 1;
+	}
+	if (cachePath != NULL) {
+		cache.load (cachePath);			// New cache if there isn't file yet
+	}
+
+	for (int i = arg + 1; i < argc; i++) {
+		std::vector<uint8_t> image;
+		if (!readImage (argv[i], image) || !verifier.verify (image.data(), image.size(), result,
+			cachePath != NULL ? &cache : NULL)) {
+			fprintf (stderr, "Wrong card image: %s\n", argv[i]);
+			return 1;
+		}
+		if (rounds == 0) {
+			printCard (argv[i], result);
+		}
+		images.push_back (image);
+		results.push_back (result);
+	}
+
+	if (rounds > 0) {
+		unsigned long punches = 0;		// Punches verified, so loop isn't optimized away
+		Clock::time_point start = Clock::now();
+		for (long r = 0; r < rounds; r++) {
+			for (size_t i = 0; i < images.size(); i++) {
+				verifier.verify (images[i].data(), images[i].size(), result);
+				punches += result.numPunches;
+			}
+		}
+		double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+		printf ("One by one: %lu cards (%lu punches) in %.3f s: %.0f cards/s, %.0f MACs/s\n",
+			rounds * images.size(), punches, elapsed, rounds * images.size() / elapsed,
+			punches / elapsed);
+
+		benchmarkBatch (verifier, images, results, rounds, threads);
+		benchmarkCache (verifier, images, results, rounds);
+	}
+
+	if (cachePath != NULL) {
+		printCache ("Prefix cache", cache);
+		if (!cache.save (cachePath)) {
+			fprintf (stderr, "Can't save %s\n", cachePath);
+			return 1;
+		}
+	}
+
+	return 0;
+
+}
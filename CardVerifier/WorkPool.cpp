@@ -0,0 +1,139 @@
+/*********************************************************************************************/
+/*
+ * Work-stealing thread pool PC library
+ * 
+ *  This library runs tasks in several threads with work stealing.
+*/
+/*********************************************************************************************/
+
+
+#include "WorkPool.h"
+
+
+// Starts the threads. Worker 0 is the thread calling run()
+WorkPool::WorkPool (unsigned threads) : generation(0), stop(false), task(NULL), pending(0),
+	stolen(0) {
+
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency ();
+	}
+	if (threads == 0) {
+		threads = 1;
+	}
+	for (unsigned i = 0; i < threads; i++) {
+		queues.push_back (std::unique_ptr<Queue> (new Queue()));
+	}
+	for (unsigned i = 1; i < threads; i++) {
+		this->threads.push_back (std::thread (&WorkPool::loop, this, i));
+	}
+
+}
+
+
+WorkPool::~WorkPool () {
+	{
+		std::lock_guard<std::mutex> guard (lock);
+		stop = true;
+	}
+	wake.notify_all ();
+	for (size_t i = 0; i < threads.size(); i++) {
+		threads[i].join ();
+	}
+}
+
+
+unsigned WorkPool::size () const {
+	return queues.size();
+}
+
+
+unsigned long WorkPool::steals () const {
+	return stolen;
+}
+
+
+// Gives each thread a range of tasks & works until all are done
+void WorkPool::run (size_t numTasks, const Task &task) {
+
+	if (numTasks == 0) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard (lock);
+		this->task = &task;
+		pending = numTasks;
+		for (size_t i = 0; i < queues.size(); i++) {
+			std::lock_guard<std::mutex> queueGuard (queues[i]->lock);
+			for (size_t t = numTasks * i / queues.size(); t < numTasks * (i + 1) / queues.size(); t++) {
+				queues[i]->tasks.push_back (t);
+			}
+		}
+		generation++;
+	}
+	wake.notify_all ();
+
+	work (0);
+
+	std::unique_lock<std::mutex> guard (lock);
+	done.wait (guard, [this] { return pending == 0; });
+
+}
+
+
+void WorkPool::loop (unsigned worker) {
+
+	unsigned long seen = 0;				// Last generation worked
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> guard (lock);
+			wake.wait (guard, [&] { return stop || generation != seen; });
+			if (stop) {
+				return;
+			}
+			seen = generation;
+		}
+		work (worker);
+	}
+
+}
+
+
+void WorkPool::work (unsigned worker) {
+
+	size_t taskIndex;
+
+	while (next (worker, taskIndex)) {
+		(*task) (taskIndex, worker);
+		if (--pending == 0) {
+			std::lock_guard<std::mutex> guard (lock);
+			done.notify_all ();
+		}
+	}
+
+}
+
+
+// Front of own queue or, if it's empty, back of the first queue with tasks
+bool WorkPool::next (unsigned worker, size_t &taskIndex) {
+
+	for (size_t i = 0; i < queues.size(); i++) {
+		Queue &queue = *queues[(worker + i) % queues.size()];
+		std::lock_guard<std::mutex> guard (queue.lock);
+		if (!queue.tasks.empty()) {
+			if (i == 0) {
+				taskIndex = queue.tasks.front();
+				queue.tasks.pop_front ();
+			} else {
+				taskIndex = queue.tasks.back();
+				queue.tasks.pop_back ();
+				stolen++;
+			}
+			return true;
+		}
+	}
+
+	return false;
+
+}
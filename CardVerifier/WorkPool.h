@@ -0,0 +1,59 @@
+/*********************************************************************************************/
+/*
+ * Work-stealing thread pool PC library
+ * 
+ *  Runs numbered tasks (i.e. batches of cards) in several threads. Tasks are split in equal
+ *	ranges, one queue per thread. Each thread takes tasks from the front of its own queue
+ *	and, when it's empty, steals them from the back of the queue of another thread, so a
+ *	thread with slower batches doesn't delay the rest. The thread calling run() works too.
+*/
+/*********************************************************************************************/
+
+
+#ifndef __WORKPOOL_H__
+#define __WORKPOOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+class WorkPool {
+public:
+	typedef std::function<void (size_t task, unsigned worker)> Task;
+
+	WorkPool (unsigned threads);		// 0 is one per core
+	~WorkPool ();
+	unsigned size () const;				// Threads, including the one calling run()
+	void run (size_t numTasks, const Task &task);	// Returns when all tasks are done
+	unsigned long steals () const;		// Tasks run by a thread that didn't own them
+
+private:
+	// Tasks of one thread
+	struct Queue {
+		std::mutex lock;
+		std::deque<size_t> tasks;
+	};
+
+	std::vector<std::unique_ptr<Queue> > queues;
+	std::vector<std::thread> threads;
+	std::mutex lock;					// Protects generation & stop
+	std::condition_variable wake;		// New tasks or stop
+	std::condition_variable done;		// All tasks done
+	unsigned long generation;			// Number of run() calls
+	bool stop;
+	const Task *task;					// Task of current run()
+	std::atomic<size_t> pending;		// Tasks not finished
+	std::atomic<unsigned long> stolen;
+
+	void loop (unsigned worker);		// Body of threads
+	void work (unsigned worker);		// Runs tasks until all queues are empty
+	bool next (unsigned worker, size_t &taskIndex);	// Own task or stolen one
+};
+
+#endif
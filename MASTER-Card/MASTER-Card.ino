@@ -23,7 +23,7 @@ SerialInterface usb;
 
 void setup() {
 
-  Serial.begin (115200);            // Sets up serial port baudrate
+  Serial.begin (SERIAL_BAUDRATE);   // Sets up serial port baudrate
   while (!Serial);                  // Waits until serial port is opened in PC
 }
 
@@ -35,10 +35,24 @@ void loop() {
     PlayerCard card;
     card.begin();
     card.format(); 
+  } else if (userChoice == BULK_FORMAT_CHOICE) {
+    PlayerCard card;
+    card.begin();
+    card.bulkFormat();              // Formats cards from a start list sent by PC
   } else if (userChoice == '4') {
     PlayerCard card;
     card.begin();
     card.readPunches();
+  } else if (userChoice == CARD_IMAGE_CHOICE) {
+    PlayerCard card;
+    card.begin();
+    card.dumpImage();               // Sends raw card for verifying punches in PC
+  } else if (userChoice == SERIAL_TEST_CHOICE) {
+    usb.sendTestReadout();          // Fake full card for measuring serial throughput
+  } else if (userChoice == SERIAL_BINARY_CHOICE) {
+    usb.setMode (SERIAL_MODE_BINARY); // Next messages are sent in binary frames
+  } else if (userChoice == SERIAL_TEXT_CHOICE) {
+    usb.setMode (SERIAL_MODE_TEXT); // Next messages are sent in text lines
   }
 
 
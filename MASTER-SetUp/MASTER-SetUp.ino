@@ -24,7 +24,7 @@ SerialInterface usb;
 
 void setup() {
 
-  Serial.begin (115200);            // Sets up serial port baudrate
+  Serial.begin (SERIAL_BAUDRATE);   // Sets up serial port baudrate
   while (!Serial);                  // Waits until serial port is opened in PC
 }
 
@@ -38,6 +38,13 @@ void loop() {
   } else if (userChoice == '2') {
     MasterSetUpStations setUp;      // Manages the stations' setup
     setUp.continuePreviousEvent (); // Continues a previous process of setting up
+  } else if (userChoice == EXPORT_KEYS_CHOICE) {
+    MasterSetUpStations setUp;
+    setUp.exportStationKeys();      // Sends station keys for verifying punches in PC
+  } else if (userChoice == SERIAL_BINARY_CHOICE) {
+    usb.setMode (SERIAL_MODE_BINARY); // Next messages are sent in binary frames
+  } else if (userChoice == SERIAL_TEXT_CHOICE) {
+    usb.setMode (SERIAL_MODE_TEXT); // Next messages are sent in text lines
   }
 
 
@@ -25,7 +25,7 @@ SerialInterface usb;
  
 void setup() { 
  
-  Serial.begin (115200);            // Sets up serial port baudrate 
+  Serial.begin (SERIAL_BAUDRATE);   // Sets up serial port baudrate 
   while (!Serial);                  // Waits until serial port is opened in PC 
 } 
  
@@ -43,10 +43,27 @@ void loop() {
     PlayerCard card; 
     card.begin();                   
     card.format();                  // Formats a card
+  } else if (userChoice == BULK_FORMAT_CHOICE) { 
+    PlayerCard card; 
+    card.begin(); 
+    card.bulkFormat();              // Formats cards from a start list sent by PC 
   } else if (userChoice == '4') { 
     PlayerCard card; 
     card.begin(); 
     card.readPunches();             // Reads and validates punches of a card
+  } else if (userChoice == CARD_IMAGE_CHOICE) { 
+    PlayerCard card; 
+    card.begin(); 
+    card.dumpImage();               // Sends raw card for verifying punches in PC 
+  } else if (userChoice == EXPORT_KEYS_CHOICE) { 
+    MasterSetUpStations setUp; 
+    setUp.exportStationKeys();      // Sends station keys for verifying punches in PC 
+  } else if (userChoice == SERIAL_TEST_CHOICE) { 
+    usb.sendTestReadout();          // Fake full card for measuring serial throughput 
+  } else if (userChoice == SERIAL_BINARY_CHOICE) { 
+    usb.setMode (SERIAL_MODE_BINARY); // Next messages are sent in binary frames 
+  } else if (userChoice == SERIAL_TEXT_CHOICE) { 
+    usb.setMode (SERIAL_MODE_TEXT); // Next messages are sent in text lines 
   } 
  
  
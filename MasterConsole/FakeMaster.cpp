@@ -0,0 +1,269 @@
+/*********************************************************************************************/
+/*
+ * FakeMaster
+ *
+ *  Stand-in of the Master device for testing PC programs without hardware. It opens a
+ *	pseudo-terminal, prints its path and answers like MASTER sketch does: text mode until
+ *	'B' choice and then binary frames. Station setup & card reading take the time given
+ *	with -d (milliseconds) to simulate NFC.
+ *
+ *	Usage: FakeMaster [-d 300] [-n 45] [-c 1]
+ *
+ *	-n is the number of punches of fake cards. Readouts cycle through -c different cards
+ *	(UIDs 0 to c - 1), each with its own punch times, so several FakeMasters with the same
+ *	-c read the same cards like Masters of one event do.
+ *
+ *	Build: g++ -O2 -std=c++11 FakeMaster.cpp SerialPort.cpp FrameParser.cpp -o FakeMaster
+*/
+/*********************************************************************************************/
+
+
+#include "SerialPort.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+
+#define CARD_IMAGE_SIZE		(UID_SIZE + 64 * 16)	// UID & 64 blocks of 16 bytes
+#define STATION_REC_SIZE	32			// Size in bytes of each station key
+#define WRITE_TIMEOUT		1000		// Max ms writing a frame
+
+
+static SerialPort port;					// Master side of the PTY
+static unsigned delayMs = 300;			// Simulated NFC time
+static uint8_t cardPunches = 45;		// Punches of fake cards
+static uint8_t stationID = 0;			// Next station ID
+static uint32_t numCards = 1;			// Different fake cards
+static uint32_t nextCard = 0;			// UID of next fake card read
+static uint8_t name [NAME_SIZE] = "Fake runner";	// Name of fake card
+static uint8_t category [CAT_SIZE] = "Senior";		// Category of fake card
+
+
+// Sends a frame to PC
+static void send (uint8_t type, const uint8_t *payload, uint16_t len) {
+	port.sendFrame (type, payload, len, WRITE_TIMEOUT);
+}
+
+
+// Waits a frame of the given type. Others are answered with NAK like SerialInterface does
+static bool receive (Frame &frame, uint8_t type) {
+	while (port.readFrame (frame, -1)) {
+		if (frame.type == type) {
+			return true;
+		}
+		send (MSG_NAK, &frame.type, 1);
+	}
+	return false;
+}
+
+
+// Sends a readout of the given fake card with the given punches
+static void sendReadout (uint32_t uid, uint8_t punches) {
+
+	uint8_t payload [CARD_HEADER_SIZE + 1 + 255 * PUNCH_REC_SIZE];
+	uint8_t *punch = &payload[CARD_HEADER_SIZE + 1];
+
+	for (uint8_t i = 0; i < UID_SIZE; i++) {
+		payload[i] = (uint8_t)(uid >> (8 * (UID_SIZE - 1 - i)));
+	}
+	memcpy (&payload[UID_SIZE], name, NAME_SIZE);
+	memcpy (&payload[UID_SIZE + NAME_SIZE], category, CAT_SIZE);
+	payload[CARD_HEADER_SIZE] = punches;
+	for (uint8_t i = 0; i < punches; i++, punch += PUNCH_REC_SIZE) {
+		punch[0] = i % (stationID + 1);
+		punch[1] = 10 + uid % 8;
+		punch[2] = i / 60;
+		punch[3] = i % 60;
+		punch[4] = 1;
+	}
+	send (MSG_CARD_READOUT, payload, CARD_HEADER_SIZE + 1 + punches * PUNCH_REC_SIZE);
+
+}
+
+
+// Setup loop of MasterSetUpStations::setUpProcess
+static void setUpProcess () {
+
+	Frame frame;
+	uint8_t choice;
+
+	do {
+		send (MSG_STATION_ID, &stationID, 1);
+		if (!receive (frame, MSG_CHOICE) || frame.payload.size() != 1) {
+			return;
+		}
+		choice = frame.payload[0];
+
+		if (choice == SETUP_ONE_CHOICE) {
+			usleep (delayMs * 1000);
+			stationID++;
+			uint8_t ok = '1';
+			send (MSG_CHAR, &ok, 1);
+		} else if (choice == SETUP_BATCH_CHOICE) {
+			if (!receive (frame, MSG_NUMBER) || frame.payload.size() != 1) {
+				return;
+			}
+			for (uint8_t i = 0; i < frame.payload[0]; i++) {
+				uint8_t status [6] = { stationID, SETUP_STATUS_FULL, 0, 0, 0, 0 };
+				if (stationID < MASTER_MAX_STATIONS) {	// Like the master, by key room
+					status[1] = SETUP_STATUS_OK;
+					status[2] = (uint8_t)delayMs;
+					status[3] = (uint8_t)(delayMs >> 8);
+					stationID++;
+					usleep (delayMs * 1000);
+				}
+				send (MSG_STATION_STATUS, status, sizeof(status));
+			}
+		} else {
+			send (MSG_CHAR, &choice, 1);
+		}
+	} while (choice == SETUP_ONE_CHOICE || choice == SETUP_BATCH_CHOICE);
+
+}
+
+
+// Runs one choice of the main menu in binary mode
+static void runChoice (uint8_t choice) {
+
+	Frame frame;
+
+	if (choice == NEW_EVENT_CHOICE) {
+		// Date & time
+		if (!receive (frame, MSG_TEXT) || !receive (frame, MSG_TEXT)) {
+			return;
+		}
+		stationID = 0;
+		setUpProcess ();
+
+	} else if (choice == CONTINUE_CHOICE) {
+		setUpProcess ();
+
+	} else if (choice == FORMAT_CHOICE) {
+		uint8_t header [CARD_HEADER_SIZE] = { 0 };
+		usleep (delayMs * 1000);
+		memcpy (&header[UID_SIZE], name, NAME_SIZE);
+		memcpy (&header[UID_SIZE + NAME_SIZE], category, CAT_SIZE);
+		send (MSG_CARD_HEADER, header, sizeof(header));
+		if (receive (frame, MSG_CHOICE) && frame.payload.size() == 1 && frame.payload[0] == '1') {
+			if (receive (frame, MSG_TEXT)) {
+				memset (name, 0, sizeof(name));
+				memcpy (name, frame.payload.data(), frame.payload.size() < NAME_SIZE ?
+					frame.payload.size() : NAME_SIZE - 1);
+			}
+			if (receive (frame, MSG_TEXT)) {
+				memset (category, 0, sizeof(category));
+				memcpy (category, frame.payload.data(), frame.payload.size() < CAT_SIZE ?
+					frame.payload.size() : CAT_SIZE - 1);
+			}
+		}
+
+	} else if (choice == READ_CHOICE) {
+		usleep (delayMs * 1000);
+		sendReadout (nextCard, cardPunches);
+		nextCard = (nextCard + 1) % numCards;
+
+	} else if (choice == SERIAL_TEST_CHOICE) {
+		sendReadout (0, TEST_PUNCHES);
+
+	} else if (choice == CARD_IMAGE_CHOICE) {
+		uint8_t image [CARD_IMAGE_SIZE] = { 0x11, 0x22, 0x33, 0x44 };
+		usleep (delayMs * 1000);
+		send (MSG_CARD_IMAGE, image, sizeof(image));
+
+	} else if (choice == BULK_FORMAT_CHOICE) {
+		// Each entry is programmed in next fake card or in the card bound to it
+		while (receive (frame, MSG_START_ENTRY) && frame.payload.size() == CARD_HEADER_SIZE) {
+			uint8_t status [UID_SIZE + 1] = { 0, 0, 0, (uint8_t)nextCard, FORMAT_OK };
+			usleep (delayMs * 1000);
+			if (frame.payload[0] | frame.payload[1] | frame.payload[2] | frame.payload[3]) {
+				memcpy (status, frame.payload.data(), UID_SIZE);
+			}
+			nextCard = (nextCard + 1) % numCards;
+			send (MSG_FORMAT_STATUS, status, sizeof(status));
+		}
+
+	} else if (choice == EXPORT_KEYS_CHOICE) {
+		uint8_t table [1 + 255 * STATION_REC_SIZE];
+		table[0] = stationID;
+		for (uint16_t i = 1; i < 1 + stationID * STATION_REC_SIZE; i++) {
+			table[i] = rand ();
+		}
+		send (MSG_KEY_TABLE, table, 1 + stationID * STATION_REC_SIZE);
+	}
+
+}
+
+
+int main (int argc, char *argv[]) {
+
+	uint8_t binary = false;				// Mode of SerialInterface
+	uint8_t ack = '1';
+	Frame frame;
+	struct termios tty;
+	int opt;
+	int pty;
+	int slave;							// Kept open so PTY doesn't hang up between PC programs
+
+	while ((opt = getopt (argc, argv, "d:n:c:")) != -1) {
+		switch (opt) {
+			case 'd': delayMs = strtoul (optarg, NULL, 10); break;
+			case 'n': cardPunches = (uint8_t)atoi (optarg); break;
+			case 'c': numCards = strtoul (optarg, NULL, 10); break;
+			default:
+				fprintf (stderr, "Usage: %s [-d ms] [-n punches] [-c cards]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (numCards == 0) {
+		numCards = 1;
+	}
+
+	pty = posix_openpt (O_RDWR | O_NOCTTY);
+	if (pty < 0 || grantpt (pty) != 0 || unlockpt (pty) != 0) {
+		perror ("posix_openpt");
+		return 1;
+	}
+	slave = open (ptsname (pty), O_RDWR | O_NOCTTY);
+	if (slave < 0 || tcgetattr (slave, &tty) != 0) {
+		perror ("ptsname");
+		return 1;
+	}
+	cfmakeraw (&tty);					// No echo nor "\n" translation, like a serial port
+	tcsetattr (slave, TCSANOW, &tty);
+
+	if (!port.attach (pty)) {
+		perror ("epoll");
+		return 1;
+	}
+	printf ("%s\n", ptsname (pty));
+	fflush (stdout);
+
+	while (true) {
+		if (!binary) {
+			// Text mode: SerialInterface::receiveChoiceSendAck reads a byte & drains buffer
+			int choice = port.readByte (-1);
+			if (choice < 0) {
+				return 0;
+			}
+			while (port.readByte (10) >= 0);
+			port.write ("1\r\n", WRITE_TIMEOUT);
+			binary = (choice == SERIAL_BINARY_CHOICE);
+
+		} else {
+			if (!receive (frame, MSG_CHOICE) || frame.payload.size() != 1) {
+				return 0;
+			}
+			send (MSG_ACK, &ack, 1);
+			if (frame.payload[0] == SERIAL_TEXT_CHOICE) {
+				binary = false;
+			} else {
+				runChoice (frame.payload[0]);
+			}
+		}
+	}
+
+}
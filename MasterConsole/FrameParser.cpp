@@ -0,0 +1,72 @@
+/*********************************************************************************************/
+/*
+ * Binary frame parser for PC programs
+ * 
+ *  Incremental parser of SerialInterface binary frames.
+*/
+/*********************************************************************************************/
+
+
+#include "FrameParser.h"
+
+
+FrameParser::FrameParser () : state(WAIT_SYNC), len(0), crc(0), rxCrc(0) { }
+
+
+// Feeds one received byte. Returns true when it completes a frame with correct CRC
+bool FrameParser::feed (uint8_t data) {
+
+	switch (state) {
+		case WAIT_SYNC:
+			if (data == FRAME_SYNC) {
+				crc = 0xFFFF;
+				state = WAIT_TYPE;
+			}
+			break;
+		case WAIT_TYPE:
+			current.type = data;
+			crc = crc16 (crc, data);
+			state = WAIT_LEN_L;
+			break;
+		case WAIT_LEN_L:
+			len = data;
+			crc = crc16 (crc, data);
+			state = WAIT_LEN_H;
+			break;
+		case WAIT_LEN_H:
+			len |= ((uint16_t)data) << 8;
+			crc = crc16 (crc, data);
+			current.payload.clear ();
+			current.payload.reserve (len);
+			state = (len > 0) ? WAIT_PAYLOAD : WAIT_CRC_L;
+			break;
+		case WAIT_PAYLOAD:
+			current.payload.push_back (data);
+			crc = crc16 (crc, data);
+			if (current.payload.size() == len) {
+				state = WAIT_CRC_L;
+			}
+			break;
+		case WAIT_CRC_L:
+			rxCrc = data;
+			state = WAIT_CRC_H;
+			break;
+		case WAIT_CRC_H:
+			rxCrc |= ((uint16_t)data) << 8;
+			state = WAIT_SYNC;
+			return rxCrc == crc;
+	}
+
+	return false;
+
+}
+
+
+Frame &FrameParser::frame () {
+	return current;
+}
+
+
+void FrameParser::reset () {
+	state = WAIT_SYNC;
+}
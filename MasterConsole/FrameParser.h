@@ -0,0 +1,45 @@
+/*********************************************************************************************/
+/*
+ * Binary frame parser for PC programs
+ * 
+ *  Incremental parser of SerialInterface binary frames. Bytes are fed one by one as they
+ *	arrive, so it can be used with blocking reads or from an event loop. Bytes before SYNC
+ *	and frames with wrong CRC are discarded.
+*/
+/*********************************************************************************************/
+
+
+#ifndef __FRAMEPARSER_H__
+#define __FRAMEPARSER_H__
+
+#include "Protocol.h"
+
+#include <vector>
+
+
+// Binary frame received from the other side
+struct Frame {
+	uint8_t type;						// Message type
+	std::vector<uint8_t> payload;		// Payload of the frame
+};
+
+
+class FrameParser {
+public:
+	FrameParser ();
+	bool feed (uint8_t data);			// True when a frame with correct CRC is complete
+	Frame &frame ();					// Last complete frame
+	void reset ();						// Discards the frame being parsed
+
+private:
+	enum State { WAIT_SYNC, WAIT_TYPE, WAIT_LEN_L, WAIT_LEN_H, WAIT_PAYLOAD, WAIT_CRC_L,
+		WAIT_CRC_H };
+
+	State state;						// Next expected field
+	Frame current;						// Frame being parsed or last complete frame
+	uint16_t len;						// Length of payload
+	uint16_t crc;						// CRC calculated over received bytes
+	uint16_t rxCrc;						// Received CRC
+};
+
+#endif
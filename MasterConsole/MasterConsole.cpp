@@ -0,0 +1,667 @@
+/*********************************************************************************************/
+/*
+ * MasterConsole
+ *
+ *  Native PC console for the Master device (Linux). It offers the same menu as the Python
+ *	scripts, but talks to the Master in binary mode of SerialInterface, so commands and
+ *	their data are sent back-to-back without sleeps: each frame is read by the Master when
+ *	it's ready. Serial port is non-blocking and waited with epoll. Timing of each operation
+ *	is logged to stderr (or to the file given with -l).
+ *
+ *	Usage: MasterConsole -p /dev/ttyACM0 [-b 115200] [-l log.txt]
+ *
+ *	With several -p options (or with -r) it only reads cards, in all the Masters at once
+ *	(see MultiReadout). Readouts are merged by card UID & punch time and saved in the CSV
+ *	file given with -o. Cards per minute are reported each -s seconds. With -c, each card is
+ *	marked OK or MP with the course of its category (see Results/Course.h). With -d, new
+ *	punches are also appended to the punch store in that directory (see Results/PunchStore.h):
+ *
+ *		MasterConsole -p /dev/ttyACM0 -p /dev/ttyACM1 [-o results.csv] [-s 10] [-c courses.txt]
+ *		              [-d event.store]
+ *
+ *	It can be tested without hardware against FakeMaster, which emulates the Master in a
+ *	pseudo-terminal:
+ *
+ *		./FakeMaster &					(prints the PTY path, i.e. /dev/pts/3)
+ *		./MasterConsole -p /dev/pts/3
+ *
+ *	Build: g++ -O2 -std=c++11 -I../Results MasterConsole.cpp MultiReadout.cpp ReadoutStore.cpp \
+ *	           SerialPort.cpp FrameParser.cpp ../Results/Course.cpp ../Results/PunchStore.cpp \
+ *	           -o MasterConsole
+ *	       g++ -O2 -std=c++11 FakeMaster.cpp SerialPort.cpp FrameParser.cpp -o FakeMaster
+*/
+/*********************************************************************************************/
+
+
+#include "MasterConsole.h"
+#include "MultiReadout.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+MasterConsole::MasterConsole (SerialPort &port, FILE *log) : port(port), log(log),
+	start(Clock::now()) { }
+
+
+/* Master can be in text mode (just reset) or in binary mode (previous console didn't finish).
+A 'T' choice frame returns it to text mode in both cases: in text mode the frame is read as
+a wrong choice & answered with "1". After that, 'B' changes it to binary mode. The probe is
+repeated while Master doesn't answer (it's booting after opening the port) */
+bool MasterConsole::connect () {
+
+	Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(CONNECT_TIMEOUT);
+	uint8_t textChoice = SERIAL_TEXT_CHOICE;
+	std::string line;
+	bool answered = false;
+
+	start = Clock::now();
+	while (!answered && Clock::now() < deadline) {
+		port.sendFrame (MSG_CHOICE, &textChoice, 1, WRITE_TIMEOUT);
+		answered = port.readByte (PROBE_PERIOD) >= 0;
+	}
+	if (!answered) {
+		return false;
+	}
+	while (port.readByte (QUIET_TIME) >= 0);	// Rest of the answer
+
+	port.write (std::string(1, SERIAL_BINARY_CHOICE), WRITE_TIMEOUT);
+	if (!port.readLine (line, ACK_TIMEOUT) || line != "1") {
+		return false;
+	}
+	logTiming ("Master in binary mode", start);
+
+	return true;
+
+}
+
+
+// Returns Master to text mode, so Python scripts can be used again
+void MasterConsole::disconnect () {
+	sendChoice (SERIAL_TEXT_CHOICE);
+	waitAck ();
+}
+
+
+// Main menu. Same options as Python scripts
+void MasterConsole::run () {
+
+	std::string choice;
+
+	do {
+		printf ("\n\n\n --------------------------------------------\n");
+		printf (" | MASTER device for setting up sport event |\n");
+		printf (" --------------------------------------------\n");
+		printf (" Please, send the option number of your choice\n");
+		printf ("   1. Set up and start a new event\n");
+		printf ("   2. Continue setting up an event\n");
+		printf ("   3. Clean card\n");
+		printf ("   4. Read card\n");
+		printf ("   5. Measure serial throughput\n");
+		printf ("   6. Dump card image for verifying it in PC\n");
+		printf ("   7. Export station keys for verifying cards in PC\n");
+		printf ("   8. Program cards from a start list\n");
+		printf ("   0. Close\n\n");
+
+		choice = ask ("Introduce your choice: ");
+
+		if (choice == "1") {
+			printf ("This will erase all previous event data\n");
+			if (ask ("Type 'yes' if you want to start new event: ") == "yes") {
+				newEvent ();
+			}
+		} else if (choice == "2") {
+			sendChoice (CONTINUE_CHOICE);
+			if (waitAck ()) {
+				setupMenu ();
+			}
+		} else if (choice == "3") {
+			formatCard ();
+		} else if (choice == "4") {
+			readCard ();
+		} else if (choice == "5") {
+			throughputTest ();
+		} else if (choice == "6") {
+			dumpImage ();
+		} else if (choice == "7") {
+			exportKeys ();
+		} else if (choice == "8") {
+			bulkFormat ();
+		}
+	} while (choice != "0" && std::cin);
+
+}
+
+
+// Sends a choice frame. ACK is read later, so data of the choice can be sent just after it
+bool MasterConsole::sendChoice (uint8_t choice) {
+	return port.sendFrame (MSG_CHOICE, &choice, 1, WRITE_TIMEOUT);
+}
+
+
+// Sends a string frame (name, category, date...)
+bool MasterConsole::sendText (const std::string &text) {
+	return port.sendFrame (MSG_TEXT, (const uint8_t *)text.data(), text.size(), WRITE_TIMEOUT);
+}
+
+
+// Waits the ACK of a choice
+bool MasterConsole::waitAck () {
+
+	Clock::time_point sent = Clock::now();
+	Frame frame;
+
+	if (!expect (frame, MSG_ACK, ACK_TIMEOUT)) {
+		return false;
+	}
+	logTiming ("Choice acknowledged", sent);
+	return true;
+
+}
+
+
+// Waits a frame of the given type. NAK & other frames are reported and ignored
+bool MasterConsole::expect (Frame &frame, uint8_t type, int timeoutMs) {
+
+	while (port.readFrame (frame, timeoutMs)) {
+		if (frame.type == type) {
+			return true;
+		}
+		fprintf (stderr, "Unexpected frame 0x%02X (waiting 0x%02X)\n", frame.type, type);
+	}
+	fprintf (stderr, "Timeout waiting frame 0x%02X\n", type);
+	return false;
+
+}
+
+
+// Logs elapsed time since the given instant
+void MasterConsole::logTiming (const char *what, Clock::time_point since) {
+
+	Clock::time_point now = Clock::now();
+
+	fprintf (log, "[%9.3f s] %s: %.1f ms\n",
+		std::chrono::duration<double>(now - start).count(), what,
+		std::chrono::duration<double, std::milli>(now - since).count());
+	fflush (log);
+
+}
+
+
+// Reads a line typed by user
+std::string MasterConsole::ask (const char *prompt) {
+	std::string line;
+	printf ("%s", prompt);
+	fflush (stdout);
+	std::getline (std::cin, line);
+	return line;
+}
+
+
+// Char field of card, until first '\0'
+std::string MasterConsole::field (const uint8_t *data, size_t size) {
+	return std::string ((const char *)data, strnlen ((const char *)data, size));
+}
+
+
+// Starts a new event. Date & time are pipelined after the choice
+void MasterConsole::newEvent () {
+
+	char date [16];						// Date in format "mmm dd yyyy"
+	char hour [16];						// Time in format "hh:mm:ss"
+	time_t now = time (NULL);
+
+	strftime (date, sizeof(date), "%b %d %Y", localtime (&now));
+	strftime (hour, sizeof(hour), "%H:%M:%S", localtime (&now));
+
+	sendChoice (NEW_EVENT_CHOICE);
+	sendText (date);
+	sendText (hour);
+	if (waitAck ()) {
+		setupMenu ();
+	}
+
+}
+
+
+// Menu for setting up stations
+void MasterConsole::setupMenu () {
+
+	Frame frame;
+	std::string choice;
+	uint8_t station;
+
+	do {
+		if (!expect (frame, MSG_STATION_ID, ACK_TIMEOUT) || frame.payload.size() != 1) {
+			return;
+		}
+		station = frame.payload[0];
+
+		printf ("\n Put station #%u on card reader\n", station);
+		printf (" After that, send the option number of your choice\n");
+		printf ("   1. Set up this station\n");
+		printf ("   2. Finish the setup process\n");
+		printf ("   3. Set up several stations one after another\n\n");
+
+		choice = ask ("Introduce your choice: ");
+		if (choice != "1" && choice != "3") {
+			choice = "2";
+		}
+
+		if (choice == "3") {
+			int number = atoi (ask ("How many stations? ").c_str());
+			uint8_t count = (uint8_t)(number < 0 ? 0 : (number > 255 ? 255 : number));
+			Clock::time_point batchStart = Clock::now();
+
+			sendChoice (SETUP_BATCH_CHOICE);
+			port.sendFrame (MSG_NUMBER, &count, 1, WRITE_TIMEOUT);
+
+			printf ("\n Put the stations on card reader one after another\n\n");
+			printf (" IDS \tResult \tTime\n");
+			for (uint8_t i = 0; i < count; i++) {
+				if (!expect (frame, MSG_STATION_STATUS, WAIT_FOREVER) ||
+					frame.payload.size() != 6) {
+					return;
+				}
+				uint32_t elapsed = frame.payload[2] | (frame.payload[3] << 8) |
+					(frame.payload[4] << 16) | ((uint32_t)frame.payload[5] << 24);
+				printf (" %u \t%s \t%.2f s\n", frame.payload[0],
+					frame.payload[1] == SETUP_STATUS_OK ? "Ok!" :
+					(frame.payload[1] == SETUP_STATUS_FULL ? "Full!" : "Error!"),
+					elapsed / 1000.0);
+			}
+			logTiming ("Batch setup", batchStart);
+
+		} else {
+			Clock::time_point setupStart = Clock::now();
+
+			sendChoice (choice[0]);
+			if (!expect (frame, MSG_CHAR, WAIT_FOREVER) || frame.payload.size() != 1) {
+				return;
+			}
+			if (choice == "1") {
+				if (frame.payload[0] == '1') {
+					printf (" Station #%u set up\n", station);
+				} else {
+					printf ("Error with Station. Reset it and try again\n");
+				}
+				logTiming ("Station setup", setupStart);
+			}
+		}
+	} while (choice != "2");
+
+}
+
+
+// Menu for formatting a user card. New name & category are pipelined after the choice
+void MasterConsole::formatCard () {
+
+	Frame frame;
+	std::string choice;
+
+	sendChoice (FORMAT_CHOICE);
+	if (!waitAck ()) {
+		return;
+	}
+
+	printf ("\nPlease, put card on reader\n\n");
+	if (!expect (frame, MSG_CARD_HEADER, WAIT_FOREVER) ||
+		frame.payload.size() != CARD_HEADER_SIZE) {
+		return;
+	}
+	printCardHeader (frame.payload.data());
+
+	printf (" What do you want to do?\n");
+	printf ("   1. Change name and category & format card\n");
+	printf ("   2. Format card with same name and category\n");
+	printf ("   3. Don't do anything\n");
+	choice = ask ("Introduce your choice: ");
+
+	if (choice == "1") {
+		std::string name = ask ("Introduce user name: ").substr (0, NAME_SIZE - 1);
+		std::string category = ask ("Introduce category: ").substr (0, CAT_SIZE - 1);
+		sendChoice ('1');
+		sendText (name);
+		sendText (category);
+	} else {
+		sendChoice (choice == "2" ? '2' : '3');
+	}
+
+}
+
+
+// Reads and shows the punches of a card
+void MasterConsole::readCard () {
+
+	Frame frame;
+	Clock::time_point readStart;
+	const uint8_t *punch;
+
+	sendChoice (READ_CHOICE);
+	if (!waitAck ()) {
+		return;
+	}
+
+	printf ("\nPlease, put card on reader\n\n");
+	readStart = Clock::now();
+	if (!expect (frame, MSG_CARD_READOUT, WAIT_FOREVER) ||
+		frame.payload.size() < CARD_HEADER_SIZE + 1 ||
+		frame.payload.size() != CARD_HEADER_SIZE + 1u +
+			frame.payload[CARD_HEADER_SIZE] * PUNCH_REC_SIZE) {
+		return;
+	}
+	logTiming ("Card readout", readStart);
+
+	printCardHeader (frame.payload.data());
+	printf (" \n IDS \tPunch Time \tValidated?\n");
+	punch = &frame.payload[CARD_HEADER_SIZE + 1];
+	for (uint8_t i = 0; i < frame.payload[CARD_HEADER_SIZE]; i++, punch += PUNCH_REC_SIZE) {
+		printf (" %u \t%02u:%02u:%02u        %s\n", punch[0], punch[1], punch[2], punch[3],
+			punch[4] ? "Ok!" : "Error!");
+	}
+
+}
+
+
+// Master sends a fake full card. Prints punches per second from first to last byte
+void MasterConsole::throughputTest () {
+
+	Frame frame;
+	Clock::time_point sent;
+	double seconds;
+
+	sent = Clock::now();
+	sendChoice (SERIAL_TEST_CHOICE);
+	if (!waitAck () || !expect (frame, MSG_CARD_READOUT, ACK_TIMEOUT)) {
+		return;
+	}
+	seconds = std::chrono::duration<double>(Clock::now() - sent).count();
+	logTiming ("Throughput test", sent);
+
+	printf ("\n %u punches in %.1f ms: %.0f punches/s (including choice round trip)\n",
+		TEST_PUNCHES, seconds * 1000, TEST_PUNCHES / seconds);
+
+}
+
+
+// Master sends the raw image of a card, which is saved in card_<UID>.bin
+void MasterConsole::dumpImage () {
+
+	Frame frame;
+	Clock::time_point readStart;
+	char fileName [32];
+	FILE *file;
+
+	sendChoice (CARD_IMAGE_CHOICE);
+	if (!waitAck ()) {
+		return;
+	}
+
+	printf ("\nPlease, put card on reader\n\n");
+	readStart = Clock::now();
+	if (!expect (frame, MSG_CARD_IMAGE, WAIT_FOREVER) || frame.payload.size() < UID_SIZE) {
+		return;
+	}
+	logTiming ("Card image", readStart);
+
+	snprintf (fileName, sizeof(fileName), "card_%02X%02X%02X%02X.bin", frame.payload[0],
+		frame.payload[1], frame.payload[2], frame.payload[3]);
+	file = fopen (fileName, "wb");
+	if (file == NULL || fwrite (frame.payload.data(), 1, frame.payload.size(), file) !=
+		frame.payload.size()) {
+		fprintf (stderr, "Can't save %s\n", fileName);
+	} else {
+		printf (" Card image saved in %s\n", fileName);
+		printf (" Verify it with: CardVerifier/VerifyCards keys.bin %s\n", fileName);
+	}
+	if (file != NULL) {
+		fclose (file);
+	}
+
+}
+
+
+// Master sends the keys of all the stations of the event, which are saved in keys.bin
+void MasterConsole::exportKeys () {
+
+	Frame frame;
+	FILE *file;
+
+	sendChoice (EXPORT_KEYS_CHOICE);
+	if (!waitAck () || !expect (frame, MSG_KEY_TABLE, ACK_TIMEOUT) || frame.payload.empty()) {
+		return;
+	}
+
+	file = fopen ("keys.bin", "wb");
+	if (file == NULL || fwrite (frame.payload.data(), 1, frame.payload.size(), file) !=
+		frame.payload.size()) {
+		fprintf (stderr, "Can't save keys.bin\n");
+	} else {
+		printf (" Keys of %u stations saved in keys.bin. Keep this file secret\n",
+			frame.payload[0]);
+	}
+	if (file != NULL) {
+		fclose (file);
+	}
+	memset (frame.payload.data(), 0, frame.payload.size());
+
+}
+
+
+/* Loads a start list: one runner per line with "name,category[,UID]". UID (8 hex digits)
+binds the entry to a card; without it, any card is valid. Empty lines and lines starting
+with '#' are skipped. Each entry is saved as the payload of a MSG_START_ENTRY frame */
+static bool loadStartList (const char *path, std::vector<std::vector<uint8_t> > &entries) {
+
+	FILE *file = fopen (path, "r");
+	char line [256];
+
+	if (file == NULL) {
+		return false;
+	}
+
+	while (fgets (line, sizeof(line), file) != NULL) {
+		std::vector<uint8_t> entry (CARD_HEADER_SIZE, 0);
+		char *name = strtok (line, ",\r\n");
+		char *category = strtok (NULL, ",\r\n");
+		char *uid = strtok (NULL, ",\r\n");
+		unsigned long value;
+
+		if (name == NULL || name[0] == '#') {
+			continue;
+		}
+		if (uid != NULL) {
+			value = strtoul (uid, NULL, 16);
+			for (uint8_t i = 0; i < UID_SIZE; i++) {
+				entry[i] = (uint8_t)(value >> (8 * (UID_SIZE - 1 - i)));
+			}
+		}
+		strncpy ((char *)&entry[UID_SIZE], name, NAME_SIZE - 1);
+		if (category != NULL) {
+			strncpy ((char *)&entry[UID_SIZE + NAME_SIZE], category, CAT_SIZE - 1);
+		}
+		entries.push_back (entry);
+	}
+
+	fclose (file);
+	return true;
+
+}
+
+
+/* Programs the cards of a start list. Each entry is sent when the previous card has been
+programmed, so Master has it before the next card is put on reader */
+void MasterConsole::bulkFormat () {
+
+	std::vector<std::vector<uint8_t> > entries;
+	std::string path = ask ("Start list file: ");
+	Clock::time_point bulkStart;
+	Frame frame;
+	size_t done = 0;
+	double minutes;
+
+	if (!loadStartList (path.c_str(), entries)) {
+		fprintf (stderr, "Can't open %s\n", path.c_str());
+		return;
+	}
+
+	sendChoice (BULK_FORMAT_CHOICE);
+	if (!waitAck ()) {
+		return;
+	}
+
+	printf ("\n Put the cards on reader one after another\n\n");
+	printf (" #   \tUser ID \tName            \tResult\n");
+	bulkStart = Clock::now();
+	while (done < entries.size()) {
+		const uint8_t *entry = entries[done].data();
+
+		port.sendFrame (MSG_START_ENTRY, entry, CARD_HEADER_SIZE, WRITE_TIMEOUT);
+		do {
+			if (!expect (frame, MSG_FORMAT_STATUS, WAIT_FOREVER) ||
+				frame.payload.size() != UID_SIZE + 1) {
+				return;
+			}
+			printf (" %-4zu\t%02X%02X%02X%02X\t%-16s\t%s\n", done + 1, frame.payload[0],
+				frame.payload[1], frame.payload[2], frame.payload[3],
+				field (&entry[UID_SIZE], NAME_SIZE).c_str(),
+				frame.payload[UID_SIZE] == FORMAT_OK ? "Ok!" :
+				frame.payload[UID_SIZE] == FORMAT_WRONG_CARD ? "Wrong card" : "Error! Try again");
+		} while (frame.payload[UID_SIZE] != FORMAT_OK);
+		done++;
+	}
+	port.sendFrame (MSG_START_ENTRY, NULL, 0, WRITE_TIMEOUT);	// End of list
+	logTiming ("Start list", bulkStart);
+
+	minutes = std::chrono::duration<double>(Clock::now() - bulkStart).count() / 60;
+	printf ("\n %zu cards programmed: %.1f cards/min\n", done, done / minutes);
+
+}
+
+
+// Prints UID, name & category of a card header
+void MasterConsole::printCardHeader (const uint8_t *header) {
+	printf (" --------------------------------\n");
+	printf (" User ID: %02X%02X%02X%02X\n", header[0], header[1], header[2], header[3]);
+	printf (" Name: %s\n", field (&header[UID_SIZE], NAME_SIZE).c_str());
+	printf (" Category: %s\n", field (&header[UID_SIZE + NAME_SIZE], CAT_SIZE).c_str());
+	printf (" --------------------------------\n");
+}
+
+
+// Reads cards in all the Masters at once & saves the merged results
+static int multiReadout (const std::vector<const char *> &paths, unsigned long baudrate,
+	FILE *log, const char *csvPath, const char *coursesPath, const char *storePath,
+	int statsPeriodMs) {
+
+	ReadoutStore store;
+	CourseSet courses;
+	PunchStore punches;
+	std::string error;
+
+	if (coursesPath != NULL && !courses.load (coursesPath, error)) {
+		fprintf (stderr, "%s\n", error.c_str());
+		return 1;
+	}
+	if (storePath != NULL) {
+		if (!punches.open (storePath, false)) {
+			fprintf (stderr, "Can't open punch store %s\n", storePath);
+			return 1;
+		}
+		if (punches.recovered () > 0) {
+			printf ("%u punches recovered in %s\n", punches.recovered(), storePath);
+		}
+	}
+
+	MultiReadout readout (store, coursesPath != NULL ? &courses : NULL,
+		storePath != NULL ? &punches : NULL, log);
+
+	for (size_t i = 0; i < paths.size(); i++) {
+		if (!readout.open (paths[i], baudrate)) {
+			fprintf (stderr, "Can't open %s at %lu baud\n", paths[i], baudrate);
+			return 1;
+		}
+	}
+	if (!readout.connect ()) {
+		return 1;
+	}
+	readout.run (statsPeriodMs);
+
+	if (csvPath != NULL) {
+		if (!store.saveCsv (csvPath)) {
+			fprintf (stderr, "Can't save %s\n", csvPath);
+			return 1;
+		}
+		printf ("Punches of %zu cards saved in %s\n", store.numCards(), csvPath);
+	}
+
+	return 0;
+
+}
+
+
+int main (int argc, char *argv[]) {
+
+	std::vector<const char *> paths;	// Serial ports of Masters
+	unsigned long baudrate = 115200;	// Must be SERIAL_BAUDRATE of Master
+	FILE *log = stderr;					// Where timings are logged
+	const char *csvPath = NULL;			// Where merged readouts are saved
+	const char *coursesPath = NULL;		// Courses for validating cards
+	const char *storePath = NULL;		// Punch store directory
+	int statsPeriodMs = STATS_PERIOD;
+	bool readoutMode = false;			// Only read cards, even with one Master
+	SerialPort port;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "p:b:l:o:s:c:d:r")) != -1) {
+		switch (opt) {
+			case 'p': paths.push_back (optarg); break;
+			case 'b': baudrate = strtoul (optarg, NULL, 10); break;
+			case 'o': csvPath = optarg; break;
+			case 'c': coursesPath = optarg; break;
+			case 'd': storePath = optarg; break;
+			case 's': statsPeriodMs = atoi (optarg) * 1000; break;
+			case 'r': readoutMode = true; break;
+			case 'l':
+				log = fopen (optarg, "a");
+				if (log == NULL) {
+					perror (optarg);
+					return 1;
+				}
+				break;
+			default:
+				paths.clear ();
+				optind = argc;
+				break;
+		}
+	}
+	if (paths.empty() || statsPeriodMs <= 0) {
+		fprintf (stderr, "Usage: %s -p port [-p port ...] [-b baudrate] [-l log] [-r] "
+			"[-o results.csv] [-s seconds] [-c courses.txt] [-d store]\n", argv[0]);
+		return 2;
+	}
+
+	if (readoutMode || paths.size() > 1) {
+		return multiReadout (paths, baudrate, log, csvPath, coursesPath, storePath,
+			statsPeriodMs);
+	}
+
+	if (!port.open (paths[0], baudrate)) {
+		fprintf (stderr, "Can't open %s at %lu baud\n", paths[0], baudrate);
+		return 1;
+	}
+
+	MasterConsole console (port, log);
+	if (!console.connect ()) {
+		fprintf (stderr, "Master doesn't answer on %s\n", paths[0]);
+		return 1;
+	}
+	console.run ();
+	console.disconnect ();
+
+	return 0;
+
+}
@@ -0,0 +1,62 @@
+/*********************************************************************************************/
+/*
+ * MasterConsole
+ *
+ *  Native PC console for the Master device (Linux). See MasterConsole.cpp.
+*/
+/*********************************************************************************************/
+
+
+#ifndef __MASTERCONSOLE_H__
+#define __MASTERCONSOLE_H__
+
+#include "SerialPort.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <string>
+
+
+#define CONNECT_TIMEOUT		5000		// Max ms waiting for Master after opening the port
+#define PROBE_PERIOD		250			// Ms between probes while Master is booting
+#define QUIET_TIME			50			// Ms without data for considering a probe answered
+#define ACK_TIMEOUT			2000		// Max ms waiting for ACK of a choice
+#define WRITE_TIMEOUT		1000		// Max ms writing a frame
+#define WAIT_FOREVER		-1			// Operations waiting for user actions (i.e. cards)
+
+
+typedef std::chrono::steady_clock Clock;
+
+
+class MasterConsole {
+public:
+	MasterConsole (SerialPort &port, FILE *log);
+	bool connect ();					// Changes Master to binary mode
+	void disconnect ();					// Returns Master to text mode
+	void run ();						// Main menu
+
+private:
+	SerialPort &port;					// Serial connection with Master
+	FILE *log;							// Where timings are logged
+	Clock::time_point start;			// Time of connection, for log timestamps
+
+	bool sendChoice (uint8_t choice);	// Sends a choice frame without waiting ACK
+	bool sendText (const std::string &text);	// Sends a string frame
+	bool waitAck ();					// Waits ACK of a choice
+	bool expect (Frame &frame, uint8_t type, int timeoutMs);	// Waits a frame of a type
+	void logTiming (const char *what, Clock::time_point since);
+	static std::string ask (const char *prompt);	// Reads a line typed by user
+	static std::string field (const uint8_t *data, size_t size);	// Char field of card
+
+	void newEvent ();
+	void setupMenu ();
+	void formatCard ();
+	void readCard ();
+	void throughputTest ();
+	void dumpImage ();
+	void exportKeys ();
+	void bulkFormat ();
+	void printCardHeader (const uint8_t *header);
+};
+
+#endif
@@ -0,0 +1,285 @@
+/*********************************************************************************************/
+/*
+ * Concurrent readout of several Masters
+ * 
+ *  Reads cards in several Masters at once from a single event loop.
+*/
+/*********************************************************************************************/
+
+
+#include "MultiReadout.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define STDIN_INDEX			((uint64_t)-1)	// epoll data of stdin
+
+
+MultiReadout::MultiReadout (ReadoutStore &store, const CourseSet *courses,
+	PunchStore *punches, FILE *log) : store(store), courses(courses), punches(punches),
+	log(log), epollFd(epoll_create1 (0)), start(Clock::now()) {
+
+	// Cards only save time of day. Event is today
+	time_t now = time (NULL);
+	struct tm day;
+	localtime_r (&now, &day);
+	day.tm_hour = day.tm_min = day.tm_sec = 0;
+	eventDay = mktime (&day);
+
+}
+
+
+MultiReadout::~MultiReadout () {
+	if (epollFd >= 0) {
+		close (epollFd);
+	}
+}
+
+
+/* Opens the serial port of a Master. All ports are opened before connecting, so Masters
+reset by the port opening boot at the same time */
+bool MultiReadout::open (const char *path, unsigned long baudrate) {
+
+	std::unique_ptr<Master> master (new Master());
+	struct epoll_event event;
+
+	if (epollFd < 0 || !master->port.open (path, baudrate)) {
+		return false;
+	}
+
+	memset (&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.u64 = masters.size();
+	if (epoll_ctl (epollFd, EPOLL_CTL_ADD, master->port.descriptor(), &event) != 0) {
+		return false;
+	}
+
+	master->path = path;
+	master->online = true;
+	master->readouts = 0;
+	masters.push_back (std::move (master));
+	return true;
+
+}
+
+
+// Changes all Masters to binary mode
+bool MultiReadout::connect () {
+
+	for (size_t i = 0; i < masters.size(); i++) {
+		MasterConsole console (masters[i]->port, log);
+		if (!console.connect ()) {
+			fprintf (stderr, "Master doesn't answer on %s\n", masters[i]->path.c_str());
+			return false;
+		}
+	}
+	return true;
+
+}
+
+
+/* Event loop. Every Master is waiting a card; frames of each one are processed as they
+arrive. Stats are printed each statsPeriodMs. A line typed in stdin (or its end) finishes */
+void MultiReadout::run (int statsPeriodMs) {
+
+	struct epoll_event events [16];
+	struct epoll_event event;
+	Clock::time_point nextStats;
+	bool finish = false;
+	int n;
+
+	memset (&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.u64 = STDIN_INDEX;
+	epoll_ctl (epollFd, EPOLL_CTL_ADD, STDIN_FILENO, &event);
+
+	start = Clock::now();
+	nextStats = start + std::chrono::milliseconds(statsPeriodMs);
+	for (size_t i = 0; i < masters.size(); i++) {
+		masters[i]->lastReadout = start;
+		requestCard (*masters[i]);
+	}
+
+	printf ("\nPut cards on any Master. Press Enter to finish\n\n");
+	fflush (stdout);
+
+	while (!finish) {
+		long wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+			nextStats - Clock::now()).count();
+
+		n = epoll_wait (epollFd, events, 16, wait > 0 ? (int)wait : 0);
+		if (n < 0 && errno != EINTR) {
+			break;
+		}
+
+		for (int i = 0; i < n; i++) {
+			if (events[i].data.u64 == STDIN_INDEX) {
+				char line [64];
+				finish = true;
+				if (read (STDIN_FILENO, line, sizeof(line)) < 0) {
+					perror ("stdin");
+				}
+			} else {
+				receive (events[i].data.u64);
+				if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+					Master &master = *masters[events[i].data.u64];
+					fprintf (stderr, "Master on %s disconnected\n", master.path.c_str());
+					epoll_ctl (epollFd, EPOLL_CTL_DEL, master.port.descriptor(), NULL);
+					master.port.close ();
+					master.online = false;
+				}
+			}
+		}
+
+		if (Clock::now() >= nextStats) {
+			printStats ();
+			nextStats += std::chrono::milliseconds(statsPeriodMs);
+		}
+	}
+
+	epoll_ctl (epollFd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+	printStats ();
+	printf ("Masters waiting a card return to main menu after reading it\n");
+
+}
+
+
+// Prints cards per minute of each Master and of all of them
+void MultiReadout::printStats () {
+
+	double elapsed = minutes ();
+
+	fprintf (log, "--- %.1f min ---\n", elapsed);
+	for (size_t i = 0; i < masters.size(); i++) {
+		fprintf (log, " %-16s %6lu cards %8.1f cards/min%s\n", masters[i]->path.c_str(),
+			masters[i]->readouts, masters[i]->readouts / elapsed,
+			masters[i]->online ? "" : " (disconnected)");
+	}
+	fprintf (log, " %-16s %6lu cards %8.1f cards/min (%zu different, %lu duplicated)\n",
+		"Total", store.numReadouts(), store.numReadouts() / elapsed, store.numCards(),
+		store.numDuplicates());
+	fflush (log);
+
+}
+
+
+// Sends "read card" choice. Its ACK is ignored when it arrives
+bool MultiReadout::requestCard (Master &master) {
+	uint8_t choice = READ_CHOICE;
+	return master.port.sendFrame (MSG_CHOICE, &choice, 1, WRITE_TIMEOUT);
+}
+
+
+// Processes all the frames received from a Master without waiting more data
+void MultiReadout::receive (size_t index) {
+
+	Master &master = *masters[index];
+	Frame frame;
+
+	while (master.port.readFrame (frame, 0)) {
+		if (frame.type == MSG_CARD_READOUT) {
+			readout (index, frame);
+			requestCard (master);
+		} else if (frame.type == MSG_NAK) {
+			fprintf (stderr, "%s: choice rejected\n", master.path.c_str());
+			requestCard (master);
+		} else if (frame.type != MSG_ACK) {
+			fprintf (stderr, "%s: unexpected frame 0x%02X\n", master.path.c_str(), frame.type);
+		}
+	}
+
+}
+
+
+// Merges a card readout and prints it
+void MultiReadout::readout (size_t index, const Frame &frame) {
+
+	Master &master = *masters[index];
+	Clock::time_point now = Clock::now();
+	ReadoutStore::Result result;
+	std::vector<Punch> added;
+	static const char *results [] = { "new card", "new punches", "duplicated", "malformed" };
+
+	result = store.add (frame.payload.data(), frame.payload.size(), index, &added);
+	if (result == ReadoutStore::MALFORMED) {
+		fprintf (stderr, "%s: malformed readout\n", master.path.c_str());
+		return;
+	}
+	master.readouts++;
+
+	const CardRecord *card = store.find (((uint32_t)frame.payload[0] << 24) |
+		(frame.payload[1] << 16) | (frame.payload[2] << 8) | frame.payload[3]);
+	if (punches != NULL && !added.empty()) {
+		for (size_t i = 0; i < added.size(); i++) {
+			punches->append (card->uid, added[i].station, eventDay + added[i].time,
+				added[i].valid, SOURCE_READOUT);
+		}
+		if (!punches->sync ()) {
+			fprintf (stderr, "Can't save punches of card %08X\n", card->uid);
+		}
+	}
+	printf (" %-16s %08X %-16s %3u punches  %-11s %s\n", master.path.c_str(), card->uid,
+		card->name.c_str(), frame.payload[CARD_HEADER_SIZE], results[result],
+		validate (*card).c_str());
+	fflush (stdout);
+
+	fprintf (log, "[%9.3f s] %s: card after %.1f ms\n",
+		std::chrono::duration<double>(now - start).count(), master.path.c_str(),
+		std::chrono::duration<double, std::milli>(now - master.lastReadout).count());
+	master.lastReadout = now;
+
+}
+
+
+/* Validates all the punches received from a card with the course of its category. Punches
+with wrong MAC don't count */
+std::string MultiReadout::validate (const CardRecord &card) const {
+
+	const Course *course = courses != NULL ? courses->find (card.category) : NULL;
+	std::vector<uint8_t> stations;
+	std::vector<uint32_t> times;
+	CourseResult result;
+	char text [32];
+	std::string status;
+
+	if (course == NULL) {
+		return courses != NULL ? "no course for " + card.category : "";
+	}
+
+	for (std::set<Punch>::const_iterator p = card.punches.begin(); p != card.punches.end(); ++p) {
+		if (p->valid) {
+			stations.push_back (p->station);
+			times.push_back (p->time);
+		}
+	}
+	course->validate (stations.data(), times.data(), stations.size(), result);
+
+	if (course->getType() == COURSE_SCORE) {
+		snprintf (text, sizeof(text), "%d points", result.points);
+		status = text;
+	} else if (result.ok) {
+		status = "OK";
+	} else {
+		status = "MP, missing";
+		for (size_t i = 0; i < result.missing.size(); i++) {
+			status += " " + std::to_string (result.missing[i]);
+		}
+		return status;
+	}
+	if (result.time > 0) {
+		snprintf (text, sizeof(text), " %u:%02u:%02u", result.time / 3600,
+			(result.time / 60) % 60, result.time % 60);
+		status += text;
+	}
+	return status;
+
+}
+
+
+double MultiReadout::minutes () const {
+	return std::chrono::duration<double>(Clock::now() - start).count() / 60;
+}
@@ -0,0 +1,67 @@
+/*********************************************************************************************/
+/*
+ * Concurrent readout of several Masters
+ * 
+ *  Reads cards in several Masters at once (i.e. one per finish lane) from a single event
+ *	loop. All the serial ports and stdin are waited with one epoll instance. Each Master is
+ *	kept in "read card" choice: when a readout arrives, it's merged in the ReadoutStore and
+ *	the choice is sent again, so the Master is ready for next card at once. When courses are
+ *	given, each card is validated against the course of its category as soon as it's read,
+ *	so the runner is marked OK or MP (mispunched) at once. When a punch store is given, new
+ *	punches of each card are appended to it and synced, so they survive a crash of the PC.
+*/
+/*********************************************************************************************/
+
+
+#ifndef __MULTIREADOUT_H__
+#define __MULTIREADOUT_H__
+
+#include "MasterConsole.h"
+#include "ReadoutStore.h"
+#include "Course.h"
+#include "PunchStore.h"
+
+#include <memory>
+#include <vector>
+
+
+#define STATS_PERIOD		10000		// Ms between throughput reports
+
+
+class MultiReadout {
+public:
+	MultiReadout (ReadoutStore &store, const CourseSet *courses, PunchStore *punches,
+		FILE *log);
+	~MultiReadout ();
+	bool open (const char *path, unsigned long baudrate);	// Adds a Master
+	bool connect ();					// Changes all Masters to binary mode
+	void run (int statsPeriodMs);		// Reads cards until user press Enter
+	void printStats ();					// Per Master & aggregate cards per minute
+
+private:
+	// Master connected to the PC
+	struct Master {
+		std::string path;				// Serial port
+		SerialPort port;
+		bool online;					// False when port has been closed
+		unsigned long readouts;			// Cards read in this Master
+		Clock::time_point lastReadout;	// For logging time between cards
+	};
+
+	ReadoutStore &store;				// Where readouts are merged
+	const CourseSet *courses;			// Courses by category (NULL if not validated)
+	PunchStore *punches;				// Where new punches are saved (may be NULL)
+	uint32_t eventDay;					// Unix time of midnight, for punch times
+	FILE *log;							// Where timings are logged
+	std::vector<std::unique_ptr<Master> > masters;
+	int epollFd;						// Waits all ports & stdin
+	Clock::time_point start;			// Beginning of readout, for cards per minute
+
+	bool requestCard (Master &master);	// Sends "read card" choice
+	void receive (size_t index);		// Processes all frames received from a Master
+	void readout (size_t index, const Frame &frame);
+	std::string validate (const CardRecord &card) const;	// OK, MP or score-O points
+	double minutes () const;			// Minutes since start
+};
+
+#endif
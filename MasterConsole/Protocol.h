@@ -0,0 +1,86 @@
+/*********************************************************************************************/
+/*
+ * Master serial protocol for PC programs
+ * 
+ *  Constants of the serial protocol between PC and Master. They must match the ones of
+ *	SerialInterface, PlayerCard and SetUpStations libraries.
+ *
+ *	Binary frame: SYNC (0x7E) | TYPE | LEN (2 bytes, LSB first) | PAYLOAD | CRC-16 (LSB first)
+*/
+/*********************************************************************************************/
+
+
+#ifndef __PROTOCOL_H__
+#define __PROTOCOL_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+#define FRAME_SYNC			0x7E		// First byte of each binary frame
+#define FRAME_HEADER_SIZE	4			// SYNC, TYPE & LEN
+#define FRAME_CRC_SIZE		2			// Size in bytes of CRC-16
+
+#define MSG_ACK				0x01		// Acknowledge. Payload: value of ack
+#define MSG_NAK				0x02		// Frame rejected. Payload: type of rejected frame
+#define MSG_CHOICE			0x03		// User's choice. Payload: choice
+#define MSG_NUMBER			0x04		// Number. Payload: value
+#define MSG_TEXT			0x05		// String. Payload: chars without '\0'
+#define MSG_CHAR			0x06		// Byte. Payload: value
+#define MSG_HEX				0x07		// Byte array. Payload: bytes
+#define MSG_STATION_ID		0x10		// Next station ID. Payload: ID
+#define MSG_STATION_STATUS	0x11		// Setup result. Payload: ID, status, ms (4 bytes)
+#define MSG_CARD_HEADER		0x20		// Card header. Payload: UID, name, category
+#define MSG_CARD_READOUT	0x21		// Whole card. Payload: header, # punches, punches
+#define MSG_PUNCH			0x22		// Single punch. Payload: punch record
+#define MSG_CARD_END		0x23		// No more punches. Empty payload
+#define MSG_CARD_IMAGE		0x24		// Raw card. Payload: UID & 64 blocks of 16 bytes
+#define MSG_KEY_TABLE		0x25		// Station keys. Payload: # stations & 32 bytes keys
+#define MSG_START_ENTRY		0x26		// Start list entry. Payload: UID, name, category
+#define MSG_FORMAT_STATUS	0x27		// Card programmed. Payload: UID & status
+
+#define UID_SIZE			4			// Size in bytes of UID of Mifare Classic cards
+#define NAME_SIZE			16			// Size in bytes of player name field in card
+#define CAT_SIZE			15			// Size in bytes of category field in card
+#define CARD_HEADER_SIZE	(UID_SIZE + NAME_SIZE + CAT_SIZE)	// Size of card header message
+#define PUNCH_REC_SIZE		5			// IDS, hour, minute, second & validated
+#define TEST_PUNCHES		45			// Punches of fake card of throughput test
+
+#define NEW_EVENT_CHOICE	'1'			// Set up and start a new event
+#define CONTINUE_CHOICE		'2'			// Continue setting up an event
+#define FORMAT_CHOICE		'3'			// Clean card
+#define READ_CHOICE			'4'			// Read card
+#define SERIAL_TEST_CHOICE	'5'			// Measure serial throughput
+#define CARD_IMAGE_CHOICE	'6'			// Dump raw card image
+#define EXPORT_KEYS_CHOICE	'7'			// Export station keys
+#define BULK_FORMAT_CHOICE	'8'			// Program cards from a start list
+#define SETUP_ONE_CHOICE	'1'			// Set up station on reader
+#define SETUP_END_CHOICE	'2'			// Finish setup process
+#define SETUP_BATCH_CHOICE	'3'			// Set up N stations unattended
+#define SERIAL_TEXT_CHOICE	'T'			// Change to text mode
+#define SERIAL_BINARY_CHOICE	'B'		// Change to binary mode
+
+#define SETUP_STATUS_ERROR	0			// Station setup failed
+#define SETUP_STATUS_OK		1			// Station set up
+#define SETUP_STATUS_FULL	2			// Not set up: master can't hold more station keys
+#define MASTER_MAX_STATIONS	128			// Station keys in AT24C32 of master (4096 / 32)
+
+#define FORMAT_OK			0			// Card programmed with start list entry
+#define FORMAT_WRONG_CARD	1			// Card UID isn't the one bound to the entry
+#define FORMAT_WRITE_ERROR	2			// Card header couldn't be written
+
+
+// Updates CRC-16 CCITT (polynomial 0x1021, initial value 0xFFFF) with one byte
+inline uint16_t crc16 (uint16_t crc, uint8_t data) {
+	crc ^= ((uint16_t)data) << 8;
+	for (uint8_t i = 0; i < 8; i++) {
+		if (crc & 0x8000) {
+			crc = (crc << 1) ^ 0x1021;
+		} else {
+			crc <<= 1;
+		}
+	}
+	return crc;
+}
+
+#endif
@@ -0,0 +1,127 @@
+/*********************************************************************************************/
+/*
+ * Store of card readouts for PC programs
+ * 
+ *  Merges the readouts received from one or several Masters.
+*/
+/*********************************************************************************************/
+
+
+#include "ReadoutStore.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+ReadoutStore::ReadoutStore () : readouts(0), duplicates(0) { }
+
+
+/* Merges the payload of a MSG_CARD_READOUT frame (header, # punches & punch records).
+A readout that doesn't add any punch is a duplicate (same card read again). New punches
+are also appended to added, if given */
+ReadoutStore::Result ReadoutStore::add (const uint8_t *readout, size_t len, int source,
+	std::vector<Punch> *added) {
+
+	const uint8_t *punch = &readout[CARD_HEADER_SIZE + 1];
+	uint32_t uid;
+	size_t numAdded = 0;
+
+	if (len < CARD_HEADER_SIZE + 1 ||
+		len != CARD_HEADER_SIZE + 1u + readout[CARD_HEADER_SIZE] * PUNCH_REC_SIZE) {
+		return MALFORMED;
+	}
+
+	uid = ((uint32_t)readout[0] << 24) | (readout[1] << 16) | (readout[2] << 8) | readout[3];
+	readouts++;
+
+	std::pair<std::map<uint32_t, CardRecord>::iterator, bool> inserted =
+		cards.insert (std::make_pair (uid, CardRecord()));
+	CardRecord &card = inserted.first->second;
+
+	if (inserted.second) {
+		card.uid = uid;
+		card.readouts = 0;
+		card.source = source;
+	}
+	card.name = field (&readout[UID_SIZE], NAME_SIZE);	// Last format of the card
+	card.category = field (&readout[UID_SIZE + NAME_SIZE], CAT_SIZE);
+	card.readouts++;
+
+	for (uint8_t i = 0; i < readout[CARD_HEADER_SIZE]; i++, punch += PUNCH_REC_SIZE) {
+		Punch p;
+		p.station = punch[0];
+		p.time = punch[1] * 3600u + punch[2] * 60u + punch[3];
+		p.valid = punch[4] != 0;
+		if (card.punches.insert (p).second) {
+			numAdded++;
+			if (added != NULL) {
+				added->push_back (p);
+			}
+		}
+	}
+
+	if (inserted.second) {
+		return NEW_CARD;
+	} else if (numAdded > 0) {
+		return NEW_PUNCHES;
+	}
+	duplicates++;
+	return DUPLICATE;
+
+}
+
+
+// Card with the given UID or NULL if it hasn't been read
+const CardRecord *ReadoutStore::find (uint32_t uid) const {
+	std::map<uint32_t, CardRecord>::const_iterator it = cards.find (uid);
+	return it != cards.end() ? &it->second : NULL;
+}
+
+
+size_t ReadoutStore::numCards () const {
+	return cards.size();
+}
+
+
+unsigned long ReadoutStore::numReadouts () const {
+	return readouts;
+}
+
+
+unsigned long ReadoutStore::numDuplicates () const {
+	return duplicates;
+}
+
+
+// Saves all the punches in CSV format: UID, name, category, IDS, time, validated
+bool ReadoutStore::saveCsv (const char *path) const {
+
+	FILE *file = fopen (path, "w");
+	bool ok;
+
+	if (file == NULL) {
+		return false;
+	}
+
+	fprintf (file, "uid,name,category,station,time,valid\n");
+	for (std::map<uint32_t, CardRecord>::const_iterator it = cards.begin();
+		it != cards.end(); ++it) {
+		const CardRecord &card = it->second;
+		for (std::set<Punch>::const_iterator p = card.punches.begin();
+			p != card.punches.end(); ++p) {
+			fprintf (file, "%08X,\"%s\",\"%s\",%u,%02u:%02u:%02u,%u\n", card.uid,
+				card.name.c_str(), card.category.c_str(), p->station, p->time / 3600,
+				(p->time / 60) % 60, p->time % 60, p->valid);
+		}
+	}
+
+	ok = !ferror (file);
+	return fclose (file) == 0 && ok;
+
+}
+
+
+// Char field of card, until first '\0'
+std::string ReadoutStore::field (const uint8_t *data, size_t size) {
+	return std::string ((const char *)data, strnlen ((const char *)data, size));
+}
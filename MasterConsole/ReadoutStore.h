@@ -0,0 +1,67 @@
+/*********************************************************************************************/
+/*
+ * Store of card readouts for PC programs
+ * 
+ *  Merges the readouts received from one or several Masters. Cards are identified by UID
+ *	and punches by station & time, so a card read twice (in the same Master or in another
+ *	one) only adds the punches that weren't received before.
+*/
+/*********************************************************************************************/
+
+
+#ifndef __READOUTSTORE_H__
+#define __READOUTSTORE_H__
+
+#include "Protocol.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+
+// Punch of a card. Ordered by time & station
+struct Punch {
+	uint32_t time;						// Seconds since midnight
+	uint8_t station;					// IDS of station
+	bool valid;							// Validated by Master
+
+	bool operator< (const Punch &other) const {
+		return time != other.time ? time < other.time : station < other.station;
+	}
+};
+
+
+// Card with all its punches received
+struct CardRecord {
+	uint32_t uid;						// UID of card, first byte as MSB
+	std::string name;					// Player name
+	std::string category;				// Player category
+	std::set<Punch> punches;			// Punches without duplicates
+	unsigned readouts;					// Number of times it has been read
+	int source;							// Index of Master where it was read first
+};
+
+
+class ReadoutStore {
+public:
+	enum Result { NEW_CARD, NEW_PUNCHES, DUPLICATE, MALFORMED };
+
+	ReadoutStore ();
+	Result add (const uint8_t *readout, size_t len, int source,
+		std::vector<Punch> *added = NULL);	// Merges a readout
+	const CardRecord *find (uint32_t uid) const;
+	size_t numCards () const;			// Different cards read
+	unsigned long numReadouts () const;	// Readouts received, including duplicates
+	unsigned long numDuplicates () const;	// Readouts without new punches
+	bool saveCsv (const char *path) const;	// One line per punch
+
+private:
+	std::map<uint32_t, CardRecord> cards;	// Cards by UID
+	unsigned long readouts;
+	unsigned long duplicates;
+
+	static std::string field (const uint8_t *data, size_t size);	// Char field of card
+};
+
+#endif
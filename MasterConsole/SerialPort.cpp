@@ -0,0 +1,304 @@
+/*********************************************************************************************/
+/*
+ * Non-blocking serial port for PC programs (Linux)
+ * 
+ *  Serial port opened in non-blocking mode and waited with epoll.
+*/
+/*********************************************************************************************/
+
+
+#include "SerialPort.h"
+
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <termios.h>
+#include <unistd.h>
+
+
+// Deadline of an operation. Negative timeouts never expire
+class Deadline {
+public:
+	Deadline (int timeoutMs) : forever(timeoutMs < 0),
+		end(std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs)) { }
+
+	// Milliseconds left until deadline (0 if it's reached, -1 if it never expires)
+	int remainingMs () const {
+		if (forever) {
+			return -1;
+		}
+		long ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+			end - std::chrono::steady_clock::now()).count();
+		return ms > 0 ? (int)ms : 0;
+	}
+
+private:
+	bool forever;
+	std::chrono::steady_clock::time_point end;
+};
+
+
+// Returns termios constant of a baudrate or 0 if it isn't supported
+static speed_t baudConstant (unsigned long baudrate) {
+	switch (baudrate) {
+		case 9600:		return B9600;
+		case 57600:		return B57600;
+		case 115200:	return B115200;
+		case 230400:	return B230400;
+		case 500000:	return B500000;
+		case 1000000:	return B1000000;
+		default:		return 0;
+	}
+}
+
+
+SerialPort::SerialPort () : fd(-1), epollFd(-1), rxHead(0), rxTail(0) { }
+
+
+SerialPort::~SerialPort () {
+	close ();
+}
+
+
+// Opens a serial device in raw mode with the given baudrate
+bool SerialPort::open (const char *path, unsigned long baudrate) {
+
+	struct termios tty;
+	speed_t speed = baudConstant (baudrate);
+	int newFd;
+
+	if (speed == 0) {
+		return false;
+	}
+
+	newFd = ::open (path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (newFd < 0) {
+		return false;
+	}
+
+	if (tcgetattr (newFd, &tty) != 0) {
+		::close (newFd);
+		return false;
+	}
+	cfmakeraw (&tty);
+	cfsetispeed (&tty, speed);
+	cfsetospeed (&tty, speed);
+	tty.c_cflag |= CLOCAL | CREAD;
+	tty.c_cc[VMIN] = 0;
+	tty.c_cc[VTIME] = 0;
+	if (tcsetattr (newFd, TCSANOW, &tty) != 0) {
+		::close (newFd);
+		return false;
+	}
+
+	return attach (newFd);
+
+}
+
+
+// Uses an already opened file descriptor. It's changed to non-blocking mode
+bool SerialPort::attach (int newFd) {
+
+	struct epoll_event event;
+
+	close ();
+	fcntl (newFd, F_SETFL, fcntl (newFd, F_GETFL) | O_NONBLOCK);
+
+	epollFd = epoll_create1 (0);
+	if (epollFd < 0) {
+		::close (newFd);
+		return false;
+	}
+
+	memset (&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = newFd;
+	if (epoll_ctl (epollFd, EPOLL_CTL_ADD, newFd, &event) != 0) {
+		::close (newFd);
+		::close (epollFd);
+		epollFd = -1;
+		return false;
+	}
+
+	fd = newFd;
+	rxHead = rxTail = 0;
+	parser.reset ();
+	return true;
+
+}
+
+
+void SerialPort::close () {
+	if (epollFd >= 0) {
+		::close (epollFd);
+		epollFd = -1;
+	}
+	if (fd >= 0) {
+		::close (fd);
+		fd = -1;
+	}
+}
+
+
+// Waits until fd is ready for reading (EPOLLIN) or writing (EPOLLOUT)
+bool SerialPort::wait (uint32_t events, int timeoutMs) {
+
+	struct epoll_event event;
+	int n;
+
+	memset (&event, 0, sizeof(event));
+	event.events = events;
+	event.data.fd = fd;
+	epoll_ctl (epollFd, EPOLL_CTL_MOD, fd, &event);
+
+	do {
+		n = epoll_wait (epollFd, &event, 1, timeoutMs);
+	} while (n < 0 && errno == EINTR);
+
+	return n > 0 && (event.events & events);
+
+}
+
+
+// Writes all the data, waiting while the output buffer is full
+bool SerialPort::write (const uint8_t *data, size_t len, int timeoutMs) {
+
+	Deadline deadline (timeoutMs);
+
+	while (len > 0) {
+		ssize_t n = ::write (fd, data, len);
+		if (n > 0) {
+			data += n;
+			len -= n;
+		} else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+			return false;
+		} else if (!wait (EPOLLOUT, deadline.remainingMs())) {
+			return false;
+		}
+	}
+
+	return true;
+
+}
+
+
+bool SerialPort::write (const std::string &text, int timeoutMs) {
+	return write ((const uint8_t *)text.data(), text.size(), timeoutMs);
+}
+
+
+// Sends a binary frame
+bool SerialPort::sendFrame (uint8_t type, const uint8_t *payload, uint16_t len, int timeoutMs) {
+
+	std::vector<uint8_t> frame;
+	uint16_t crc = 0xFFFF;
+
+	frame.reserve (FRAME_HEADER_SIZE + len + FRAME_CRC_SIZE);
+	frame.push_back (FRAME_SYNC);
+	frame.push_back (type);
+	frame.push_back ((uint8_t)len);
+	frame.push_back ((uint8_t)(len >> 8));
+	frame.insert (frame.end(), payload, payload + len);
+	for (size_t i = 1; i < frame.size(); i++) {
+		crc = crc16 (crc, frame[i]);
+	}
+	frame.push_back ((uint8_t)crc);
+	frame.push_back ((uint8_t)(crc >> 8));
+
+	return write (frame.data(), frame.size(), timeoutMs);
+
+}
+
+
+// Reads all available bytes into empty rxBuf, waiting for them up to timeoutMs
+bool SerialPort::fill (int timeoutMs) {
+
+	ssize_t n;
+
+	rxHead = rxTail = 0;				// Only called when all bytes have been read
+
+	n = ::read (fd, &rxBuf[rxTail], sizeof(rxBuf) - rxTail);
+	if (n <= 0) {
+		if (!wait (EPOLLIN, timeoutMs)) {
+			return false;
+		}
+		n = ::read (fd, &rxBuf[rxTail], sizeof(rxBuf) - rxTail);
+		if (n <= 0) {
+			return false;
+		}
+	}
+	rxTail += n;
+
+	return true;
+
+}
+
+
+// Returns next received byte or -1 if nothing is received in timeoutMs
+int SerialPort::readByte (int timeoutMs) {
+	if (rxHead == rxTail && !fill (timeoutMs)) {
+		return -1;
+	}
+	return rxBuf[rxHead++];
+}
+
+
+// Reads a line. "\r\n" is removed. Returns false on timeout
+bool SerialPort::readLine (std::string &line, int timeoutMs) {
+
+	Deadline deadline (timeoutMs);
+	int c;
+
+	line.clear ();
+	while ((c = readByte (deadline.remainingMs())) >= 0) {
+		if (c == '\n') {
+			return true;
+		} else if (c != '\r') {
+			line.push_back ((char)c);
+		}
+	}
+
+	return false;
+
+}
+
+
+/* Reads a frame. Bytes before SYNC and frames with wrong CRC are discarded. A frame not
+completed before timeout is kept in parser, so readFrame with timeout 0 can be called each
+time the port is ready in an event loop */
+bool SerialPort::readFrame (Frame &frame, int timeoutMs) {
+
+	Deadline deadline (timeoutMs);
+	int c;
+
+	while ((c = readByte (deadline.remainingMs())) >= 0) {
+		if (parser.feed ((uint8_t)c)) {
+			frame.type = parser.frame().type;
+			frame.payload.swap (parser.frame().payload);
+			return true;
+		}
+	}
+
+	return false;
+
+}
+
+
+// Discards received data
+void SerialPort::flushInput () {
+	rxHead = rxTail = 0;
+	parser.reset ();
+	if (fd >= 0) {
+		tcflush (fd, TCIFLUSH);
+		while (fill (0)) {
+			rxHead = rxTail = 0;
+		}
+	}
+}
+
+
+int SerialPort::descriptor () const {
+	return fd;
+}
@@ -0,0 +1,51 @@
+/*********************************************************************************************/
+/*
+ * Non-blocking serial port for PC programs (Linux)
+ * 
+ *  Serial port opened in non-blocking mode and waited with epoll, so every read and write
+ *	has a timeout and no fixed sleeps are needed. Negative timeouts wait forever. It can also wrap an already opened file
+ *	descriptor (i.e. the master side of a pseudo-terminal).
+*/
+/*********************************************************************************************/
+
+
+#ifndef __SERIALPORT_H__
+#define __SERIALPORT_H__
+
+#include "FrameParser.h"
+
+#include <string>
+
+
+#define SERIAL_RX_BUF_SIZE	4096		// Size in bytes of receive buffer
+
+
+class SerialPort {
+public:
+	SerialPort ();
+	~SerialPort ();
+	bool open (const char *path, unsigned long baudrate);	// Opens a serial device
+	bool attach (int fd);				// Uses an opened file descriptor (i.e. PTY)
+	void close ();
+	bool write (const uint8_t *data, size_t len, int timeoutMs);	// Writes all the data
+	bool write (const std::string &text, int timeoutMs);
+	bool sendFrame (uint8_t type, const uint8_t *payload, uint16_t len, int timeoutMs);
+	int readByte (int timeoutMs);		// Returns next byte or -1 on timeout
+	bool readLine (std::string &line, int timeoutMs);	// Reads a line without "\r\n"
+	bool readFrame (Frame &frame, int timeoutMs);	// Reads a frame with correct CRC
+	void flushInput ();					// Discards received data
+	int descriptor () const;			// File descriptor, for waiting several ports
+
+private:
+	int fd;								// File descriptor of serial port
+	int epollFd;						// epoll instance waiting for fd
+	uint8_t rxBuf [SERIAL_RX_BUF_SIZE];	// Received bytes not read yet
+	size_t rxHead;						// Next byte to read in rxBuf
+	size_t rxTail;						// End of received bytes in rxBuf
+	FrameParser parser;					// Frame being received
+
+	bool wait (uint32_t events, int timeoutMs);	// Waits until fd is ready
+	bool fill (int timeoutMs);			// Reads all available bytes into rxBuf
+};
+
+#endif
@@ -0,0 +1,931 @@
+/*********************************************************************************************/
+/*
+ * N211Emulator
+ *
+ *  Emulator of ublox N211 (SODAQ NB-IOT SHIELD) in a pseudo-terminal, so SodaqNBIoT can be
+ *	tested & measured on PC without SIM card nor network. It answers the AT commands used by
+ *	the library like the module does:
+ *
+ *		AT, AT+NRB, AT+CFUN, AT+CEREG, AT+CSCON, AT+CGDCONT, AT+COPS, AT+CGATT, AT+CSQ,
+ *		AT+CGPADDR, AT+CGSN, AT+NCONFIG, AT+NSOCR, AT+NSOCL, AT+NSOST, AT+NSORF
+ *
+ *	Each of them also in its "?" form. Datagrams of AT+NSOST are sent to the UDP address of
+ *	-u (the IP & port of the command are ignored; i.e. IngestPunches), each socket of the
+ *	module from its own UDP socket. Datagrams answered to it are announced with +NSONMI and
+ *	read with AT+NSORF, with the IP & port of the last AT+NSOST of their socket.
+ *
+ *	Timing of the module:
+ *	 - UART: bytes take 10 bits at -b baud both ways. 0 means no limit.
+ *	 - Each command is answered -r ms after it arrives, one by one.
+ *	 - Power on & AT+NRB take -B ms, while the module doesn't answer.
+ *	 - Registration takes -g ms after CFUN=1 or a boot with AUTOCONNECT. AT+COPS answers
+ *	   when it finishes. The module keeps it while the station reboots, like the real one.
+ *	 - Datagrams take -L ms plus up to -J ms through network, both ways, so they may arrive
+ *	   out of order. -x percent of them are lost.
+ *	 - With -o, the network is lost every -o ms (+CEREG:2) and comes back after -g ms.
+ *
+ *	The pseudo-terminal is linked from -l path. -v prints each line (">" to module, "<" from
+ *	it). Stats are printed at the end (SIGINT or SIGTERM).
+ *
+ *	Usage: N211Emulator [-l /tmp/ttyN211] [-u 127.0.0.1:16666] [-b 9600] [-r 20] [-B 3000]
+ *		[-g 5000] [-L 300] [-J 400] [-x 0] [-o 0] [-S 1] [-v]
+ *
+ *	Build: g++ -O2 -std=c++11 N211Emulator.cpp -o N211Emulator
+*/
+/*********************************************************************************************/
+
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <deque>
+#include <errno.h>
+#include <fcntl.h>
+#include <map>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+
+
+#define MODULE_SOCKETS		7			// Sockets of N211
+#define MODULE_DATAGRAMS	8			// Datagrams kept by a socket until AT+NSORF
+#define NSOST_DATA_MAX		512			// Max bytes of a datagram of AT+NSOST
+#define NSORF_DATA_MAX		512			// Max bytes given by AT+NSORF
+#define LINE_MAX			(64 + 2 * NSOST_DATA_MAX)	// Longest command
+#define OPERATOR			"21401"		// Network of the emulated cell (Vodafone)
+#define MODULE_IMEI			"357517080000001"
+#define MODULE_IP			"10.46.120.7"
+#define CELL_INFO			"\"1A2B\",\"01A2B3C4\",7"	// TAC, cell & access of +CEREG
+
+#define STAT_NOT			0			// Registration status of +CEREG
+#define STAT_HOME			1
+#define STAT_SEARCHING		2
+#define STAT_DENIED			3
+
+#define EVENT_OUTPUT		0			// Bytes to station, written when they're all sent
+#define EVENT_UPLINK		1			// Datagram arrives at server
+#define EVENT_DOWNLINK		2			// Datagram arrives at module
+#define EVENT_REGISTERED	3			// Registration finishes
+#define EVENT_BOOTED		4			// Power on or AT+NRB finishes
+#define EVENT_OUTAGE		5			// Network is lost
+
+
+typedef std::chrono::steady_clock Clock;
+
+
+// Something that happens at a given time
+struct Event {
+	uint8_t type;
+	uint8_t socket;
+	uint32_t token;						// Registration or boot it belongs to
+	std::string data;
+};
+
+
+// Socket of the module
+struct Socket {
+	bool open;
+	int fd;								// UDP socket of PC
+	int localPort;
+	char ip [16];						// Of last AT+NSOST, given by AT+NSORF
+	int port;
+	std::deque<std::string> received;	// Datagrams not read yet
+	size_t offset;						// Bytes of first datagram already read
+};
+
+
+// What the emulator has seen
+struct EmulatorStats {
+	unsigned long commands;
+	unsigned long unknown;				// Answered with ERROR as unknown
+	unsigned long boots;
+	unsigned long registrations;
+	unsigned long outages;
+	unsigned long uplink;				// Datagrams accepted by AT+NSOST
+	unsigned long uplinkBytes;
+	unsigned long downlink;				// Datagrams answered by server
+	unsigned long reads;				// AT+NSORF with data
+	unsigned long lost;					// Datagrams lost by network (both ways)
+	unsigned long full;					// Datagrams dropped because module socket was full
+	unsigned long ignored;				// Bytes from station while booting
+	unsigned long overrun;				// Bytes to station not taken by pseudo-terminal
+};
+
+
+// Options
+static const char *linkPath = "/tmp/ttyN211";
+static struct sockaddr_in server;		// Where datagrams are sent
+static unsigned long baud = 9600;
+static long answerDelay = 20;			// Ms
+static long bootDelay = 3000;
+static long registrationDelay = 5000;
+static long latency = 300;
+static long jitter = 400;
+static unsigned long lossPercent = 0;
+static long outagePeriod = 0;
+static uint32_t seed = 1;
+static bool verbose = false;
+
+// Module
+static int master = -1;					// Pseudo-terminal
+static int slave = -1;					// Kept open, so station can close & open it again
+static std::multimap<int64_t, Event> events;
+static std::deque<std::pair<int64_t, std::string> > lines;	// Commands & time they arrive
+static std::string line;				// Command being received
+static int64_t inputBusy = 0;			// Time when last byte from station arrives
+static int64_t outputBusy = 0;			// Time when last byte to station is sent
+static int64_t moduleBusy = 0;			// Time when module takes next command
+static bool booting = false;
+static bool copsWaiting = false;		// AT+COPS answers when registration finishes
+static uint32_t bootToken = 0;
+static uint32_t registrationToken = 0;
+static int cfun = 0;
+static int ceregMode = 0;
+static int csconMode = 0;
+static int copsMode = 0;				// 0 automatic, 1 manual, 2 deregistered
+static std::string copsOperator = OPERATOR;
+static std::string pdpContext;			// Of AT+CGDCONT
+static bool autoconnect = true;
+static int stat = STAT_NOT;
+static Socket sockets [MODULE_SOCKETS];
+static EmulatorStats counters;
+static Clock::time_point start;
+static volatile bool running = true;
+
+
+static int64_t now () {
+	return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+}
+
+
+// Pseudo random number, the same in every run with the same seed
+static uint32_t random32 () {
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+
+// Microseconds that n bytes take through UART
+static int64_t uartTime (size_t n) {
+	return (baud == 0) ? 0 : (int64_t)n * 10 * 1000000 / baud;
+}
+
+
+static void schedule (int64_t time, uint8_t type, uint8_t socket, uint32_t token,
+	const std::string &data) {
+
+	Event event;
+
+	event.type = type;
+	event.socket = socket;
+	event.token = token;
+	event.data = data;
+	events.insert (std::make_pair (time, event));
+
+}
+
+
+// Line to station, between "\r\n" like the module, after the ones written before
+static void output (int64_t time, const std::string &text) {
+
+	std::string bytes = "\r\n" + text + "\r\n";
+
+	outputBusy = std::max (outputBusy, time) + uartTime (bytes.size());
+	schedule (outputBusy, EVENT_OUTPUT, 0, 0, bytes);
+
+}
+
+
+// Answer of the command being handled
+static void answer (const std::string &text) {
+	output (moduleBusy, text);
+}
+
+
+// Unsolicited result code
+static void urc (const std::string &text) {
+	output (now(), text);
+}
+
+
+static bool isRegistered () {
+	return stat == STAT_HOME;
+}
+
+
+static void ceregUrc () {
+	if (ceregMode == 1 || (ceregMode == 2 && !isRegistered())) {
+		urc ("+CEREG:" + std::to_string (stat));
+	} else if (ceregMode == 2) {
+		urc ("+CEREG:" + std::to_string (stat) + "," CELL_INFO);
+	}
+}
+
+
+// Datagram through network, lost -x percent of times
+static bool travel (uint8_t type, uint8_t socket, const std::string &data) {
+
+	if (random32() % 100 < lossPercent) {
+		counters.lost++;
+		return false;
+	}
+
+	schedule (now() + (latency + (jitter > 0 ? random32() % jitter : 0)) * 1000, type, socket,
+		bootToken, data);
+
+	return true;
+
+}
+
+
+// Starts searching network. Stale registration events are ignored by their token
+static void startRegistration () {
+
+	stat = STAT_SEARCHING;
+	registrationToken++;
+	ceregUrc ();
+	schedule (now() + registrationDelay * 1000, EVENT_REGISTERED, 0, registrationToken, "");
+
+}
+
+
+static void deregister () {
+
+	registrationToken++;
+	if (stat != STAT_NOT) {
+		stat = STAT_NOT;
+		ceregUrc ();
+	}
+
+}
+
+
+// Power on or AT+NRB: everything but NCONFIG & the stored PDP context is lost
+static void reboot () {
+
+	booting = true;
+	bootToken++;
+	registrationToken++;
+	copsWaiting = false;
+	lines.clear ();
+	line.clear ();
+	cfun = 0;
+	ceregMode = 0;
+	csconMode = 0;
+	stat = STAT_NOT;
+	for (uint8_t i = 0; i < MODULE_SOCKETS; i++) {
+		if (sockets[i].open) {
+			close (sockets[i].fd);
+		}
+		sockets[i].open = false;
+		sockets[i].received.clear ();
+	}
+	counters.boots++;
+	schedule (now() + bootDelay * 1000, EVENT_BOOTED, 0, bootToken, "");
+
+}
+
+
+static std::string hex (const std::string &data) {
+
+	static const char digits [] = "0123456789ABCDEF";
+	std::string text;
+
+	for (size_t i = 0; i < data.size(); i++) {
+		text += digits[(uint8_t)data[i] >> 4];
+		text += digits[(uint8_t)data[i] & 0xF];
+	}
+
+	return text;
+
+}
+
+
+// Decodes hex digits. False if there's something else
+static bool unhex (const char *text, std::string &data) {
+
+	data.clear ();
+	for (; text[0] != '\0'; text += 2) {
+		char pair [3] = { text[0], text[1], '\0' };
+		char *end;
+		if (text[1] == '\0') {
+			return false;
+		}
+		data += (char)strtoul (pair, &end, 16);
+		if (*end != '\0') {
+			return false;
+		}
+	}
+
+	return true;
+
+}
+
+
+// Socket of a command or -1
+static int socketArgument (const char *text) {
+
+	char *end;
+	long socket = strtol (text, &end, 10);
+
+	if (end == text || socket < 0 || socket >= MODULE_SOCKETS || !sockets[socket].open) {
+		return -1;
+	}
+
+	return socket;
+
+}
+
+
+// "AT+NSOCR=DGRAM,17,port[,1]"
+static bool openSocket (const char *arguments) {
+
+	int port;
+	int i = 0;
+
+	if (strncmp (arguments, "DGRAM,17,", 9) != 0) {
+		return false;
+	}
+	port = atoi (arguments + 9);
+
+	while (i < MODULE_SOCKETS && sockets[i].open) {
+		i++;
+	}
+	for (int j = 0; j < MODULE_SOCKETS; j++) {
+		if (sockets[j].open && sockets[j].localPort == port) {
+			return false;				// Port in use
+		}
+	}
+	if (i == MODULE_SOCKETS || port < 0 || port > 65535) {
+		return false;
+	}
+
+	sockets[i].fd = socket (AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	if (sockets[i].fd < 0) {
+		perror ("socket");
+		return false;
+	}
+	sockets[i].open = true;
+	sockets[i].localPort = port;
+	sockets[i].ip[0] = '\0';
+	sockets[i].port = 0;
+	sockets[i].received.clear ();
+	sockets[i].offset = 0;
+
+	answer (std::to_string (i));
+
+	return true;
+
+}
+
+
+// "AT+NSOST=socket,ip,port,length,hex"
+static bool sendDatagram (const char *arguments) {
+
+	char ip [16];
+	int port;
+	int length;
+	int consumed = 0;
+	int socket = socketArgument (arguments);
+	const char *data;
+	std::string datagram;
+
+	if (socket < 0 || !isRegistered()) {
+		return false;
+	}
+	arguments = strchr (arguments, ',');
+	if (arguments == NULL || sscanf (arguments, ",%15[0-9.],%d,%d,%n", ip, &port, &length,
+		&consumed) != 3 || consumed == 0) {
+		return false;
+	}
+	data = arguments + consumed;
+	if (!unhex (data, datagram) || (int)datagram.size() != length || length == 0 ||
+		length > NSOST_DATA_MAX) {
+		return false;
+	}
+
+	strcpy (sockets[socket].ip, ip);
+	sockets[socket].port = port;
+	counters.uplink++;
+	counters.uplinkBytes += length;
+	travel (EVENT_UPLINK, socket, datagram);
+
+	answer (std::to_string (socket) + "," + std::to_string (length));
+
+	return true;
+
+}
+
+
+// "AT+NSORF=socket,length": "socket,ip,port,length,hex,remaining" of first datagram
+static bool readDatagram (const char *arguments) {
+
+	int socket = socketArgument (arguments);
+	const char *comma = strchr (arguments, ',');
+	long wanted = (comma != NULL) ? atol (comma + 1) : 0;
+	std::string part;
+	size_t remaining;
+
+	if (socket < 0 || wanted <= 0) {
+		return false;
+	}
+
+	Socket &s = sockets[socket];
+	if (s.received.empty()) {
+		return true;					// Only OK
+	}
+
+	part = s.received.front().substr (s.offset, std::min ((size_t)wanted,
+		(size_t)NSORF_DATA_MAX));
+	s.offset += part.size();
+	remaining = s.received.front().size() - s.offset;
+	if (remaining == 0) {
+		s.received.pop_front ();
+		s.offset = 0;
+	}
+	counters.reads++;
+
+	answer (std::to_string (socket) + "," + s.ip + "," + std::to_string (s.port) + "," +
+		std::to_string (part.size()) + "," + hex (part) + "," + std::to_string (remaining));
+
+	return true;
+
+}
+
+
+// "AT+COPS=mode[,format,operator]". It answers when registration finishes
+static bool selectOperator (const char *arguments) {
+
+	char name [16] = "";
+
+	copsMode = atoi (arguments);
+	if (copsMode == 1 && sscanf (arguments, "1,2,\"%15[0-9]\"", name) != 1) {
+		return false;
+	}
+	if (copsMode == 2) {
+		deregister ();
+		return true;
+	}
+	if (copsMode != 0 && copsMode != 1) {
+		return false;
+	}
+	if (copsMode == 1) {
+		copsOperator = name;
+	}
+	if (cfun == 0) {
+		return true;					// Registration starts with CFUN=1
+	}
+
+	if (isRegistered() && copsOperator == OPERATOR) {
+		return true;					// Already in that network: OK at once
+	}
+	if (stat != STAT_SEARCHING) {
+		startRegistration ();
+	}
+	copsWaiting = true;
+
+	return true;
+
+}
+
+
+// Handles a command from station. Returns false if its answer is ERROR
+static bool command (const std::string &text) {
+
+	const char *c = text.c_str();
+
+	if (text == "AT") {
+		return true;
+	} else if (text == "AT+NRB") {
+		answer ("REBOOTING");
+		reboot ();
+		return true;					// OK after booting
+	} else if (strncmp (c, "AT+CFUN=", 8) == 0) {
+		int value = atoi (c + 8);
+		if (value != 0 && value != 1) {
+			return false;
+		}
+		if (value == 1 && cfun == 0 && copsMode != 2) {
+			startRegistration ();
+		} else if (value == 0) {
+			deregister ();
+		}
+		cfun = value;
+	} else if (text == "AT+CFUN?") {
+		answer ("+CFUN:" + std::to_string (cfun));
+	} else if (strncmp (c, "AT+CEREG=", 9) == 0) {
+		ceregMode = atoi (c + 9);
+		return ceregMode >= 0 && ceregMode <= 2;
+	} else if (text == "AT+CEREG?") {
+		answer ("+CEREG:" + std::to_string (ceregMode) + "," + std::to_string (stat) +
+			((ceregMode == 2 && isRegistered()) ? "," CELL_INFO : ""));
+	} else if (strncmp (c, "AT+CSCON=", 9) == 0) {
+		csconMode = atoi (c + 9);
+	} else if (text == "AT+CSCON?") {
+		answer ("+CSCON:" + std::to_string (csconMode) + "," + (isRegistered() ? "1" : "0"));
+	} else if (strncmp (c, "AT+CGDCONT=", 11) == 0) {
+		pdpContext = text.substr (11);
+	} else if (text == "AT+CGDCONT?") {
+		if (!pdpContext.empty()) {
+			answer ("+CGDCONT:" + pdpContext + ",\"" + (isRegistered() ? MODULE_IP : "") +
+				"\",0,0");
+		}
+	} else if (strncmp (c, "AT+COPS=", 8) == 0) {
+		if (!selectOperator (c + 8)) {
+			return false;
+		}
+		if (copsWaiting) {
+			return true;				// OK when registration finishes
+		}
+	} else if (text == "AT+COPS?") {
+		answer ("+COPS:" + std::to_string (copsMode) + (isRegistered() ? ",2,\"" OPERATOR "\"" :
+			""));
+	} else if (text == "AT+CGATT?") {
+		answer (std::string ("+CGATT:") + (isRegistered() ? "1" : "0"));
+	} else if (text == "AT+CSQ") {
+		answer (cfun == 1 ? "+CSQ:20,99" : "+CSQ:99,99");
+	} else if (text == "AT+CGPADDR") {
+		answer (isRegistered() ? "+CGPADDR:0," MODULE_IP : "+CGPADDR:0");
+	} else if (text == "AT+CGSN=1") {
+		answer ("+CGSN:" MODULE_IMEI);
+	} else if (strncmp (c, "AT+NCONFIG=\"AUTOCONNECT\",", 25) == 0) {
+		autoconnect = strcmp (c + 25, "\"TRUE\"") == 0;
+	} else if (text == "AT+NCONFIG?") {
+		answer (std::string ("+NCONFIG:\"AUTOCONNECT\",\"") + (autoconnect ? "TRUE" : "FALSE") +
+			"\"");
+		answer ("+NCONFIG:\"CR_0354_0338_SCRAMBLING\",\"TRUE\"");
+		answer ("+NCONFIG:\"CR_0859_SI_AVOID\",\"TRUE\"");
+	} else if (strncmp (c, "AT+NSOCR=", 9) == 0) {
+		return openSocket (c + 9);
+	} else if (strncmp (c, "AT+NSOCL=", 9) == 0) {
+		int socket = socketArgument (c + 9);
+		if (socket < 0) {
+			return false;
+		}
+		close (sockets[socket].fd);
+		sockets[socket].open = false;
+	} else if (strncmp (c, "AT+NSOST=", 9) == 0) {
+		return sendDatagram (c + 9);
+	} else if (strncmp (c, "AT+NSORF=", 9) == 0) {
+		return readDatagram (c + 9);
+	} else {
+		counters.unknown++;
+		return false;
+	}
+
+	return true;
+
+}
+
+
+// Handles the commands whose turn has come, one by one
+static void handleLines () {
+
+	while (!booting && !copsWaiting && !lines.empty() && lines.front().first <= now() &&
+		moduleBusy <= now()) {
+
+		std::string text = lines.front().second;
+		lines.pop_front ();
+		counters.commands++;
+		moduleBusy = now() + answerDelay * 1000;
+
+		if (verbose) {
+			printf ("%10.3f > %s\n", now() / 1e6, text.size() > 120 ?
+				(text.substr (0, 120) + "...").c_str() : text.c_str());
+		}
+
+		if (!command (text)) {
+			answer ("ERROR");
+		} else if (!booting && !copsWaiting) {
+			answer ("OK");
+		}
+	}
+
+}
+
+
+// Bytes written by station in pseudo-terminal
+static void readStation () {
+
+	char buffer [256];
+	ssize_t n;
+
+	while ((n = read (master, buffer, sizeof(buffer))) > 0) {
+		for (ssize_t i = 0; i < n; i++) {
+			inputBusy = std::max (inputBusy, now()) + uartTime (1);
+			if (booting) {
+				counters.ignored++;
+			} else if (buffer[i] == '\r') {
+				lines.push_back (std::make_pair (inputBusy, line));
+				line.clear ();
+			} else if (buffer[i] != '\n' && line.size() < LINE_MAX) {
+				line += buffer[i];
+			}
+		}
+	}
+
+}
+
+
+// Datagrams answered by server to a socket
+static void readServer (uint8_t socket) {
+
+	char buffer [NSORF_DATA_MAX];
+	ssize_t n;
+
+	while ((n = recv (sockets[socket].fd, buffer, sizeof(buffer), 0)) > 0) {
+		counters.downlink++;
+		travel (EVENT_DOWNLINK, socket, std::string (buffer, n));
+	}
+
+}
+
+
+static void writeStation (const std::string &bytes) {
+
+	ssize_t n = write (master, bytes.data(), bytes.size());
+
+	if (n < (ssize_t)bytes.size()) {
+		counters.overrun += bytes.size() - (n > 0 ? n : 0);
+	}
+	if (verbose) {
+		std::string text = bytes.substr (2, bytes.size() - 4);
+		printf ("%10.3f < %s\n", now() / 1e6, text.size() > 120 ?
+			(text.substr (0, 120) + "...").c_str() : text.c_str());
+	}
+
+}
+
+
+static void handleEvent (const Event &event) {
+
+	Socket &socket = sockets[event.socket];
+
+	switch (event.type) {
+		case EVENT_OUTPUT:
+			writeStation (event.data);
+			break;
+
+		case EVENT_UPLINK:
+			if (!socket.open) {
+				break;					// Answer would have nowhere to go
+			}
+			sendto (socket.fd, event.data.data(), event.data.size(), 0,
+				(struct sockaddr *)&server, sizeof(server));
+			break;
+
+		case EVENT_DOWNLINK:
+			if (event.token != bootToken || !socket.open) {
+				break;					// Module rebooted meanwhile
+			}
+			if (socket.received.size() == MODULE_DATAGRAMS) {
+				counters.full++;
+				break;
+			}
+			socket.received.push_back (event.data);
+			urc ("+NSONMI:" + std::to_string (event.socket) + "," +
+				std::to_string (event.data.size()));
+			break;
+
+		case EVENT_REGISTERED:
+			if (event.token != registrationToken) {
+				break;
+			}
+			if (copsMode == 1 && copsOperator != OPERATOR) {
+				stat = STAT_DENIED;
+			} else {
+				stat = STAT_HOME;
+				counters.registrations++;
+			}
+			ceregUrc ();
+			if (copsWaiting) {
+				copsWaiting = false;
+				moduleBusy = now() + answerDelay * 1000;
+				answer (isRegistered() ? "OK" : "ERROR");
+			}
+			if (isRegistered() && outagePeriod > 0) {
+				schedule (now() + outagePeriod * 1000, EVENT_OUTAGE, 0, registrationToken, "");
+			}
+			break;
+
+		case EVENT_BOOTED:
+			if (event.token != bootToken) {
+				break;
+			}
+			booting = false;
+			moduleBusy = now() + answerDelay * 1000;
+			answer ("Neul ");
+			answer ("OK");
+			if (autoconnect) {
+				cfun = 1;
+				if (copsMode != 2) {
+					startRegistration ();
+				}
+			}
+			break;
+
+		case EVENT_OUTAGE:
+			if (event.token != registrationToken) {
+				break;
+			}
+			counters.outages++;
+			startRegistration ();		// +CEREG:2 & back after registration delay
+			break;
+	}
+
+}
+
+
+// Opens the pseudo-terminal in raw mode & links it from linkPath
+static bool openTerminal () {
+
+	struct termios raw;
+	const char *name;
+
+	master = posix_openpt (O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt (master) != 0 || unlockpt (master) != 0 ||
+		(name = ptsname (master)) == NULL) {
+		return false;
+	}
+
+	slave = open (name, O_RDWR | O_NOCTTY);
+	if (slave < 0 || tcgetattr (slave, &raw) != 0) {
+		return false;
+	}
+	cfmakeraw (&raw);
+	if (tcsetattr (slave, TCSANOW, &raw) != 0) {
+		return false;
+	}
+	fcntl (master, F_SETFL, fcntl (master, F_GETFL) | O_NONBLOCK);
+
+	unlink (linkPath);
+	if (symlink (name, linkPath) != 0) {
+		return false;
+	}
+
+	printf ("ublox N211 in %s -> %s, datagrams to %s:%u\n", linkPath, name,
+		inet_ntoa (server.sin_addr), ntohs (server.sin_port));
+
+	return true;
+
+}
+
+
+static bool parseAddress (const char *text, struct sockaddr_in &address) {
+
+	char ip [16];
+	unsigned port;
+
+	memset (&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	if (sscanf (text, "%15[0-9.]:%u", ip, &port) != 2 || port == 0 || port > 65535 ||
+		inet_pton (AF_INET, ip, &address.sin_addr) != 1) {
+		return false;
+	}
+	address.sin_port = htons (port);
+
+	return true;
+
+}
+
+
+static void stopEmulator (int) {
+	running = false;
+}
+
+
+static void printStats () {
+
+	printf ("\n%lu commands (%lu unknown), %lu boots, %lu registrations, %lu outages\n",
+		counters.commands, counters.unknown, counters.boots, counters.registrations,
+		counters.outages);
+	printf ("uplink %lu datagrams (%lu bytes), downlink %lu datagrams (%lu read), lost %lu, "
+		"socket full %lu\n", counters.uplink, counters.uplinkBytes, counters.downlink,
+		counters.reads, counters.lost, counters.full);
+	printf ("bytes ignored while booting %lu, not taken by station %lu\n", counters.ignored,
+		counters.overrun);
+
+}
+
+
+int main (int argc, char *argv[]) {
+
+	struct sigaction action;
+	struct pollfd fds [1 + MODULE_SOCKETS];
+	uint8_t owners [1 + MODULE_SOCKETS];	// Socket of each poll entry
+	int opt;
+
+	parseAddress ("127.0.0.1:16666", server);
+	while ((opt = getopt (argc, argv, "l:u:b:r:B:g:L:J:x:o:S:v")) != -1) {
+		switch (opt) {
+			case 'l': linkPath = optarg; break;
+			case 'u':
+				if (!parseAddress (optarg, server)) {
+					fprintf (stderr, "Bad address %s (ip:port)\n", optarg);
+					return 2;
+				}
+				break;
+			case 'b': baud = strtoul (optarg, NULL, 10); break;
+			case 'r': answerDelay = atol (optarg); break;
+			case 'B': bootDelay = atol (optarg); break;
+			case 'g': registrationDelay = atol (optarg); break;
+			case 'L': latency = atol (optarg); break;
+			case 'J': jitter = atol (optarg); break;
+			case 'x': lossPercent = strtoul (optarg, NULL, 10); break;
+			case 'o': outagePeriod = atol (optarg); break;
+			case 'S': seed = strtoul (optarg, NULL, 10); break;
+			case 'v': verbose = true; break;
+			default:
+				fprintf (stderr, "Usage: %s [-l link] [-u ip:port] [-b baud] [-r answerMs] "
+					"[-B bootMs]\n\t[-g registrationMs] [-L latencyMs] [-J jitterMs] "
+					"[-x loss%%] [-o outagePeriodMs] [-S seed] [-v]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (answerDelay < 0 || bootDelay < 0 || registrationDelay < 0 || latency < 0 ||
+		jitter < 0 || lossPercent > 100 || outagePeriod < 0) {
+		fprintf (stderr, "Times can't be negative & loss is a percent\n");
+		return 2;
+	}
+
+	start = Clock::now();
+	if (!openTerminal ()) {
+		perror ("Can't open pseudo-terminal");
+		return 1;
+	}
+	fflush (stdout);
+
+	// Without SA_RESTART, so poll returns at once
+	memset (&action, 0, sizeof(action));
+	action.sa_handler = stopEmulator;
+	sigaction (SIGINT, &action, NULL);
+	sigaction (SIGTERM, &action, NULL);
+
+	reboot ();							// Power on
+
+	while (running) {
+		int64_t wait = 1000000;
+		nfds_t n = 0;
+
+		while (!events.empty() && events.begin()->first <= now()) {
+			Event event = events.begin()->second;
+			events.erase (events.begin());
+			handleEvent (event);
+		}
+		handleLines ();
+
+		// Sleeps until next event, next command or a byte arrives
+		if (!events.empty()) {
+			wait = std::min (wait, events.begin()->first - now());
+		}
+		if (!lines.empty() && !booting && !copsWaiting) {
+			wait = std::min (wait, std::max (lines.front().first, moduleBusy) - now());
+		}
+
+		fds[n].fd = master;
+		fds[n].events = POLLIN;
+		owners[n++] = 0;
+		for (uint8_t i = 0; i < MODULE_SOCKETS; i++) {
+			if (sockets[i].open) {
+				fds[n].fd = sockets[i].fd;
+				fds[n].events = POLLIN;
+				owners[n++] = i;
+			}
+		}
+
+		struct timespec timeout = { 0, 0 };
+		if (wait > 0) {
+			timeout.tv_sec = wait / 1000000;
+			timeout.tv_nsec = wait % 1000000 * 1000;
+		}
+		if (ppoll (fds, n, &timeout, NULL) < 0) {
+			continue;					// Signal
+		}
+
+		if (fds[0].revents & POLLIN) {
+			readStation ();
+		}
+		for (nfds_t i = 1; i < n; i++) {
+			if (fds[i].revents & POLLIN) {
+				readServer (owners[i]);
+			}
+		}
+
+		fflush (stdout);
+	}
+
+	printStats ();
+	unlink (linkPath);
+	close (slave);
+	close (master);
+
+	return 0;
+
+}
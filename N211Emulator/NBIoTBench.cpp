@@ -0,0 +1,312 @@
+/*********************************************************************************************/
+/*
+ * NBIoTBench
+ *
+ *  SodaqNBIoT built on PC (with the Arduino of NBIoTSoak) and talking through the pseudo-
+ *	terminal of N211Emulator, for measuring the uplink like STATION_NBIOT uses it: start()
+ *	in background and punches queued from the beginning & flushed from loop(). Times are
+ *	real, so runs with the same emulator options are repeatable.
+ *
+ *	It prints the ms from start() to NB_STATE_READY and to the first punch acknowledged by
+ *	the server (cold start), and for all the punches the throughput and the latency from
+ *	queuePunch to the acknowledgement (mean, percentiles & max), the batches and the UART
+ *	bytes per punch. With -r punches are queued at that rate; with -r 0 the outbox is kept
+ *	with QUEUE_TARGET punches, which measures the max throughput (latency then includes
+ *	the wait in the outbox). -f uses fast start (setFastStart): run the bench twice against
+ *	the same emulator to measure a station that reboots while the module stays on. -c sends
+ *	compact batches (setCompactBatches) and -k makes the punches of k cards in turn, so
+ *	UIDs repeat (0: every punch has a new card).
+ *
+ *	Acknowledgements come from the UDP server the emulator sends to, i.e. IngestPunches
+ *	with a key for station -s (keys.bin of LoadPunches -w). MACs are fake, so a scratch
+ *	store must be used: it saves them as not valid after PENDING_TIMEOUT.
+ *
+ *		./N211Emulator -b 9600 -L 300 -J 400 &
+ *		../PunchServer/IngestPunches keys.bin /tmp/bench.store &
+ *		./NBIoTBench [-t /tmp/ttyN211] [-n 1000] [-r 2] [-b 8] [-w 5000] [-s 0] [-f] [-c]
+ *			[-k 0] [-v]
+ *
+ *	-b & -w are the punches & max delay of setBatch. -v prints the debug port (commands
+ *	& responses). Returns 1 if set up didn't finish in SETUP_LIMIT ms or not every punch was
+ *	acknowledged in ACK_LIMIT ms after the last one was queued.
+ *
+ *	Build: g++ -O2 -std=c++11 -I../NBIoTSoak -I../libraries/SodaqNBIoT -I../libraries/PunchOutbox
+ *		NBIoTBench.cpp ../libraries/SodaqNBIoT/SodaqNBIoT.cpp ../libraries/SodaqNBIoT/AtEngine.cpp
+ *		../libraries/PunchOutbox/PunchOutbox.cpp -o NBIoTBench
+*/
+/*********************************************************************************************/
+
+
+#include "Arduino.h"
+#include <SodaqNBIoT.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+
+#define LOCAL_PORT			10000		// Socket opened by start()
+#define SERVER_IP			"79.115.226.197"	// Written in AT+NSOST, ignored by emulator
+#define SERVER_PORT			16666
+#define QUEUE_TARGET		64			// Punches kept in outbox with -r 0
+#define SETUP_LIMIT			600000		// Max ms from start() to READY
+#define ACK_LIMIT			120000		// Max ms waiting acknowledgements after last punch
+#define WRITE_BUFFER		64			// Bytes written to terminal at once
+#define LOOP_SLEEP			200			// Us slept by each loop, so it doesn't take a core
+
+
+HardwareSerial Serial, Serial3;
+
+
+static int tty = -1;
+static char pending [WRITE_BUFFER];		// Bytes written by library, not sent to terminal
+static uint8_t pendingLength = 0;
+static bool verbose = false;
+static std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+
+unsigned long millis () {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+
+static void flushTerminal () {
+
+	ssize_t n;
+
+	for (uint8_t written = 0; written < pendingLength; written += n) {
+		n = write (tty, &pending[written], pendingLength - written);
+		if (n <= 0) {
+			break;						// Emulator is gone: library will time out
+		}
+	}
+	pendingLength = 0;
+
+}
+
+
+// Bytes written by library in Serial3. A whole command is written at once
+static void terminalWrite (uint8_t c) {
+
+	pending[pendingLength++] = c;
+	if (c == '\r' || pendingLength == WRITE_BUFFER) {
+		flushTerminal ();
+	}
+
+}
+
+
+// Fills Serial3 ring with the bytes the emulator has written, without losing any
+static void terminalRead () {
+
+	char buffer [SERIAL_RX_BUFFER_SIZE + 1];
+	ssize_t n;
+
+	flushTerminal ();
+	if (Serial3.count == SERIAL_RX_BUFFER_SIZE) {
+		return;
+	}
+
+	n = read (tty, buffer, SERIAL_RX_BUFFER_SIZE - Serial3.count);
+	if (n > 0) {
+		buffer[n] = '\0';
+		Serial3.receive (buffer);
+	}
+
+}
+
+
+static void debugWrite (uint8_t c) {
+	if (verbose) {
+		putchar (c);
+	}
+}
+
+
+static bool openTerminal (const char *path) {
+
+	struct termios raw;
+
+	tty = open (path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (tty < 0 || tcgetattr (tty, &raw) != 0) {
+		return false;
+	}
+	cfmakeraw (&raw);
+	if (tcsetattr (tty, TCSANOW, &raw) != 0) {
+		return false;
+	}
+	tcflush (tty, TCIOFLUSH);			// Lines written while nobody was reading
+
+	return true;
+
+}
+
+
+/* Fake punch of station ids: MAC isn't valid. Time starts at the real one, so punches of
+	each run are new for the server & it acknowledges them. With cards, UIDs repeat */
+static bool queuePunch (SodaqNBIoT &nbiot, unsigned long index, uint8_t ids,
+	unsigned long cards) {
+
+	static const uint32_t firstTime = (uint32_t)::time (NULL);
+	uint8_t data [1 + 4 + PUNCH_MAC_SIZE];
+	uint8_t uid [PUNCH_UID_MIN];
+	uint32_t value = 0x20000000UL + (cards ? index % cards : index);
+	uint32_t time = firstTime + index;
+
+	data[0] = ids;
+	memcpy (&data[1], &time, sizeof(time));
+	for (uint8_t i = 0; i < PUNCH_MAC_SIZE; i++) {
+		data[5 + i] = index * 31 + i;
+	}
+	for (uint8_t i = 0; i < PUNCH_UID_MIN; i++) {
+		uid[i] = value >> (8 * (PUNCH_UID_MIN - 1 - i));
+	}
+
+	return nbiot.queuePunch (data, uid, PUNCH_UID_MIN);
+
+}
+
+
+static unsigned long percentile (const std::vector<unsigned long> &sorted, double p) {
+	return sorted.empty() ? 0 : sorted[std::min (sorted.size() - 1,
+		(size_t)(p * sorted.size()))];
+}
+
+
+int main (int argc, char *argv[]) {
+
+	static SodaqNBIoT nbiot;			// Static like in a sketch
+	const char *path = "/tmp/ttyN211";
+	unsigned long total = 1000;			// Punches
+	double rate = 2;					// Punches per second, 0 for max throughput
+	unsigned long batchPunches = UPLINK_BATCH_PUNCHES;
+	unsigned long batchDelay = UPLINK_BATCH_DELAY;
+	unsigned long station = 0;
+	bool fast = false;
+	bool compact = false;
+	unsigned long cards = 0;
+	unsigned long setUpTime = 0;		// millis() when module got ready
+	unsigned long firstAck = 0;			// millis() when first punch was acknowledged
+	unsigned long firstTime = 0;		// millis() when first punch was queued
+	unsigned long lastTime = 0;			// millis() when last punch was queued
+	unsigned long made = 0;
+	unsigned long acked = 0;
+	unsigned long restarts = 0;
+	std::vector<unsigned long> queuedAt;
+	std::vector<unsigned long> latencies;
+	double mean = 0;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "t:n:r:b:w:s:fck:v")) != -1) {
+		switch (opt) {
+			case 't': path = optarg; break;
+			case 'n': total = strtoul (optarg, NULL, 10); break;
+			case 'r': rate = atof (optarg); break;
+			case 'b': batchPunches = strtoul (optarg, NULL, 10); break;
+			case 'w': batchDelay = strtoul (optarg, NULL, 10); break;
+			case 's': station = strtoul (optarg, NULL, 10); break;
+			case 'f': fast = true; break;
+			case 'c': compact = true; break;
+			case 'k': cards = strtoul (optarg, NULL, 10); break;
+			case 'v': verbose = true; break;
+			default:
+				fprintf (stderr, "Usage: %s [-t tty] [-n punches] [-r punches/s] [-b batch] "
+					"[-w batchDelayMs] [-s station] [-f] [-c] [-k cards] [-v]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (total == 0 || rate < 0 || batchPunches == 0 || station > 255) {
+		fprintf (stderr, "Punches & batch must be > 0, rate >= 0 and station < 256\n");
+		return 2;
+	}
+
+	if (!openTerminal (path)) {
+		perror (path);
+		return 1;
+	}
+	Serial3.onWrite = terminalWrite;
+	Serial3.onRead = terminalRead;
+	Serial.onWrite = debugWrite;
+
+	// Power on: the station punches while the module is set up, until every punch is acked
+	nbiot.setBatch (batchPunches, batchDelay);
+	nbiot.setFastStart (fast);
+	nbiot.setCompactBatches (compact);
+	nbiot.start (LOCAL_PORT);
+	queuedAt.reserve (total);
+	latencies.reserve (total);
+	while (acked < total && (made < total || millis() - lastTime < ACK_LIMIT) &&
+		(setUpTime != 0 || millis() < SETUP_LIMIT)) {
+
+		if (made < total && (rate == 0 ? nbiot.queueDepth() < QUEUE_TARGET :
+			made < millis() * rate / 1000)) {
+			if (queuePunch (nbiot, made, station, cards)) {
+				queuedAt.push_back (millis());
+				lastTime = millis();
+				if (made == 0) {
+					firstTime = lastTime;
+				}
+				made++;
+			}
+		}
+
+		nbiot.process ();
+		nbiot.flushQueue (nbiot.getSocket(), SERVER_IP, SERVER_PORT);
+		if (setUpTime == 0 && nbiot.getState() == NB_STATE_READY) {
+			setUpTime = millis();
+		}
+		if (nbiot.getState() == NB_STATE_FAILED) {
+			restarts++;
+			nbiot.start (LOCAL_PORT);
+		}
+
+		// Outbox is FIFO: the oldest punches are the ones acknowledged
+		for (; acked < nbiot.uplinkStats().acked && acked < made; acked++) {
+			latencies.push_back (millis() - queuedAt[acked]);
+			mean += latencies.back();
+			if (firstAck == 0) {
+				firstAck = millis();
+			}
+		}
+
+		usleep (LOOP_SLEEP);
+	}
+
+	if (setUpTime == 0) {
+		fprintf (stderr, "Set up didn't finish in %d ms (state %u)\n", SETUP_LIMIT,
+			nbiot.getState());
+		return 1;
+	}
+
+	const UplinkStats &stats = nbiot.uplinkStats();
+	double seconds = (millis() - firstTime) / 1000.0;
+	std::sort (latencies.begin(), latencies.end());
+	mean = latencies.empty() ? 0 : mean / latencies.size();
+
+	printf ("%s start: %lu ms to ready, %lu ms to first punch acknowledged (IMEI %s, "
+		"socket %d)\n", fast ? "Fast" : "Full", setUpTime, firstAck, nbiot.getIMEI(),
+		nbiot.getSocket());
+	printf ("Punches: %lu queued, %lu acknowledged in %.1f s: %.2f punches/s\n", made, acked,
+		seconds, acked / seconds);
+	printf ("Latency to ack: mean %.0f ms, p50 %lu, p90 %lu, p99 %lu, max %lu ms\n", mean,
+		percentile (latencies, 0.5), percentile (latencies, 0.9),
+		percentile (latencies, 0.99), latencies.empty() ? 0 : latencies.back());
+	printf ("Batches: %lu (mean %.1f punches, max %u), sent %lu punches, errors %lu, "
+		"ack time outs %lu, restarts %lu\n", stats.batches, stats.batches ?
+		(double)stats.sent / stats.batches : 0.0, stats.maxBatch, stats.sent, stats.errors,
+		stats.timeouts, restarts);
+	printf ("Air: %.1f bytes per punch sent (%s batches); UART: %.1f bytes written per punch, "
+		"%lu bytes lost by full ring\n", (double)stats.bytes / (stats.sent ? stats.sent : 1),
+		compact ? "compact" : "normal", (double)Serial3.written / (made ? made : 1),
+		Serial3.overflows);
+
+	close (tty);
+
+	return (acked == total) ? 0 : 1;
+
+}
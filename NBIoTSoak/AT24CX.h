@@ -0,0 +1,46 @@
+/*********************************************************************************************/
+/*
+ * AT24CX.h for PC
+ *
+ *  AT24C32 kept in RAM, for building SodaqNBIoT on PC in NBIoTSoak. Memory is shared by
+ *	every object & starts erased, so it keeps its data when a station reboots.
+*/
+/*********************************************************************************************/
+
+
+#ifndef __AT24CX_H__
+#define __AT24CX_H__
+
+
+#include "Arduino.h"
+
+
+#define AT24C32_SIZE		4096		// Bytes of AT24C32
+
+
+class AT24CX {
+public:
+	void write (unsigned int address, byte *data, int n) {
+		memcpy (&memory()[address % AT24C32_SIZE], data, n);
+	}
+	void read (unsigned int address, byte *data, int n) {
+		memcpy (data, &memory()[address % AT24C32_SIZE], n);
+	}
+
+	// The chip. Erased (0xFF) when it's first used
+	static byte *memory () {
+		static byte chip [AT24C32_SIZE];
+		static bool erased = false;
+		if (!erased) {
+			memset (chip, 0xFF, sizeof(chip));
+			erased = true;
+		}
+		return chip;
+	}
+};
+
+
+inline AT24CX AT24C32 (byte) { return AT24CX (); }
+
+
+#endif
@@ -0,0 +1,129 @@
+/*********************************************************************************************/
+/*
+ * Arduino.h for PC
+ *
+ *  The part of Arduino core used by SodaqNBIoT, for building it on PC in NBIoTSoak and
+ *	NBIoTBench. Serial ports keep received bytes in a ring of SERIAL_RX_BUFFER_SIZE like AVR
+ *	HardwareSerial does and hand written bytes to a function; another one may fill the ring
+ *	before it's read. Nothing allocates memory and there is no String, so code that needs it
+ *	doesn't build.
+*/
+/*********************************************************************************************/
+
+
+#ifndef __ARDUINO_H__
+#define __ARDUINO_H__
+
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define HIGH				1
+#define LOW					0
+#define OUTPUT				1
+#define SERIAL_RX_BUFFER_SIZE	64		// Like AVR HardwareSerial
+
+typedef uint8_t byte;
+
+
+unsigned long millis ();				// Defined by program
+inline void delay (unsigned long ms) { unsigned long start = millis(); while (millis() - start < ms); }
+inline void pinMode (uint8_t, uint8_t) { }
+inline void digitalWrite (uint8_t, uint8_t) { }
+
+
+class Print {
+public:
+	virtual size_t write (uint8_t c) = 0;
+	virtual ~Print () { }
+
+	size_t print (const char *text) {
+		size_t n = 0;
+		while (text[n] != '\0') {
+			write (text[n++]);
+		}
+		return n;
+	}
+	size_t print (char c) { return write (c); }
+	size_t print (long number) {
+		char digits [24];
+		snprintf (digits, sizeof(digits), "%ld", number);
+		return print (digits);
+	}
+	size_t print (int number) { return print ((long)number); }
+	size_t print (unsigned int number) { return print ((long)number); }
+	size_t print (unsigned long number) { return print ((long)number); }
+	size_t print (unsigned char number) { return print ((long)number); }
+	size_t println () { return print ("\r\n"); }
+	template <class T> size_t println (T value) { return print (value) + println (); }
+};
+
+
+class Stream : public Print {
+public:
+	virtual int available () = 0;
+	virtual int read () = 0;
+};
+
+
+class HardwareSerial : public Stream {
+public:
+	HardwareSerial () : head (0), count (0), overflows (0), written (0), onWrite (NULL),
+		onRead (NULL) { }
+	void begin (unsigned long) { }
+	operator bool () { return true; }
+
+	int available () {
+		if (onRead != NULL) {
+			onRead ();
+		}
+		return count;
+	}
+	int read () {
+		if (count == 0) {
+			return -1;
+		}
+		uint8_t c = rx[head];
+		head = (head + 1) % SERIAL_RX_BUFFER_SIZE;
+		count--;
+		return c;
+	}
+	size_t write (uint8_t c) {
+		written++;
+		if (onWrite != NULL) {
+			onWrite (c);
+		}
+		return 1;
+	}
+
+	// Bytes arriving from the other side. Lost if ring is full, like in the UART ISR
+	void receive (const char *text) {
+		while (*text != '\0') {
+			if (count == SERIAL_RX_BUFFER_SIZE) {
+				overflows++;
+			} else {
+				rx[(head + count) % SERIAL_RX_BUFFER_SIZE] = *text;
+				count++;
+			}
+			text++;
+		}
+	}
+
+	uint8_t rx [SERIAL_RX_BUFFER_SIZE];
+	uint16_t head;
+	uint16_t count;
+	unsigned long overflows;			// Bytes lost
+	unsigned long written;
+	void (*onWrite) (uint8_t c);		// Receives bytes written by sketch
+	void (*onRead) ();					// Calls receive() with bytes arrived, if any
+};
+
+
+extern HardwareSerial Serial, Serial3;
+
+
+#endif
@@ -0,0 +1,786 @@
+/*********************************************************************************************/
+/*
+ * NBIoTSoak
+ *
+ *  Long run of SodaqNBIoT on PC against a mock ublox N211 in Serial3 and a stand-in of the
+ *	UDP server, for checking that the library doesn't use the heap during an event and that
+ *	every punch arrives through a bad network. The mock answers AT commands like the module
+ *	does and, from time to time, answers AT+NSOST with ERROR, doesn't answer at all or
+ *	leaves the network (+CEREG:2) until it's asked with AT+CEREG?.
+ *
+ *	Datagrams accepted by the mock travel through a network that delays each one a random
+ *	time (so they arrive out of order) and loses some. The server stand-in checks CRC, that
+ *	each punch is the one queued with its sequence number and answers a cumulative
+ *	acknowledgement, which travels back through the same network, is announced with +NSONMI
+ *	and read by library with AT+NSORF. Datagrams that aren't acknowledgements arrive too.
+ *
+ *	The station queues punches & flushes batches like STATION_NBIOT does, and also sends
+ *	single punches & raw data with the blocking calls. From time to time it reboots: the
+ *	SodaqNBIoT object is built again and must find its outbox in the AT24C32. Heap in use
+ *	(mallinfo2) and the calls to malloc, calloc & realloc are printed every tenth of the
+ *	run; both must stay the same after warm-up. millis() is virtual & advances 1 ms every
+ *	MILLIS_CALLS calls.
+ *
+ *	Usage: NBIoTSoak [-n 1000000] [-e 997] [-s 4999] [-d 50021] [-l 7] [-r 1000003] [-c]
+ *
+ *	-n is the number of datagrams accepted by the mock. -e, -s & -d are the periods (in
+ *	AT+NSOST commands) of ERROR, silence & network loss, -l the period of datagrams lost by
+ *	network (both ways) and -r the period of reboots (in loops). At the end the outbox is
+ *	emptied without failures. Returns 1 if memory was allocated after warm-up, any datagram
+ *	or punch was wrong or a punch wasn't received.
+ *
+ *	-c sends compact batches, decoded with parseBatch of PunchServer and the UIDs received
+ *	by the stand-in like the server keeps them. Then punches repeat UIDs of CARDS cards and
+ *	the station ID changes every STATION_LOOPS loops.
+ *
+ *	Build: g++ -O2 -std=c++11 -I. -I../libraries/SodaqNBIoT -I../libraries/PunchOutbox
+ *		-I../PunchServer NBIoTSoak.cpp ../libraries/SodaqNBIoT/SodaqNBIoT.cpp
+ *		../libraries/SodaqNBIoT/AtEngine.cpp ../libraries/PunchOutbox/PunchOutbox.cpp
+ *		../PunchServer/Datagram.cpp -o NBIoTSoak
+*/
+/*********************************************************************************************/
+
+
+#include "Arduino.h"
+#include <SodaqNBIoT.h>
+#include "Datagram.h"					// Compact batches are decoded like in server
+
+#include <malloc.h>
+#include <new>
+#include <unistd.h>
+
+
+#define MILLIS_CALLS		1			// Calls of millis() per virtual ms
+#define WARMUP_SENDS		1000		// Datagrams before measuring heap
+#define LOCAL_PORT			10000		// Socket opened by start()
+#define SERVER_IP			"79.115.226.197"
+#define SERVER_PORT			16666
+#define QUEUE_TARGET		24			// Punches kept waiting (RAM caches 16)
+#define SINGLE_EVERY		97			// Punches queued between blocking sendPunch
+#define DATA_EVERY			389			// Punches queued between blocking sendData
+#define NOISE_EVERY			1009		// AT+NSOST between downlink datagrams that aren't ACKs
+#define LINE_MAX			(AT_COMMAND_MAX + 2 * NSOST_DATA_MAX)	// Longest command
+#define NET_LATENCY			300			// Min ms a datagram takes through network
+#define NET_JITTER			400			// Max ms added to latency
+#define NET_UPLINK			32			// Datagrams travelling to server at once
+#define NET_DOWNLINK		16			// Datagrams travelling to station at once
+#define MODULE_DOWNLINK		4			// Datagrams kept by module until AT+NSORF
+#define CARDS				6			// UIDs of punches with -c, fewer than UPLINK_DICTIONARY
+#define STATION_LOOPS		5003		// Loops between station ID changes with -c
+
+
+HardwareSerial Serial, Serial3;
+
+
+// Allocations of the whole program. glibc's own functions do the work
+extern "C" void *__libc_malloc (size_t size);
+extern "C" void *__libc_calloc (size_t count, size_t size);
+extern "C" void *__libc_realloc (void *pointer, size_t size);
+static unsigned long allocations = 0;
+
+extern "C" void *malloc (size_t size) {
+	allocations++;
+	return __libc_malloc (size);
+}
+
+extern "C" void *calloc (size_t count, size_t size) {
+	allocations++;
+	return __libc_calloc (count, size);
+}
+
+extern "C" void *realloc (void *pointer, size_t size) {
+	allocations++;
+	return __libc_realloc (pointer, size);
+}
+
+
+static unsigned long ticks = 0;			// Calls of millis()
+
+unsigned long millis () {
+	return ++ticks / MILLIS_CALLS;
+}
+
+
+// What the mock has seen
+struct MockStats {
+	unsigned long commands;				// AT commands
+	unsigned long nsost;				// AT+NSOST commands
+	unsigned long accepted;				// Datagrams "sent" to network
+	unsigned long punches;				// Punches in accepted datagrams
+	unsigned long raw;					// Accepted datagrams that aren't punches
+	unsigned long errors;				// AT+NSOST answered with ERROR
+	unsigned long silent;				// AT+NSOST not answered
+	unsigned long losses;				// Times network was lost
+	unsigned long dropped;				// Datagrams lost by network (both ways)
+	unsigned long full;					// Datagrams lost because network or module was full
+	unsigned long acks;					// Acknowledgements sent by server
+	unsigned long reads;				// AT+NSORF with data
+	unsigned long reboots;
+	unsigned long badCrc;
+	unsigned long badLength;			// Hex length doesn't match declared length
+	unsigned long badPunch;				// Punch isn't the one queued with its number
+	unsigned long badCompact;			// Compact batch that parseBatch didn't decode
+	unsigned long compact;				// Compact batches
+	unsigned long bytes;				// Bytes of batches
+	unsigned long reordered;			// Punches after a missing one
+	unsigned long repeated;				// Sequence numbers received twice (sent again)
+	unsigned long tooFar;				// Half the sequence space ahead of a missing one
+};
+
+
+// Datagram travelling through network
+struct Datagram {
+	bool used;
+	unsigned long due;					// millis() when it arrives
+	uint16_t length;
+	uint8_t data [NSOST_DATA_MAX];
+};
+
+
+// Short datagram travelling to station or waiting in module
+struct Downlink {
+	bool used;
+	unsigned long due;
+	uint8_t length;
+	uint8_t data [NSORF_MAX];
+};
+
+
+static char line [LINE_MAX + 1];		// Command being written by library
+static uint16_t lineLength = 0;
+static bool registered = false;
+static uint16_t nextSequence = 0;		// Oldest punch sequence number not received
+static uint8_t received [65536 / 8];	// Sequence numbers received after nextSequence
+static uint32_t punchLoop [65536];		// Loop that made the punch of each sequence number
+static Datagram uplink [NET_UPLINK];
+static Downlink downlink [NET_DOWNLINK];
+static Downlink module [MODULE_DOWNLINK];	// In order of arrival
+static uint8_t moduleCount = 0;
+static unsigned long errorEvery = 997;
+static unsigned long silentEvery = 4999;
+static unsigned long lossEvery = 50021;
+static unsigned long dropEvery = 7;
+static unsigned long rebootEvery = 1000003;
+static unsigned long travelled = 0;		// Datagrams put in network
+static uint32_t seed = 1;
+static MockStats mock;
+static bool compact = false;			// -c
+static UidHistory histories [256];		// UIDs received by server of each station
+
+
+// Answer a line to library, between "\r\n" like the module
+static void answer (const char *text) {
+	Serial3.receive ("\r\n");
+	Serial3.receive (text);
+	Serial3.receive ("\r\n");
+}
+
+
+// Update a CRC-16 CCITT with one byte, like SodaqNBIoT does
+static uint16_t crc16 (uint16_t crc, uint8_t data) {
+
+	crc ^= (uint16_t)data << 8;
+	for (uint8_t i = 0; i < 8; i++) {
+		crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+
+	return crc;
+
+}
+
+
+// Pseudo random number, the same in every run
+static uint32_t random32 () {
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+
+// Return the hex digits of data in text
+static void encodeHex (char *text, const uint8_t *data, uint16_t length) {
+	for (uint16_t i = 0; i < length; i++) {
+		sprintf (&text[2 * i], "%02X", data[i]);
+	}
+	text[2 * length] = '\0';
+}
+
+
+// Check a punch against the one made by makePunch for its sequence number
+static bool checkPunch (uint16_t sequence, const uint8_t *record);
+
+
+// Mark a sequence number as received & move nextSequence over the ones received
+static void receiveSequence (uint16_t sequence, const uint8_t *record) {
+
+	uint16_t distance = sequence - nextSequence;
+
+	if (distance >= 0x8000) {
+		mock.repeated++;				// Behind nextSequence: it was received
+		return;
+	}
+	if (distance >= 0x4000) {
+		mock.tooFar++;
+		return;
+	}
+	if (received[sequence >> 3] & (1 << (sequence & 7))) {
+		mock.repeated++;
+		return;
+	}
+	if (!checkPunch (sequence, record)) {
+		mock.badPunch++;
+		return;
+	}
+	if (distance != 0) {
+		mock.reordered++;
+	}
+
+	received[sequence >> 3] |= 1 << (sequence & 7);
+	while (received[nextSequence >> 3] & (1 << (nextSequence & 7))) {
+		received[nextSequence >> 3] &= ~(1 << (nextSequence & 7));
+		nextSequence++;
+	}
+
+}
+
+
+// Return the sequence numbers missing before the newest received one
+static unsigned long missingSequences () {
+
+	unsigned long missing = 0;
+	unsigned long pending = 0;			// Missing ones not followed yet by a received one
+
+	for (uint16_t sequence = nextSequence; (uint16_t)(sequence - nextSequence) < 0x4000;
+		sequence++) {
+		if (received[sequence >> 3] & (1 << (sequence & 7))) {
+			missing += pending;
+			pending = 0;
+		} else {
+			pending++;
+		}
+	}
+
+	return missing;
+
+}
+
+
+// Put a datagram from server in network, to station. It may be lost
+static void sendDownlink (const uint8_t *data, uint8_t length) {
+
+	travelled++;
+	if (travelled % dropEvery == 0) {
+		mock.dropped++;
+		return;
+	}
+
+	for (uint8_t i = 0; i < NET_DOWNLINK; i++) {
+		if (!downlink[i].used) {
+			downlink[i].used = true;
+			downlink[i].due = millis() + NET_LATENCY + random32() % NET_JITTER;
+			downlink[i].length = length;
+			memcpy (downlink[i].data, data, length);
+			return;
+		}
+	}
+	mock.full++;
+
+}
+
+
+// Answer the oldest sequence number not received yet
+static void sendAck () {
+
+	uint8_t ack [PUNCH_ACK_SIZE];
+	uint16_t crc = 0xFFFF;
+
+	ack[0] = PUNCH_ACK_VERSION << 4;
+	ack[1] = nextSequence & 0xFF;
+	ack[2] = nextSequence >> 8;
+	for (uint8_t i = 0; i < 3; i++) {
+		crc = crc16 (crc, ack[i]);
+	}
+	ack[3] = crc & 0xFF;
+	ack[4] = crc >> 8;
+	mock.acks++;
+	sendDownlink (ack, sizeof(ack));
+
+}
+
+
+// Compact batch: decoded like the server does, with the UIDs it received. False if it fails
+static bool receiveCompact (const uint8_t *datagram, uint16_t length) {
+
+	DatagramPunch punches [BATCH_PUNCHES_MAX];
+	uint8_t record [PUNCH_RECORD_SIZE];
+	uint16_t sequence;
+	int count = parseBatch (datagram, length, punches, sequence, histories);
+
+	if (count < 0) {
+		return false;
+	}
+
+	for (int i = 0; i < count; i++) {
+		record[0] = punches[i].uidLength;
+		memcpy (&record[1], punches[i].uid, punches[i].uidLength);
+		memcpy (&record[1 + punches[i].uidLength], punches[i].block, PUNCH_BLOCK_SIZE);
+		receiveSequence (sequence + i, record);
+		historyAdd (histories[punches[i].block[0]], sequence + i, punches[i]);
+	}
+	mock.punches += count;
+	mock.compact++;
+
+	return true;
+
+}
+
+
+/* Server stand-in: check CRC & punches of a batch and answer the oldest sequence number
+	not received yet */
+static void serverReceive (const uint8_t *datagram, uint16_t length) {
+
+	uint16_t crc = 0xFFFF;
+	uint16_t sequence;
+	uint16_t count;
+	uint16_t offset;
+
+	if ((datagram[0] >> 4) != PUNCH_BATCH_VERSION &&
+		(datagram[0] >> 4) != PUNCH_COMPACT_VERSION) {
+		mock.raw++;
+		return;
+	}
+
+	for (uint16_t i = 0; i + 2 < length; i++) {
+		crc = crc16 (crc, datagram[i]);
+	}
+	if (length < 6 || crc != (datagram[length - 2] | datagram[length - 1] << 8)) {
+		mock.badCrc++;
+		return;
+	}
+	mock.bytes += length;
+
+	if ((datagram[0] >> 4) == PUNCH_COMPACT_VERSION) {
+		if (!receiveCompact (datagram, length)) {
+			mock.badCompact++;
+			return;
+		}
+		sendAck ();
+		return;
+	}
+
+	count = datagram[1];
+	sequence = datagram[2] | datagram[3] << 8;
+	offset = 4;
+	for (uint16_t i = 0; i < count && offset < length; i++) {
+		offset += 1 + datagram[offset] + 1 + 4 + PUNCH_MAC_SIZE;
+	}
+	if (offset + 2 != length) {
+		mock.badLength++;
+		return;
+	}
+
+	offset = 4;
+	for (uint16_t i = 0; i < count; i++) {
+		receiveSequence (sequence + i, &datagram[offset]);
+		offset += 1 + datagram[offset] + 1 + 4 + PUNCH_MAC_SIZE;
+	}
+	mock.punches += count;
+
+	sendAck ();
+
+}
+
+
+// Decode hex of AT+NSOST. Return bytes or -1 if it isn't hex
+static int decodeHex (const char *hex, uint8_t *data) {
+
+	uint16_t length = 0;
+
+	for (; hex[0] != '\0' && hex[1] != '\0'; hex += 2) {
+		char pair [3] = { hex[0], hex[1], '\0' };
+		char *end;
+		data[length++] = strtoul (pair, &end, 16);
+		if (*end != '\0') {
+			return -1;
+		}
+	}
+
+	return (*hex == '\0') ? length : -1;
+
+}
+
+
+// "AT+NSOST=socket,ip,port,length,hex"
+static void handleNsost () {
+
+	static uint8_t datagram [NSOST_DATA_MAX];
+	const char *field = line + 9;
+	char reply [16];
+	int declared;
+	int decoded;
+
+	mock.nsost++;
+
+	for (uint8_t i = 0; i < 3 && field != NULL; i++) {	// To length
+		field = strchr (field, ',');
+		if (field != NULL) {
+			field++;
+		}
+	}
+	if (field == NULL || !registered || mock.nsost % errorEvery == 0) {
+		mock.errors++;
+		answer ("ERROR");
+		return;
+	}
+	if (mock.nsost % silentEvery == 0) {
+		mock.silent++;					// Library must time out
+		return;
+	}
+
+	declared = atoi (field);
+	field = strchr (field, ',');
+	decoded = (field != NULL) ? decodeHex (field + 1, datagram) : -1;
+	if (decoded != declared) {
+		mock.badLength++;
+		answer ("ERROR");
+		return;
+	}
+
+	mock.accepted++;
+	travelled++;
+	if (travelled % dropEvery == 0) {
+		mock.dropped++;
+	} else {
+		uint8_t i = 0;
+		while (i < NET_UPLINK && uplink[i].used) {
+			i++;
+		}
+		if (i == NET_UPLINK) {
+			mock.full++;
+		} else {
+			uplink[i].used = true;
+			uplink[i].due = millis() + NET_LATENCY + random32() % NET_JITTER;
+			uplink[i].length = decoded;
+			memcpy (uplink[i].data, datagram, decoded);
+		}
+	}
+
+	snprintf (reply, sizeof(reply), "0,%d", decoded);
+	answer (reply);
+	answer ("OK");
+
+	if (mock.nsost % NOISE_EVERY == 0) {
+		static const uint8_t noise [12] = { 0x10, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+		sendDownlink (noise, sizeof(noise));	// Not an acknowledgement
+	}
+	if (mock.nsost % lossEvery == 0) {
+		registered = false;				// Back when asked with AT+CEREG?
+		mock.losses++;
+		answer ("+CEREG:2");
+	}
+
+}
+
+
+// "AT+NSORF=socket,length". Datagrams are short, so each read takes a whole one
+static void handleNsorf () {
+
+	char reply [64 + 2 * NSORF_MAX];
+	char hex [2 * NSORF_MAX + 1];
+
+	if (moduleCount > 0) {
+		encodeHex (hex, module[0].data, module[0].length);
+		snprintf (reply, sizeof(reply), "0,%s,%d,%d,%s,0", SERVER_IP, SERVER_PORT,
+			module[0].length, hex);
+		answer (reply);
+		moduleCount--;
+		memmove (&module[0], &module[1], moduleCount * sizeof(module[0]));
+		mock.reads++;
+	}
+	answer ("OK");
+
+}
+
+
+// Answer a complete AT command like ublox N211
+static void handleLine () {
+
+	line[lineLength] = '\0';
+	mock.commands++;
+
+	if (strncmp (line, "AT+NSOST=", 9) == 0) {
+		handleNsost ();
+	} else if (strncmp (line, "AT+NSORF=", 9) == 0) {
+		handleNsorf ();
+	} else if (strcmp (line, "AT+NRB") == 0) {
+		moduleCount = 0;				// Received datagrams are lost
+		answer ("REBOOTING");
+		answer ("OK");
+	} else if (strncmp (line, "AT+COPS=", 8) == 0) {
+		registered = true;
+		answer ("OK");
+		answer ("+CEREG:5,\"1A2B\",\"01A2B3C4\",7");
+	} else if (strcmp (line, "AT+CEREG?") == 0) {
+		registered = true;				// Network comes back after being asked
+		answer ("+CEREG:2,5,\"1A2B\",\"01A2B3C4\",7");
+		answer ("OK");
+	} else if (strcmp (line, "AT+CGPADDR") == 0) {
+		answer ("+CGPADDR:0,10.46.120.7");
+		answer ("OK");
+	} else if (strcmp (line, "AT+CGSN=1") == 0) {
+		answer ("+CGSN:357517080000001");
+		answer ("OK");
+	} else if (strncmp (line, "AT+NSOCR=", 9) == 0) {
+		answer ("0");
+		answer ("OK");
+	} else if (strncmp (line, "AT", 2) == 0) {
+		answer ("OK");
+	} else {
+		answer ("ERROR");
+	}
+
+}
+
+
+// Receive a byte written by library in Serial3
+static void ubloxWrite (uint8_t c) {
+
+	if (c == '\r') {
+		handleLine ();
+		lineLength = 0;
+	} else if (lineLength < LINE_MAX) {
+		line[lineLength++] = c;
+	}
+
+}
+
+
+/* Deliver the datagrams whose time has come: to server stand-in, or to module, which
+	announces them with +NSONMI */
+static void network () {
+
+	char urc [24];
+
+	for (uint8_t i = 0; i < NET_UPLINK; i++) {
+		if (uplink[i].used && (long)(millis() - uplink[i].due) >= 0) {
+			uplink[i].used = false;
+			serverReceive (uplink[i].data, uplink[i].length);
+		}
+	}
+
+	for (uint8_t i = 0; i < NET_DOWNLINK; i++) {
+		if (downlink[i].used && (long)(millis() - downlink[i].due) >= 0) {
+			downlink[i].used = false;
+			if (moduleCount == MODULE_DOWNLINK) {
+				mock.full++;
+				continue;
+			}
+			module[moduleCount++] = downlink[i];
+			snprintf (urc, sizeof(urc), "+NSONMI:0,%d", downlink[i].length);
+			answer (urc);
+		}
+	}
+
+}
+
+
+/* Fake punch block & UID of a loop. Some cards have 7 bytes UID. With -c the station
+	changes less often and cards punch again */
+static uint8_t makePunch (unsigned long loop, uint8_t *data, uint8_t *uid) {
+
+	uint32_t time = 1790000000UL + loop;
+	unsigned long card = compact ? loop % CARDS : loop;
+
+	data[0] = compact ? loop / STATION_LOOPS % 32 : loop % 32;	// Station ID
+	memcpy (&data[1], &time, sizeof(time));
+	for (uint8_t i = 0; i < PUNCH_MAC_SIZE; i++) {
+		data[5 + i] = loop * 31 + i;
+	}
+	for (uint8_t i = 0; i < PUNCH_UID_MAX; i++) {
+		uid[i] = card >> (i % 4 * 8);
+	}
+
+	return (loop % 50 == 0) ? PUNCH_UID_MAX : PUNCH_UID_MIN;
+
+}
+
+
+static bool checkPunch (uint16_t sequence, const uint8_t *record) {
+
+	uint8_t data [1 + 4 + PUNCH_MAC_SIZE];
+	uint8_t uid [PUNCH_UID_MAX];
+	uint8_t uidLength = makePunch (punchLoop[sequence], data, uid);
+
+	return record[0] == uidLength && memcmp (&record[1], uid, uidLength) == 0 &&
+		memcmp (&record[1 + uidLength], data, sizeof(data)) == 0;
+
+}
+
+
+static void printRow (size_t heap) {
+	printf ("%10lu %10lu %8lu %6lu %6lu %6lu %6lu %6lu %12zu %12lu\n", mock.accepted,
+		mock.punches, mock.nsost, mock.errors, mock.silent, mock.losses, mock.dropped,
+		mock.reboots, heap, allocations);
+}
+
+
+// Queue a punch, keeping the loop that made it for checking it in server
+static bool queuePunch (SodaqNBIoT &nbiot, uint16_t &queued, unsigned long loop) {
+
+	uint8_t data [1 + 4 + PUNCH_MAC_SIZE];
+	uint8_t uid [PUNCH_UID_MAX];
+	uint8_t uidLength = makePunch (loop, data, uid);
+
+	if (!nbiot.queuePunch (data, uid, uidLength)) {
+		return false;
+	}
+	punchLoop[queued++] = loop;
+
+	return true;
+
+}
+
+
+int main (int argc, char *argv[]) {
+
+	static SodaqNBIoT nbiot;			// Static like in a sketch
+	unsigned long target = 1000000;		// Datagrams accepted by mock
+	unsigned long checkpoint;
+	unsigned long loop = 0;
+	unsigned long made = 0;				// Punches made for queueing
+	unsigned long single = 0;			// Value of made in last sendPunch
+	unsigned long rawMade = 0;			// Value of made in last sendData
+	unsigned long baseAllocations;
+	unsigned long timeouts = 0;			// Of every boot
+	unsigned long acked = 0;
+	size_t baseHeap;
+	size_t heap = 0;
+	uint16_t queued = 0;				// Sequence number of next punch queued
+	uint8_t data [1 + 4 + PUNCH_MAC_SIZE];
+	uint8_t uid [PUNCH_UID_MAX];
+	uint8_t raw [32] = { 0 };			// Version 0, so server doesn't take it as punches
+	int opt;
+
+	while ((opt = getopt (argc, argv, "n:e:s:d:l:r:c")) != -1) {
+		switch (opt) {
+			case 'n': target = strtoul (optarg, NULL, 10); break;
+			case 'e': errorEvery = strtoul (optarg, NULL, 10); break;
+			case 's': silentEvery = strtoul (optarg, NULL, 10); break;
+			case 'd': lossEvery = strtoul (optarg, NULL, 10); break;
+			case 'l': dropEvery = strtoul (optarg, NULL, 10); break;
+			case 'r': rebootEvery = strtoul (optarg, NULL, 10); break;
+			case 'c': compact = true; break;
+			default:
+				fprintf (stderr, "Usage: %s [-n sends] [-e errors] [-s silences] [-d losses] "
+					"[-l drops] [-r reboots] [-c]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (errorEvery == 0 || silentEvery == 0 || lossEvery == 0 || dropEvery == 0 ||
+		rebootEvery == 0 || target <= WARMUP_SENDS) {
+		fprintf (stderr, "Periods must be > 0 and sends > %d\n", WARMUP_SENDS);
+		return 2;
+	}
+
+	Serial3.onWrite = ubloxWrite;
+	printf ("%10s %10s %8s %6s %6s %6s %6s %6s %12s %12s\n", "datagrams", "punches", "nsost",
+		"error", "silent", "lost", "drop", "boots", "heap bytes", "allocations");
+
+	nbiot.setBatch (UPLINK_BATCH_PUNCHES, UPLINK_BATCH_DELAY);
+	nbiot.setCompactBatches (compact);
+	nbiot.start (LOCAL_PORT);
+
+	checkpoint = WARMUP_SENDS;
+	baseHeap = 0;
+	baseAllocations = 0;
+
+	while (mock.accepted < target) {
+		loop++;
+
+		if (nbiot.queueDepth() < QUEUE_TARGET) {
+			made++;
+			queuePunch (nbiot, queued, loop);
+		}
+
+		network ();
+		nbiot.process ();
+		nbiot.flushQueue (nbiot.getSocket(), SERVER_IP, SERVER_PORT);
+
+		// Blocking calls every some punches, not loops, so they don't fill the network
+		if (nbiot.getState() == NB_STATE_READY && made % SINGLE_EVERY == 0 && made != single) {
+			uint8_t uidLength = makePunch (loop, data, uid);
+			single = made;
+			if (nbiot.sendPunch (data, uid, nbiot.getSocket(), SERVER_IP, SERVER_PORT,
+				uidLength)) {
+				punchLoop[queued++] = loop;
+			}
+		}
+		if (nbiot.getState() == NB_STATE_READY && made % DATA_EVERY == 0 && made != rawMade) {
+			rawMade = made;
+			nbiot.sendData (raw, sizeof(raw), nbiot.getSocket(), SERVER_IP, SERVER_PORT);
+		}
+		if (nbiot.getState() == NB_STATE_FAILED) {
+			nbiot.start (LOCAL_PORT);
+		}
+
+		// Power goes off: RAM is lost, AT24C32 & the datagrams in network aren't
+		if (loop % rebootEvery == 0) {
+			timeouts += nbiot.uplinkStats().timeouts;
+			acked += nbiot.uplinkStats().acked;
+			nbiot.~SodaqNBIoT ();
+			new (&nbiot) SodaqNBIoT ();
+			Serial3.count = 0;
+			lineLength = 0;
+			mock.reboots++;
+			nbiot.setBatch (UPLINK_BATCH_PUNCHES, UPLINK_BATCH_DELAY);
+			nbiot.setCompactBatches (compact);
+			nbiot.start (LOCAL_PORT);
+		}
+
+		if (mock.accepted >= checkpoint) {
+			heap = mallinfo2().uordblks;
+			if (checkpoint == WARMUP_SENDS) {
+				baseHeap = heap;
+				baseAllocations = allocations;
+			}
+			printRow (heap);
+			fflush (stdout);
+			checkpoint = (checkpoint == WARMUP_SENDS) ? target / 10 : checkpoint + target / 10;
+		}
+	}
+
+	// Outbox is emptied without failures, so every punch must have been acknowledged
+	errorEvery = silentEvery = lossEvery = dropEvery = (unsigned long)-1;
+	while (nbiot.queueDepth() > 0 || nbiot.getState() != NB_STATE_READY) {
+		network ();
+		nbiot.process ();
+		nbiot.flushQueue (nbiot.getSocket(), SERVER_IP, SERVER_PORT, true);
+		if (nbiot.getState() == NB_STATE_FAILED) {
+			nbiot.start (LOCAL_PORT);
+		}
+	}
+
+	heap = mallinfo2().uordblks;
+	printRow (heap);
+
+	const UplinkStats &stats = nbiot.uplinkStats();
+	printf ("\nlast boot: queued %lu, sent %lu (%lu batches, max %u), batch errors %lu, "
+		"recovered %u, dropped %lu\n", stats.queued, stats.sent, stats.batches, stats.maxBatch,
+		stats.errors, stats.recovered, stats.dropped);
+	printf ("punches queued %u (mod 65536), acknowledged %lu, ack time outs %lu\n", queued,
+		acked + stats.acked, timeouts + stats.timeouts);
+	printf ("acks sent %lu, read %lu, raw datagrams %lu, lost in full queues %lu\n", mock.acks,
+		mock.reads, mock.raw, mock.full);
+	printf ("bad CRC %lu, bad length %lu, bad punch %lu, reordered %lu, sent again %lu, "
+		"missing %lu\n", mock.badCrc, mock.badLength, mock.badPunch, mock.reordered,
+		mock.repeated, missingSequences() + mock.tooFar);
+	printf ("%lu compact batches (%lu not decoded), %.1f bytes per punch\n", mock.compact,
+		mock.badCompact, mock.punches ? (double)mock.bytes / mock.punches : 0.0);
+	printf ("UART bytes lost %lu, virtual time %lu s\n", Serial3.overflows, millis() / 1000);
+	printf ("heap after warm-up %zu -> %zu bytes, allocations %lu\n", baseHeap, heap,
+		allocations - baseAllocations);
+
+	return (heap != baseHeap || allocations != baseAllocations || mock.badCrc > 0 ||
+		mock.badLength > 0 || mock.badPunch > 0 || mock.badCompact > 0 || nextSequence != queued ||
+		missingSequences() + mock.tooFar > 0) ? 1 : 0;
+
+}
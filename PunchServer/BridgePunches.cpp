@@ -0,0 +1,162 @@
+/*********************************************************************************************/
+/*
+ * BridgePunches
+ *
+ *  Brings to IngestPunches the batches of punches published by MQTT stations
+ *	(ReadNFCPublishMQTT with MQTTUplink). They have the format of the datagrams of
+ *	SodaqNBIoT, so each message is sent as it is in a UDP datagram and the server verifies,
+ *	saves & deduplicates its punches like with NB-IoT stations.
+ *
+ *	Messages are read from the standard input, one per line in hexadecimal, as printed by
+ *	mosquitto_sub. A persistent session (-c with a fixed id) and QoS 1 make the broker
+ *	keep the batches published while the bridge isn't running:
+ *
+ *		mosquitto_sub -h localhost -t '/Stations/+' -q 1 -c -i bridge -F %x |
+ *			./BridgePunches [-h 127.0.0.1] [-p 16666] [-v]
+ *
+ *	Lines that aren't valid batches are dropped. Acknowledgements of the server are read &
+ *	counted only: stations already removed the punches when the broker acknowledged them.
+ *	-v prints each batch. At the end of the input it prints the counters.
+ *
+ *	Build: g++ -O2 -std=c++11 BridgePunches.cpp Datagram.cpp -o BridgePunches
+*/
+/*********************************************************************************************/
+
+
+#include "Datagram.h"
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+#define LINE_MAX_SIZE		(2 * DATAGRAM_MAX + 2)	// Hex digits, new line & null char
+#define ACK_WAIT			500			// Ms waiting acknowledgements at the end
+
+
+// Decodes the last word of a line in hexadecimal. Returns its bytes or -1
+static int decodeLine (const char *line, uint8_t *data, size_t size) {
+
+	const char *end = line + strlen (line);
+	const char *hex;
+	int length = 0;
+
+	while (end > line && isspace ((unsigned char)end[-1])) {
+		end--;
+	}
+	hex = end;
+	while (hex > line && !isspace ((unsigned char)hex[-1])) {
+		hex--;							// Topic may go before, i.e. with -F '%t %x'
+	}
+	if ((end - hex) % 2 != 0 || (size_t)(end - hex) / 2 > size) {
+		return -1;
+	}
+
+	for (; hex < end; hex += 2) {
+		char digits [3] = { hex[0], hex[1], '\0' };
+		char *rest;
+		data[length++] = strtoul (digits, &rest, 16);
+		if (*rest != '\0') {
+			return -1;
+		}
+	}
+
+	return length;
+
+}
+
+
+// Counts the acknowledgements received from the server
+static void readAcks (int fd, unsigned long &acks) {
+
+	uint8_t datagram [DATAGRAM_MAX];
+	uint16_t next;
+	ssize_t n;
+
+	while ((n = recv (fd, datagram, sizeof(datagram), MSG_DONTWAIT)) > 0) {
+		if (parseAck (datagram, n, next)) {
+			acks++;
+		}
+	}
+
+}
+
+
+int main (int argc, char *argv[]) {
+
+	const char *host = "127.0.0.1";
+	unsigned long port = 16666;
+	bool verbose = false;
+	struct sockaddr_in server;
+	char line [LINE_MAX_SIZE];
+	uint8_t datagram [DATAGRAM_MAX];
+	DatagramPunch punches [BATCH_PUNCHES_MAX];
+	uint16_t sequence;
+	unsigned long batches = 0;
+	unsigned long punchCount = 0;
+	unsigned long bad = 0;
+	unsigned long acks = 0;
+	int fd;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "h:p:v")) != -1) {
+		switch (opt) {
+			case 'h': host = optarg; break;
+			case 'p': port = strtoul (optarg, NULL, 10); break;
+			case 'v': verbose = true; break;
+			default:
+				fprintf (stderr, "Usage: mosquitto_sub ... -F %%x | %s [-h host] [-p port] [-v]\n",
+					argv[0]);
+				return 2;
+		}
+	}
+
+	memset (&server, 0, sizeof(server));
+	server.sin_family = AF_INET;
+	server.sin_port = htons (port);
+	if (inet_pton (AF_INET, host, &server.sin_addr) != 1) {
+		fprintf (stderr, "Bad IPv4 address %s\n", host);
+		return 1;
+	}
+	fd = socket (AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0 || connect (fd, (struct sockaddr *)&server, sizeof(server)) != 0) {
+		perror ("socket");
+		return 1;
+	}
+
+	while (fgets (line, sizeof(line), stdin) != NULL) {
+		int length = decodeLine (line, datagram, sizeof(datagram));
+		int count = (length > 0) ? parseBatch (datagram, length, punches, sequence) : -1;
+
+		if (count < 0) {
+			bad++;
+			continue;
+		}
+		if (send (fd, datagram, length, 0) != length) {
+			perror ("send");
+			return 1;
+		}
+		batches++;
+		punchCount += count;
+		if (verbose) {
+			printf ("Station %u: %d punches from %u\n", punches[0].block[0], count, sequence);
+			fflush (stdout);
+		}
+
+		readAcks (fd, acks);
+	}
+
+	usleep (ACK_WAIT * 1000);			// Last acknowledgements
+	readAcks (fd, acks);
+	close (fd);
+
+	printf ("%lu batches (%lu punches) sent, %lu lines dropped, %lu acknowledgements\n",
+		batches, punchCount, bad, acks);
+
+	return 0;
+
+}
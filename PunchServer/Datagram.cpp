@@ -0,0 +1,299 @@
+/*********************************************************************************************/
+/*
+ * Punch datagram PC library
+ *
+ *  This library builds & parses the punch datagrams of NB-IoT stations.
+*/
+/*********************************************************************************************/
+
+
+#include "Datagram.h"
+
+#include <string.h>
+
+
+// CRC-16 CCITT of data, like SodaqNBIoT & SerialInterface
+uint16_t datagramCrc (const uint8_t *data, size_t length) {
+
+	uint16_t crc = 0xFFFF;
+
+	for (size_t i = 0; i < length; i++) {
+		crc ^= (uint16_t)data[i] << 8;
+		for (uint8_t bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+	}
+
+	return crc;
+
+}
+
+
+// Reads a varint at offset, moving it. Returns false if it goes past end or is too long
+static bool readVarint (const uint8_t *data, size_t &offset, size_t end, uint32_t &value) {
+
+	value = 0;
+	for (uint8_t shift = 0; shift < 35; shift += 7) {
+		if (offset == end) {
+			return false;
+		}
+		value |= (uint32_t)(data[offset] & 0x7F) << shift;
+		if ((data[offset++] & 0x80) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+
+}
+
+
+// Writes a varint at offset, moving it
+static void writeVarint (uint8_t *data, size_t &offset, uint32_t value) {
+
+	while (value >= 0x80) {
+		data[offset++] = (value & 0x7F) | 0x80;
+		value >>= 7;
+	}
+	data[offset++] = value;
+
+}
+
+
+/* Parses the punches of a compact batch (after its header & before its CRC). A HEAD that
+	refers to a punch before the batch takes its UID from the history of the station */
+static int parseCompact (const uint8_t *datagram, size_t length, DatagramPunch *punches,
+	uint8_t count, uint16_t sequence, const UidHistory *histories) {
+
+	size_t offset = 9;
+	size_t end = length - 2;
+	uint8_t station;
+	uint32_t time;
+
+	if (length < 9 + 2) {
+		return -1;
+	}
+	station = datagram[4];
+	memcpy (&time, &datagram[5], sizeof(time));	// Little endian like in AVR
+
+	for (uint8_t i = 0; i < count; i++) {
+		uint32_t delta;
+
+		if (offset == end) {
+			return -1;
+		}
+		if (datagram[offset] & 0x80) {
+			uint8_t distance = datagram[offset++] & 0x7F;
+			uint16_t target = sequence + i - distance;
+
+			if (distance == 0) {
+				return -1;
+			}
+			if (distance <= i) {
+				punches[i].uidLength = punches[i - distance].uidLength;
+				memcpy (punches[i].uid, punches[i - distance].uid, PUNCH_UID_MAX);
+			} else {
+				const UidHistory *history = (histories != NULL) ? &histories[station] : NULL;
+				uint16_t slot = target % UID_HISTORY_SIZE;
+				if (history == NULL || history->uidLength[slot] == 0 ||
+					history->sequence[slot] != target) {
+					return -1;			// Server doesn't know that punch
+				}
+				punches[i].uidLength = history->uidLength[slot];
+				memcpy (punches[i].uid, history->uid[slot], PUNCH_UID_MAX);
+			}
+		} else {
+			uint8_t uidLength = datagram[offset++];
+			if (uidLength < PUNCH_UID_MIN || uidLength > PUNCH_UID_MAX ||
+				offset + uidLength > end) {
+				return -1;
+			}
+			punches[i].uidLength = uidLength;
+			memset (punches[i].uid, 0, PUNCH_UID_MAX);
+			memcpy (punches[i].uid, &datagram[offset], uidLength);
+			offset += uidLength;
+		}
+
+		if (i > 0) {
+			if (!readVarint (datagram, offset, end, delta)) {
+				return -1;
+			}
+			time += (int32_t)((delta >> 1) ^ -(int32_t)(delta & 1));	// Zigzag
+		}
+		if (offset + PUNCH_MAC_SIZE > end) {
+			return -1;
+		}
+		punches[i].block[0] = station;
+		memcpy (&punches[i].block[1], &time, sizeof(time));
+		memcpy (&punches[i].block[5], &datagram[offset], PUNCH_MAC_SIZE);
+		offset += PUNCH_MAC_SIZE;
+	}
+
+	return (offset == end) ? count : -1;
+
+}
+
+
+/* Parses a batch of punches, normal or compact. Sequence is the number of the first one;
+	the rest are consecutive. Histories has one entry per station ID, for compact HEADs that
+	refer to punches before the batch; without it they aren't valid. Returns the punches or
+	-1 if version, CRC, lengths or HEADs are wrong */
+int parseBatch (const uint8_t *datagram, size_t length, DatagramPunch *punches,
+	uint16_t &sequence, const UidHistory *histories) {
+
+	size_t offset = 4;
+	uint8_t count;
+
+	if (length < 4 + 2 || ((datagram[0] >> 4) != PUNCH_BATCH_VERSION &&
+		(datagram[0] >> 4) != PUNCH_COMPACT_VERSION) || datagramCrc (datagram, length - 2) !=
+		(datagram[length - 2] | datagram[length - 1] << 8)) {
+		return -1;
+	}
+
+	count = datagram[1];
+	sequence = datagram[2] | datagram[3] << 8;
+	if (count == 0 || count > BATCH_PUNCHES_MAX) {
+		return -1;
+	}
+
+	if ((datagram[0] >> 4) == PUNCH_COMPACT_VERSION) {
+		return parseCompact (datagram, length, punches, count, sequence, histories);
+	}
+
+	for (uint8_t i = 0; i < count; i++) {
+		uint8_t uidLength = datagram[offset];
+		if (uidLength < PUNCH_UID_MIN || uidLength > PUNCH_UID_MAX ||
+			offset + 1 + uidLength + PUNCH_BLOCK_SIZE > length - 2) {
+			return -1;
+		}
+		punches[i].uidLength = uidLength;
+		memcpy (punches[i].uid, &datagram[offset + 1], uidLength);
+		memcpy (punches[i].block, &datagram[offset + 1 + uidLength], PUNCH_BLOCK_SIZE);
+		offset += 1 + uidLength + PUNCH_BLOCK_SIZE;
+	}
+
+	return (offset + 2 == length) ? count : -1;
+
+}
+
+
+// Builds a batch of punches like SodaqNBIoT does. Returns its length
+size_t buildBatch (uint8_t *datagram, const DatagramPunch *punches, uint8_t count,
+	uint16_t sequence) {
+
+	size_t length = 4;
+	uint16_t crc;
+
+	datagram[0] = PUNCH_BATCH_VERSION << 4;
+	datagram[1] = count;
+	datagram[2] = sequence & 0xFF;
+	datagram[3] = sequence >> 8;
+	for (uint8_t i = 0; i < count; i++) {
+		datagram[length++] = punches[i].uidLength;
+		memcpy (&datagram[length], punches[i].uid, punches[i].uidLength);
+		length += punches[i].uidLength;
+		memcpy (&datagram[length], punches[i].block, PUNCH_BLOCK_SIZE);
+		length += PUNCH_BLOCK_SIZE;
+	}
+	crc = datagramCrc (datagram, length);
+	datagram[length++] = crc & 0xFF;
+	datagram[length++] = crc >> 8;
+
+	return length;
+
+}
+
+
+/* Builds a compact batch of punches of the same station. A UID already in the batch goes
+	as a HEAD with its distance. Returns its length */
+size_t buildCompactBatch (uint8_t *datagram, const DatagramPunch *punches, uint8_t count,
+	uint16_t sequence) {
+
+	size_t length = 9;
+	uint16_t crc;
+
+	datagram[0] = PUNCH_COMPACT_VERSION << 4;
+	datagram[1] = count;
+	datagram[2] = sequence & 0xFF;
+	datagram[3] = sequence >> 8;
+	datagram[4] = punches[0].block[0];
+	memcpy (&datagram[5], &punches[0].block[1], 4);
+	for (uint8_t i = 0; i < count; i++) {
+		uint8_t distance = 0;
+		for (uint8_t j = i; j > 0 && distance == 0; j--) {
+			if (punches[j - 1].uidLength == punches[i].uidLength &&
+				memcmp (punches[j - 1].uid, punches[i].uid, punches[i].uidLength) == 0) {
+				distance = i - (j - 1);
+			}
+		}
+		if (distance != 0) {
+			datagram[length++] = 0x80 | distance;
+		} else {
+			datagram[length++] = punches[i].uidLength;
+			memcpy (&datagram[length], punches[i].uid, punches[i].uidLength);
+			length += punches[i].uidLength;
+		}
+		if (i > 0) {
+			int32_t delta = (int32_t)(punches[i].block[1] | punches[i].block[2] << 8 |
+				punches[i].block[3] << 16 | (uint32_t)punches[i].block[4] << 24) -
+				(int32_t)(punches[i - 1].block[1] | punches[i - 1].block[2] << 8 |
+				punches[i - 1].block[3] << 16 | (uint32_t)punches[i - 1].block[4] << 24);
+			writeVarint (datagram, length, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+		}
+		memcpy (&datagram[length], &punches[i].block[5], PUNCH_MAC_SIZE);
+		length += PUNCH_MAC_SIZE;
+	}
+	crc = datagramCrc (datagram, length);
+	datagram[length++] = crc & 0xFF;
+	datagram[length++] = crc >> 8;
+
+	return length;
+
+}
+
+
+// Builds the acknowledgement of every punch before next
+void buildAck (uint8_t *ack, uint16_t next) {
+
+	uint16_t crc;
+
+	ack[0] = PUNCH_ACK_VERSION << 4;
+	ack[1] = next & 0xFF;
+	ack[2] = next >> 8;
+	crc = datagramCrc (ack, 3);
+	ack[3] = crc & 0xFF;
+	ack[4] = crc >> 8;
+
+}
+
+
+// Parses an acknowledgement. Returns false if it isn't valid
+bool parseAck (const uint8_t *datagram, size_t length, uint16_t &next) {
+
+	if (length != PUNCH_ACK_SIZE || datagram[0] != (PUNCH_ACK_VERSION << 4) ||
+		datagramCrc (datagram, 3) != (datagram[3] | datagram[4] << 8)) {
+		return false;
+	}
+	next = datagram[1] | datagram[2] << 8;
+
+	return true;
+
+}
+
+
+// Empties the history of a station
+void historyClear (UidHistory &history) {
+	memset (&history, 0, sizeof(history));
+}
+
+
+// Keeps the UID of a punch received with its sequence number
+void historyAdd (UidHistory &history, uint16_t sequence, const DatagramPunch &punch) {
+
+	uint16_t slot = sequence % UID_HISTORY_SIZE;
+
+	history.sequence[slot] = sequence;
+	history.uidLength[slot] = punch.uidLength;
+	memcpy (history.uid[slot], punch.uid, PUNCH_UID_MAX);
+
+}
@@ -0,0 +1,82 @@
+/*********************************************************************************************/
+/*
+ * Punch datagram PC library
+ *
+ *  Builds & parses the datagrams of SodaqNBIoT (see SodaqNBIoT.h): batches of punches sent
+ *	by stations and the cumulative acknowledgements answered by the server. All fields are
+ *	LSB first, like in user's card:
+ *
+ *		BATCH VERSION << 4 | COUNT | SEQUENCE (2) | COUNT x (UID LENGTH | UID | IDS | TIME |
+ *		MAC) | CRC (2)
+ *
+ *		ACK VERSION << 4 | NEXT SEQUENCE (2) | CRC (2)
+ *
+ *	IDS, TIME & MAC are the punch block written in user's card. CRC-16 is CCITT (polynomial
+ *	0x1021, initial value 0xFFFF) over the previous fields.
+ *
+ *	Compact batches carry the IDS once & the time of the first punch, and the rest as
+ *	differences with the previous punch:
+ *
+ *		COMPACT VERSION << 4 | COUNT | SEQUENCE (2) | IDS | TIME (4) | COUNT x (HEAD | UID |
+ *		DELTA | MAC) | CRC (2)
+ *
+ *	HEAD is the UID length & UID follows, or 0x80 | D (D from 1 to DICTIONARY_DISTANCE_MAX)
+ *	without UID: the UID is the one of the punch D sequence numbers before, earlier in the
+ *	batch or already acknowledged, so the server has it (see UidHistory). DELTA isn't in the
+ *	first punch: it's the time minus the time of the previous punch, zigzag encoded (0, -1,
+ *	1, -2... as 0, 1, 2, 3...) in a varint of 7 bits per byte, low bits first, bit 7 set if
+ *	more bytes follow.
+*/
+/*********************************************************************************************/
+
+
+#ifndef __DATAGRAM_H__
+#define __DATAGRAM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define PUNCH_BATCH_VERSION	2			// Version of binary batch of punches
+#define PUNCH_COMPACT_VERSION	4		// Version of compact batch of punches
+#define PUNCH_ACK_VERSION	3			// Version of acknowledgement sent by server
+#define PUNCH_ACK_SIZE		5
+#define PUNCH_UID_MIN		4			// Shortest UID of ISO14443A cards
+#define PUNCH_UID_MAX		7			// Longest UID of ISO14443A cards
+#define PUNCH_BLOCK_SIZE	16			// IDS, time & MAC, like in user's card
+#define PUNCH_MAC_SIZE		11
+#define DATAGRAM_MAX		512			// Max bytes of a datagram sent by ublox N211
+#define BATCH_PUNCHES_MAX	((DATAGRAM_MAX - 6) / (1 + PUNCH_UID_MIN + PUNCH_BLOCK_SIZE))
+#define DICTIONARY_DISTANCE_MAX	127		// Max D of a compact HEAD
+#define UID_HISTORY_SIZE	256			// Last sequence numbers of a station with their UID
+
+
+// Punch of a batch
+struct DatagramPunch {
+	uint8_t uidLength;
+	uint8_t uid [PUNCH_UID_MAX];
+	uint8_t block [PUNCH_BLOCK_SIZE];	// IDS, time & MAC
+};
+
+
+// UIDs received from a station, for the HEADs of compact batches that refer to them
+struct UidHistory {
+	uint16_t sequence [UID_HISTORY_SIZE];
+	uint8_t uidLength [UID_HISTORY_SIZE];	// 0: empty
+	uint8_t uid [UID_HISTORY_SIZE][PUNCH_UID_MAX];
+};
+
+
+uint16_t datagramCrc (const uint8_t *data, size_t length);
+int parseBatch (const uint8_t *datagram, size_t length, DatagramPunch *punches,
+	uint16_t &sequence, const UidHistory *histories = NULL);	// Punches or -1 if not valid
+size_t buildBatch (uint8_t *datagram, const DatagramPunch *punches, uint8_t count,
+	uint16_t sequence);					// Bytes written (up to DATAGRAM_MAX)
+size_t buildCompactBatch (uint8_t *datagram, const DatagramPunch *punches, uint8_t count,
+	uint16_t sequence);					// Same station. HEADs only refer inside batch
+void historyClear (UidHistory &history);
+void historyAdd (UidHistory &history, uint16_t sequence, const DatagramPunch &punch);
+void buildAck (uint8_t *ack, uint16_t next);	// PUNCH_ACK_SIZE bytes
+bool parseAck (const uint8_t *datagram, size_t length, uint16_t &next);
+
+#endif
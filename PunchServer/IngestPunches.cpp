@@ -0,0 +1,125 @@
+/*********************************************************************************************/
+/*
+ * IngestPunches
+ *
+ *  UDP server of NB-IoT stations (SERVER_PORT of STATION_NBIOT). It verifies the punches of
+ *	each batch with the key table exported by the Master, saves them in the punch store of
+ *	the event (see Results/PunchStore.h) and acknowledges them, so stations remove them from
+ *	their outbox (see PunchServer.h). New punches are also written to each client connected
+ *	to the TCP port given with -t, one line "UID,station,time,valid" per punch:
+ *
+ *		nc localhost 16667
+ *
+ *	With -l, cards of the start list with UID (the file of MasterConsole option 8) have
+ *	their first punch verified at once; the first punch of other cards is saved as not
+ *	valid after PENDING_TIMEOUT. Stats are printed each -s seconds. SIGINT or SIGTERM
+ *	finishes.
+ *
+ *	The store must not be opened by another writer (i.e. MasterConsole -d) meanwhile.
+ *	Results engine & exports can open it read-only.
+ *
+ *	Usage: IngestPunches [-p 16666] [-t 16667] [-l startlist.csv] [-s 10] keys.bin store
+ *
+ *	It can be tested without stations with LoadPunches.
+ *
+ *	Build: g++ -O2 -std=c++11 -I../CardVerifier -I../Results -I../libraries/Crypto
+ *		IngestPunches.cpp PunchServer.cpp Datagram.cpp ../CardVerifier/MultiBlake2s.cpp
+ *		../Results/PunchStore.cpp -o IngestPunches
+*/
+/*********************************************************************************************/
+
+
+#include "PunchServer.h"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+#define SERVER_PORT			16666		// Port of STATION_NBIOT
+#define SUBSCRIBER_PORT		16667
+#define STATS_PERIOD		10			// Seconds between stats
+
+
+static PunchServer *server = NULL;		// Stopped by signals
+
+
+static void stopServer (int) {
+	if (server != NULL) {
+		server->stop ();
+	}
+}
+
+
+int main (int argc, char *argv[]) {
+
+	unsigned long udpPort = SERVER_PORT;
+	unsigned long subscriberPort = SUBSCRIBER_PORT;
+	const char *startListPath = NULL;
+	int statsPeriod = STATS_PERIOD;
+	struct sigaction action;
+	PunchStore store;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "p:t:l:s:")) != -1) {
+		switch (opt) {
+			case 'p': udpPort = strtoul (optarg, NULL, 10); break;
+			case 't': subscriberPort = strtoul (optarg, NULL, 10); break;
+			case 'l': startListPath = optarg; break;
+			case 's': statsPeriod = atoi (optarg); break;
+			default: optind = argc; break;
+		}
+	}
+	if (argc - optind != 2 || statsPeriod <= 0 || udpPort == 0 || udpPort > 65535 ||
+		subscriberPort > 65535) {
+		fprintf (stderr, "Usage: %s [-p udpPort] [-t subscriberPort] [-l startlist.csv] "
+			"[-s seconds] keys.bin store\n", argv[0]);
+		return 2;
+	}
+
+	if (!store.open (argv[optind + 1], false)) {
+		fprintf (stderr, "Can't open punch store %s\n", argv[optind + 1]);
+		return 1;
+	}
+
+	PunchServer ingest (store, stdout);
+	if (!ingest.loadKeys (argv[optind])) {
+		fprintf (stderr, "Can't load key table %s\n", argv[optind]);
+		return 1;
+	}
+	if (startListPath != NULL && !ingest.loadStartList (startListPath)) {
+		fprintf (stderr, "Can't load start list %s\n", startListPath);
+		return 1;
+	}
+	if (!ingest.open (argv[optind + 1])) {
+		fprintf (stderr, "Can't read ingest log of %s\n", argv[optind + 1]);
+		return 1;
+	}
+	if (!ingest.listen (udpPort, subscriberPort)) {
+		perror ("Can't open sockets");
+		return 1;
+	}
+
+	// Without SA_RESTART, so epoll_wait returns at once
+	memset (&action, 0, sizeof(action));
+	action.sa_handler = stopServer;
+	server = &ingest;
+	sigaction (SIGINT, &action, NULL);
+	sigaction (SIGTERM, &action, NULL);
+
+	printf ("Waiting punches in UDP port %lu (%s)", udpPort, MultiBlake2s::backend ());
+	if (subscriberPort != 0) {
+		printf (", subscribers in TCP port %lu", subscriberPort);
+	}
+	printf (". %u punches in store\n", store.size ());
+	fflush (stdout);
+
+	ingest.run (statsPeriod * 1000);
+
+	server = NULL;
+	store.close ();
+
+	return 0;
+
+}
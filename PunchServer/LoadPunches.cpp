@@ -0,0 +1,362 @@
+/*********************************************************************************************/
+/*
+ * LoadPunches
+ *
+ *  Load generator for IngestPunches. It plays an event of C cards punching in S stations
+ *	at R punches per second through loopback: each station has its own UDP socket and sends
+ *	batches of BATCH_PUNCHES punches like SodaqNBIoT, with consecutive sequence numbers.
+ *	Punches have the MAC of PlayerCard (BLAKE2s with the station key over UID, IDS, time &
+ *	previous block of the card), so the server must verify all of them.
+ *
+ *	Acknowledgements are read meanwhile. At the end it waits ACK_WAIT ms and prints the
+ *	punches per second sent and the punches not acknowledged (lost by a full socket
+ *	buffer of the server: nothing is sent again).
+ *
+ *	First write the key table & start list of the event, then start the server with them:
+ *
+ *		./LoadPunches -w [-s 50] [-c 10000] keys.bin startlist.csv
+ *		./IngestPunches -l startlist.csv keys.bin event.store &
+ *		./LoadPunches [-r 100000] [-d 10] [-c 10000] [-p 16666] [-z] keys.bin
+ *
+ *	-z sends compact batches (see Datagram.h) and prints the bytes per punch.
+ *
+ *	A card punches the stations in turn and holds CARD_PUNCHES punches, like a real one: the
+ *	run ends before -d seconds if every card is full. A card can't punch the same station
+ *	twice in a second, so -r must not be over stations x cards.
+ *
+ *	Cards are the same in both runs while -c isn't bigger than when the start list was
+ *	written. Each run plays cards from their first punch, so it needs a new store: in a
+ *	store loaded before, the server chains them after their last punch and they wait.
+ *
+ *	Build: g++ -O2 -std=c++11 -I../CardVerifier -I../libraries/Crypto LoadPunches.cpp
+ *		Datagram.cpp ../CardVerifier/MultiBlake2s.cpp -o LoadPunches
+*/
+/*********************************************************************************************/
+
+
+#include "Datagram.h"
+#include "MultiBlake2s.h"
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+
+#define BATCH_PUNCHES		8			// Like PUNCH_BATCH of STATION_NBIOT
+#define CARD_PUNCHES		45			// Punches of a full card (MAX_PUNCHES of CardVerifier)
+#define FIRST_UID			0x10000000	// UID of first card; the rest are consecutive
+#define CATEGORIES			4
+#define CAT_SIZE			15			// Size in bytes of category field in card
+#define ACK_WAIT			2000		// Ms waiting acknowledgements at the end
+#define PACE_PERIOD			1			// Ms between bursts of punches
+
+
+typedef std::chrono::steady_clock Clock;
+
+
+// Station played by the generator
+struct Station {
+	int fd;								// Socket connected to server
+	uint16_t sequence;					// Of next batch
+	uint16_t acked;						// Next number of last acknowledgement
+	uint8_t count;						// Punches of batch being filled
+	DatagramPunch punches [BATCH_PUNCHES];
+};
+
+
+// Card played by the generator
+struct Card {
+	uint8_t uid [PUNCH_UID_MIN];
+	uint8_t last [PUNCH_BLOCK_SIZE];	// Previous block of next punch
+	uint16_t visits;					// Punches made
+};
+
+
+static void cardUid (uint32_t index, uint8_t *uid) {
+	uint32_t value = FIRST_UID + index;
+	for (uint8_t i = 0; i < PUNCH_UID_MIN; i++) {
+		uid[i] = value >> (8 * (PUNCH_UID_MIN - 1 - i));
+	}
+}
+
+
+static void cardCategory (uint32_t index, char *category) {
+	snprintf (category, CAT_SIZE, "Cat%u", (unsigned)(index % CATEGORIES));
+}
+
+
+// Writes random keys for the stations and a start list with the UID of each card
+static int writeEvent (unsigned stations, unsigned cards, const char *keysPath,
+	const char *startListPath) {
+
+	uint8_t table [1 + MAX_STATIONS * STATION_REC_SIZE];
+	FILE *random = fopen ("/dev/urandom", "rb");
+	FILE *file;
+	char category [CAT_SIZE];
+
+	table[0] = stations;
+	if (random == NULL || fread (&table[1], STATION_REC_SIZE, stations, random) != stations) {
+		fprintf (stderr, "Can't read /dev/urandom\n");
+		return 1;
+	}
+	fclose (random);
+
+	file = fopen (keysPath, "wb");
+	if (file == NULL || fwrite (table, 1, 1 + stations * STATION_REC_SIZE, file) !=
+		1 + stations * STATION_REC_SIZE) {
+		perror (keysPath);
+		return 1;
+	}
+	fclose (file);
+
+	file = fopen (startListPath, "w");
+	if (file == NULL) {
+		perror (startListPath);
+		return 1;
+	}
+	fprintf (file, "# name,category,UID\n");
+	for (unsigned i = 0; i < cards; i++) {
+		cardCategory (i, category);
+		fprintf (file, "Runner %u,%s,%08X\n", i, category, FIRST_UID + i);
+	}
+	fclose (file);
+
+	printf ("Keys of %u stations in %s, %u cards in %s\n", stations, keysPath, cards,
+		startListPath);
+
+	return 0;
+
+}
+
+
+// Sends the batch being filled in a station, compact or not
+static bool sendBatch (Station &station, bool compact, unsigned long &datagrams,
+	unsigned long &bytes) {
+
+	uint8_t datagram [DATAGRAM_MAX];
+	size_t length;
+
+	if (station.count == 0) {
+		return true;
+	}
+
+	length = compact ? buildCompactBatch (datagram, station.punches, station.count,
+		station.sequence) : buildBatch (datagram, station.punches, station.count,
+		station.sequence);
+	if (send (station.fd, datagram, length, 0) != (ssize_t)length) {
+		return false;
+	}
+	station.sequence += station.count;
+	station.count = 0;
+	datagrams++;
+	bytes += length;
+
+	return true;
+
+}
+
+
+// Reads the acknowledgements received by every station
+static void readAcks (std::vector<Station> &stations) {
+
+	uint8_t datagram [DATAGRAM_MAX];
+	uint16_t next;
+	ssize_t n;
+
+	for (size_t i = 0; i < stations.size(); i++) {
+		while ((n = recv (stations[i].fd, datagram, sizeof(datagram), MSG_DONTWAIT)) > 0) {
+			if (parseAck (datagram, n, next) &&
+				(uint16_t)(next - stations[i].acked) <= (uint16_t)(stations[i].sequence -
+				stations[i].acked)) {
+				stations[i].acked = next;
+			}
+		}
+	}
+
+}
+
+
+int main (int argc, char *argv[]) {
+
+	unsigned long rate = 100000;		// Punches per second
+	unsigned long seconds = 10;
+	unsigned numCards = 10000;
+	unsigned numStations = 50;
+	unsigned long port = 16666;
+	const char *host = "127.0.0.1";
+	bool write = false;
+	bool compact = false;
+	std::vector<Station> stations;
+	std::vector<Card> cards;
+	struct sockaddr_in server;
+	uint8_t table [1 + MAX_STATIONS * STATION_REC_SIZE];
+	MultiBlake2s multi;
+	FILE *file;
+	size_t len;
+	unsigned long made = 0;
+	unsigned long datagrams = 0;
+	unsigned long bytes = 0;			// Of datagrams sent
+	unsigned long failed = 0;			// send() errors: batches not sent
+	unsigned long unacked = 0;
+	unsigned long total;				// Punches until every card is full
+	uint32_t firstTime;
+	Clock::time_point start;
+	double elapsed;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "wr:d:c:s:h:p:z")) != -1) {
+		switch (opt) {
+			case 'w': write = true; break;
+			case 'r': rate = strtoul (optarg, NULL, 10); break;
+			case 'd': seconds = strtoul (optarg, NULL, 10); break;
+			case 'c': numCards = strtoul (optarg, NULL, 10); break;
+			case 's': numStations = strtoul (optarg, NULL, 10); break;
+			case 'h': host = optarg; break;
+			case 'p': port = strtoul (optarg, NULL, 10); break;
+			case 'z': compact = true; break;
+			default: optind = argc; break;
+		}
+	}
+	if ((write && argc - optind != 2) || (!write && argc - optind != 1) || rate == 0 ||
+		numCards == 0 || numStations == 0 || numStations >= MAX_STATIONS) {
+		fprintf (stderr, "Usage: %s -w [-s stations] [-c cards] keys.bin startlist.csv\n"
+			"       %s [-r punches/s] [-d seconds] [-c cards] [-h host] [-p port] [-z]\n"
+			"          keys.bin\n", argv[0], argv[0]);
+		return 2;
+	}
+
+	if (write) {
+		return writeEvent (numStations, numCards, argv[optind], argv[optind + 1]);
+	}
+
+	file = fopen (argv[optind], "rb");
+	len = (file != NULL) ? fread (table, 1, sizeof(table), file) : 0;
+	if (file != NULL) {
+		fclose (file);
+	}
+	if (len < 1 || table[0] == 0 || len != 1 + (size_t)table[0] * STATION_REC_SIZE) {
+		fprintf (stderr, "Can't load key table %s\n", argv[optind]);
+		return 1;
+	}
+	numStations = table[0];
+	if (numStations < CARD_PUNCHES && (unsigned long)numStations * numCards < rate) {
+		fprintf (stderr, "Cards would punch a station twice in the same second: -r must "
+			"be up to %lu with %u stations & %u cards\n", (unsigned long)numStations * numCards,
+			numStations, numCards);
+		return 2;
+	}
+	total = (unsigned long)numCards * CARD_PUNCHES;
+	multi.setKeys ((const uint8_t (*)[STATION_REC_SIZE])&table[1], numStations);
+
+	memset (&server, 0, sizeof(server));
+	server.sin_family = AF_INET;
+	server.sin_port = htons (port);
+	if (inet_pton (AF_INET, host, &server.sin_addr) != 1) {
+		fprintf (stderr, "Bad IPv4 address %s\n", host);
+		return 1;
+	}
+
+	stations.resize (numStations);
+	for (unsigned i = 0; i < numStations; i++) {
+		memset (&stations[i], 0, sizeof(stations[i]));
+		stations[i].fd = socket (AF_INET, SOCK_DGRAM, 0);
+		if (stations[i].fd < 0 || connect (stations[i].fd, (struct sockaddr *)&server,
+			sizeof(server)) != 0) {
+			perror ("socket");
+			return 1;
+		}
+	}
+
+	cards.resize (numCards);
+	for (unsigned i = 0; i < numCards; i++) {
+		char category [CAT_SIZE];
+		cardUid (i, cards[i].uid);
+		memset (cards[i].last, 0, sizeof(cards[i].last));	// NB is 0 for the MAC
+		cardCategory (i, category);
+		memcpy (&cards[i].last[1], category, CAT_SIZE);
+		cards[i].visits = 0;
+	}
+
+	firstTime = (uint32_t)time (NULL);
+	start = Clock::now();
+
+	while (made < total &&
+		(elapsed = std::chrono::duration<double>(Clock::now() - start).count()) < seconds) {
+		unsigned long due = (unsigned long)(elapsed * rate);
+
+		if (due > total) {
+			due = total;
+		}
+
+		// Punch j: card j % cards in its next station. A card visits stations in turn
+		for (; made < due; made++) {
+			Card &card = cards[made % numCards];
+			uint8_t ids = (made % numCards + card.visits) % numStations;
+			Station &station = stations[ids];
+			DatagramPunch &punch = station.punches[station.count];
+			uint32_t punchTime = firstTime + (uint32_t)(made / rate);
+			MacInput input;
+			uint8_t mac [1][AUTH_IN_CARD_SIZE];
+
+			punch.uidLength = PUNCH_UID_MIN;
+			memcpy (punch.uid, card.uid, PUNCH_UID_MIN);
+			punch.block[0] = ids;
+			memcpy (&punch.block[1], &punchTime, sizeof(punchTime));	// Little endian
+
+			input.station = ids;
+			memcpy (&input.message[0], card.uid, PUNCH_UID_MIN);
+			memcpy (&input.message[4], punch.block, 5);
+			memcpy (&input.message[9], card.last, PUNCH_BLOCK_SIZE);
+			multi.computeMacs (&input, 1, mac);
+			memcpy (&punch.block[5], mac[0], PUNCH_MAC_SIZE);
+
+			memcpy (card.last, punch.block, PUNCH_BLOCK_SIZE);
+			card.visits++;
+
+			if (++station.count == BATCH_PUNCHES && !sendBatch (station, compact, datagrams,
+				bytes)) {
+				failed++;
+				station.count = 0;
+			}
+		}
+
+		readAcks (stations);
+		usleep (PACE_PERIOD * 1000);
+	}
+
+	for (unsigned i = 0; i < numStations; i++) {
+		if (!sendBatch (stations[i], compact, datagrams, bytes)) {
+			failed++;
+		}
+	}
+	elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+	start = Clock::now();
+	while (Clock::now() - start < std::chrono::milliseconds(ACK_WAIT)) {
+		readAcks (stations);
+		usleep (PACE_PERIOD * 1000);
+	}
+	for (unsigned i = 0; i < numStations; i++) {
+		unacked += (uint16_t)(stations[i].sequence - stations[i].acked);
+		close (stations[i].fd);
+	}
+
+	printf ("%lu punches in %lu datagrams in %.2f s: %.0f punches/s (%u stations, %u cards)\n",
+		made, datagrams, elapsed, made / elapsed, numStations, numCards);
+	printf ("%lu batches not sent, %lu punches not acknowledged, %.1f bytes per punch\n",
+		failed, unacked, made ? (double)bytes / made : 0.0);
+	if (made == total) {
+		printf ("Every card is full (%d punches): run ended before %lu s\n", CARD_PUNCHES,
+			seconds);
+	}
+
+	return 0;
+
+}
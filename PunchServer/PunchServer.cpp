@@ -0,0 +1,785 @@
+/*********************************************************************************************/
+/*
+ * Punch ingestion server PC library (Linux)
+ *
+ *  This library receives, verifies & saves the punches sent by NB-IoT stations.
+*/
+/*********************************************************************************************/
+
+
+#include "PunchServer.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+#define UDP_INDEX			((uint64_t)-1)	// epoll data of UDP socket
+#define LISTEN_INDEX		((uint64_t)-2)	// epoll data of TCP listener
+#define UDP_BUFFER			(16 << 20)	// Receive buffer of UDP socket, for bursts
+#define EXPIRE_PERIOD		1000		// Ms between searches of expired punches
+#define FLUSH_WAIT			10			// Max ms of epoll_wait while a subscriber has output
+#define CAT_SIZE			15			// Size in bytes of category field in card
+
+
+PunchServer::PunchServer (PunchStore &store, FILE *log) : store(store), log(log),
+	histories(STORE_STATIONS), logFd(-1), udpFd(-1), listenFd(-1),
+	epollFd(epoll_create1 (0)), replaying(false), running(false), start(Clock::now()) {
+
+	memset (hasKey, 0, sizeof(hasKey));
+	memset (stations, 0, sizeof(stations));
+	memset (&counters, 0, sizeof(counters));
+
+}
+
+
+PunchServer::~PunchServer () {
+
+	for (size_t i = 0; i < subscribers.size(); i++) {
+		close (subscribers[i].fd);
+	}
+	if (udpFd >= 0) {
+		close (udpFd);
+	}
+	if (listenFd >= 0) {
+		close (listenFd);
+	}
+	if (logFd >= 0) {
+		close (logFd);
+	}
+	if (epollFd >= 0) {
+		close (epollFd);
+	}
+
+}
+
+
+// Loads the key table exported by the Master: number of stations & 32 bytes key of each one
+bool PunchServer::loadKeys (const char *path) {
+
+	uint8_t table [1 + MAX_STATIONS * STATION_REC_SIZE];
+	FILE *file = fopen (path, "rb");
+	size_t len;
+
+	if (file == NULL) {
+		return false;
+	}
+	len = fread (table, 1, sizeof(table), file);
+	fclose (file);
+
+	if (len < 1 || len != 1 + (size_t)table[0] * STATION_REC_SIZE) {
+		return false;
+	}
+
+	multi.setKeys ((const uint8_t (*)[STATION_REC_SIZE])&table[1], table[0]);
+	for (uint16_t i = 0; i < STORE_STATIONS; i++) {
+		hasKey[i] = i < table[0];
+	}
+	memset (table, 0, sizeof(table));	// Cleans keys from memory
+
+	return true;
+
+}
+
+
+/* Loads the start list of MasterConsole: one runner per line with "name,category[,UID]".
+	Cards with UID have their category block as previous block of the first punch, like
+	PlayerCard writes it (NB set to 0). Call it before open() */
+bool PunchServer::loadStartList (const char *path) {
+
+	FILE *file = fopen (path, "r");
+	char line [256];
+
+	if (file == NULL) {
+		return false;
+	}
+
+	while (fgets (line, sizeof(line), file) != NULL) {
+		char *name = strtok (line, ",\r\n");
+		char *category = strtok (NULL, ",\r\n");
+		char *uid = strtok (NULL, ",\r\n");
+
+		if (name == NULL || name[0] == '#' || uid == NULL) {
+			continue;
+		}
+
+		Card &card = cards[(uint32_t)strtoul (uid, NULL, 16)];
+		card.chained = true;
+		card.touched = false;
+		memset (card.last, 0, sizeof(card.last));
+		if (category != NULL) {
+			strncpy ((char *)&card.last[1], category, CAT_SIZE - 1);
+		}
+	}
+
+	fclose (file);
+	return true;
+
+}
+
+
+/* Opens the ingest log of the store directory and reads it again, so cards & stations are
+	as before last stop */
+bool PunchServer::open (const char *dir) {
+
+	std::string path = std::string (dir) + "/" + INGEST_LOG;
+
+	logFd = ::open (path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (logFd < 0) {
+		return false;
+	}
+
+	return replay ();
+
+}
+
+
+// Opens the UDP socket of stations & the TCP listener of subscribers
+bool PunchServer::listen (uint16_t udpPort, uint16_t subscriberPort) {
+
+	struct sockaddr_in address;
+	struct epoll_event event;
+	int size = UDP_BUFFER;
+	int yes = 1;
+
+	memset (&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl (INADDR_ANY);
+	memset (&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+
+	udpFd = socket (AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	address.sin_port = htons (udpPort);
+	if (udpFd < 0 || bind (udpFd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+		return false;
+	}
+	// Bigger than allowed by net.core.rmem_max only as root. Default is kept otherwise
+	if (setsockopt (udpFd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) != 0) {
+		setsockopt (udpFd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	}
+	event.data.u64 = UDP_INDEX;
+	if (epoll_ctl (epollFd, EPOLL_CTL_ADD, udpFd, &event) != 0) {
+		return false;
+	}
+
+	if (subscriberPort == 0) {
+		return true;
+	}
+
+	listenFd = socket (AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	address.sin_port = htons (subscriberPort);
+	if (listenFd < 0 || setsockopt (listenFd, SOL_SOCKET, SO_REUSEADDR, &yes,
+		sizeof(yes)) != 0 || bind (listenFd, (struct sockaddr *)&address,
+		sizeof(address)) != 0 || ::listen (listenFd, 16) != 0) {
+		return false;
+	}
+	event.data.u64 = LISTEN_INDEX;
+
+	return epoll_ctl (epollFd, EPOLL_CTL_ADD, listenFd, &event) == 0;
+
+}
+
+
+/* Event loop: reads rounds of datagrams, accepts subscribers and writes them the new
+	punches. Stats are printed each statsPeriodMs */
+void PunchServer::run (int statsPeriodMs) {
+
+	struct epoll_event events [16];
+	Clock::time_point nextStats;
+	Clock::time_point nextExpire;
+	Clock::time_point nextSync;
+	int n;
+
+	running = true;
+	start = Clock::now();
+	nextStats = start + std::chrono::milliseconds(statsPeriodMs);
+	nextExpire = start + std::chrono::milliseconds(EXPIRE_PERIOD);
+	nextSync = start + std::chrono::milliseconds(STORE_SYNC_PERIOD);
+
+	while (running) {
+		Clock::time_point next = std::min (nextStats, std::min (nextExpire, nextSync));
+		long wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+			next - Clock::now()).count();
+		bool waiting = false;			// A subscriber has output
+
+		for (size_t i = 0; i < subscribers.size(); i++) {
+			waiting = waiting || !subscribers[i].output.empty();
+		}
+		if (waiting && wait > FLUSH_WAIT) {
+			wait = FLUSH_WAIT;
+		}
+
+		n = epoll_wait (epollFd, events, 16, wait > 0 ? (int)wait : 0);
+		if (n < 0 && errno != EINTR) {
+			break;
+		}
+
+		for (int i = 0; i < n; i++) {
+			if (events[i].data.u64 == UDP_INDEX) {
+				receive ();
+			} else if (events[i].data.u64 == LISTEN_INDEX) {
+				accept ();
+			} else {
+				// Subscribers don't send anything: data is dropped, end closes it
+				for (size_t s = 0; s < subscribers.size(); s++) {
+					if ((uint64_t)subscribers[s].fd == events[i].data.u64) {
+						char buffer [256];
+						if (read (subscribers[s].fd, buffer, sizeof(buffer)) <= 0) {
+							drop (s);
+						}
+						break;
+					}
+				}
+			}
+		}
+
+		for (size_t i = 0; i < subscribers.size(); ) {
+			size_t before = subscribers.size();
+			flush (i);
+			if (subscribers.size() == before) {
+				i++;
+			}
+		}
+
+		if (Clock::now() >= nextExpire) {
+			expire ();
+			nextExpire += std::chrono::milliseconds(EXPIRE_PERIOD);
+		}
+		if (Clock::now() >= nextSync) {
+			store.sync ();
+			nextSync += std::chrono::milliseconds(STORE_SYNC_PERIOD);
+		}
+		if (Clock::now() >= nextStats) {
+			printStats ();
+			nextStats += std::chrono::milliseconds(statsPeriodMs);
+		}
+	}
+
+	store.sync ();
+	printStats ();
+
+}
+
+
+// Finishes run(). It can be called from a signal handler
+void PunchServer::stop () {
+	running = false;
+}
+
+
+// Prints counters & punches per second since run() started
+void PunchServer::printStats () {
+
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	size_t pending = 0;
+
+	for (std::unordered_map<uint32_t, Card>::const_iterator it = cards.begin();
+		it != cards.end(); ++it) {
+		pending += it->second.pending.size();
+	}
+
+	fprintf (log, "--- %.1f s ---\n", seconds);
+	fprintf (log, " %lu datagrams (%lu bad, %lu compact), %lu punches (%.0f/s), %lu "
+		"duplicates, %lu rejected by long UID\n", counters.datagrams, counters.badDatagrams,
+		counters.compact, counters.punches,
+		seconds > 0 ? counters.punches / seconds : 0.0, counters.duplicates,
+		counters.longUids);
+	fprintf (log, " %lu verified, %lu not valid, %zu waiting, %lu restarts, %lu acks in "
+		"%lu rounds, %zu subscribers (%lu dropped)\n", counters.verified, counters.invalid,
+		pending, counters.restarts, counters.acks, counters.rounds, subscribers.size(),
+		counters.dropped);
+	fflush (log);
+
+}
+
+
+const IngestStats &PunchServer::stats () const {
+	return counters;
+}
+
+
+
+
+
+
+// Reads the datagrams waiting in the socket, up to ROUND_DATAGRAMS, and commits them
+void PunchServer::receive () {
+
+	struct mmsghdr messages [RECV_BATCH];
+	struct iovec vectors [RECV_BATCH];
+	unsigned count = 0;
+	int n;
+
+	for (int i = 0; i < RECV_BATCH; i++) {
+		vectors[i].iov_base = datagrams[i];
+		vectors[i].iov_len = DATAGRAM_MAX;
+		memset (&messages[i], 0, sizeof(messages[i]));
+		messages[i].msg_hdr.msg_iov = &vectors[i];
+		messages[i].msg_hdr.msg_iovlen = 1;
+		messages[i].msg_hdr.msg_name = &addresses[i];
+	}
+
+	while (count < ROUND_DATAGRAMS) {
+		for (int i = 0; i < RECV_BATCH; i++) {
+			messages[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+		}
+		n = recvmmsg (udpFd, messages, RECV_BATCH, MSG_DONTWAIT, NULL);
+		if (n <= 0) {
+			break;
+		}
+		for (int i = 0; i < n; i++) {
+			datagram (datagrams[i], messages[i].msg_len, addresses[i]);
+		}
+		count += n;
+		if (n < RECV_BATCH) {
+			break;						// Socket is empty
+		}
+	}
+
+	if (count > 0) {
+		resolve ();
+		commit ();
+	}
+
+}
+
+
+/* Handles a batch: every punch marks its sequence number, new ones wait in their card to be
+	verified. All punches of a batch must come from a station with key */
+void PunchServer::datagram (const uint8_t *data, size_t length, const struct sockaddr_in &from) {
+
+	DatagramPunch punches [BATCH_PUNCHES_MAX];
+	uint16_t sequence;
+	uint8_t station;
+	int count;
+
+	counters.datagrams++;
+
+	count = parseBatch (data, length, punches, sequence, histories.data());
+	if (count <= 0) {
+		counters.badDatagrams++;
+		return;
+	}
+	if ((data[0] >> 4) == PUNCH_COMPACT_VERSION) {
+		counters.compact++;
+	}
+	station = punches[0].block[0];
+	for (int i = 0; i < count; i++) {
+		if (punches[i].block[0] != station || !hasKey[station]) {
+			counters.badDatagrams++;
+			return;
+		}
+	}
+
+	// MACs cover 4 bytes UIDs only: a longer one can't be verified nor saved. The batch isn't
+	// acknowledged, so the station keeps its punches instead of dropping them
+	for (int i = 0; i < count; i++) {
+		if (punches[i].uidLength != PUNCH_UID_MIN) {
+			counters.longUids += count;
+			return;
+		}
+	}
+
+	for (int i = 0; i < count; i++) {
+		bool isNew = false;
+
+		counters.punches++;
+		if (addPunch (uidValue (punches[i].uid), punches[i].block)) {
+			isNew = true;
+			logPunch (punches[i], sequence + i);
+		} else {
+			counters.duplicates++;
+		}
+		received (station, sequence + i, isNew);
+		historyAdd (histories[station], sequence + i, punches[i]);
+	}
+
+	stations[station].ack = true;
+	stations[station].address = from;
+
+}
+
+
+/* Marks a sequence number of a station. Numbers behind the oldest missing one are punches
+	sent again, unless they are new: then, like numbers too far ahead, the station started a
+	new outbox (i.e. its EEPROM was cleared) */
+void PunchServer::received (uint8_t station, uint16_t sequence, bool isNew) {
+
+	Station &state = stations[station];
+	uint16_t distance;
+
+	if (!state.known) {
+		state.known = true;
+		state.next = sequence;
+		state.received = 0;
+	}
+
+	distance = sequence - state.next;
+	if (distance >= 0x8000 && !isNew) {
+		return;
+	}
+	if (distance >= SEQUENCE_AHEAD) {
+		counters.restarts++;
+		state.next = sequence;
+		state.received = 0;
+		distance = 0;
+	}
+
+	state.received |= (uint64_t)1 << distance;
+	while (state.received & 1) {
+		state.received >>= 1;
+		state.next++;
+	}
+
+}
+
+
+/* Adds a punch to the ones waiting in its card, unless it's in the store or waiting
+	already. Return false if it's a duplicate */
+bool PunchServer::addPunch (uint32_t uid, const uint8_t *block) {
+
+	Card &card = cards[uid];			// New cards aren't chained
+	Pending punch;
+	uint32_t time;
+
+	for (size_t i = 0; i < card.pending.size(); i++) {
+		if (memcmp (card.pending[i].block, block, 5) == 0) {	// IDS & time
+			return false;
+		}
+	}
+	memcpy (&time, &block[1], sizeof(time));	// Little endian like in AVR
+	if (!replaying && inStore (uid, block[0], time)) {
+		return false;
+	}
+
+	memcpy (punch.block, block, PUNCH_BLOCK_SIZE);
+	punch.arrival = Clock::now();
+	card.pending.push_back (punch);
+	if (!card.touched) {
+		card.touched = true;
+		touched.push_back (uid);
+	}
+
+	return true;
+
+}
+
+
+// Adds the record of a punch to the ingest log of this round
+void PunchServer::logPunch (const DatagramPunch &punch, uint16_t sequence) {
+
+	uint8_t record [INGEST_RECORD_SIZE];
+	uint16_t crc;
+
+	if (replaying) {
+		return;
+	}
+
+	memset (record, 0, sizeof(record));
+	record[0] = punch.uidLength;
+	memcpy (&record[1], punch.uid, punch.uidLength);
+	memcpy (&record[1 + PUNCH_UID_MAX], punch.block, PUNCH_BLOCK_SIZE);
+	record[1 + PUNCH_UID_MAX + PUNCH_BLOCK_SIZE] = sequence & 0xFF;
+	record[2 + PUNCH_UID_MAX + PUNCH_BLOCK_SIZE] = sequence >> 8;
+	crc = datagramCrc (record, INGEST_RECORD_SIZE - 2);
+	record[INGEST_RECORD_SIZE - 2] = crc & 0xFF;
+	record[INGEST_RECORD_SIZE - 1] = crc >> 8;
+
+	logBuffer.insert (logBuffer.end(), record, record + sizeof(record));
+
+}
+
+
+/* Verifies the punches waiting in touched cards against the last block of each card, all
+	MACs at once. A verified punch is the last block of its card, so the rest of punches of
+	the card are tried again with it, until no punch is verified */
+void PunchServer::resolve () {
+
+	std::vector<MacInput> inputs;
+	std::vector<std::pair<uint32_t, size_t> > punches;	// Card & pending punch of each input
+	std::vector<std::pair<uint32_t, size_t> > matches;	// First match of each card
+	std::vector<uint32_t> work;
+	std::vector<uint8_t> macs;
+
+	work.swap (touched);
+	for (size_t i = 0; i < work.size(); i++) {
+		cards[work[i]].touched = false;
+	}
+
+	while (!work.empty()) {
+		inputs.clear ();
+		punches.clear ();
+		for (size_t i = 0; i < work.size(); i++) {
+			Card &card = cards[work[i]];
+			if (!card.chained) {
+				continue;
+			}
+			for (size_t p = 0; p < card.pending.size(); p++) {
+				MacInput input;
+				input.station = card.pending[p].block[0];
+				for (uint8_t b = 0; b < 4; b++) {
+					input.message[b] = work[i] >> (8 * (3 - b));
+				}
+				memcpy (&input.message[4], card.pending[p].block, 5);	// IDS & time
+				memcpy (&input.message[9], card.last, PUNCH_BLOCK_SIZE);
+				inputs.push_back (input);
+				punches.push_back (std::make_pair (work[i], p));
+			}
+		}
+
+		macs.resize (inputs.size() * AUTH_IN_CARD_SIZE);
+		multi.computeMacs (inputs.data(), inputs.size(),
+			(uint8_t (*)[AUTH_IN_CARD_SIZE])macs.data());
+
+		// Two punches can't follow the same block: only the first match of a card is taken
+		matches.clear ();
+		for (size_t i = 0; i < punches.size(); i++) {
+			const Pending &punch = cards[punches[i].first].pending[punches[i].second];
+			if ((matches.empty() || matches.back().first != punches[i].first) &&
+				memcmp (&macs[i * AUTH_IN_CARD_SIZE], &punch.block[5], PUNCH_MAC_SIZE) == 0) {
+				matches.push_back (punches[i]);
+			}
+		}
+
+		work.clear ();
+		for (size_t i = 0; i < matches.size(); i++) {
+			Card &card = cards[matches[i].first];
+			memcpy (card.last, card.pending[matches[i].second].block, PUNCH_BLOCK_SIZE);
+			card.pending.erase (card.pending.begin() + matches[i].second);
+			save (matches[i].first, card.last, true);
+			if (!card.pending.empty()) {
+				work.push_back (matches[i].first);
+			}
+		}
+	}
+
+}
+
+
+// Appends a punch to the store and to the output of subscribers
+void PunchServer::save (uint32_t uid, const uint8_t *block, bool valid) {
+
+	uint32_t time;
+	char line [48];
+
+	memcpy (&time, &block[1], sizeof(time));
+
+	if (valid) {
+		counters.verified++;
+	} else {
+		counters.invalid++;
+	}
+	if (replaying && inStore (uid, block[0], time)) {
+		return;							// Saved before last stop
+	}
+
+	store.append (uid, block[0], time, valid, SOURCE_NBIOT);
+
+	snprintf (line, sizeof(line), "%08X,%u,%u,%u\n", uid, block[0], time, valid ? 1 : 0);
+	for (size_t i = 0; i < subscribers.size(); i++) {
+		subscribers[i].output += line;
+	}
+
+}
+
+
+/* Saves as not valid the punches that have waited PENDING_TIMEOUT for the previous one of
+	their card. The oldest one is the last block of its card, so next ones can be verified */
+void PunchServer::expire () {
+
+	Clock::time_point limit = Clock::now() - std::chrono::milliseconds(PENDING_TIMEOUT);
+
+	for (std::unordered_map<uint32_t, Card>::iterator it = cards.begin(); it != cards.end();
+		++it) {
+		Card &card = it->second;
+		bool expired = false;
+
+		while (!card.pending.empty() && card.pending[0].arrival <= limit) {
+			memcpy (card.last, card.pending[0].block, PUNCH_BLOCK_SIZE);
+			card.chained = true;
+			card.pending.erase (card.pending.begin());
+			save (it->first, card.last, false);
+			expired = true;
+		}
+		if (expired && !card.pending.empty() && !card.touched) {
+			card.touched = true;
+			touched.push_back (it->first);
+		}
+	}
+
+	resolve ();
+
+}
+
+
+/* Makes the records of this round durable and then acknowledges the batches of each
+	station with the oldest number not received */
+void PunchServer::commit () {
+
+	uint8_t ack [PUNCH_ACK_SIZE];
+
+	if (!logBuffer.empty()) {
+		size_t written = 0;
+		while (written < logBuffer.size()) {
+			ssize_t n = write (logFd, &logBuffer[written], logBuffer.size() - written);
+			if (n <= 0) {
+				perror (INGEST_LOG);
+				logBuffer.clear ();
+				return;					// No acknowledgement: stations send them again
+			}
+			written += n;
+		}
+		fdatasync (logFd);
+		logBuffer.clear ();
+	}
+	counters.rounds++;
+
+	for (uint16_t i = 0; i < STORE_STATIONS; i++) {
+		if (stations[i].ack) {
+			stations[i].ack = false;
+			buildAck (ack, stations[i].next);
+			sendto (udpFd, ack, sizeof(ack), 0, (struct sockaddr *)&stations[i].address,
+				sizeof(stations[i].address));
+			counters.acks++;
+		}
+	}
+
+}
+
+
+// Accepts a subscriber. It gets the punches saved from now on
+void PunchServer::accept () {
+
+	struct epoll_event event;
+	Subscriber subscriber;
+
+	subscriber.fd = accept4 (listenFd, NULL, NULL, SOCK_NONBLOCK);
+	if (subscriber.fd < 0) {
+		return;
+	}
+
+	memset (&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.u64 = subscriber.fd;
+	if (epoll_ctl (epollFd, EPOLL_CTL_ADD, subscriber.fd, &event) != 0) {
+		close (subscriber.fd);
+		return;
+	}
+	subscribers.push_back (subscriber);
+
+}
+
+
+// Writes the output of a subscriber without waiting. Drops it if too much is waiting
+void PunchServer::flush (size_t index) {
+
+	Subscriber &subscriber = subscribers[index];
+	ssize_t n;
+
+	if (subscriber.output.empty()) {
+		return;
+	}
+
+	n = send (subscriber.fd, subscriber.output.data(), subscriber.output.size(),
+		MSG_NOSIGNAL);
+	if (n > 0) {
+		subscriber.output.erase (0, n);
+	} else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+		drop (index);
+		return;
+	}
+
+	if (subscriber.output.size() > SUBSCRIBER_BUFFER) {
+		counters.dropped++;
+		drop (index);
+	}
+
+}
+
+
+void PunchServer::drop (size_t index) {
+
+	epoll_ctl (epollFd, EPOLL_CTL_DEL, subscribers[index].fd, NULL);
+	close (subscribers[index].fd);
+	subscribers.erase (subscribers.begin() + index);
+
+}
+
+
+/* Reads the ingest log again like the datagrams it comes from. A record cut by a crash
+	ends the log: it's removed so next records are appended after the valid ones */
+bool PunchServer::replay () {
+
+	uint8_t records [1024 * INGEST_RECORD_SIZE];
+	off_t valid = 0;
+	ssize_t n = 0;
+	bool end = false;
+
+	if (lseek (logFd, 0, SEEK_SET) != 0) {
+		return false;
+	}
+
+	replaying = true;
+	while (!end && (n = read (logFd, records, sizeof(records))) > 0) {
+		for (ssize_t offset = 0; offset < n; offset += INGEST_RECORD_SIZE) {
+			const uint8_t *record = &records[offset];
+			DatagramPunch punch;
+			uint16_t sequence;
+			bool isNew = false;
+
+			if (n - offset < INGEST_RECORD_SIZE || datagramCrc (record,
+				INGEST_RECORD_SIZE - 2) != (record[INGEST_RECORD_SIZE - 2] |
+				record[INGEST_RECORD_SIZE - 1] << 8) || record[0] < PUNCH_UID_MIN ||
+				record[0] > PUNCH_UID_MAX) {
+				end = true;
+				break;
+			}
+
+			punch.uidLength = record[0];
+			memcpy (punch.uid, &record[1], PUNCH_UID_MAX);
+			memcpy (punch.block, &record[1 + PUNCH_UID_MAX], PUNCH_BLOCK_SIZE);
+			sequence = record[1 + PUNCH_UID_MAX + PUNCH_BLOCK_SIZE] |
+				record[2 + PUNCH_UID_MAX + PUNCH_BLOCK_SIZE] << 8;
+			if (punch.uidLength == PUNCH_UID_MIN) {	// Logs of older versions had long UIDs
+				isNew = addPunch (uidValue (punch.uid), punch.block);
+			}
+			received (punch.block[0], sequence, isNew);
+			historyAdd (histories[punch.block[0]], sequence, punch);
+			valid += INGEST_RECORD_SIZE;
+		}
+		resolve ();
+	}
+	replaying = false;
+
+	if (n < 0 || ftruncate (logFd, valid) != 0) {
+		return false;
+	}
+	memset (&counters, 0, sizeof(counters));	// Counters are of this run
+
+	return true;
+
+}
+
+
+// Returns true if the store has a punch of the card in the station at that time
+bool PunchServer::inStore (uint32_t uid, uint8_t station, uint32_t time) const {
+
+	for (uint32_t i = store.firstByUid (uid); i != NO_PUNCH; i = store.nextByUid (i)) {
+		if (store.stations()[i] == station && store.times()[i] == time) {
+			return true;
+		}
+	}
+
+	return false;
+
+}
+
+
+uint32_t PunchServer::uidValue (const uint8_t *uid) {
+	return (uint32_t)uid[0] << 24 | (uint32_t)uid[1] << 16 | (uint32_t)uid[2] << 8 | uid[3];
+}
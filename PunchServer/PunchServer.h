@@ -0,0 +1,172 @@
+/*********************************************************************************************/
+/*
+ * Punch ingestion server PC library (Linux)
+ *
+ *  Receives the batches of punches sent by NB-IoT stations (SodaqNBIoT) in a UDP socket,
+ *	verifies them, saves them in a PunchStore and sends each new punch to the subscribers
+ *	connected by TCP, as a line "UID,station,time,valid". One epoll instance waits the UDP
+ *	socket, the TCP listener & subscribers; datagrams are read with recvmmsg, many per call.
+ *
+ *	Verification: the MAC of a punch is BLAKE2s with the key of its station over UID, IDS,
+ *	time & previous block of the card (see PlayerCard::generateMac). The previous block is
+ *	the last punch of the same card, maybe sent by another station, or the category block
+ *	of the card for its first punch (known if the card is in the start list). A punch waits
+ *	in its card until the previous one arrives; each time a punch is verified, the ones
+ *	waiting are tried again. MACs of all the punches of a round are computed at once with
+ *	MultiBlake2s. A punch that waits PENDING_TIMEOUT is saved as not valid and the next
+ *	ones of its card are verified after it.
+ *
+ *	Punches already in the store or waiting with the same UID, station & time are
+ *	duplicates (sent again by a station or read from the card by a Master) and are dropped.
+ *	Only 4 bytes UIDs (Mifare Classic) are accepted, like in the rest of the platform: the
+ *	MAC of PlayerCard & the key of PunchStore cover 4 bytes. Batches can carry UIDs of up to
+ *	7 bytes, but a batch with any of them is rejected (counted in longUids) and not
+ *	acknowledged, so the station keeps its punches in its outbox instead of losing them.
+ *
+ *	Acknowledgements: each station gets the oldest sequence number not received from it
+ *	(see Datagram.h). A batch behind it with new punches, or far ahead of it, means the
+ *	station started a new outbox, so its numbers start again there.
+ *
+ *	Compact batches refer to UIDs of punches received before by their sequence number, so
+ *	the UID of the last UID_HISTORY_SIZE numbers of each station is kept (also when reading
+ *	the ingest log again). A batch that refers to a number not kept is bad: the station
+ *	sends it again without references after its acknowledgement time out.
+ *
+ *	Durability: new punches of a round are appended to the ingest log of the store
+ *	directory and synced before any acknowledgement is sent (group commit), so a station
+ *	never drops a punch the server could lose. When opening, the log is read again to
+ *	rebuild cards & stations; punches already in the store aren't appended twice. The store
+ *	is synced every STORE_SYNC_PERIOD.
+*/
+/*********************************************************************************************/
+
+
+#ifndef __PUNCHSERVER_H__
+#define __PUNCHSERVER_H__
+
+#include "Datagram.h"
+#include "MultiBlake2s.h"
+#include "PunchStore.h"
+
+#include <chrono>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+#define RECV_BATCH			64			// Datagrams of each recvmmsg
+#define ROUND_DATAGRAMS		1024		// Max datagrams of a round (one log sync)
+#define PENDING_TIMEOUT		120000		// Max ms a punch waits for the previous one
+#define STORE_SYNC_PERIOD	1000		// Ms between syncs of the punch store
+#define SUBSCRIBER_BUFFER	(1 << 20)	// Bytes waiting for a subscriber before dropping it
+#define SEQUENCE_AHEAD		64			// Numbers received ahead of the oldest missing one
+#define INGEST_LOG			"ingest.log"	// File in store directory
+#define INGEST_RECORD_SIZE	28			// UID length, UID, block, sequence & CRC
+
+
+typedef std::chrono::steady_clock Clock;
+
+
+// Counters of the server
+struct IngestStats {
+	unsigned long datagrams;			// Datagrams received
+	unsigned long compact;				// Compact batches
+	unsigned long badDatagrams;			// Not a batch, bad CRC or unknown station
+	unsigned long punches;				// Punches in batches, also sent again
+	unsigned long duplicates;
+	unsigned long longUids;				// Punches of batches rejected by UIDs over 4 bytes
+	unsigned long verified;				// Saved with correct MAC
+	unsigned long invalid;				// Saved after PENDING_TIMEOUT
+	unsigned long restarts;				// Stations that started numbers again
+	unsigned long acks;
+	unsigned long rounds;				// Log syncs
+	unsigned long dropped;				// Subscribers too slow
+};
+
+
+class PunchServer {
+public:
+	PunchServer (PunchStore &store, FILE *log);
+	~PunchServer ();
+	bool loadKeys (const char *path);	// Key table exported by Master
+	bool loadStartList (const char *path);	// "name,category,UID" of each card
+	bool open (const char *dir);		// Opens ingest log of the store & reads it again
+	bool listen (uint16_t udpPort, uint16_t subscriberPort);	// Port 0: no subscribers
+	void run (int statsPeriodMs);		// Until stop() or SIGINT / SIGTERM
+	void stop ();
+	void printStats ();
+	const IngestStats &stats () const;
+
+private:
+	// Punch waiting for the previous one of its card
+	struct Pending {
+		uint8_t block [PUNCH_BLOCK_SIZE];
+		Clock::time_point arrival;
+	};
+
+	// State of a card: block that the MAC of its next punch covers
+	struct Card {
+		bool chained;					// False until the previous block is known
+		bool touched;					// In touched list
+		uint8_t last [PUNCH_BLOCK_SIZE];
+		std::vector<Pending> pending;
+	};
+
+	// Sequence numbers of a station
+	struct Station {
+		bool known;
+		uint16_t next;					// Oldest number not received
+		uint64_t received;				// Bit i: next + i received
+		bool ack;						// Acknowledgement due at end of round
+		struct sockaddr_in address;		// Of its last datagram
+	};
+
+	// Subscriber of new punches
+	struct Subscriber {
+		int fd;
+		std::string output;				// Lines not written yet
+	};
+
+	PunchStore &store;
+	FILE *log;
+	MultiBlake2s multi;					// Midstates of station keys
+	bool hasKey [STORE_STATIONS];
+	std::unordered_map<uint32_t, Card> cards;
+	std::vector<uint32_t> touched;		// Cards with new punches in this round
+	Station stations [STORE_STATIONS];
+	std::vector<UidHistory> histories;	// Last UIDs of each station, by sequence number
+	std::vector<Subscriber> subscribers;
+	std::vector<uint8_t> logBuffer;		// Records of this round
+	int logFd;
+	int udpFd;
+	int listenFd;
+	int epollFd;
+	bool replaying;						// Reading ingest log: no logging nor store duplicates
+	volatile bool running;
+	IngestStats counters;
+	Clock::time_point start;
+
+	// Buffers of recvmmsg
+	uint8_t datagrams [RECV_BATCH][DATAGRAM_MAX];
+	struct sockaddr_in addresses [RECV_BATCH];
+
+	void receive ();					// Reads a round of datagrams, then commits it
+	void datagram (const uint8_t *data, size_t length, const struct sockaddr_in &from);
+	void received (uint8_t station, uint16_t sequence, bool isNew);
+	bool addPunch (uint32_t uid, const uint8_t *block);	// False if duplicate
+	void logPunch (const DatagramPunch &punch, uint16_t sequence);
+	void resolve ();					// Verifies punches waiting in touched cards
+	void save (uint32_t uid, const uint8_t *block, bool valid);
+	void expire ();						// Saves punches that waited PENDING_TIMEOUT
+	void commit ();						// Syncs log & sends acknowledgements
+	void accept ();						// New subscriber
+	void flush (size_t index);			// Writes what a subscriber can take
+	void drop (size_t index);
+	bool replay ();						// Reads ingest log again
+	bool inStore (uint32_t uid, uint8_t station, uint32_t time) const;
+	static uint32_t uidValue (const uint8_t *uid);	// First byte as MSB, like PunchStore
+};
+
+#endif
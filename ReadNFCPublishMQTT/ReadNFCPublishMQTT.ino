@@ -2,43 +2,52 @@
 /*
  * ReadNFCPublishMQTT
  * Created by Manuel Montenegro, January 12, 2017.
- * Developed for Manuel Montenegro Final Year Project. 
- * 
- *  This sketch send some data readed from a Mifare Classic 1k NFC card when this is placed 
- *  on the reader.
- *  
- *  Compatible boards with this sketch: Arduino UNO and Genuino 101.
+ * Developed for Manuel Montenegro Bachelor Thesis.
+ *
+ *  Station of the platform that publishes its punches by MQTT through an Ethernet shield,
+ *  instead of NB-IoT like STATION_NBIOT. It's set up by the Master like the rest of stations
+ *  and punches user's cards with PlayerCard.
+ *
+ *  Punches are kept in the EEPROM of the RTC module until the broker acknowledges them
+ *  (QoS 1), so they're published after a lost connection or a reboot too. They go in
+ *  binary batches of PUNCH_BATCH punches, or when the oldest one has waited PUNCH_DELAY ms,
+ *  to topic "/Stations/Station<IDS>" (see MQTTUplink.h). Cards are polled for POLL_TIMEOUT
+ *  ms so MQTT keep alive & reconnections are handled between polls, and the broker never
+ *  holds the loop more than a second.
+ *
+ *  It can be tested with mosquitto in the PC of BROKER_IP and the punch server, which
+ *  receives the batches by BridgePunches (see PunchServer/BridgePunches.cpp):
+ *
+ *    mosquitto -v
+ *    mosquitto_sub -h localhost -t '/Stations/+' -q 1 -c -i bridge -F %x | ./BridgePunches
+ *
+ *  Compatible boards with this sketch: Arduino MEGA with Ethernet shield.
 */
 /*********************************************************************************************/
 
 #include <Ethernet.h>
-#include <MQTTClient.h>
-#include <PN532.h>
+#include <SetUpStations.h>          // Stations' setup library
+#include <PlayerCard.h>             // User's card management library
+#include <MQTTUplink.h>             // Punches published by MQTT library
 
-// In Adafruit PN532 Shield, IRQ pin is attached to digital pin 2
-#define PN532_IRQ       2
-#define PN532_RESET     3    // Not connected by default on the Adafruit NFC Shield
+#define LED_PIN           3         // Digital Pin where is tied LED
+#define CARD_TIMEOUT      1         // Number of seconds between punch
+#define MIFARE_BLOCK_SIZE 16        // Size of each block on Mifare Classic 1k Card
+#define PUNCH_BATCH       8         // Punches published in one message
+#define PUNCH_DELAY       5000      // Max ms a punch waits before being published
+#define POLL_TIMEOUT      50        // Ms waiting a card in each loop
+#define CONNECT_TIMEOUT   1000      // Max ms of TCP connection with broker
 
-#define READ_TIMEOUT    7500 // Time that the NFC reader waits for a card (millisec.)
-#define REREAD_TIMEOUT  5000 // Guard interval for avoiding read the card several times
+#define BROKER_IP       "192.168.48.1"  // PC running mosquitto
+#define BROKER_PORT     1883
+#define CLIENT_ID       "Station1"  // Must be different in each station
 
-// Each authentication key type has a ID number.
-#define keyAType        0    //TODO: this should be in library
-#define keyBType        1 
+PlayerCard card;                    // Manages operation with user cards
+EthernetClient net;                 // Object managing ethernet connection
+MQTTUplink mqtt;                    // Publishes punches to broker
 
-Adafruit_PN532 nfc (PN532_IRQ, PN532_RESET);  // Object managing PN532 module
-EthernetClient net;                           // Object managing ethernet connection
-MQTTClient mqttClient;                        // Object managing MQTT protocol
-
-bool iso14443aCard;           // Flag to check if the card is an ISO 14443A card
-uint8_t uid[7];               // Buffer to store the returned UID
-uint8_t uidLength;            // Length of the UID (depending on card type)
-uint8_t currentblock = 4;     // Counter to keep track of which block we're on
-uint8_t data[16];             // Array to store block data during reads
-char dataHex[33];             // Array to store block data in hexadecimal string
-
-// Keyb of Mifare Classic NFC card of the proyect
-uint8_t keyb[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+uint8_t data [MIFARE_BLOCK_SIZE];
+uint8_t idUser [7];
 
 // MAC and IP address of the network card
 byte mac[] = {0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
@@ -47,90 +56,50 @@ byte gateway[] = {192, 168, 49, 252};
 byte dnsdir[] = {150, 214, 40, 11};
 byte subnet[] = {255, 255, 254, 0};
 
+void setup() {
 
-void messageReceived (String &topic, String &payload) {
-  
-}
+  pinMode(LED_PIN, OUTPUT);         // Set Up digital pin for LED
 
-// Connects to Shiftr.io platform using the token of the device
-void mqttConnect () {
-    Serial.println("Connecting to Shiftr.io platform...");
-    while (!mqttClient.connect("Arduino", "0785c4b1", "37bd163a173b6c24")) {
-    delay(250);
-  }
-  Serial.println("Connection stablished!");
-}
+  StationNewSetUp stationSetUp;     // Manages the stations' setup
 
-// Converts a byte array to a string of the bytes values formatted in hexadecimal
-// Buffer must be an array with length (2 * length of array + 1)
-void bytesToHexString(byte array[], unsigned int len, char buffer[]) {
-    for (unsigned int i = 0; i < len; i++)
-    {
-        byte nib1 = (array[i] >> 4) & 0x0F;
-        byte nib2 = (array[i] >> 0) & 0x0F;
-        buffer[i*2+0] = nib1  < 0xA ? '0' + nib1  : 'A' + nib1  - 0xA;
-        buffer[i*2+1] = nib2  < 0xA ? '0' + nib2  : 'A' + nib2  - 0xA;
-    }
-    buffer[len*2] = '\0';
-}
+  digitalWrite(LED_PIN, HIGH);      // Turn on LED for indicating set up period has started
 
+  stationSetUp.startNewSetUp ();    // Starts the process of setting up station
 
-void setup() {
+  digitalWrite (LED_PIN, LOW);      // Turn off LED for indicating set up period has finished
 
-  // Setting serial port baudrate
-  Serial.begin (115200);
+  stationSetUp.precomputeKeys ();   // Key pair for next event, while station is carried out
 
-  // Wait until serial port is stablished (necessary for Genuino 101)
-  while (!Serial);
+  card.begin();
 
-  nfc.begin();   // I2C initialization & resets PN532 module
-  
-  // Check if PN532 is correctly connected to Arduino pins
-  uint32_t versiondata = nfc.getFirmwareVersion();
-  if (! versiondata) {
-    Serial.println("Didn't find PN532 board");
-    while (1); // halt
-  }
+  Ethernet.begin(mac, ip, dnsdir, gateway, subnet); // Ethernet connection initialization
+  net.setConnectionTimeout (CONNECT_TIMEOUT);       // Unreachable broker doesn't hold loop
 
-  nfc.SAMConfig();  // Configure the Secure Access Module of PN532
+  mqtt.setBatch (PUNCH_BATCH, PUNCH_DELAY);
+  mqtt.begin (BROKER_IP, BROKER_PORT, net, CLIENT_ID);  // Retried in loop() if it fails
 
-  Ethernet.begin(mac, ip, dnsdir, gateway, subnet); // Ethernet connection initialization
-  mqttClient.begin("broker.shiftr.io", net);        // MQTT client initialization
-  mqttConnect ();                                   // Connection to shiftr.io namespace
-  
 }
 
 void loop() {
 
-  // Send messages and check for incoming messages from MQTT
-  mqttClient.loop();
+  unsigned long punchTime;
 
-  // Check if connection is still stablished
-  if (!mqttClient.connected()) {
-    mqttConnect();
-  }
+  mqtt.process ();
+
+  if ( card.punch(data, idUser, POLL_TIMEOUT) ) {
+
+    digitalWrite (LED_PIN, HIGH);
+    delay (50);
+    digitalWrite (LED_PIN, LOW);
+    delay(50);
 
-  // Wait until a valid card is placed on the reader or elapse a timeout
-  // If the sketch blocks more than 15 seconds here, Shiftr.io will disconnect the device
-  iso14443aCard = nfc.readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, &uidLength, READ_TIMEOUT);
-
-  // If the UID has been readed correctly and the card type is valid...
-  // (Mifare Classic 1K has a UID length of 4 bytes)
-  if ( iso14443aCard && (uidLength == 4) ) {
-    
-    //Authenticates block sector that is going to be readed
-    if ( nfc.mifareclassic_AuthenticateBlock (uid, uidLength, currentblock, keyBType, keyb) ) {
-
-      // Reads the entire block
-      if ( nfc.mifareclassic_ReadDataBlock(currentblock, data) ) {
-        
-        // formats the byte array to a string of the bytes values expressed in hex
-        bytesToHexString (data, sizeof(data), dataHex);
-        // sends the block readed
-        mqttClient.publish("/Stations/Station1", dataHex);
-        
-      }
+    mqtt.queuePunch (data, idUser);
+
+    punchTime = millis();           // Waits between punches keeping MQTT connection
+    while (millis() - punchTime < CARD_TIMEOUT*1000UL) {
+      mqtt.process ();
     }
+
   }
-}
 
+}
@@ -0,0 +1,251 @@
+/*********************************************************************************************/
+/*
+ * BenchResults
+ * 
+ *  Synthetic benchmark of the results engine. It creates an event with R runners split in K
+ *	categories, each one with a course of C controls, simulates all the punches of the race
+ *	and feeds them to the engine in time order, like they would arrive live. After each
+ *	punch the position of the runner is queried, like a live results screen does. It prints
+ *	the sustained ingest rate and the podium of each category. Then the same punches are fed
+ *	shuffled to a new engine, like several Masters & stations would send them, and its
+ *	results must be the same ones (exit code 1 if they aren't).
+ *
+ *	After that, the card of each runner (its punches plus some extra ones, with a control
+ *	missing in 1 of each 20 cards) is validated with the linear course of its category, and
+ *	the number of cards validated per second is printed.
+ *
+ *	Usage: BenchResults [-r 10000] [-c 60] [-k 8]
+ *
+ *	Build: g++ -O2 -std=c++11 BenchResults.cpp ResultsEngine.cpp Course.cpp -o BenchResults
+*/
+/*********************************************************************************************/
+
+
+#include "ResultsEngine.h"
+#include "Course.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+#define START_TIME			36000		// 10:00:00 in seconds since midnight
+#define START_INTERVAL		1			// Seconds between starts of runners
+#define MIN_LEG_TIME		60			// Min seconds between two controls
+#define MAX_LEG_TIME		600			// Max seconds between two controls
+#define COURSE_STATIONS		250			// Station IDs used by courses
+#define EXTRA_PUNCHES		3			// Punches out of course in each card
+#define MP_RATIO			20			// 1 of each MP_RATIO cards misses a control
+#define VALIDATION_ROUNDS	20			// Times all the cards are validated
+
+
+typedef std::chrono::steady_clock Clock;
+
+
+// Punch of the simulated race
+struct SimPunch {
+	uint32_t time;
+	uint32_t uid;
+	uint8_t station;
+
+	bool operator< (const SimPunch &other) const {
+		return time < other.time;
+	}
+};
+
+
+/* Feeds the punches of the race in random order to a new engine and compares its results with
+	the ones of the live engine. Returns true if they match */
+static bool checkOutOfOrder (const std::vector<std::vector<uint8_t> > &courses,
+	std::vector<SimPunch> race, const ResultsEngine &live, std::mt19937 &rng) {
+
+	ResultsEngine engine;
+	unsigned differ = 0;
+
+	for (size_t i = 0; i < courses.size(); i++) {
+		engine.addCategory (live.categoryName (i), courses[i]);
+	}
+	for (size_t i = 0; i < race.size(); i++) {
+		const Runner *runner = live.findRunner (race[i].uid);
+		if (engine.findRunner (race[i].uid) == NULL) {
+			engine.addRunner (runner->uid, runner->name, runner->category);
+		}
+	}
+
+	std::shuffle (race.begin(), race.end(), rng);
+	for (size_t i = 0; i < race.size(); i++) {
+		engine.addPunch (race[i].uid, race[i].station, race[i].time, true);
+	}
+
+	for (size_t i = 0; i < race.size(); i++) {
+		const Runner *expected = live.findRunner (race[i].uid);
+		const Runner *runner = engine.findRunner (race[i].uid);
+		if (runner->reached != expected->reached || runner->splits != expected->splits ||
+			engine.position (runner->uid) != live.position (runner->uid)) {
+			differ++;
+		}
+	}
+
+	printf ("\nOut of order: %zu punches shuffled, %lu used, results %s (%u differ)\n",
+		race.size(), engine.numPunches(), differ == 0 ? "match" : "DON'T match", differ);
+
+	return differ == 0 && engine.numPunches() == live.numPunches();
+
+}
+
+
+// Validates a card of each runner with the linear course of its category
+static void benchmarkCourses (const std::vector<std::vector<uint8_t> > &courses,
+	unsigned numRunners, std::mt19937 &rng) {
+
+	std::vector<Course> compiled (courses.size());
+	std::vector<std::vector<uint8_t> > cards (numRunners);
+	std::vector<uint32_t> times;
+	std::string error;
+	CourseResult result;
+	Clock::time_point start;
+	double seconds;
+	unsigned ok = 0;
+
+	for (size_t i = 0; i < courses.size(); i++) {
+		std::string definition = "linear";
+		for (size_t c = 0; c < courses[i].size(); c++) {
+			definition += " " + std::to_string (courses[i][c]);
+		}
+		compiled[i].parse (definition, error);
+	}
+
+	for (unsigned i = 0; i < numRunners; i++) {
+		std::vector<uint8_t> &card = cards[i];
+		std::uniform_int_distribution<uint32_t> station (1, COURSE_STATIONS);
+		card = courses[i % courses.size()];
+		for (unsigned e = 0; e < EXTRA_PUNCHES; e++) {
+			std::uniform_int_distribution<size_t> position (1, card.size() - 1);
+			card.insert (card.begin() + position (rng), station (rng));
+		}
+		if (i % MP_RATIO == 0) {
+			card.erase (card.begin() + card.size() / 2);
+		}
+		if (card.size() > times.size()) {
+			times.resize (card.size());
+		}
+	}
+	for (size_t i = 0; i < times.size(); i++) {
+		times[i] = START_TIME + i * MIN_LEG_TIME;
+	}
+
+	start = Clock::now();
+	for (unsigned round = 0; round < VALIDATION_ROUNDS; round++) {
+		for (unsigned i = 0; i < numRunners; i++) {
+			compiled[i % courses.size()].validate (cards[i].data(), times.data(),
+				cards[i].size(), result);
+			ok += result.ok;
+		}
+	}
+	seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	printf ("\nCourse validation: %u cards (%u OK, %u MP) in %.3f s: %.0f cards/s\n",
+		numRunners * VALIDATION_ROUNDS, ok, numRunners * VALIDATION_ROUNDS - ok, seconds,
+		numRunners * VALIDATION_ROUNDS / seconds);
+
+}
+
+
+int main (int argc, char *argv[]) {
+
+	unsigned numRunners = 10000;
+	unsigned numControls = 60;			// Including start & finish
+	unsigned numCategories = 8;
+	std::mt19937 rng (2018);			// Fixed seed: same race in each run
+	std::vector<std::vector<uint8_t> > courses;
+	std::vector<SimPunch> race;
+	std::vector<const Runner *> podium;
+	ResultsEngine engine;
+	Clock::time_point start;
+	double seconds;
+	size_t checksum = 0;				// Sum of positions, so queries aren't optimized away
+	int opt;
+
+	while ((opt = getopt (argc, argv, "r:c:k:")) != -1) {
+		switch (opt) {
+			case 'r': numRunners = strtoul (optarg, NULL, 10); break;
+			case 'c': numControls = strtoul (optarg, NULL, 10); break;
+			case 'k': numCategories = strtoul (optarg, NULL, 10); break;
+			default:
+				fprintf (stderr, "Usage: %s [-r runners] [-c controls] [-k categories]\n",
+					argv[0]);
+				return 2;
+		}
+	}
+	if (numControls < 2 || numControls > COURSE_STATIONS || numCategories == 0) {
+		fprintf (stderr, "Courses need 2 to %u controls and 1 category at least\n",
+			COURSE_STATIONS);
+		return 2;
+	}
+
+	// Each category has its own course: random stations in random order
+	for (unsigned i = 0; i < numCategories; i++) {
+		std::vector<uint8_t> stations;
+		for (unsigned s = 1; s <= COURSE_STATIONS; s++) {
+			stations.push_back (s);
+		}
+		std::shuffle (stations.begin(), stations.end(), rng);
+		stations.resize (numControls);
+		courses.push_back (stations);
+		engine.addCategory ("Category " + std::to_string (i + 1), stations);
+	}
+
+	// Runners & their punches along the course of their category
+	race.reserve ((size_t)numRunners * numControls);
+	for (unsigned i = 0; i < numRunners; i++) {
+		uint32_t uid = 0x10000000 + i;
+		uint16_t category = i % numCategories;
+		uint32_t time = START_TIME + i * START_INTERVAL;
+		std::uniform_int_distribution<uint32_t> leg (MIN_LEG_TIME, MAX_LEG_TIME);
+
+		engine.addRunner (uid, "Runner " + std::to_string (i + 1), category);
+		for (unsigned c = 0; c < numControls; c++) {
+			SimPunch punch = { time, uid, courses[category][c] };
+			race.push_back (punch);
+			time += leg (rng);
+		}
+	}
+	std::stable_sort (race.begin(), race.end());	// Live order, course order per runner
+
+	// Live ingest: each punch updates results & the runner's position is queried
+	start = Clock::now();
+	for (size_t i = 0; i < race.size(); i++) {
+		engine.addPunch (race[i].uid, race[i].station, race[i].time, true);
+		checksum += engine.position (race[i].uid);
+	}
+	seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	printf ("%u runners, %u categories, %u controls: %zu punches in %.3f s\n", numRunners,
+		numCategories, numControls, race.size(), seconds);
+	printf ("%.0f punches/s (%.0f ns per punch & position query)\n", race.size() / seconds,
+		seconds * 1e9 / race.size());
+
+	for (uint16_t i = 0; i < engine.numCategories(); i++) {
+		engine.leaderboard (i, 0, 3, podium);
+		printf ("\n %s\n", engine.categoryName (i).c_str());
+		for (size_t p = 0; p < podium.size(); p++) {
+			uint32_t total = podium[p]->splits.back();
+			printf ("  %zu. %-14s %02X%02X%02X%02X  %u:%02u:%02u\n", p + 1,
+				podium[p]->name.c_str(), podium[p]->uid >> 24, (podium[p]->uid >> 16) & 0xFF,
+				(podium[p]->uid >> 8) & 0xFF, podium[p]->uid & 0xFF, total / 3600,
+				(total / 60) % 60, total % 60);
+		}
+	}
+
+	if (!checkOutOfOrder (courses, race, engine, rng)) {
+		return 1;
+	}
+
+	benchmarkCourses (courses, numRunners, rng);
+
+	return checksum == 0;
+
+}
@@ -0,0 +1,166 @@
+/*********************************************************************************************/
+/*
+ * BenchStore
+ * 
+ *  Benchmark of the punch store with a synthetic event of R runners punching C controls
+ *	(500000 punches by default). It appends all punches in time order syncing each S, like
+ *	Masters saving readouts, then opens the store read-only and times:
+ *	 - a scan of the columns counting valid punches of each station & source
+ *	 - the list of punches of every runner (UID index)
+ *	 - the list of punches of every control (station index)
+ *
+ *	At last, a child process appends punches and dies without closing the store. The time
+ *	of the recovery in next opening and the punches recovered are printed.
+ *
+ *	Directory must not hold a store yet.
+ *
+ *	Usage: BenchStore [-r 10000] [-c 50] [-s 1000] directory
+ *
+ *	Build: g++ -O2 -std=c++11 BenchStore.cpp PunchStore.cpp -o BenchStore
+*/
+/*********************************************************************************************/
+
+
+#include "PunchStore.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+#define EVENT_START			1791950400	// 10:00 of event day
+#define CRASH_PUNCHES		1000		// Punches appended by the child that crashes
+
+
+typedef std::chrono::steady_clock Clock;
+
+
+static double seconds (Clock::time_point start) {
+	return std::chrono::duration<double> (Clock::now() - start).count();
+}
+
+
+int main (int argc, char *argv[]) {
+
+	uint32_t runners = 10000;
+	uint32_t controls = 50;
+	uint32_t syncEach = 1000;
+	PunchStore store;
+	Clock::time_point start;
+	uint64_t sum = 0;					// Keeps compiler from removing queries
+	int opt;
+
+	while ((opt = getopt (argc, argv, "r:c:s:")) != -1) {
+		switch (opt) {
+			case 'r': runners = strtoul (optarg, NULL, 10); break;
+			case 'c': controls = strtoul (optarg, NULL, 10); break;
+			case 's': syncEach = strtoul (optarg, NULL, 10); break;
+			default: optind = argc; break;
+		}
+	}
+	if (optind != argc - 1 || runners == 0 || controls == 0 || controls > 255 ||
+		syncEach == 0) {
+		fprintf (stderr, "Usage: %s [-r runners] [-c controls] [-s sync] directory\n",
+			argv[0]);
+		return 2;
+	}
+	const char *dir = argv[optind];
+
+	// Append .................................................................
+	if (!store.open (dir, false) || store.size() != 0) {
+		fprintf (stderr, "Can't create a new store in %s\n", dir);
+		return 1;
+	}
+	start = Clock::now();
+	for (uint32_t c = 0; c < controls; c++) {
+		for (uint32_t r = 0; r < runners; r++) {
+			// Runner r starts at minute r % 120 & takes 2-5 minutes per control
+			uint32_t time = EVENT_START + (r % 120) * 60 + c * (120 + r % 180);
+			if (!store.append (0x04000000 + r, c + 1, time, r % 97 != 0, SOURCE_READOUT)) {
+				fprintf (stderr, "Can't append punch\n");
+				return 1;
+			}
+			if (store.size() % syncEach == 0) {
+				store.sync ();
+			}
+		}
+	}
+	store.close ();
+	double elapsed = seconds (start);
+	uint32_t total = runners * controls;
+	printf ("Append:     %u punches in %.3f s, %.0f punches/s (sync each %u)\n", total,
+		elapsed, total / elapsed, syncEach);
+
+	// Queries ................................................................
+	if (!store.open (dir, true)) {
+		fprintf (stderr, "Can't open %s\n", dir);
+		return 1;
+	}
+
+	uint32_t perStation [STORE_STATIONS] = { 0 };
+	uint32_t perSource [3] = { 0 };
+	start = Clock::now();
+	const uint8_t *stations = store.stations();
+	const uint8_t *valid = store.valid();
+	const uint8_t *sources = store.sources();
+	for (uint32_t i = 0; i < store.size(); i++) {
+		perStation[stations[i]] += valid[i];
+		perSource[sources[i] % 3]++;
+	}
+	elapsed = seconds (start);
+	printf ("Scan:       %.3f ms, %.0f punches/s (%u valid at control 1)\n", elapsed * 1000,
+		store.size() / elapsed, perStation[1]);
+
+	start = Clock::now();
+	for (uint32_t r = 0; r < runners; r++) {
+		for (uint32_t i = store.firstByUid (0x04000000 + r); i != NO_PUNCH;
+			i = store.nextByUid (i)) {
+			sum += store.times()[i];
+		}
+	}
+	elapsed = seconds (start);
+	printf ("By UID:     %.3f ms, %.1f us per runner\n", elapsed * 1000,
+		elapsed * 1e6 / runners);
+
+	start = Clock::now();
+	for (uint32_t c = 1; c <= controls; c++) {
+		for (uint32_t i = store.firstByStation (c); i != NO_PUNCH; i = store.nextByStation (i)) {
+			sum += store.uids()[i];
+		}
+	}
+	elapsed = seconds (start);
+	printf ("By station: %.3f ms, %.1f us per control\n", elapsed * 1000,
+		elapsed * 1e6 / controls);
+	store.close ();
+
+	// Crash ..................................................................
+	pid_t child = fork ();
+	if (child == 0) {
+		if (!store.open (dir, false)) {
+			_exit (1);
+		}
+		for (uint32_t i = 0; i < CRASH_PUNCHES; i++) {
+			store.append (0x05000000 + i, 1, EVENT_START + 20000 + i, true, SOURCE_NBIOT);
+			if (i == CRASH_PUNCHES / 2) {
+				store.sync ();
+			}
+		}
+		_exit (0);						// Without close()
+	}
+	waitpid (child, NULL, 0);
+
+	start = Clock::now();
+	if (!store.open (dir, false)) {
+		fprintf (stderr, "Can't recover %s\n", dir);
+		return 1;
+	}
+	elapsed = seconds (start);
+	printf ("Recovery:   %.3f ms, %u punches recovered after last sync, %u in store\n",
+		elapsed * 1000, store.recovered(), store.size());
+	store.close ();
+
+	return sum == 0;
+
+}
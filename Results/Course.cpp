@@ -0,0 +1,392 @@
+/*********************************************************************************************/
+/*
+ * Course validation PC library
+ * 
+ *  This library checks that the punches of a card follow the course of its category.
+*/
+/*********************************************************************************************/
+
+
+#include "Course.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// Splits a definition in tokens. Parentheses & '|' are tokens even without spaces
+static std::vector<std::string> tokenize (const std::string &definition) {
+
+	std::string spaced;
+	std::vector<std::string> tokens;
+	std::string token;
+
+	for (size_t i = 0; i < definition.size(); i++) {
+		char c = definition[i];
+		if (c == '(' || c == ')' || c == '|') {
+			spaced += ' ';
+			spaced += c;
+			spaced += ' ';
+		} else {
+			spaced += c;
+		}
+	}
+
+	std::istringstream stream (spaced);
+	while (stream >> token) {
+		tokens.push_back (token);
+	}
+	return tokens;
+
+}
+
+
+// Parses a station ID. Returns false if it isn't a number from 0 to 255
+static bool parseStation (const std::string &token, uint8_t &station) {
+	char *end;
+	unsigned long value = strtoul (token.c_str(), &end, 10);
+	if (token.empty() || *end != '\0' || value >= NUM_STATIONS) {
+		return false;
+	}
+	station = value;
+	return true;
+}
+
+
+Course::Course () : type(COURSE_LINEAR), length(0), start(0), finish(0), limit(0) {
+	memset (points, 0, sizeof(points));
+}
+
+
+// Parses a course definition: type & stations (see Course.h)
+bool Course::parse (const std::string &definition, std::string &error) {
+
+	std::vector<std::string> tokens = tokenize (definition);
+
+	if (tokens.empty()) {
+		error = "missing course type";
+		return false;
+	}
+
+	if (tokens[0] == "score") {
+		type = COURSE_SCORE;
+		return parseScore (tokens, error);
+	} else if (tokens[0] == "linear") {
+		type = COURSE_LINEAR;
+	} else if (tokens[0] == "butterfly") {
+		type = COURSE_BUTTERFLY;
+	} else {
+		error = "unknown course type " + tokens[0];
+		return false;
+	}
+
+	return parseVariations (tokens, error);
+
+}
+
+
+// Score-O: start, finish, limit in minutes (0 for none) & control:points pairs
+bool Course::parseScore (const std::vector<std::string> &tokens, std::string &error) {
+
+	char *end;
+
+	if (tokens.size() < 5 || !parseStation (tokens[1], start) ||
+		!parseStation (tokens[2], finish)) {
+		error = "score course needs start, finish, limit & controls";
+		return false;
+	}
+	limit = strtoul (tokens[3].c_str(), &end, 10) * 60;
+	if (*end != '\0') {
+		error = "wrong time limit " + tokens[3];
+		return false;
+	}
+
+	for (size_t i = 4; i < tokens.size(); i++) {
+		size_t colon = tokens[i].find (':');
+		uint8_t station;
+		long value;
+
+		if (colon == std::string::npos || !parseStation (tokens[i].substr (0, colon), station)) {
+			error = "wrong control " + tokens[i];
+			return false;
+		}
+		value = strtol (tokens[i].c_str() + colon + 1, &end, 10);
+		if (*end != '\0' || value <= 0 || value > 1000) {
+			error = "wrong points in " + tokens[i];
+			return false;
+		}
+		points[station] = value;
+	}
+
+	return true;
+
+}
+
+
+/* Linear & butterfly: every valid order of the controls, saved as chains. Each group of loops
+adds all its permutations, so a course with groups of 2 & 3 loops has 2 * 6 chains */
+bool Course::parseVariations (const std::vector<std::string> &tokens, std::string &error) {
+
+	std::vector<std::vector<uint8_t> > variations (1);
+
+	for (size_t i = 1; i < tokens.size(); i++) {
+		uint8_t station;
+
+		if (tokens[i] == "(") {
+			std::vector<std::vector<uint8_t> > loops (1);
+			std::vector<std::vector<uint8_t> > expanded;
+			std::vector<size_t> order;
+
+			if (type != COURSE_BUTTERFLY) {
+				error = "loops are only allowed in butterfly courses";
+				return false;
+			}
+			for (i++; i < tokens.size() && tokens[i] != ")"; i++) {
+				if (tokens[i] == "|") {
+					loops.push_back (std::vector<uint8_t>());
+				} else if (parseStation (tokens[i], station)) {
+					loops.back().push_back (station);
+				} else {
+					error = "wrong station " + tokens[i];
+					return false;
+				}
+			}
+			if (i == tokens.size()) {
+				error = "missing )";
+				return false;
+			}
+
+			for (size_t l = 0; l < loops.size(); l++) {
+				if (loops[l].empty()) {
+					error = "empty loop";
+					return false;
+				}
+				order.push_back (l);
+			}
+			do {
+				for (size_t v = 0; v < variations.size(); v++) {
+					expanded.push_back (variations[v]);
+					for (size_t l = 0; l < order.size(); l++) {
+						expanded.back().insert (expanded.back().end(), loops[order[l]].begin(),
+							loops[order[l]].end());
+					}
+				}
+				if (expanded.size() > MAX_VARIATIONS) {
+					error = "too many loop orders";
+					return false;
+				}
+			} while (std::next_permutation (order.begin(), order.end()));
+			variations.swap (expanded);
+
+		} else if (parseStation (tokens[i], station)) {
+			for (size_t v = 0; v < variations.size(); v++) {
+				variations[v].push_back (station);
+			}
+
+		} else {
+			error = "wrong station " + tokens[i];
+			return false;
+		}
+	}
+
+	if (variations[0].size() < 2) {
+		error = "course needs start & finish";
+		return false;
+	}
+
+	length = variations[0].size();		// All orders have the same controls
+	chains.clear ();
+	for (size_t v = 0; v < variations.size(); v++) {
+		chains.insert (chains.end(), variations[v].begin(), variations[v].end());
+	}
+	start = chains.front();
+	finish = chains[length - 1];
+	return true;
+
+}
+
+
+/* Validates the punches of a card (only the ones with correct MAC), in card order. Linear &
+butterfly run the chains; only mispunched cards need the LCS for finding missing controls */
+void Course::validate (const uint8_t *stations, const uint32_t *times, size_t len,
+	CourseResult &result) const {
+
+	bool started = false;
+	bool finished = false;
+	uint32_t startTime = 0;
+	uint32_t finishTime = 0;
+
+	for (size_t i = 0; i < len; i++) {	// First start punch & last finish punch
+		if (!started && stations[i] == start) {
+			started = true;
+			startTime = times[i];
+		} else if (started && stations[i] == finish) {
+			finished = true;
+			finishTime = times[i];
+		}
+	}
+	result.time = finished ? finishTime - startTime : 0;
+	result.missing.clear ();
+	result.points = 0;
+
+	if (type == COURSE_SCORE) {
+		bool visited [NUM_STATIONS] = { false };
+		result.matched = 0;
+		for (size_t i = 0; i < len; i++) {
+			if (points[stations[i]] > 0 && !visited[stations[i]]) {
+				visited[stations[i]] = true;
+				result.points += points[stations[i]];
+				result.matched++;
+			}
+		}
+		if (limit > 0 && result.time > limit) {
+			result.points -= SCORE_PENALTY * ((result.time - limit + 59) / 60);
+		}
+		result.ok = finished;
+		return;
+	}
+
+	result.ok = false;
+	for (size_t c = 0; c < chains.size() && !result.ok; c += length) {
+		const uint8_t *expected = &chains[c];
+		size_t state = 0;				// Controls of this chain matched
+		for (size_t i = 0; i < len && state < length; i++) {
+			state += (stations[i] == expected[state]);
+		}
+		result.ok = (state == length);
+	}
+
+	if (result.ok) {
+		result.matched = length;
+		return;
+	}
+
+	// Mispunched: chain with more controls in order tells which ones are missing
+	result.matched = 0;
+	for (size_t c = 0; c < chains.size(); c += length) {
+		std::vector<uint8_t> missing;
+		size_t matched = lcs (&chains[c], length, stations, len, &missing);
+		if (c == 0 || matched > result.matched) {
+			result.matched = matched;
+			result.missing.swap (missing);
+		}
+	}
+
+}
+
+
+CourseType Course::getType () const {
+	return type;
+}
+
+
+size_t Course::numVariations () const {
+	return length > 0 ? chains.size() / length : 1;
+}
+
+
+// Length of the longest common subsequence of course & punches. Saves controls out of it
+size_t Course::lcs (const uint8_t *course, size_t courseLen, const uint8_t *stations,
+	size_t len, std::vector<uint8_t> *missing) {
+
+	size_t cols = len + 1;
+	std::vector<uint16_t> table ((courseLen + 1) * cols, 0);
+
+	for (size_t c = 1; c <= courseLen; c++) {
+		for (size_t p = 1; p <= len; p++) {
+			if (course[c - 1] == stations[p - 1]) {
+				table[c * cols + p] = table[(c - 1) * cols + p - 1] + 1;
+			} else {
+				table[c * cols + p] = std::max (table[(c - 1) * cols + p], table[c * cols + p - 1]);
+			}
+		}
+	}
+
+	if (missing != NULL) {				// Walks back the table from the end
+		size_t c = courseLen;
+		size_t p = len;
+		while (c > 0) {
+			if (p > 0 && course[c - 1] == stations[p - 1]) {
+				c--;
+				p--;
+			} else if (p > 0 && table[c * cols + p - 1] == table[c * cols + p]) {
+				p--;
+			} else {
+				missing->push_back (course[--c]);
+			}
+		}
+		std::reverse (missing->begin(), missing->end());
+	}
+
+	return table[courseLen * cols + len];
+
+}
+
+
+// Loads a course file. Error has the line number & the problem
+bool CourseSet::load (const char *path, std::string &error) {
+
+	FILE *file = fopen (path, "r");
+	char line [1024];
+	unsigned number = 0;
+
+	if (file == NULL) {
+		error = std::string("can't open ") + path;
+		return false;
+	}
+
+	while (fgets (line, sizeof(line), file) != NULL) {
+		std::string text (line);
+		number++;
+		if (!add (text.substr (0, text.find ('#')), error)) {
+			error = std::string(path) + ":" + std::to_string (number) + ": " + error;
+			fclose (file);
+			return false;
+		}
+	}
+
+	fclose (file);
+	return true;
+
+}
+
+
+// Adds a line of a course file: "<category>: <course>". Blank lines are skipped
+bool CourseSet::add (const std::string &line, std::string &error) {
+
+	size_t colon = line.find (':');
+	std::string category;
+	Course course;
+
+	if (line.find_first_not_of (" \t\r\n") == std::string::npos) {
+		return true;
+	}
+	if (colon == std::string::npos) {
+		error = "missing ':' after category";
+		return false;
+	}
+
+	category = line.substr (0, colon);
+	category.erase (0, category.find_first_not_of (" \t"));
+	category.erase (category.find_last_not_of (" \t") + 1);
+
+	if (!course.parse (line.substr (colon + 1), error)) {
+		return false;
+	}
+	courses[category] = course;
+	return true;
+
+}
+
+
+const Course *CourseSet::find (const std::string &category) const {
+	std::map<std::string, Course>::const_iterator it = courses.find (category);
+	return it != courses.end() ? &it->second : NULL;
+}
+
+
+size_t CourseSet::size () const {
+	return courses.size();
+}
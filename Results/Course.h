@@ -0,0 +1,100 @@
+/*********************************************************************************************/
+/*
+ * Course validation PC library
+ * 
+ *  This library checks that the punches of a card follow the course of its category. Three
+ *	kinds of courses are supported:
+ *	 - Linear: controls in a fixed order. Extra punches (wrong controls, repeated punches)
+ *	   are allowed, so the course must be a subsequence of the punches. When it isn't, the
+ *	   runner is mispunched (MP) and the missing controls are found with the longest common
+ *	   subsequence (LCS) of course and punches.
+ *	 - Butterfly: like linear, but groups of loops can be run in any order.
+ *	 - Score-O: any control in any order, each one with its points. Points are lost for each
+ *	   started minute over the time limit.
+ *
+ *	Linear & butterfly courses are compiled to chain automata: each valid order of controls
+ *	is a chain whose state is the number of controls matched, and a punch only advances it
+ *	when it's the next expected control. Matching the first occurrence is always optimal for
+ *	a chain, so extra punches never need backtracking. Chains are stored back to back in one
+ *	array of stations, so validating is one comparison per punch and chain and thousands of
+ *	cards are validated per second. A single deterministic automaton for a butterfly isn't
+ *	used: with extra punches allowed, progress in each loop order is independent and the
+ *	number of states grows exponentially.
+ *
+ *	Course file: one category per line (# starts a comment), stations are station IDs. The
+ *	category is the one saved in the cards, so it can have spaces.
+ *
+ *		<category>: linear <start> <control> ... <finish>
+ *		<category>: butterfly <start> <control> ( <loop 1> | <loop 2> ... ) ... <finish>
+ *		<category>: score <start> <finish> <limit in minutes> <control>:<points> ...
+*/
+/*********************************************************************************************/
+
+
+#ifndef __COURSE_H__
+#define __COURSE_H__
+
+#include <map>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+#define NUM_STATIONS		256			// Station IDs are one byte
+#define MAX_VARIATIONS		5040		// Max orders of controls of a butterfly course
+#define SCORE_PENALTY		1			// Points lost per started minute over time limit
+
+
+enum CourseType { COURSE_LINEAR, COURSE_BUTTERFLY, COURSE_SCORE };
+
+
+// Result of validating the punches of a card
+struct CourseResult {
+	bool ok;							// Linear & butterfly: all controls in order.
+										// Score-O: finish punched
+	uint16_t matched;					// Controls of course punched (in order if it applies)
+	std::vector<uint8_t> missing;		// Controls not punched (MP)
+	int points;							// Score-O points after penalty
+	uint32_t time;						// Seconds from start to finish (0 if not punched)
+};
+
+
+class Course {
+public:
+	Course ();
+	bool parse (const std::string &definition, std::string &error);	// Type & stations
+	void validate (const uint8_t *stations, const uint32_t *times, size_t len,
+		CourseResult &result) const;	// Punches in card order
+	CourseType getType () const;
+	size_t numVariations () const;		// Valid orders of controls
+
+private:
+	CourseType type;
+	std::vector<uint8_t> chains;		// Valid orders of controls, one after another
+	size_t length;						// Controls of each order, from start to finish
+	int16_t points [NUM_STATIONS];		// Score-O points of each station
+	uint8_t start;						// Start station
+	uint8_t finish;						// Finish station
+	uint32_t limit;						// Score-O time limit in seconds
+
+	bool parseScore (const std::vector<std::string> &tokens, std::string &error);
+	bool parseVariations (const std::vector<std::string> &tokens, std::string &error);
+	static size_t lcs (const uint8_t *course, size_t courseLen, const uint8_t *stations,
+		size_t len, std::vector<uint8_t> *missing);
+};
+
+
+// Courses of an event by category
+class CourseSet {
+public:
+	bool load (const char *path, std::string &error);	// Loads a course file
+	bool add (const std::string &line, std::string &error);	// Adds a course file line
+	const Course *find (const std::string &category) const;	// NULL if not defined
+	size_t size () const;
+
+private:
+	std::map<std::string, Course> courses;
+};
+
+#endif
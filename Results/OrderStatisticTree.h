@@ -0,0 +1,187 @@
+/*********************************************************************************************/
+/*
+ * Order-statistic tree for PC programs
+ * 
+ *  Ordered set that also answers "how many keys are smaller than this one" (rank) and
+ *	"which is the k-th key" (select) in O(log n). It's a treap (binary search tree with
+ *	random heap priorities) whose nodes keep the size of their subtree. Nodes are saved in
+ *	a vector and linked by index, so erased nodes are reused without new allocations.
+ *
+ *	Key must have operator<. Keys are unique: inserting an existing key does nothing.
+*/
+/*********************************************************************************************/
+
+
+#ifndef __ORDERSTATISTICTREE_H__
+#define __ORDERSTATISTICTREE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+
+template <typename Key>
+class OrderStatisticTree {
+public:
+	OrderStatisticTree () : root(NIL), seed(0x9E3779B9) { }
+
+	// Inserts a key. Returns false if it was already in the tree
+	bool insert (const Key &key) {
+		int32_t left, right, node;
+		if (contains (key)) {
+			return false;
+		}
+		node = newNode (key);
+		split (root, key, false, left, right);
+		root = merge (merge (left, node), right);
+		return true;
+	}
+
+	// Erases a key. Returns false if it wasn't in the tree
+	bool erase (const Key &key) {
+		int32_t left, middle, right;
+		split (root, key, false, left, right);			// left < key <= right
+		split (right, key, true, middle, right);		// middle == key < right
+		if (middle != NIL) {
+			freeNodes.push_back (middle);
+		}
+		root = merge (left, right);
+		return middle != NIL;
+	}
+
+	bool contains (const Key &key) const {
+		int32_t node = root;
+		while (node != NIL) {
+			if (key < nodes[node].key) {
+				node = nodes[node].left;
+			} else if (nodes[node].key < key) {
+				node = nodes[node].right;
+			} else {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Number of keys smaller than the given one (0-based position if it's in the tree)
+	size_t rank (const Key &key) const {
+		size_t smaller = 0;
+		int32_t node = root;
+		while (node != NIL) {
+			if (nodes[node].key < key) {
+				smaller += sizeOf (nodes[node].left) + 1;
+				node = nodes[node].right;
+			} else {
+				node = nodes[node].left;
+			}
+		}
+		return smaller;
+	}
+
+	// k-th smallest key (0-based). k must be less than size()
+	const Key &select (size_t k) const {
+		int32_t node = root;
+		while (true) {
+			size_t leftSize = sizeOf (nodes[node].left);
+			if (k < leftSize) {
+				node = nodes[node].left;
+			} else if (k == leftSize) {
+				return nodes[node].key;
+			} else {
+				k -= leftSize + 1;
+				node = nodes[node].right;
+			}
+		}
+	}
+
+	size_t size () const {
+		return sizeOf (root);
+	}
+
+	void clear () {
+		nodes.clear ();
+		freeNodes.clear ();
+		root = NIL;
+	}
+
+private:
+	static const int32_t NIL = -1;		// Index of empty subtree
+
+	struct Node {
+		Key key;
+		uint32_t priority;				// Random. Parent's priority is greater
+		uint32_t size;					// Number of nodes of the subtree
+		int32_t left;					// Index of left child
+		int32_t right;					// Index of right child
+	};
+
+	std::vector<Node> nodes;			// All nodes, including free ones
+	std::vector<int32_t> freeNodes;		// Erased nodes for reusing
+	int32_t root;						// Index of root node
+	uint32_t seed;						// State of priorities generator
+
+	size_t sizeOf (int32_t node) const {
+		return node == NIL ? 0 : nodes[node].size;
+	}
+
+	void update (int32_t node) {
+		nodes[node].size = 1 + sizeOf (nodes[node].left) + sizeOf (nodes[node].right);
+	}
+
+	// xorshift32: priorities only need to be independent of keys
+	uint32_t random () {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		return seed;
+	}
+
+	int32_t newNode (const Key &key) {
+		Node node = { key, random (), 1, NIL, NIL };
+		if (!freeNodes.empty()) {
+			int32_t index = freeNodes.back ();
+			freeNodes.pop_back ();
+			nodes[index] = node;
+			return index;
+		}
+		nodes.push_back (node);
+		return (int32_t)nodes.size() - 1;
+	}
+
+	/* Splits a subtree in keys smaller than key (left) and the rest (right). With orEqual,
+	keys equal to key also go to left */
+	void split (int32_t node, const Key &key, bool orEqual, int32_t &left, int32_t &right) {
+		if (node == NIL) {
+			left = right = NIL;
+			return;
+		}
+		if (nodes[node].key < key || (orEqual && !(key < nodes[node].key))) {
+			split (nodes[node].right, key, orEqual, nodes[node].right, right);
+			left = node;
+		} else {
+			split (nodes[node].left, key, orEqual, left, nodes[node].left);
+			right = node;
+		}
+		update (node);
+	}
+
+	// Merges two subtrees. All keys of left must be smaller than keys of right
+	int32_t merge (int32_t left, int32_t right) {
+		if (left == NIL) {
+			return right;
+		}
+		if (right == NIL) {
+			return left;
+		}
+		if (nodes[left].priority > nodes[right].priority) {
+			nodes[left].right = merge (nodes[left].right, right);
+			update (left);
+			return left;
+		}
+		nodes[right].left = merge (left, nodes[right].left);
+		update (right);
+		return right;
+	}
+};
+
+#endif
@@ -0,0 +1,522 @@
+/*********************************************************************************************/
+/*
+ * Punch store PC library (Linux)
+ * 
+ *  This library saves the punches of an event in memory mapped column files.
+*/
+/*********************************************************************************************/
+
+
+#include "PunchStore.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+
+#define STORE_MAGIC			0x48435550	// "PUCH"
+#define STORE_VERSION		1
+#define UID_INDEX_SLOTS		4096		// Initial slots of UID index (power of 2)
+
+
+// Header saved in meta file
+struct PunchStore::Meta {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;						// Punches appended
+	uint32_t synced;					// Punches durable in disk
+	uint32_t clean;						// 1 if closed properly: indexes are right
+	uint32_t uidSlots;					// Slots of UID index
+	uint32_t uidCount;					// Different UIDs in index
+	uint32_t stationFirst [STORE_STATIONS];
+	uint32_t stationLast [STORE_STATIONS];
+	uint32_t stationCount [STORE_STATIONS];
+};
+
+
+// Entry of UID index. Empty if count is 0
+struct PunchStore::UidSlot {
+	uint32_t uid;
+	uint32_t first;
+	uint32_t last;
+	uint32_t count;
+};
+
+
+// Bytes of each column
+static const size_t columnSize [] = { 4, 4, 1, 1, 1, 4, 4, 4 };
+static const char *columnFile [] = { "uid.col", "time.col", "station.col", "valid.col",
+	"source.col", "check.col", "next_uid.col", "next_station.col" };
+
+
+// Slot of a UID in an index of the given slots (power of 2)
+static inline uint32_t uidHash (uint32_t uid, uint32_t slots) {
+	return (uid * 0x9E3779B1u) >> 7 & (slots - 1);
+}
+
+
+template <typename T> T *PunchStore::column (int col) const {
+	return (T *)columns[col].data;
+}
+
+
+PunchStore::PunchStore () : meta(NULL), readOnly(true), count(0), recoveredPunches(0) {
+	for (int i = 0; i < NUM_COLUMNS; i++) {
+		columns[i].fd = -1;
+		columns[i].data = NULL;
+	}
+	uidIndex.fd = metaFile.fd = -1;
+	uidIndex.data = metaFile.data = NULL;
+}
+
+
+PunchStore::~PunchStore () {
+	close ();
+}
+
+
+// Opens the store in the given directory. Writer creates it if it doesn't exist
+bool PunchStore::open (const char *dir, bool readOnly) {
+
+	std::string path (dir);
+
+	close ();
+	this->readOnly = readOnly;
+	recoveredPunches = 0;
+	if (!readOnly) {
+		mkdir (dir, 0755);
+	}
+
+	if (!openMapping (metaFile, path + "/meta", sizeof(Meta))) {
+		close ();
+		return false;
+	}
+	meta = (Meta *)metaFile.data;
+	if (metaFile.fileSize == 0) {
+		// New store
+		if (readOnly || !growMapping (metaFile, sizeof(Meta))) {
+			close ();
+			return false;
+		}
+		memset (meta, 0, sizeof(Meta));
+		meta->magic = STORE_MAGIC;
+		meta->version = STORE_VERSION;
+		meta->clean = 1;
+		for (int i = 0; i < STORE_STATIONS; i++) {
+			meta->stationFirst[i] = meta->stationLast[i] = NO_PUNCH;
+		}
+	}
+	if (metaFile.fileSize < sizeof(Meta) || meta->magic != STORE_MAGIC ||
+		meta->version != STORE_VERSION) {
+		close ();
+		return false;
+	}
+
+	for (int i = 0; i < NUM_COLUMNS; i++) {
+		if (!openMapping (columns[i], path + "/" + columnFile[i],
+			(size_t)STORE_PUNCHES * columnSize[i])) {
+			close ();
+			return false;
+		}
+	}
+	if (!openMapping (uidIndex, path + "/uid.idx", (size_t)2 * MAX_UIDS * sizeof(UidSlot))) {
+		close ();
+		return false;
+	}
+
+	if (readOnly) {
+		// Writer may be appending. Punches are visible once count is stored
+		count = __atomic_load_n (&meta->count, __ATOMIC_ACQUIRE);
+		return true;
+	}
+
+	// Writer: store is dirty until close(), so a crash is detected in next opening
+	if (!meta->clean || meta->uidSlots == 0) {
+		if (!recover ()) {
+			close ();
+			return false;
+		}
+	}
+	count = meta->count;
+	meta->clean = 0;
+	msync (metaFile.data, metaFile.fileSize, MS_SYNC);
+
+	return true;
+
+}
+
+
+void PunchStore::close () {
+
+	if (meta != NULL && !readOnly) {
+		sync ();
+		meta->clean = 1;
+		msync (metaFile.data, metaFile.fileSize, MS_SYNC);
+	}
+	for (int i = 0; i < NUM_COLUMNS; i++) {
+		closeMapping (columns[i]);
+	}
+	closeMapping (uidIndex);
+	closeMapping (metaFile);
+	meta = NULL;
+	count = 0;
+
+}
+
+
+// Appends a punch. Readers see it once it is in all columns & indexes
+bool PunchStore::append (uint32_t uid, uint8_t station, uint32_t time, bool valid,
+	uint8_t source) {
+
+	if (meta == NULL || readOnly || count >= STORE_PUNCHES) {
+		return false;
+	}
+	if ((size_t)(count + 1) * 4 > columns[COL_UID].fileSize) {
+		size_t punches = ((size_t)count / GROW_PUNCHES + 1) * GROW_PUNCHES;
+		for (int i = 0; i < NUM_COLUMNS; i++) {
+			if (!growMapping (columns[i], punches * columnSize[i])) {
+				return false;
+			}
+		}
+	}
+
+	column<uint32_t>(COL_UID)[count] = uid;
+	column<uint32_t>(COL_TIME)[count] = time;
+	column<uint8_t>(COL_STATION)[count] = station;
+	column<uint8_t>(COL_VALID)[count] = valid;
+	column<uint8_t>(COL_SOURCE)[count] = source;
+	column<uint32_t>(COL_CHECK)[count] = check (count);
+	if (!link (count)) {
+		return false;
+	}
+	count++;
+	__atomic_store_n (&meta->count, count, __ATOMIC_RELEASE);
+
+	return true;
+
+}
+
+
+// Writes appended punches to disk. Then they survive a crash of the computer
+bool PunchStore::sync () {
+
+	if (meta == NULL || readOnly) {
+		return false;
+	}
+	if (meta->synced == count) {
+		return true;
+	}
+
+	for (int i = 0; i < NUM_COLUMNS; i++) {
+		// msync needs an address aligned to a page
+		size_t page = sysconf (_SC_PAGESIZE);
+		size_t from = (size_t)meta->synced * columnSize[i] / page * page;
+		size_t to = (size_t)count * columnSize[i];
+		if (msync (columns[i].data + from, to - from, MS_SYNC) != 0) {
+			return false;
+		}
+	}
+	meta->synced = count;
+
+	return msync (metaFile.data, metaFile.fileSize, MS_SYNC) == 0;
+
+}
+
+
+// Readers take a new snapshot of the punches appended by writer
+uint32_t PunchStore::refresh () {
+	if (meta != NULL && readOnly) {
+		count = __atomic_load_n (&meta->count, __ATOMIC_ACQUIRE);
+	}
+	return count;
+}
+
+
+uint32_t PunchStore::size () const {
+	return count;
+}
+
+
+uint32_t PunchStore::recovered () const {
+	return recoveredPunches;
+}
+
+
+const uint32_t *PunchStore::uids () const {
+	return column<uint32_t>(COL_UID);
+}
+
+
+const uint32_t *PunchStore::times () const {
+	return column<uint32_t>(COL_TIME);
+}
+
+
+const uint8_t *PunchStore::stations () const {
+	return column<uint8_t>(COL_STATION);
+}
+
+
+const uint8_t *PunchStore::valid () const {
+	return column<uint8_t>(COL_VALID);
+}
+
+
+const uint8_t *PunchStore::sources () const {
+	return column<uint8_t>(COL_SOURCE);
+}
+
+
+uint32_t PunchStore::firstByUid (uint32_t uid) const {
+	const UidSlot *slot = findUid (uid);
+	return slot != NULL && slot->first < count ? slot->first : NO_PUNCH;
+}
+
+
+// Lists end at the last punch of the snapshot of readers
+uint32_t PunchStore::nextByUid (uint32_t punch) const {
+	uint32_t next = column<uint32_t>(COL_NEXT_UID)[punch];
+	return next < count ? next : NO_PUNCH;
+}
+
+
+uint32_t PunchStore::countByUid (uint32_t uid) const {
+	const UidSlot *slot = findUid (uid);
+	return slot != NULL ? slot->count : 0;
+}
+
+
+uint32_t PunchStore::firstByStation (uint8_t station) const {
+	uint32_t first = meta != NULL ? meta->stationFirst[station] : NO_PUNCH;
+	return first < count ? first : NO_PUNCH;
+}
+
+
+uint32_t PunchStore::nextByStation (uint32_t punch) const {
+	uint32_t next = column<uint32_t>(COL_NEXT_STATION)[punch];
+	return next < count ? next : NO_PUNCH;
+}
+
+
+uint32_t PunchStore::countByStation (uint8_t station) const {
+	return meta != NULL ? meta->stationCount[station] : 0;
+}
+
+
+// Maps a file reserving the given address space. Only its current size can be accessed
+bool PunchStore::openMapping (Mapping &mapping, const std::string &path, size_t reserved) {
+
+	struct stat info;
+
+	mapping.fd = ::open (path.c_str(), readOnly ? O_RDONLY : O_RDWR | O_CREAT, 0644);
+	if (mapping.fd < 0 || fstat (mapping.fd, &info) != 0) {
+		return false;
+	}
+	mapping.fileSize = info.st_size;
+	mapping.reserved = reserved;
+	mapping.data = (uint8_t *)mmap (NULL, reserved, readOnly ? PROT_READ :
+		PROT_READ | PROT_WRITE, MAP_SHARED, mapping.fd, 0);
+	if (mapping.data == MAP_FAILED) {
+		mapping.data = NULL;
+		return false;
+	}
+
+	return true;
+
+}
+
+
+// Makes the file bigger. New bytes are zero
+bool PunchStore::growMapping (Mapping &mapping, size_t size) {
+	if (size > mapping.reserved || ftruncate (mapping.fd, size) != 0) {
+		return false;
+	}
+	mapping.fileSize = size;
+	return true;
+}
+
+
+void PunchStore::closeMapping (Mapping &mapping) {
+	if (mapping.data != NULL) {
+		munmap (mapping.data, mapping.reserved);
+		mapping.data = NULL;
+	}
+	if (mapping.fd >= 0) {
+		::close (mapping.fd);
+		mapping.fd = -1;
+	}
+}
+
+
+// FNV-1a of the position & fields of a punch. A punch of zeros doesn't match it
+uint32_t PunchStore::check (uint32_t punch) const {
+
+	uint8_t data [15];
+	uint32_t hash = 2166136261u;
+	uint32_t uid = column<uint32_t>(COL_UID)[punch];
+	uint32_t time = column<uint32_t>(COL_TIME)[punch];
+
+	memcpy (&data[0], &punch, 4);
+	memcpy (&data[4], &uid, 4);
+	memcpy (&data[8], &time, 4);
+	data[12] = column<uint8_t>(COL_STATION)[punch];
+	data[13] = column<uint8_t>(COL_VALID)[punch];
+	data[14] = column<uint8_t>(COL_SOURCE)[punch];
+	for (uint8_t i = 0; i < sizeof(data); i++) {
+		hash = (hash ^ data[i]) * 16777619u;
+	}
+
+	return hash;
+
+}
+
+
+const PunchStore::UidSlot *PunchStore::findUid (uint32_t uid) const {
+
+	if (meta == NULL || meta->uidSlots == 0) {
+		return NULL;
+	}
+
+	const UidSlot *slots = (const UidSlot *)uidIndex.data;
+	uint32_t mask = meta->uidSlots - 1;
+
+	// Linear probing
+	for (uint32_t i = uidHash (uid, meta->uidSlots); slots[i].count != 0; i = (i + 1) & mask) {
+		if (slots[i].uid == uid) {
+			return &slots[i];
+		}
+	}
+
+	return NULL;
+
+}
+
+
+// Adds a punch at the end of the lists of its UID & station
+bool PunchStore::link (uint32_t punch) {
+
+	uint32_t uid = column<uint32_t>(COL_UID)[punch];
+	uint8_t station = column<uint8_t>(COL_STATION)[punch];
+	UidSlot *slot = const_cast<UidSlot *>(findUid (uid));
+
+	column<uint32_t>(COL_NEXT_UID)[punch] = NO_PUNCH;
+	column<uint32_t>(COL_NEXT_STATION)[punch] = NO_PUNCH;
+
+	if (slot == NULL) {
+		if ((meta->uidCount + 1) * 2 > meta->uidSlots && !growUidIndex ()) {
+			return false;
+		}
+		UidSlot *slots = (UidSlot *)uidIndex.data;
+		uint32_t i = uidHash (uid, meta->uidSlots);
+		while (slots[i].count != 0) {
+			i = (i + 1) & (meta->uidSlots - 1);
+		}
+		slots[i].uid = uid;
+		slots[i].first = slots[i].last = punch;
+		slots[i].count = 1;
+		meta->uidCount++;
+	} else {
+		column<uint32_t>(COL_NEXT_UID)[slot->last] = punch;
+		slot->last = punch;
+		slot->count++;
+	}
+
+	if (meta->stationFirst[station] == NO_PUNCH) {
+		meta->stationFirst[station] = punch;
+	} else {
+		column<uint32_t>(COL_NEXT_STATION)[meta->stationLast[station]] = punch;
+	}
+	meta->stationLast[station] = punch;
+	meta->stationCount[station]++;
+
+	return true;
+
+}
+
+
+// Doubles the slots of UID index & inserts again the UIDs
+bool PunchStore::growUidIndex () {
+
+	uint32_t slots = meta->uidSlots == 0 ? UID_INDEX_SLOTS : meta->uidSlots * 2;
+	UidSlot *table = (UidSlot *)uidIndex.data;
+	std::vector<UidSlot> used;
+
+	if (slots > 2 * MAX_UIDS) {
+		return false;
+	}
+	for (uint32_t i = 0; i < meta->uidSlots; i++) {
+		if (table[i].count != 0) {
+			used.push_back (table[i]);
+		}
+	}
+	if (!growMapping (uidIndex, (size_t)slots * sizeof(UidSlot))) {
+		return false;
+	}
+	memset (table, 0, (size_t)slots * sizeof(UidSlot));
+	meta->uidSlots = slots;
+
+	for (size_t j = 0; j < used.size(); j++) {
+		uint32_t i = uidHash (used[j].uid, slots);
+		while (table[i].count != 0) {
+			i = (i + 1) & (slots - 1);
+		}
+		table[i] = used[j];
+	}
+
+	return true;
+
+}
+
+
+// Punches up to synced one are in disk. After them, punches with a right check were
+// written before the crash; first wrong one ends the tail. Indexes are built again
+bool PunchStore::recover () {
+
+	size_t capacity = columns[COL_CHECK].fileSize / 4;
+	uint32_t n = meta->synced;
+	uint32_t *checks = column<uint32_t>(COL_CHECK);
+
+	// All columns must have the same capacity
+	for (int i = 0; i < NUM_COLUMNS; i++) {
+		if (columns[i].fileSize / columnSize[i] < capacity) {
+			capacity = columns[i].fileSize / columnSize[i];
+		}
+	}
+	if (n > capacity) {
+		n = capacity;
+	}
+	while (n < capacity && checks[n] == check (n)) {
+		n++;
+	}
+	recoveredPunches = n > meta->synced ? n - meta->synced : 0;
+
+	// Erases the checks of the rest, so old punches don't come back in another crash
+	if (n < capacity) {
+		memset (&checks[n], 0, (capacity - n) * 4);
+	}
+
+	// Rebuilds indexes
+	meta->uidSlots = meta->uidCount = 0;
+	if (!growUidIndex ()) {
+		return false;
+	}
+	for (int i = 0; i < STORE_STATIONS; i++) {
+		meta->stationFirst[i] = meta->stationLast[i] = NO_PUNCH;
+		meta->stationCount[i] = 0;
+	}
+	for (uint32_t i = 0; i < n; i++) {
+		if (!link (i)) {
+			return false;
+		}
+	}
+	meta->count = count = n;
+	if (meta->synced > n) {
+		meta->synced = n;
+	}
+
+	return sync ();
+
+}
@@ -0,0 +1,109 @@
+/*********************************************************************************************/
+/*
+ * Punch store PC library (Linux)
+ * 
+ *  Append-only store of all the punches of an event, saved in a directory with one file
+ *	per column (UID, station, time, valid & source). Files are memory mapped, so programs
+ *	(results engine, exports, live dashboards) scan the columns in place without loading
+ *	them in the heap. Address space for STORE_PUNCHES is reserved when opening, so
+ *	pointers to columns stay valid while files grow.
+ *
+ *	Indexes:
+ *	 - By UID: hash table (uid.idx) with first & last punch of each card, and a column with
+ *	   the next punch of the same card.
+ *	 - By station: first & last punch of each station in the meta file, and a column with
+ *	   the next punch of the same station.
+ *
+ *	Crash safety: each punch has a check column (hash of its fields & position). sync()
+ *	makes appended punches durable and saves how many they are. If the writer didn't close
+ *	the store, next opening accepts the punches after the synced ones while their check is
+ *	correct, erases the rest of the tail and rebuilds the indexes.
+ *
+ *	Several programs can open the store in read-only mode while one writer appends to it.
+ *	Readers see the punches appended before opening or last refresh(). UID index is rebuilt
+ *	when it grows, so a reader can miss a card meanwhile: look it up again after refresh().
+*/
+/*********************************************************************************************/
+
+
+#ifndef __PUNCHSTORE_H__
+#define __PUNCHSTORE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+
+#define STORE_PUNCHES		(1u << 24)	// Address space reserved for each column
+#define MAX_UIDS			(1u << 20)	// Max different cards in UID index
+#define GROW_PUNCHES		65536		// Files grow in steps of this number of punches
+#define NO_PUNCH			0xFFFFFFFF	// End of a list of punches
+#define STORE_STATIONS		256			// Station IDs are one byte
+
+#define SOURCE_READOUT		0			// Punch read from card by a Master
+#define SOURCE_NBIOT		1			// Punch sent by a station through NB-IoT
+#define SOURCE_JOURNAL		2			// Punch recovered from a station journal
+
+
+class PunchStore {
+public:
+	PunchStore ();
+	~PunchStore ();
+	bool open (const char *dir, bool readOnly);	// Creates the store if it doesn't exist
+	void close ();						// Syncs & marks the store as closed properly
+	bool append (uint32_t uid, uint8_t station, uint32_t time, bool valid, uint8_t source);
+	bool sync ();						// Makes appended punches durable
+	uint32_t size () const;				// Number of punches
+	uint32_t refresh ();				// Readers see punches appended since last call
+	uint32_t recovered () const;		// Punches of the tail recovered when opening
+
+	// Columns, for scanning them in place. Punch i is position i of every column
+	const uint32_t *uids () const;
+	const uint32_t *times () const;		// Unix time
+	const uint8_t *stations () const;
+	const uint8_t *valid () const;		// 1 if MAC is correct
+	const uint8_t *sources () const;	// SOURCE_READOUT, SOURCE_NBIOT or SOURCE_JOURNAL
+
+	// Lists of punches in append order: for (i = first...; i != NO_PUNCH; i = next...(i))
+	uint32_t firstByUid (uint32_t uid) const;
+	uint32_t nextByUid (uint32_t punch) const;
+	uint32_t countByUid (uint32_t uid) const;
+	uint32_t firstByStation (uint8_t station) const;
+	uint32_t nextByStation (uint32_t punch) const;
+	uint32_t countByStation (uint8_t station) const;
+
+private:
+	enum { COL_UID, COL_TIME, COL_STATION, COL_VALID, COL_SOURCE, COL_CHECK, COL_NEXT_UID,
+		COL_NEXT_STATION, NUM_COLUMNS };
+
+	// Memory mapped file
+	struct Mapping {
+		int fd;
+		uint8_t *data;					// Reserved address space
+		size_t reserved;				// Bytes of address space
+		size_t fileSize;				// Current size of the file
+	};
+
+	struct Meta;						// Header saved in meta file
+	struct UidSlot;						// Entry of UID index
+
+	Mapping columns [NUM_COLUMNS];
+	Mapping uidIndex;
+	Mapping metaFile;
+	Meta *meta;
+	bool readOnly;
+	uint32_t count;						// Punches of writer or snapshot of reader
+	uint32_t recoveredPunches;
+
+	template <typename T> T *column (int col) const;
+	bool openMapping (Mapping &mapping, const std::string &path, size_t reserved);
+	bool growMapping (Mapping &mapping, size_t size);
+	void closeMapping (Mapping &mapping);
+	uint32_t check (uint32_t punch) const;	// Hash of fields & position of a punch
+	const UidSlot *findUid (uint32_t uid) const;
+	bool link (uint32_t punch);			// Adds a punch to the indexes
+	bool growUidIndex ();
+	bool recover ();					// Recovers tail & rebuilds indexes after a crash
+};
+
+#endif
@@ -0,0 +1,238 @@
+/*********************************************************************************************/
+/*
+ * Results engine PC library
+ * 
+ *  This library turns verified punches into live results.
+*/
+/*********************************************************************************************/
+
+
+#include "ResultsEngine.h"
+
+#include <algorithm>
+
+
+ResultsEngine::ResultsEngine () : punches(0) { }
+
+
+// Adds a category with its course (start, controls & finish stations). Returns its index
+uint16_t ResultsEngine::addCategory (const std::string &name,
+	const std::vector<uint8_t> &course) {
+
+	categories.push_back (Category());
+	Category &category = categories.back();
+	category.name = name;
+	category.course = course;
+	category.splits.resize (course.size());
+
+	return categories.size() - 1;
+
+}
+
+
+int ResultsEngine::findCategory (const std::string &name) const {
+	for (size_t i = 0; i < categories.size(); i++) {
+		if (categories[i].name == name) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+// Registers a runner. Returns false if the card is already registered or category is wrong
+bool ResultsEngine::addRunner (uint32_t uid, const std::string &name, uint16_t category) {
+
+	Runner runner;
+
+	if (category >= categories.size() || runnerIndex.count (uid) > 0) {
+		return false;
+	}
+
+	runner.uid = uid;
+	runner.name = name;
+	runner.category = category;
+	runner.reached = 0;
+	runner.startTime = 0;
+	runner.lastTime = 0;
+	runner.splits.reserve (categories[category].course.size());
+	runner.punches.reserve (categories[category].course.size());
+
+	runnerIndex[uid] = runners.size();
+	runners.push_back (runner);
+	categories[category].standings.insert (standingKey (runner));
+
+	return true;
+
+}
+
+
+/* Adds a verified punch. It's kept with the runner's punches in time order & used if it's the
+next control of runner's course after the last one used, so punches received again (i.e. the
+card is read twice) and extra punches are ignored. If it's newer than the rest, standings &
+split ranking are updated in O(log n). If it's older, the course is matched again with all
+the punches of the runner, so results don't depend on the order punches arrive */
+bool ResultsEngine::addPunch (uint32_t uid, uint8_t station, uint32_t time, bool valid) {
+
+	std::unordered_map<uint32_t, uint32_t>::const_iterator it = runnerIndex.find (uid);
+	std::vector<CardPunch>::iterator next;
+	CardPunch punch = { time, station };
+	bool used;
+
+	if (!valid || it == runnerIndex.end()) {
+		return false;
+	}
+
+	Runner &runner = runners[it->second];
+	Category &category = categories[runner.category];
+
+	// After the punches of the same second, which can't be the same one again
+	next = std::upper_bound (runner.punches.begin(), runner.punches.end(), punch);
+	for (std::vector<CardPunch>::iterator p = next; p != runner.punches.begin() &&
+		(p - 1)->time == time; p--) {
+		if ((p - 1)->station == station) {
+			return false;
+		}
+	}
+
+	if (next != runner.punches.end()) {	// Older than others: splits may change
+		next = runner.punches.insert (next, punch);
+		return matchCourse (runner, category, next - runner.punches.begin());
+	}
+	runner.punches.push_back (punch);
+
+	used = runner.reached < category.course.size() &&
+		station == category.course[runner.reached] &&
+		(runner.reached == 0 || time > runner.lastTime);
+	if (used) {
+		category.standings.erase (standingKey (runner));
+		reachControl (runner, category, time);
+		category.standings.insert (standingKey (runner));
+	}
+
+	return used;
+
+}
+
+
+const Runner *ResultsEngine::findRunner (uint32_t uid) const {
+	std::unordered_map<uint32_t, uint32_t>::const_iterator it = runnerIndex.find (uid);
+	return it != runnerIndex.end() ? &runners[it->second] : NULL;
+}
+
+
+// Position of runner in the standings of its category (1 is first)
+size_t ResultsEngine::position (uint32_t uid) const {
+	const Runner *runner = findRunner (uid);
+	if (runner == NULL) {
+		return NO_POSITION;
+	}
+	return categories[runner->category].standings.rank (standingKey (*runner)) + 1;
+}
+
+
+// Position of runner in the split ranking of a control (0 is start)
+size_t ResultsEngine::splitPosition (uint32_t uid, size_t control) const {
+	const Runner *runner = findRunner (uid);
+	if (runner == NULL || control >= runner->reached) {
+		return NO_POSITION;
+	}
+	SplitKey key = { runner->splits[control], uid };
+	return categories[runner->category].splits[control].rank (key) + 1;
+}
+
+
+/* Gets up to count runners of a category from position first + 1 (first is 0-based). Each
+runner is found in O(log n), so any page of a large category is cheap. Returns the count */
+size_t ResultsEngine::leaderboard (uint16_t category, size_t first, size_t count,
+	std::vector<const Runner *> &page) const {
+
+	const OrderStatisticTree<StandingKey> &standings = categories[category].standings;
+
+	page.clear ();
+	for (size_t i = first; i < first + count && i < standings.size(); i++) {
+		page.push_back (findRunner (standings.select (i).uid));
+	}
+	return page.size();
+
+}
+
+
+size_t ResultsEngine::numCategories () const {
+	return categories.size();
+}
+
+
+const std::string &ResultsEngine::categoryName (uint16_t category) const {
+	return categories[category].name;
+}
+
+
+size_t ResultsEngine::courseLength (uint16_t category) const {
+	return categories[category].course.size();
+}
+
+
+unsigned long ResultsEngine::numPunches () const {
+	return punches;
+}
+
+
+// Runner reaches next control of its course at time. Caller updates the standings
+void ResultsEngine::reachControl (Runner &runner, Category &category, uint32_t time) {
+
+	uint32_t split;
+
+	if (runner.reached == 0) {
+		runner.startTime = time;
+	}
+	split = time - runner.startTime;
+
+	SplitKey splitKey = { split, runner.uid };
+	category.splits[runner.reached].insert (splitKey);
+	runner.splits.push_back (split);
+	runner.lastTime = time;
+	runner.reached++;
+	punches++;
+
+}
+
+
+/* Matches again the course with all the punches of runner, in time order, and updates its
+splits & standing. Returns true if the punch of index newPunch is used */
+bool ResultsEngine::matchCourse (Runner &runner, Category &category, size_t newPunch) {
+
+	bool used = false;
+
+	category.standings.erase (standingKey (runner));
+	for (uint16_t c = 0; c < runner.reached; c++) {
+		SplitKey splitKey = { runner.splits[c], runner.uid };
+		category.splits[c].erase (splitKey);
+	}
+	punches -= runner.reached;
+	runner.reached = 0;
+	runner.splits.clear ();
+	runner.startTime = runner.lastTime = 0;
+
+	for (size_t i = 0; i < runner.punches.size() && runner.reached < category.course.size();
+		i++) {
+		const CardPunch &punch = runner.punches[i];
+		if (punch.station == category.course[runner.reached] &&
+			(runner.reached == 0 || punch.time > runner.lastTime)) {
+			reachControl (runner, category, punch.time);
+			used |= (i == newPunch);
+		}
+	}
+
+	category.standings.insert (standingKey (runner));
+	return used;
+
+}
+
+
+// Key of a runner in the standings of its category
+ResultsEngine::StandingKey ResultsEngine::standingKey (const Runner &runner) const {
+	StandingKey key = { (uint16_t)(categories[runner.category].course.size() - runner.reached),
+		runner.reached > 0 ? runner.lastTime - runner.startTime : 0, runner.uid };
+	return key;
+}
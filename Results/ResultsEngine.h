@@ -0,0 +1,121 @@
+/*********************************************************************************************/
+/*
+ * Results engine PC library
+ * 
+ *  This library turns verified punches into live results. Each category has a course (the
+ *	ordered list of stations, from start to finish) and each runner a category. Punches can
+ *	arrive in any order and from any source (Master readout, NB-IoT uplink...). Each runner
+ *	keeps all its punches in time order and its course is matched with them like in the
+ *	card: a punch counts when it's the next control of the course after the last one used.
+ *	A punch newer than the rest advances the runner in O(log n); an older one (i.e. control
+ *	3 arrives before control 2) makes the runner's splits be matched again from its punches.
+ *
+ *	For each category it keeps:
+ *	 - Standings: runners ordered by controls reached and then by time at last control.
+ *	 - Split ranking of each control: runners ordered by time since start at that control.
+ *	Both are order-statistic trees, so each punch updates them and any position or page of
+ *	the leaderboard is obtained in O(log n).
+ *
+ *	Times are seconds in any epoch (seconds since midnight from Master readouts, unix time
+ *	from NB-IoT), but all the punches of an event must use the same one.
+*/
+/*********************************************************************************************/
+
+
+#ifndef __RESULTSENGINE_H__
+#define __RESULTSENGINE_H__
+
+#include "OrderStatisticTree.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+#define NO_POSITION			0			// Position of unknown runner or unreached control
+
+
+// Punch of a runner's card
+struct CardPunch {
+	uint32_t time;
+	uint8_t station;
+
+	bool operator< (const CardPunch &other) const {
+		return time < other.time;
+	}
+};
+
+
+// Runner registered in the event
+struct Runner {
+	uint32_t uid;						// UID of runner's card
+	std::string name;					// Player name
+	uint16_t category;					// Index of category
+	uint16_t reached;					// Controls of course punched, including start
+	uint32_t startTime;					// Time of punch at start control
+	uint32_t lastTime;					// Time of punch at last reached control
+	std::vector<uint32_t> splits;		// Seconds since start at each reached control
+	std::vector<CardPunch> punches;		// Valid punches received, in time order
+};
+
+
+class ResultsEngine {
+public:
+	ResultsEngine ();
+	uint16_t addCategory (const std::string &name, const std::vector<uint8_t> &course);
+	int findCategory (const std::string &name) const;	// Index or -1 if it doesn't exist
+	bool addRunner (uint32_t uid, const std::string &name, uint16_t category);
+	bool addPunch (uint32_t uid, uint8_t station, uint32_t time, bool valid);	// True if used
+	const Runner *findRunner (uint32_t uid) const;
+	size_t position (uint32_t uid) const;	// Position in category standings (1 is first)
+	size_t splitPosition (uint32_t uid, size_t control) const;	// Position at a control
+	size_t leaderboard (uint16_t category, size_t first, size_t count,
+		std::vector<const Runner *> &page) const;	// Runners from position first + 1
+	size_t numCategories () const;
+	const std::string &categoryName (uint16_t category) const;
+	size_t courseLength (uint16_t category) const;
+	unsigned long numPunches () const;	// Punches used in results
+
+private:
+	// Key of standings: fewer controls left first, then less time since start
+	struct StandingKey {
+		uint16_t remaining;				// Controls of course not reached yet
+		uint32_t time;					// Seconds since start at last reached control
+		uint32_t uid;					// Ties are ordered by UID
+
+		bool operator< (const StandingKey &other) const {
+			if (remaining != other.remaining) {
+				return remaining < other.remaining;
+			}
+			return time != other.time ? time < other.time : uid < other.uid;
+		}
+	};
+
+	// Key of split ranking of a control
+	struct SplitKey {
+		uint32_t time;					// Seconds since start
+		uint32_t uid;
+
+		bool operator< (const SplitKey &other) const {
+			return time != other.time ? time < other.time : uid < other.uid;
+		}
+	};
+
+	struct Category {
+		std::string name;
+		std::vector<uint8_t> course;	// Stations from start to finish
+		OrderStatisticTree<StandingKey> standings;
+		std::vector<OrderStatisticTree<SplitKey> > splits;	// One tree per control
+	};
+
+	std::vector<Category> categories;
+	std::vector<Runner> runners;
+	std::unordered_map<uint32_t, uint32_t> runnerIndex;	// Index in runners by UID
+	unsigned long punches;
+
+	StandingKey standingKey (const Runner &runner) const;
+	void reachControl (Runner &runner, Category &category, uint32_t time);
+	bool matchCourse (Runner &runner, Category &category, size_t newPunch);	// New one used
+};
+
+#endif
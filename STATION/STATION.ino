@@ -38,6 +38,8 @@ void setup() {
 
   digitalWrite (LED_PIN, LOW);      // Turn off LED for indicating set up period has finished
 
+  stationSetUp.precomputeKeys ();   // Key pair for next event, while station is carried out
+
 }
 
 void loop() {
@@ -10,6 +10,19 @@
  * 
  *  Serial port "Serial" is for USB debug. Serial port "Serial1" stablish a serial 
  *  communication with NB-IoT modem ublox N211.
+ *
+ *  Punches are queued and sent in batches of PUNCH_BATCH punches, or when the oldest one
+ *  has waited PUNCH_DELAY ms. Cards are polled for POLL_TIMEOUT ms so the queue is flushed
+ *  while no runner is punching. Queued punches are kept in the EEPROM of the RTC module
+ *  until the server acknowledges them, so they're sent after a reboot too. Batches are
+ *  compact: a runner's card punched again in the same station goes as a reference to an
+ *  earlier punch and punch times as differences, which saves a third of the bytes on air.
+ *
+ *  The ublox module registers in the network in background, after station setup, so the
+ *  station punches from the start. With fast start, a module that is still set up and
+ *  registered (the station rebooted, the module didn't) isn't reset, so punches are sent
+ *  in about a second. POLL_TIMEOUT is kept short because ublox responses are read between
+ *  polls and UART buffer only holds 64 bytes.
  *  
  *  Compatible boards with this sketch: Arduino Leonardo.
 */
@@ -22,24 +35,22 @@
 #define LED_PIN           3         // Digital Pin where is tied LED
 #define CARD_TIMEOUT      1         // Number of seconds between punch
 #define MIFARE_BLOCK_SIZE 16        // Size of each block on Mifare Classic 1k Card
+#define PUNCH_BATCH       8         // Punches sent in one datagram
+#define PUNCH_DELAY       5000      // Max ms a punch waits before being sent
+#define POLL_TIMEOUT      50        // Ms waiting a card in each loop
+#define LOCAL_PORT        10000     // Port of UDP socket in ublox module
 
-String SERVER_IP = "79.115.226.197";  // IP of UDP server
-String SERVER_PORT = "16666";       // Port of UDP server
+#define SERVER_IP   "79.115.226.197"  // IP of UDP server
+#define SERVER_PORT 16666           // Port of UDP server
 
 PlayerCard card;                    // Manages operation with user cards
 SodaqNBIoT nbiot;                   // Ublox module
 
-int socket;                         // Socket for sending & receiving data
 uint8_t data [MIFARE_BLOCK_SIZE];               
 uint8_t idUser [7];
 
 void setup() {
 
-  // Start ublox modem
-  if ( nbiot.begin() ) {            // If device is registered in network
-    socket = nbiot.openSocket (10000);
-  }
-    
   pinMode(LED_PIN, OUTPUT);         // Set Up digital pin for LED
 
   StationNewSetUp stationSetUp;     // Manages the stations' setup
@@ -50,23 +61,44 @@ void setup() {
 
   digitalWrite (LED_PIN, LOW);      // Turn off LED for indicating set up period has finished
 
+  stationSetUp.precomputeKeys ();   // Key pair for next event, while station is carried out
+
   card.begin();
+
+  nbiot.setBatch (PUNCH_BATCH, PUNCH_DELAY);
+  nbiot.setFastStart (true);        // Keeps module settings & registration if they're right
+  nbiot.setCompactBatches (true);   // Server must accept version 4 (PunchServer)
+
+  nbiot.start (LOCAL_PORT);         // Registers & opens socket while loop() runs
   
 }
 
 void loop() {
 
-  if ( card.punch(data, idUser) ) {
+  unsigned long punchTime;
+
+  nbiot.process ();
+
+  if ( card.punch(data, idUser, POLL_TIMEOUT) ) {
   
     digitalWrite (LED_PIN, HIGH);
     delay (50);
     digitalWrite (LED_PIN, LOW);
     delay(50);
   
-    nbiot.sendPunch (data, idUser, socket, SERVER_IP, SERVER_PORT);
+    nbiot.queuePunch (data, idUser);
   
-    delay(CARD_TIMEOUT*1000);
+    punchTime = millis();           // Waits between punches handling ublox responses
+    while (millis() - punchTime < CARD_TIMEOUT*1000UL) {
+      nbiot.process ();
+    }
 
   }
+
+  nbiot.flushQueue (nbiot.getSocket(), SERVER_IP, SERVER_PORT);
+
+  if (nbiot.getState() == NB_STATE_FAILED) {
+    nbiot.start (LOCAL_PORT);       // Resets the module & tries again (fast start is skipped)
+  }
   
-}
+}
@@ -12,15 +12,35 @@
 #################################################################################
 
 import serial
+import struct
 import time
 import sys
 
 
+# Binary frames: SYNC | TYPE | LEN (2 bytes) | PAYLOAD | CRC-16 (2 bytes)
+FRAME_SYNC = 0x7E
+MSG_ACK = 0x01
+MSG_NAK = 0x02
+MSG_CHOICE = 0x03
+MSG_CARD_READOUT = 0x21
+MSG_CARD_IMAGE = 0x24
+MSG_KEY_TABLE = 0x25
+MSG_START_ENTRY = 0x26
+MSG_FORMAT_STATUS = 0x27
+FORMAT_OK = 0
+FORMAT_WRONG_CARD = 1
+
+NAME_SIZE = 16
+CAT_SIZE = 15
+PUNCH_REC_SIZE = 5
+
+
 
 # Main function. This will execute at the beginning of the process
 def main():
 
-	# Serial connection with Arduino parameters
+	# Serial connection with Arduino parameters (baudrate must be SERIAL_BAUDRATE of Arduino,
+	# i.e. 115200 or 1000000)
 	port = 'COM14'
 	baudrate = 115200
 
@@ -50,6 +70,10 @@ def introMenu (arduino):
 		print "   2. Continue setting up an event"
 		print "   3. Clean card"
 		print "   4. Read card"
+		print "   5. Measure serial throughput"
+		print "   6. Dump card image for verifying it in PC"
+		print "   7. Export station keys for verifying cards in PC"
+		print "   8. Program cards from a start list"
 		print "   0. Close\n"
 
 		choice = raw_input("Introduce your choice: ")
@@ -60,6 +84,22 @@ def introMenu (arduino):
 			if confirmation != 'yes':
 				return
 
+		if choice == '4':
+			readPunchsBinary(arduino)
+			continue
+		elif choice == '5':
+			throughputTest(arduino)
+			continue
+		elif choice == '6':
+			dumpCardImage(arduino)
+			continue
+		elif choice == '7':
+			exportKeys(arduino)
+			continue
+		elif choice == '8':
+			bulkFormat(arduino)
+			continue
+
 		arduino.write(bytes(choice))
 
 		ack = arduino.readline().rstrip()
@@ -91,7 +131,7 @@ def setupMenu (arduino):
 
 	choice = '1';
 
-	while choice == '1':
+	while choice == '1' or choice == '3':
 		
 		# Read the station ID
 		station = arduino.readline().rstrip()
@@ -99,15 +139,49 @@ def setupMenu (arduino):
 		print "\n Put station #%s on card reader" % station
 		print " After that, send the option number of your choice"
 		print "   1. Set up this station"
-		print "   2. Finish the setup process\n"
+		print "   2. Finish the setup process"
+		print "   3. Set up several stations one after another\n"
 
 		choice = raw_input("Introduce your choice: ")
+
+		if choice == '3':
+			batchSetupMenu(arduino)
+			continue
+
+		startTime = time.time()
 		arduino.write(bytes(choice))
 
 		ack = arduino.readline().rstrip()
 
 		if ack == '0':
 			print "Error with Station. Reset it and try again"
+		elif ack == '1':
+			print " Station #%s set up in %.2f seconds" % (station, time.time() - startTime)
+
+
+
+# Menu for setting up several stations without asking for each one
+def batchSetupMenu (arduino):
+
+	number = raw_input("How many stations? ")
+
+	arduino.write(bytes('3'))
+	time.sleep(0.2)
+	arduino.write(bytes(number))
+
+	print "\n Put the stations on card reader one after another\n"
+	print " IDS 	Result 	Time"
+
+	# Master sends one record "ID;status;ms" per station. Status 2: no room for its key
+	for i in range(int(number)):
+		ids, ok, elapsed = arduino.readline().rstrip().split(';')
+		if ok == '1':
+			result = "Ok!"
+		elif ok == '2':
+			result = "Full!"
+		else:
+			result = "Error!"
+		print " %s 	%s 	%.2f s" % (ids, result, int(elapsed) / 1000.0)
 
 
 
@@ -179,6 +253,206 @@ def readPunchs(arduino):
 
 
 
+
+# Updates CRC-16 CCITT (polynomial 0x1021, initial value 0xFFFF) with a string of bytes
+def crc16(crc, data):
+	for byte in data:
+		crc ^= ord(byte) << 8
+		for i in range(8):
+			if crc & 0x8000:
+				crc = ((crc << 1) ^ 0x1021) & 0xFFFF
+			else:
+				crc = (crc << 1) & 0xFFFF
+	return crc
+
+
+# Sends a binary frame to Master
+def writeFrame(arduino, msgType, payload):
+	body = struct.pack('<BH', msgType, len(payload)) + payload
+	arduino.write(chr(FRAME_SYNC) + body + struct.pack('<H', crc16(0xFFFF, body)))
+
+
+# Reads a binary frame from Master. Returns type and payload or None if CRC is wrong
+def readFrame(arduino):
+	while ord(arduino.read(1)) != FRAME_SYNC:
+		pass
+	header = arduino.read(3)
+	msgType, length = struct.unpack('<BH', header)
+	payload = arduino.read(length)
+	crc, = struct.unpack('<H', arduino.read(2))
+	if crc != crc16(0xFFFF, header + payload):
+		return None
+	return msgType, payload
+
+
+# Sends a choice in binary mode and waits for ACK
+def sendChoiceBinary(arduino, choice):
+	writeFrame(arduino, MSG_CHOICE, choice)
+	frame = readFrame(arduino)
+	return frame is not None and frame[0] == MSG_ACK
+
+
+# Changes Master to binary mode, runs a choice that answers with one frame and returns to
+# text mode. Returns the payload (None if frame type or CRC are wrong) and the elapsed time
+# from first to last byte of the frame
+def commandBinary(arduino, choice, msgType):
+	arduino.write(bytes('B'))
+	if arduino.readline().rstrip() != '1' or not sendChoiceBinary(arduino, choice):
+		print "Error changing to binary mode"
+		return None, 0
+
+	# The whole answer is sent in one frame
+	while ord(arduino.read(1)) != FRAME_SYNC:
+		pass
+	startTime = time.time()
+	header = arduino.read(3)
+	rxType, length = struct.unpack('<BH', header)
+	payload = arduino.read(length)
+	crc, = struct.unpack('<H', arduino.read(2))
+	elapsed = time.time() - startTime
+
+	sendChoiceBinary(arduino, 'T')
+
+	if rxType != msgType or crc != crc16(0xFFFF, header + payload):
+		print "Error in frame received from Master"
+		return None, 0
+	return payload, elapsed
+
+
+# Reads a card in binary mode
+def readPunchsBinary(arduino):
+	print "\nPlease, put card on reader\n"
+
+	payload, elapsed = commandBinary(arduino, '4', MSG_CARD_READOUT)
+	if payload is None:
+		return
+
+	uid = payload[0:4].encode('hex').upper()
+	userName = payload[4:4 + NAME_SIZE].split('\0')[0]
+	category = payload[4 + NAME_SIZE:4 + NAME_SIZE + CAT_SIZE].split('\0')[0]
+	punches = ord(payload[4 + NAME_SIZE + CAT_SIZE])
+
+	print " --------------------------------"
+	print " User ID: %s" % uid
+	print " Name: %s" % userName
+	print " Category: %s" % category
+	print " --------------------------------"
+	print " "
+	print " IDS 	Punch Time 	Validated?"
+
+	offset = 4 + NAME_SIZE + CAT_SIZE + 1
+	for i in range(punches):
+		ids, hour, minute, second, validated = struct.unpack('<5B',
+			payload[offset:offset + PUNCH_REC_SIZE])
+		offset += PUNCH_REC_SIZE
+		if validated:
+			result = "Ok!"
+		else:
+			result = "Error!"
+		print " %d 	%02d:%02d:%02d        %s" % (ids, hour, minute, second, result)
+
+
+# Master sends the raw image of a card, which is saved in card_<UID>.bin
+def dumpCardImage(arduino):
+	print "\nPlease, put card on reader\n"
+
+	payload, elapsed = commandBinary(arduino, '6', MSG_CARD_IMAGE)
+	if payload is None:
+		return
+
+	fileName = "card_%s.bin" % payload[0:4].encode('hex').upper()
+	with open(fileName, 'wb') as imageFile:
+		imageFile.write(payload)
+	print " Card image saved in %s" % fileName
+	print " Verify it with: CardVerifier/VerifyCards keys.bin %s" % fileName
+
+
+# Master sends the keys of all the stations of the event, which are saved in keys.bin
+def exportKeys(arduino):
+	payload, elapsed = commandBinary(arduino, '7', MSG_KEY_TABLE)
+	if payload is None:
+		return
+
+	with open('keys.bin', 'wb') as keysFile:
+		keysFile.write(payload)
+	print " Keys of %d stations saved in keys.bin. Keep this file secret" % ord(payload[0])
+
+
+# Programs cards from a start list file. Each line is "name,category[,UID]" (UID in hex binds
+# the entry to a card). Each entry is sent when the previous card has been programmed
+def bulkFormat(arduino):
+	fileName = raw_input("Start list file: ")
+	entries = []
+	with open(fileName) as startList:
+		for line in startList:
+			fields = line.strip().split(',')
+			if fields[0] == '' or fields[0].startswith('#'):
+				continue
+			uid = '\0' * 4
+			if len(fields) > 2:
+				uid = struct.pack('>I', int(fields[2], 16))
+			category = ''
+			if len(fields) > 1:
+				category = fields[1]
+			entries.append(uid + fields[0][:NAME_SIZE - 1].ljust(NAME_SIZE, '\0') +
+				category[:CAT_SIZE - 1].ljust(CAT_SIZE, '\0'))
+
+	arduino.write(bytes('B'))
+	if arduino.readline().rstrip() != '1' or not sendChoiceBinary(arduino, '8'):
+		print "Error changing to binary mode"
+		return
+
+	print "\n Put the cards on reader one after another\n"
+	startTime = time.time()
+	for number, entry in enumerate(entries):
+		writeFrame(arduino, MSG_START_ENTRY, entry)
+		status = None
+		while status != FORMAT_OK:
+			frame = readFrame(arduino)
+			if frame is None or frame[0] != MSG_FORMAT_STATUS:
+				continue
+			status = ord(frame[1][4])
+			if status == FORMAT_OK:
+				result = "Ok!"
+			elif status == FORMAT_WRONG_CARD:
+				result = "Wrong card"
+			else:
+				result = "Error! Try again"
+			print " %d 	%s 	%s 	%s" % (number + 1, frame[1][0:4].encode('hex').upper(),
+				entry[4:4 + NAME_SIZE].split('\0')[0], result)
+	writeFrame(arduino, MSG_START_ENTRY, '')
+	elapsed = time.time() - startTime
+
+	sendChoiceBinary(arduino, 'T')
+	print "\n %d cards programmed in %.0f s" % (len(entries), elapsed)
+
+
+# Master sends a fake full card in text and binary mode and prints punches per second
+def throughputTest(arduino):
+	punches = 45
+	print "\n Mode 	Punches/s 	(baudrate %d)" % arduino.baudrate
+
+	# Text mode: from first line to last line of the card
+	arduino.write(bytes('5'))
+	arduino.readline()
+	arduino.readline()
+	startTime = time.time()
+	arduino.readline()
+	arduino.readline()
+	while arduino.readline().rstrip() == '1':
+		arduino.readline()
+		arduino.readline()
+		arduino.readline()
+	elapsed = time.time() - startTime
+	print " Text 	%.0f" % (punches / elapsed)
+
+	# Binary mode: from first to last byte of the frame
+	payload, elapsed = commandBinary(arduino, '5', MSG_CARD_READOUT)
+	if payload is not None:
+		print " Binary 	%.0f" % (punches / elapsed)
+
+
+
 # Start process 
 if __name__ == '__main__':
     main()
\ No newline at end of file
@@ -5,15 +5,30 @@
  * Developed for Manuel Montenegro Final Year Project.
  * 
  *  This sketch simulates a Diffie-Hellman key exchange between two devices
- *  and prints the elapsed time during processing.
- *  
+ *  and prints the elapsed time during processing. After that, it runs a
+ *  benchmark of Curve25519 field operations and of dh1/dh2, printing the
+ *  average time and CPU cycles of each one.
+ *
+ *  Cycles are calculated from micros(), so its resolution is 4 microseconds
+ *  (64 cycles at 16 MHz). Field operations are repeated FIELD_ITERATIONS
+ *  times for this reason.
+ *
+ *  For the unrolled backend of mul & square, define CURVE25519_UNROLLED as 1
+ *  in the build flags of the Crypto library (see Curve25519.h).
+ *
  *  Compatible boards with this sketch: Arduino UNO, Arduino Leonardo, Genuino 
  *  101 and Intel Galileo.
 */
 /****************************************************************************/
 
+#define TEST_CURVE25519_FIELD_OPS 1 // Makes field operations public
+
 #include <Curve25519.h>
 #include <RNG.h>
+#include <utility/LimbUtil.h>
+
+#define FIELD_ITERATIONS  100       // Number of times each field op is run
+#define DH_ITERATIONS     5         // Number of times dh1 & dh2 are run
 
 // Prints bytes array data in hex with leading zeroes
 void printHex ( uint8_t data [], uint8_t length ) {
@@ -27,6 +42,96 @@ void printHex ( uint8_t data [], uint8_t length ) {
    Serial.println();
 }
 
+// Prints the average time and cycles of a benchmark
+void printBenchmark ( const char *name, unsigned long elapsed, unsigned long iterations ) {
+  Serial.print(name);
+  Serial.print(": ");
+  Serial.print((double)elapsed / iterations);
+  Serial.print(" us, ");
+  Serial.print(((double)elapsed / iterations) * (F_CPU / 1000000L));
+  Serial.println(" cycles");
+}
+
+// Runs each field operation FIELD_ITERATIONS times and prints the results
+void benchmarkFieldOps () {
+
+  limb_t x [NUM_LIMBS_256BIT];
+  limb_t y [NUM_LIMBS_256BIT];
+  limb_t result [NUM_LIMBS_256BIT];
+  unsigned long timeStart;
+
+  RNG.rand ((uint8_t *)x, sizeof(x));
+  RNG.rand ((uint8_t *)y, sizeof(y));
+  x[NUM_LIMBS_256BIT - 1] &= ((limb_t)~0) >> 1; // Values less than 2^255 - 19
+  y[NUM_LIMBS_256BIT - 1] &= ((limb_t)~0) >> 1;
+
+  timeStart = micros();
+  for (int i = 0; i < FIELD_ITERATIONS; i++) {
+    Curve25519::mul (result, x, y);
+  }
+  printBenchmark ("mul", micros() - timeStart, FIELD_ITERATIONS);
+
+  timeStart = micros();
+  for (int i = 0; i < FIELD_ITERATIONS; i++) {
+    Curve25519::square (result, x);
+  }
+  printBenchmark ("square", micros() - timeStart, FIELD_ITERATIONS);
+
+  timeStart = micros();
+  for (int i = 0; i < FIELD_ITERATIONS; i++) {
+    Curve25519::mulA24 (result, x);
+  }
+  printBenchmark ("mulA24", micros() - timeStart, FIELD_ITERATIONS);
+
+  timeStart = micros();
+  for (int i = 0; i < FIELD_ITERATIONS; i++) {
+    Curve25519::add (result, x, y);
+  }
+  printBenchmark ("add", micros() - timeStart, FIELD_ITERATIONS);
+
+  timeStart = micros();
+  for (int i = 0; i < FIELD_ITERATIONS; i++) {
+    Curve25519::sub (result, x, y);
+  }
+  printBenchmark ("sub", micros() - timeStart, FIELD_ITERATIONS);
+
+}
+
+// Runs dh1, dh1FixedBase & dh2 DH_ITERATIONS times and prints the results
+void benchmarkDH () {
+
+  uint8_t k [32];
+  uint8_t f [32];
+  uint8_t otherK [32];
+  uint8_t otherF [32];
+  unsigned long dh1Time = 0;
+  unsigned long dh2Time = 0;
+  unsigned long fixedBaseTime = 0;
+  unsigned long timeStart;
+
+  Curve25519::dh1 (otherK, otherF);   // Public key of the other party
+
+  for (int i = 0; i < DH_ITERATIONS; i++) {
+    timeStart = micros();
+    Curve25519::dh1 (k, f);
+    dh1Time += micros() - timeStart;
+
+    timeStart = micros();
+    Curve25519::dh1FixedBase (k, f);
+    fixedBaseTime += micros() - timeStart;
+
+    memcpy (k, otherK, sizeof(k));
+    timeStart = micros();
+    Curve25519::dh2 (k, f);
+    dh2Time += micros() - timeStart;
+  }
+
+  printBenchmark ("dh1", dh1Time, DH_ITERATIONS);
+  printBenchmark ("dh1FixedBase", fixedBaseTime, DH_ITERATIONS);
+  printBenchmark ("dh2", dh2Time, DH_ITERATIONS);
+
+}
+
 void setup() {
   
   // Open serial port
@@ -132,6 +237,25 @@ void setup() {
   Serial.print( "Elapsed time (in microseconds): " );
   Serial.println( timeEnd - timeStart );
   Serial.println();
+
+  // Check both shared keys are the same
+  if (memcmp (alice_k, bob_k, sizeof(alice_k)) == 0) {
+    Serial.println ("Shared keys match");
+  } else {
+    Serial.println ("Shared keys DON'T match");
+  }
+  Serial.println();
+
+
+  // Benchmark ..............................................................
+#if CURVE25519_UNROLLED
+  Serial.println ("Benchmark of Curve25519 (unrolled backend) ...");
+#else
+  Serial.println ("Benchmark of Curve25519 (loop backend) ...");
+#endif
+
+  benchmarkFieldOps ();
+  benchmarkDH ();
 }
 
 void loop() {
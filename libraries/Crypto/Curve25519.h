@@ -25,6 +25,12 @@
 
 #include "BigNumberUtil.h"
 
+// Backend of field multiplication & squaring: 1 selects the unrolled
+// multiply-accumulate by columns (see Curve25519.cpp), 0 the row by row loops.
+#if !defined(CURVE25519_UNROLLED)
+#define CURVE25519_UNROLLED 0
+#endif
+
 class Ed25519;
 
 class Curve25519
@@ -35,6 +41,9 @@ public:
     static void dh1(uint8_t k[32], uint8_t f[32]);
     static bool dh2(uint8_t k[32], uint8_t f[32]);
 
+    static void evalFixedBase(uint8_t result[32], const uint8_t s[32]);
+    static void dh1FixedBase(uint8_t k[32], uint8_t f[32]);
+
 #if defined(TEST_CURVE25519_FIELD_OPS)
 public:
 #else
@@ -48,10 +57,8 @@ private:
     static void mulNoReduce(limb_t *result, const limb_t *x, const limb_t *y);
 
     static void mul(limb_t *result, const limb_t *x, const limb_t *y);
-    static void square(limb_t *result, const limb_t *x)
-    {
-        mul(result, x, x);
-    }
+    static void squareNoReduce(limb_t *result, const limb_t *x);
+    static void square(limb_t *result, const limb_t *x);
 
     static void mulA24(limb_t *result, const limb_t *x);
 
@@ -67,6 +74,8 @@ private:
     static void recip(limb_t *result, const limb_t *x);
     static bool sqrt(limb_t *result, const limb_t *x);
 
+    static void combSelect(limb_t *ypx, limb_t *ymx, limb_t *xy2d, uint8_t index);
+
     // Constructor and destructor are private - cannot instantiate this class.
     Curve25519() {}
     ~Curve25519() {}
@@ -0,0 +1,255 @@
+/*********************************************************************************************/
+/*
+ * MQTT uplink Arduino library
+ *
+ *  Sends the punches of a station to an MQTT broker in batches, from an outbox in AT24C32.
+*/
+/*********************************************************************************************/
+
+
+#include <MQTTUplink.h>
+
+
+MQTTUplink::MQTTUplink () : client (MQTT_BUFFER_SIZE) {
+	clientId = user = password = NULL;
+	oldestTime = lastAttempt = 0;
+	retryDelay = MQTT_RETRY_DELAY;
+	retryPending = false;
+	batchPunches = MQTT_BATCH_PUNCHES;
+	batchDelay = MQTT_BATCH_DELAY;
+	memset (&stats, 0, sizeof(stats));
+}
+
+
+/* Set the broker & credentials, find the punches left in outbox before a reboot and connect.
+	If the broker doesn't answer, process() tries again later */
+void MQTTUplink::begin (const char *host, uint16_t port, Client &net, const char *clientId,
+	const char *user, const char *password) {
+
+	this->clientId = clientId;
+	this->user = user;
+	this->password = password;
+
+	stats.recovered = outbox.load ();	// Punches not acknowledged before a reboot
+	oldestTime = millis() - batchDelay;	// They go at once
+
+	client.begin (host, port, net);
+	client.setOptions (MQTT_KEEP_ALIVE, true, MQTT_COMMAND_TIMEOUT);
+	connect ();
+
+}
+
+
+// Set the max punches of a batch & the max ms a punch waits before being published
+void MQTTUplink::setBatch (uint8_t punches, unsigned long delayMs) {
+
+	if (punches < 1) {
+		punches = 1;
+	} else if (punches > MQTT_BATCH_MAX) {
+		punches = MQTT_BATCH_MAX;
+	}
+	batchPunches = punches;
+	batchDelay = delayMs;
+
+}
+
+
+/* Queue a punch for publishing it in next batch. Data is the punch block written in user's
+	card. It's saved in outbox of AT24C32 until broker acknowledges it. Return false if
+	outbox is full */
+bool MQTTUplink::queuePunch (const uint8_t *data, const uint8_t *idUser, uint8_t uidLength) {
+
+	QueuedPunch punch;
+
+	if (uidLength < PUNCH_UID_MIN || uidLength > PUNCH_UID_MAX) {
+		return false;
+	}
+
+	memset (&punch, 0, sizeof(punch));
+	punch.uidLength = uidLength;
+	memcpy (punch.uid, idUser, uidLength);
+	memcpy (punch.data, data, sizeof(punch.data));
+	if (!outbox.push (punch)) {
+		stats.dropped++;
+		return false;
+	}
+
+	if (outbox.size() == 1) {
+		oldestTime = millis();			// First punch waiting
+	}
+	stats.queued++;
+	if (outbox.size() > stats.maxDepth) {
+		stats.maxDepth = outbox.size();
+	}
+
+	return true;
+
+}
+
+
+/* Keep the connection with the broker (pings & reconnections) and publish a batch if it's
+	full or its oldest punch has waited the max delay. Call it often from loop() */
+void MQTTUplink::process () {
+
+	if (!client.loop () && !connect ()) {
+		return;							// Not connected: punches wait in outbox
+	}
+
+	if (outbox.size() == 0 || (outbox.size() < batchPunches &&
+		(millis() - oldestTime) < batchDelay)) {
+		return;
+	}
+
+	flushQueue ();
+
+}
+
+
+/* Publish the oldest punches of outbox in a batch with QoS 1. They leave the outbox when
+	broker acknowledges them (PUBACK). Return false if it didn't */
+bool MQTTUplink::flushQueue () {
+
+	uint8_t payload [MQTT_PAYLOAD_MAX];
+	char topic [MQTT_TOPIC_SIZE];
+	uint16_t length;
+	uint8_t count;
+	uint8_t ids;
+
+	if (!client.connected ()) {
+		return false;
+	}
+
+	length = buildBatch (payload, count, ids);
+	if (count == 0) {
+		return true;					// Nothing to publish
+	}
+
+	strcpy (topic, MQTT_TOPIC_ROOT);
+	appendNumber (&topic[strlen (topic)], ids);
+
+	// Waits PUBACK up to MQTT_COMMAND_TIMEOUT. MQTTClient closes connection without it
+	if (!client.publish (topic, (const char *)payload, length, false, 1)) {
+		stats.errors++;
+		return false;
+	}
+
+	outbox.release (outbox.first() + count);
+	oldestTime = millis();				// Rest waits for next batch
+	stats.acked += count;
+	stats.batches++;
+
+	return true;
+
+}
+
+
+bool MQTTUplink::isConnected () {
+	return client.connected ();
+}
+
+
+// Return the number of punches in outbox, not acknowledged yet
+uint16_t MQTTUplink::queueDepth () {
+	return outbox.size();
+}
+
+
+// Return statistics of MQTT uplink
+const MQTTStats &MQTTUplink::uplinkStats () {
+	return stats;
+}
+
+
+
+/* Connect to broker if the back off delay since the last failure has elapsed. Return true
+	if connected */
+bool MQTTUplink::connect () {
+
+	if (client.connected ()) {
+		return true;
+	}
+	if (retryPending && (millis() - lastAttempt) < retryDelay) {
+		return false;
+	}
+
+	if (!client.connect (clientId, user, password)) {
+		if (retryPending) {
+			retryDelay = (retryDelay * 2 > MQTT_RETRY_DELAY_MAX) ? MQTT_RETRY_DELAY_MAX :
+				retryDelay * 2;
+		}
+		retryPending = true;
+		lastAttempt = millis();
+		stats.failures++;
+		return false;
+	}
+
+	retryPending = false;
+	retryDelay = MQTT_RETRY_DELAY;
+	stats.connections++;
+
+	return true;
+
+}
+
+
+/* Write in payload a batch with the oldest punches of outbox: up to batchPunches, all of
+	the same station (IDS), which gives the topic. Return its bytes */
+uint16_t MQTTUplink::buildBatch (uint8_t *payload, uint8_t &count, uint8_t &ids) {
+
+	QueuedPunch punch;
+	uint16_t sequence = outbox.first();
+	uint16_t length = 4;				// Header
+	uint16_t crc;
+
+	count = 0;
+	ids = 0;
+	while (count < batchPunches && count < outbox.size()) {
+		if (!outbox.read (sequence + count, punch)) {
+			outbox.truncate (sequence + count);	// Lost slot: outbox ends before it
+			break;
+		}
+		if (count > 0 && punch.data[0] != ids) {
+			break;						// Station set up again: next batch & topic
+		}
+		ids = punch.data[0];
+		payload[length++] = punch.uidLength;
+		memcpy (&payload[length], punch.uid, punch.uidLength);
+		length += punch.uidLength;
+		memcpy (&payload[length], punch.data, sizeof(punch.data));
+		length += sizeof(punch.data);
+		count++;
+	}
+
+	payload[0] = PUNCH_BATCH_VERSION << 4;
+	payload[1] = count;
+	payload[2] = sequence & 0xFF;
+	payload[3] = sequence >> 8;
+	crc = PunchOutbox::crc16 (0xFFFF, payload, length);
+	payload[length++] = crc & 0xFF;
+	payload[length++] = crc >> 8;
+
+	return length;
+
+}
+
+
+
+// Write a number in decimal at the end of a char array. Return the new end
+char *MQTTUplink::appendNumber (char *to, unsigned int number) {
+
+	char digits [6];					// Up to 65535
+	uint8_t count = 0;
+
+	do {
+		digits[count++] = '0' + number % 10;
+		number /= 10;
+	} while (number > 0);
+
+	while (count > 0) {
+		*to++ = digits[--count];
+	}
+	*to = '\0';
+
+	return to;
+
+}
@@ -0,0 +1,106 @@
+/*********************************************************************************************/
+/*
+ * MQTT uplink Arduino library
+ *
+ *  Sends the punches of a station to an MQTT broker (arduino-mqtt MQTTClient over any
+ *	Client, i.e. EthernetClient). Punches are queued (queuePunch) in the outbox of the
+ *	AT24C32 of the RTC module (PunchOutbox), so they survive reboots & lost connections,
+ *	and published by process(), called from loop(), in batches with the binary format of
+ *	SodaqNBIoT (see SodaqNBIoT.h), in topic MQTT_TOPIC_ROOT followed by the IDS of the
+ *	station, i.e. "/Stations/Station3":
+ *
+ *		BATCH VERSION << 4 | COUNT | SEQUENCE (2) | COUNT x (UID LENGTH | UID | IDS | TIME |
+ *		MAC) | CRC (2)
+ *
+ *	A batch is published when it has the punches set with setBatch or when its oldest punch
+ *	has waited the max delay. It goes with QoS 1: punches leave the outbox when the broker
+ *	answers with PUBACK; if it doesn't, the batch is published again after reconnecting.
+ *	Server discards punches received twice by their sequence numbers, like with NB-IoT.
+ *
+ *	process() never waits more than MQTT_COMMAND_TIMEOUT for the broker (plus the connection
+ *	time out of the Client while reconnecting), so cards are still detected between calls.
+ *	Reconnections are spaced out from MQTT_RETRY_DELAY, doubling up to MQTT_RETRY_DELAY_MAX.
+ *
+ *	Compatible boards with this library: Arduino MEGA (MQTTClient needs 2 buffers of
+ *	MQTT_BUFFER_SIZE bytes).
+*/
+/*********************************************************************************************/
+
+
+#ifndef __MQTTUPLINK_H__
+#define __MQTTUPLINK_H__
+
+
+#include "Arduino.h"
+#include <Client.h>
+#include <MQTTClient.h>					// arduino-mqtt library by Joël Gähwiler
+#include <PunchOutbox.h>				// Punches kept in AT24C32 until acknowledged
+
+
+#define PUNCH_BATCH_VERSION	2			// Version of binary batch of punches
+#define PUNCH_RECORD_SIZE	(1 + PUNCH_UID_MAX + 1 + 4 + PUNCH_MAC_SIZE)	// Queued punch
+
+#define MQTT_BATCH_MAX		8			// Max punches per batch (fits in MQTTClient buffer)
+#define MQTT_BUFFER_SIZE	256			// Bytes of each MQTTClient buffer
+#define MQTT_PAYLOAD_MAX	(4 + MQTT_BATCH_MAX * PUNCH_RECORD_SIZE + 2)
+#define MQTT_TOPIC_ROOT		"/Stations/Station"	// Followed by IDS of station
+#define MQTT_TOPIC_SIZE		24
+#define MQTT_KEEP_ALIVE		30			// Seconds between pings of MQTT
+#define MQTT_COMMAND_TIMEOUT	1000	// Max ms waiting CONNACK or PUBACK
+#define MQTT_RETRY_DELAY	1000		// Ms before first reconnection
+#define MQTT_RETRY_DELAY_MAX	32000	// Limit of back off
+#define MQTT_BATCH_PUNCHES	8			// Default punches per batch
+#define MQTT_BATCH_DELAY	5000		// Default max ms a punch waits in outbox
+
+
+// Counters of MQTT uplink
+struct MQTTStats {
+	unsigned long queued;				// Punches queued
+	unsigned long dropped;				// Punches lost because outbox was full
+	unsigned long acked;				// Punches answered with PUBACK
+	unsigned long batches;				// Batches answered with PUBACK
+	unsigned long errors;				// Batches without PUBACK
+	unsigned long connections;			// Successful connections to broker
+	unsigned long failures;				// Failed connections
+	uint16_t maxDepth;					// Max punches in outbox
+	uint16_t recovered;					// Punches found in outbox at begin
+};
+
+
+class MQTTUplink {
+public:
+	MQTTUplink ();
+	void begin (const char *host, uint16_t port, Client &net, const char *clientId,
+		const char *user = NULL, const char *password = NULL);
+	void setBatch (uint8_t punches, unsigned long delayMs);
+	bool queuePunch (const uint8_t *data, const uint8_t *idUser,
+		uint8_t uidLength = PUNCH_UID_MIN);	// False if outbox is full
+	void process ();					// Keeps connection & publishes batches
+	bool flushQueue ();					// Publishes a batch now. False if not acknowledged
+	bool isConnected ();
+	uint16_t queueDepth ();				// Punches not acknowledged
+	const MQTTStats &uplinkStats ();
+
+
+private:
+	MQTTClient client;
+	PunchOutbox outbox;
+	const char *clientId;
+	const char *user;
+	const char *password;
+	unsigned long oldestTime;			// millis() when oldest punch in outbox was queued
+	unsigned long lastAttempt;			// millis() of last failed connection
+	unsigned long retryDelay;			// Grows with back off
+	bool retryPending;
+	uint8_t batchPunches;
+	unsigned long batchDelay;
+	MQTTStats stats;
+
+	bool connect ();					// Connects again if retry delay has elapsed
+	uint16_t buildBatch (uint8_t *payload, uint8_t &count, uint8_t &ids);	// Bytes
+	static char *appendNumber (char *to, unsigned int number);
+
+};
+
+
+#endif
@@ -10,6 +10,12 @@
         IRQ pin is unused.
 
 	@section  HISTORY
+    V1.2    Split target data exchange so the host can work between receiving
+            and answering, and let the initiator wait for a slow answer
+                u8 P2PInitiatorTxRx(u8 *t_buf, u8 t_len, u8 *r_buf, u8 *r_len, u16 timeout);
+                u8 P2PTargetRx(u8 *r_buf, u8 *r_len);
+                u8 P2PTargetTx(u8 *t_buf, u8 t_len);
+
     V1.1    Add fuction about Peer to Peer communication
                 u8 P2PInitiatorInit();
                 u8 P2PTargetInit();
@@ -577,6 +583,24 @@ u8 P2PPN532::P2PTargetInit()
 */
 /*****************************************************************************/
 u8 P2PPN532::P2PInitiatorTxRx(u8 *t_buf, u8 t_len, u8 *r_buf, u8 *r_len)
+{
+    return P2PInitiatorTxRx(t_buf, t_len, r_buf, r_len, 0);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Initiator send and reciev data, waiting for the target answer.
+    @param  tx_buf --- data send buffer, user sets
+            tx_len --- data send legth, user sets.
+            rx_buf --- data recieve buffer, returned by P2PInitiatorTxRx
+            rx_len --- data receive length, returned by P2PInitiatorTxRx
+            timeout --- max time in ms that initiator waits for the answer.
+                        0 keeps the fixed 200ms wait of V1.1
+	@return 0 - send failed
+            1 - send successfully
+*/
+/*****************************************************************************/
+u8 P2PPN532::P2PInitiatorTxRx(u8 *t_buf, u8 t_len, u8 *r_buf, u8 *r_len, u16 timeout)
 {
 //    wait_ready();
 //    wait_ready();
@@ -593,7 +617,13 @@ u8 P2PPN532::P2PInitiatorTxRx(u8 *t_buf, u8 t_len, u8 *r_buf, u8 *r_len)
     Serial.println("Initiator DataExchange sent.");
 #endif
 
-    wait_ready(200);
+    if(timeout){
+        if(!poll_ready(timeout)){
+            return 0;
+        }
+    }else{
+        wait_ready(200);
+    }
 
     read_dt(nfc_buf, 60);
     if(nfc_buf[5] != 0xD5){
@@ -643,6 +673,25 @@ u8 P2PPN532::P2PInitiatorTxRx(u8 *t_buf, u8 t_len, u8 *r_buf, u8 *r_len)
 */
 /*****************************************************************************/
 u8 P2PPN532::P2PTargetTxRx(u8 *t_buf, u8 t_len, u8 *r_buf, u8 *r_len)
+{
+    if(!P2PTargetRx(r_buf, r_len)){
+        return 0;
+    }
+
+    return P2PTargetTx(t_buf, t_len);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Target recievs data. The initiator keeps waiting for the answer
+            until P2PTargetTx is called.
+    @param  rx_buf --- data recieve buffer, returned by P2PTargetRx
+            rx_len --- data receive length, returned by P2PTargetRx
+	@return 0 - receive failed
+            1 - receive successfully
+*/
+/*****************************************************************************/
+u8 P2PPN532::P2PTargetRx(u8 *r_buf, u8 *r_len)
 {
     nfc_buf[0] = PN532_COMMAND_TGGETDATA;
     if(!write_cmd_check_ack(nfc_buf, 1)){
@@ -680,6 +729,20 @@ u8 P2PPN532::P2PTargetTxRx(u8 *t_buf, u8 t_len, u8 *r_buf, u8 *r_len)
     *r_len = nfc_buf[3]-3;
     memcpy(r_buf, nfc_buf+8, *r_len);
 
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Target answers the data recieved by P2PTargetRx.
+    @param  tx_buf --- data send buffer, user sets
+            tx_len --- data send legth, user sets.
+	@return 0 - send failed
+            1 - send successfully
+*/
+/*****************************************************************************/
+u8 P2PPN532::P2PTargetTx(u8 *t_buf, u8 t_len)
+{
     nfc_buf[0] = PN532_COMMAND_TGSETDATA;
     memcpy(nfc_buf+1, t_buf, t_len);
 
@@ -1166,3 +1229,27 @@ u8 P2PPN532::wait_ready(u8 ms)
     delay(ms);
     return PN532_I2C_READY;
 }
+
+/*****************************************************************************/
+/*!
+	@brief  Polls the I2C status byte until PN532 has a response ready. Used
+        when the other device needs a long time to answer.
+	@param  ms - max time to wait in milliseconds.
+	@return PN532_I2C_READY - response ready
+            PN532_I2C_BUSY - timeout
+*/
+/*****************************************************************************/
+u8 P2PPN532::poll_ready(u16 ms)
+{
+    u32 start = millis();
+
+    do{
+        delay(NFC_POLL_TIME);
+        Wire.requestFrom((u8)PN532_I2C_ADDRESS, (u8)1);
+        if(receive() & PN532_I2C_READY){
+            return PN532_I2C_READY;
+        }
+    }while((millis() - start) < ms);
+
+    return PN532_I2C_BUSY;
+}
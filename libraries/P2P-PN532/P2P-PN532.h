@@ -10,6 +10,11 @@
         1. IRQ pin is unused.
         2. Referenced Adafruit_NFCShield_I2C library
 	@section  HISTORY
+    V1.2    Split target data exchange and add initiator answer timeout
+            u8 P2PInitiatorTxRx(u8 *t_buf, u8 t_len, u8 *r_buf, u8 *r_len, u16 timeout);
+            u8 P2PTargetRx(u8 *r_buf, u8 *r_len);
+            u8 P2PTargetTx(u8 *t_buf, u8 t_len);
+
     V1.1    Add fuction about Peer to Peer communication
             u8 P2PInitiatorInit();
             u8 P2PTargetInit();
@@ -39,6 +44,7 @@
 #define __TYPE_REDEFINE
 typedef uint8_t u8;
 typedef int8_t  s8;
+typedef uint16_t u16;
 typedef int16_t  s16;
 typedef uint32_t u32;
 typedef int32_t  s32;
@@ -171,6 +177,7 @@ typedef int32_t  s32;
 //#define PN532DEBUG
 //#define PN532_P2P_DEBUG
 #define NFC_WAIT_TIME                       30
+#define NFC_POLL_TIME                       10
 #define NFC_CMD_BUF_LEN                     64
 #define NFC_FRAME_ID_INDEX                  6
 
@@ -197,7 +204,10 @@ public:
     u8 P2PInitiatorInit();
     u8 P2PTargetInit();
     u8 P2PInitiatorTxRx(u8 *t_buf, u8 t_len, u8 *r_buf, u8 *r_len);
+    u8 P2PInitiatorTxRx(u8 *t_buf, u8 t_len, u8 *r_buf, u8 *r_len, u16 timeout);
     u8 P2PTargetTxRx(u8 *t_buf, u8 t_len, u8 *r_buf, u8 *r_len);
+    u8 P2PTargetRx(u8 *r_buf, u8 *r_len);
+    u8 P2PTargetTx(u8 *t_buf, u8 t_len);
 
     u8 TgInitAsTarget();
     u8 TargetPolling();
@@ -217,6 +227,7 @@ private:
 	void read_dt(u8 *buf, u8 len);
 	u8 read_sta(void);
 	u8 wait_ready(u8 ms=NFC_WAIT_TIME);
+	u8 poll_ready(u16 ms);
 	u8 read_ack(void);
 };
 
@@ -44,15 +44,14 @@ void PlayerCard::format () {
 
 	uint8_t userChoice;					// Choose of user in Serial interface
 	uint8_t uid[7];						// For storing card UID
+	uint8_t uidLength;					// Length of the UID (depends on card type)
 	uint8_t nextBlock;
 	uint8_t category [CAT_SIZE];		// Char array with player category
 	uint8_t name [NAME_SIZE];			// Char array with player name
 
 	readCardHeader(uid, &nextBlock, category, name);// Reads info from card header
 
-	usb.sendHexString(uid,UID_LENGTH);	// Sends the UID of user's card
-	usb.sendString (name);				// Sends user's name
-	usb.sendString (category);			// Sends user's category
+	usb.sendCardHeader (uid, name, category);	// Sends UID, name & category of user's card
 
 	userChoice = usb.receiveChoice();	// Saves user choice
 
@@ -62,16 +61,69 @@ void PlayerCard::format () {
 		usb.receiveName (name);			// Reads new user name
 		usb.receiveCategory (category);	// Reads new user category
 
-		writeCardHeader (FIRST_PUNCH_BLOCK, category, name);	// Writes the Card Header
-	
-	} else if (userChoice == '2') {
+	}
 
-		writeCardHeader (FIRST_PUNCH_BLOCK, category, name);	// Writes the Card Header
+	if (userChoice == '1' || userChoice == '2') {
+
+		// Card could have been removed and put again while user was choosing
+		if (nfc.readPassiveTargetID (PN532_MIFARE_ISO14443A, uid, &uidLength)
+			&& (uidLength == UID_LENGTH)) {
+			writeCardHeader (uid, FIRST_PUNCH_BLOCK, category, name);	// Writes the Card Header
+		}
 	
 	}
 }
 
 
+/* Master formats a batch of cards with the entries of a start list streamed by PC. Each
+entry has name, category and the UID of the card bound to it (all 0 for any card). For each
+entry Master waits for a card, writes its header in one transaction and answers with UID &
+status. A card is only handled once while it stays on the reader, so the next entry isn't
+written in the same card. The list ends with an empty entry */
+void PlayerCard::bulkFormat () {
+
+	uint8_t uid[7];						// UID of card on reader
+	uint8_t uidLength;					// Length of the UID (depends on card type)
+	uint8_t lastUid[UID_LENGTH] = { 0 };// Last card handled
+	uint8_t entryUid[UID_LENGTH];		// Card bound to current entry
+	uint8_t anyCard[UID_LENGTH] = { 0 };// Entry UID meaning that any card is valid
+	uint8_t category [CAT_SIZE];		// Char array with player category
+	uint8_t name [NAME_SIZE];			// Char array with player name
+	uint8_t status;						// Result of programming current card
+
+	while (usb.receiveStartEntry (entryUid, name, category)) {
+
+		do {
+			// Waits until a card different from the last handled one is placed on reader
+			if (!nfc.readPassiveTargetID (PN532_MIFARE_ISO14443A, uid, &uidLength)
+				|| (uidLength != UID_LENGTH) || (memcmp (uid, lastUid, UID_LENGTH) == 0)) {
+				status = FORMAT_WRONG_CARD;
+				continue;
+			}
+
+			if ((memcmp (entryUid, anyCard, UID_LENGTH) != 0)
+				&& (memcmp (entryUid, uid, UID_LENGTH) != 0)) {
+				status = FORMAT_WRONG_CARD;
+			} else if (writeCardHeader (uid, FIRST_PUNCH_BLOCK, category, name)) {
+				status = FORMAT_OK;
+			} else {
+				status = FORMAT_WRITE_ERROR;
+			}
+
+			// After a write error the same card is tried again until it's written
+			if (status != FORMAT_WRITE_ERROR) {
+				memcpy (lastUid, uid, UID_LENGTH);
+			}
+
+			usb.sendFormatStatus (uid, status);	// Compact ack, PC sends next entry with it
+
+		} while (status != FORMAT_OK);
+
+	}
+
+}
+
+
 
 
 
@@ -99,9 +151,8 @@ void PlayerCard::readPunches () {
 
 	readCardHeader(uid, &lastBlock, category, name);// Reads info from card header
 
-	usb.sendHexString(uid,UID_LENGTH);	// Sends the UID of user's card
-	usb.sendString (name);				// Sends user's name
-	usb.sendString (category);			// Sends user's category
+	// Sends UID, name & category. In binary mode punches are sent in the same frame
+	usb.beginCardReadout (uid, name, category, countPunches(lastBlock));
 
 
 	blockPointer = FIRST_PUNCH_BLOCK;	// blockPointer starts pointing to first punch block
@@ -175,6 +226,48 @@ void PlayerCard::readPunches () {
 
 
 
+/* Master sends the raw image of the card (UID & all 64 blocks) to PC in a binary frame, 
+without verifying the punches. PC verifies them with the keys exported by the Master, so
+readout time is only the time of reading the card. Blocks that can't be read are sent as 0*/
+void PlayerCard::dumpImage () {
+
+	uint8_t uid[7];						// UID of user's card
+	uint8_t uidLength;					// Length of the UID (depends on card type)
+	uint8_t data[MIFARE_BLOCK_SIZE];	// For storing block data during reads
+	uint8_t authenticated = false;		// True if sector of current block is authenticated
+
+	// Waits until a valid card is placed on the reader and return readed UID
+	if (!nfc.readPassiveTargetID (PN532_MIFARE_ISO14443A, uid, &uidLength)
+		|| (uidLength != UID_LENGTH)) {
+		memset (uid, 0, sizeof(uid));	// PC will reject an image with UID 0
+	}
+
+	usb.beginFrame (MSG_CARD_IMAGE, UID_LENGTH + CARD_BLOCKS * MIFARE_BLOCK_SIZE);
+	usb.writeFrame (uid, UID_LENGTH);
+
+	for (uint8_t block = 0; block < CARD_BLOCKS; block++) {
+
+		// Each sector is authenticated once, when reading its first block
+		if (nfc.mifareclassic_IsFirstBlock(block)) {
+			authenticated = nfc.mifareclassic_AuthenticateBlock (uid, UID_LENGTH, block,
+				keyBType, keyb);
+		}
+
+		if (!authenticated || !nfc.mifareclassic_ReadDataBlock(block, data)) {
+			memset (data, 0, sizeof(data));
+		}
+
+		usb.writeFrame (data, sizeof(data));
+
+	}
+
+	usb.endFrame ();
+
+}
+
+
+
+
 /* Station puts a punch record in user card with information about this control point.
 The data saved in card is defined in documentation of this proyect*/
 void PlayerCard::punch ( ) {
@@ -241,8 +334,9 @@ void PlayerCard::punch ( ) {
 
 
 /* Station puts a punch record in user card with information about this control point.
-The data saved in card is defined in documentation of this proyect*/
-bool PlayerCard::punch (uint8_t *data, uint8_t *uid) {
+The data saved in card is defined in documentation of this proyect. If timeout isn't 0,
+returns false when no card is placed in that milliseconds, so loop() can do other tasks*/
+bool PlayerCard::punch (uint8_t *data, uint8_t *uid, uint16_t timeout) {
 
 	// uint8_t uid[7];						// UID of user's card
 	uint8_t uidLength;					// Length of the UID (depends on card type)
@@ -252,7 +346,7 @@ bool PlayerCard::punch (uint8_t *data, uint8_t *uid) {
 	uint8_t success;					// Control flag
 
 	// Waits until a valid card is placed on the reader and return readed UID
-	success = nfc.readPassiveTargetID (PN532_MIFARE_ISO14443A, uid, &uidLength);
+	success = nfc.readPassiveTargetID (PN532_MIFARE_ISO14443A, uid, &uidLength, timeout);
 	// Checks if this is a Mifare Classic Card (UID length is 4)
 	if (success && (uidLength == UID_LENGTH)) {
 
@@ -393,6 +487,21 @@ uint8_t PlayerCard::nextFreeBlock ( uint8_t cardBlock ) {
 }
 
 
+// Return how many punches there are in user's card before lastBlock
+uint8_t PlayerCard::countPunches ( uint8_t lastBlock ) {
+
+	uint8_t count = 0;					// Number of punches
+	uint8_t block;						// Block of current punch
+
+	for (block = FIRST_PUNCH_BLOCK; block < lastBlock; block = nextFreeBlock(block)) {
+		count++;
+	}
+
+	return count;
+
+}
+
+
 // Return the last written block of user's card avoiding sector trailer's blocks
 uint8_t PlayerCard::previousBlock ( uint8_t cardBlock ) {
 
@@ -458,43 +567,38 @@ void PlayerCard::readCardHeader ( uint8_t *uid, uint8_t *nb, uint8_t *cat, uint8
 }
 
 
-// Writes data in first card's sector: next memory block, category and player name.
-void PlayerCard::writeCardHeader (uint8_t nb, uint8_t *cat, uint8_t *name) {
+/* Writes data in first card's sector: next memory block, category and player name. Card with
+the given UID must be on reader. Both blocks are in sector 0, so they are written with one
+authentication. Returns true if both blocks are written */
+uint8_t PlayerCard::writeCardHeader (uint8_t *uid, uint8_t nb, uint8_t *cat, uint8_t *name) {
 
-	uint8_t uid [7];					// Returned UID of Mifare Card
-	uint8_t uidLength;					// Length of the UID (depends on card type)
 	uint8_t currentBlock;				// Counter to keep track of actual block
-	uint8_t success;					// Control flag
+	uint8_t success = false;			// Control flag
 	uint8_t data[MIFARE_BLOCK_SIZE];	// For storing block data during reads
 
 	currentBlock = NB_CAT_BLOCK;		// First block in read is block #1
 
-	// Waits until a valid card is placed on the reader and return readed UID
-	success = nfc.readPassiveTargetID (PN532_MIFARE_ISO14443A, uid, &uidLength);
-
-	// Checks if this is a Mifare Classic Card (UID length is 4)
-	if (success && (uidLength == UID_LENGTH)) {
-
-		// Authenticates the block's sector
-    	if ( nfc.mifareclassic_AuthenticateBlock (uid, uidLength, currentBlock, keyBType, keyb) ) {
-			
-			memcpy(data, &nb, sizeof(nb));	// Next free memory block
-			memcpy(&data[1],cat,CAT_SIZE);	// User's category
-			nfc.mifareclassic_WriteDataBlock (currentBlock, data); // Writes block in card
+	// Authenticates the block's sector
+	if ( nfc.mifareclassic_AuthenticateBlock (uid, UID_LENGTH, currentBlock, keyBType, keyb) ) {
+		
+		memcpy(data, &nb, sizeof(nb));	// Next free memory block
+		memcpy(&data[1],cat,CAT_SIZE);	// User's category
+		success = nfc.mifareclassic_WriteDataBlock (currentBlock, data); // Writes block in card
 
-			currentBlock = NAME_BLOCK;	// Take the next block
+		currentBlock = NAME_BLOCK;		// Take the next block
 
-			memcpy(data, name, NAME_SIZE);	// User's name
-			nfc.mifareclassic_WriteDataBlock (currentBlock, data);	//Writes next block
+		memcpy(data, name, NAME_SIZE);	// User's name
+		success = nfc.mifareclassic_WriteDataBlock (currentBlock, data) && success;	//Writes next block
 
-		}
 	}
 
+	return success;
+
 }
 
 
 void PlayerCard::loadStationKey (uint8_t ids) {
-	uint8_t position = (ids*STATION_REC_SIZE);
+	unsigned int position = (ids*STATION_REC_SIZE);
 	i2cEeprom.read(position, stationKey, STATION_REC_SIZE);
 
 }
@@ -62,6 +62,12 @@
 #define ID_STATION_ADDR		0			// Arduino EEPROM address where is stored station ID
 #define KEY_EEPROM_ADDR		50			// Arduino EEPROM address where is stored station Key
 #define I2C_EEPROM_ADDR		0x57		// I2C Address of EEPROM integrated in RTC module
+#define CARD_BLOCKS			64			// Number of blocks of Mifare Classic 1k Card
+#define CARD_IMAGE_CHOICE	'6'			// PC choice for dumping the raw card image
+#define BULK_FORMAT_CHOICE	'8'			// PC choice for programming cards from a start list
+#define FORMAT_OK			0			// Card programmed with start list entry
+#define FORMAT_WRONG_CARD	1			// Card UID isn't the one bound to the entry
+#define FORMAT_WRITE_ERROR	2			// Card header couldn't be written
 
 
 class PlayerCard {
@@ -69,9 +75,11 @@ public:
 	PlayerCard ();
 	void begin ();						// Inits the hardware
 	void format ();						// Master formats player card erasing previous data	
+	void bulkFormat ();					// Master formats cards from a start list sent by PC
 	void readPunches ();				// Master reads & validates punches from card
+	void dumpImage ();					// Master sends raw card to PC for verifying there
 	void punch ();						// Station puts information about this control point
-	bool punch (uint8_t *data, uint8_t *uid);
+	bool punch (uint8_t *data, uint8_t *uid, uint16_t timeout = 0);	// Timeout in ms, 0 waits
 
 
 
@@ -89,12 +97,13 @@ private:
 	uint8_t stationKey [HMAC_KEY_SIZE];	// Negociated key of this station
 
 	void readCardHeader (uint8_t *uid, uint8_t *nb, uint8_t *cat, uint8_t *name );
-	void writeCardHeader (uint8_t nb, uint8_t *cat, uint8_t *name);	// Writes card header info
+	uint8_t writeCardHeader (uint8_t *uid, uint8_t nb, uint8_t *cat, uint8_t *name);	// Writes card header info
 	void buildPunchRecord ( uint8_t currentBlock, uint8_t *lastBlockData, uint8_t *block, uint8_t *uid );	// Builds the next record
 	// Method that generates a message authentication code with blake2s
 	void generateMac (uint8_t *mac, uint8_t *uid, uint8_t ids, uint32_t time, uint8_t *lastBlockData );
 	uint8_t nextFreeBlock ( uint8_t cardBlock );// Return the following free block of card
 	uint8_t previousBlock ( uint8_t cardBlock );// Return the last written block
+	uint8_t countPunches ( uint8_t lastBlock );	// Return the number of punches in card
 	void loadStationKey (uint8_t ids);	// Master searchs in EEPROM the key for this IDS
 
 };
@@ -0,0 +1,173 @@
+/*********************************************************************************************/
+/*
+ * Punch outbox Arduino library
+ *
+ *  Punches waiting to be delivered by a station, kept in the AT24C32 of the RTC module.
+*/
+/*********************************************************************************************/
+
+
+#include <PunchOutbox.h>
+
+
+PunchOutbox::PunchOutbox () {
+	firstSequence = nextSequence = 0;
+	firstSlot = 0;
+	eeprom = AT24C32 (OUTBOX_EEPROM_ADDR);	// Inits I2C EEPROM in RTC module
+}
+
+
+/* Read the header and the valid slots after it. A header not valid (first use or power
+	lost while writing it) starts an empty outbox. Return the punches found */
+uint16_t PunchOutbox::load () {
+
+	OutboxHeader header;
+	QueuedPunch punch;
+
+	eeprom.read (OUTBOX_ADDR, (byte *)&header, sizeof(header));
+	if (header.magic != OUTBOX_MAGIC || header.firstSlot >= OUTBOX_PUNCHES ||
+		header.crc != crc16 (0xFFFF, (const uint8_t *)&header, sizeof(header) - 2)) {
+		firstSequence = 0;
+		firstSlot = 0;
+		saveHeader ();
+	} else {
+		firstSequence = header.firstSequence;
+		firstSlot = header.firstSlot;
+	}
+
+	// Slots are written in order, so the first one not valid ends the outbox
+	nextSequence = firstSequence;
+	while (size() < OUTBOX_PUNCHES && read (nextSequence, punch)) {
+		nextSequence++;
+	}
+
+	return size();
+
+}
+
+
+// Write a punch in the slot of the next sequence number. Return false if outbox is full
+bool PunchOutbox::push (const QueuedPunch &punch) {
+
+	OutboxSlot slot;
+
+	if (size() == OUTBOX_PUNCHES) {
+		return false;
+	}
+
+	memset (&slot, 0, sizeof(slot));
+	slot.sequence = nextSequence;
+	slot.punch = punch;
+	slot.crc = crc16 (0xFFFF, (const uint8_t *)&slot, sizeof(slot) - 2);
+	eeprom.write (slotAddress (nextSequence), (byte *)&slot, sizeof(slot));	// One page
+	nextSequence++;
+
+	return true;
+
+}
+
+
+// Read the punch of a sequence number. Return false if its slot isn't valid
+bool PunchOutbox::read (uint16_t sequence, QueuedPunch &punch) {
+
+	OutboxSlot slot;
+
+	eeprom.read (slotAddress (sequence), (byte *)&slot, sizeof(slot));
+	if (slot.sequence != sequence ||
+		slot.crc != crc16 (0xFFFF, (const uint8_t *)&slot, sizeof(slot) - 2)) {
+		return false;
+	}
+	punch = slot.punch;
+
+	return true;
+
+}
+
+
+// Remove the punches before next, which must be in outbox, & save the header
+void PunchOutbox::release (uint16_t next) {
+
+	uint16_t count = next - firstSequence;
+
+	if (count == 0 || count > size()) {
+		return;
+	}
+
+	firstSequence = next;
+	firstSlot = (firstSlot + count) % OUTBOX_PUNCHES;
+	saveHeader ();
+
+}
+
+
+// Forget the punches from end on, because the slot of end was found not valid
+void PunchOutbox::truncate (uint16_t end) {
+	if ((uint16_t)(end - firstSequence) < size()) {
+		nextSequence = end;
+	}
+}
+
+
+uint16_t PunchOutbox::first () {
+	return firstSequence;
+}
+
+
+uint16_t PunchOutbox::end () {
+	return nextSequence;
+}
+
+
+uint16_t PunchOutbox::size () {
+	return nextSequence - firstSequence;
+}
+
+
+void PunchOutbox::saveHeader () {
+
+	OutboxHeader header;
+
+	header.magic = OUTBOX_MAGIC;
+	header.firstSequence = firstSequence;
+	header.firstSlot = firstSlot;
+	header.reserved = 0;
+	header.crc = crc16 (0xFFFF, (const uint8_t *)&header, sizeof(header) - 2);
+	eeprom.write (OUTBOX_ADDR, (byte *)&header, sizeof(header));
+
+}
+
+
+// Return the AT24C32 address of the slot of a sequence number in outbox
+unsigned int PunchOutbox::slotAddress (uint16_t sequence) {
+	return OUTBOX_ADDR + OUTBOX_SLOT_SIZE * (1 + (firstSlot + (uint16_t)(sequence -
+		firstSequence)) % OUTBOX_PUNCHES);
+}
+
+
+// Update a CRC-16 CCITT with len bytes
+uint16_t PunchOutbox::crc16 (uint16_t crc, const uint8_t *data, uint8_t len) {
+
+	for (uint8_t i = 0; i < len; i++) {
+		crc = crc16 (crc, data[i]);
+	}
+
+	return crc;
+
+}
+
+
+// Update a CRC-16 CCITT with one byte, like SerialInterface does
+uint16_t PunchOutbox::crc16 (uint16_t crc, uint8_t data) {
+
+	crc ^= ((uint16_t)data) << 8;
+	for (uint8_t i = 0; i < 8; i++) {
+		if (crc & 0x8000) {
+			crc = (crc << 1) ^ 0x1021;
+		} else {
+			crc <<= 1;
+		}
+	}
+
+	return crc;
+
+}
@@ -0,0 +1,92 @@
+/*********************************************************************************************/
+/*
+ * Punch outbox Arduino library
+ *
+ *  Punches waiting to be delivered by a station, kept in the AT24C32 of the RTC module so
+ *	they survive reboots. Each punch gets a sequence number & a page of its own (slot),
+ *	written once with its number and a CRC, so a slot half written when power was lost is
+ *	detected. The first page (header) keeps the oldest number still in the outbox and its
+ *	slot; it's only written when punches leave (release).
+ *
+ *	Slots are a ring of OUTBOX_PUNCHES pages after the header and before the wrap key of
+ *	SetUpStations (WRAP_KEY_ADDR). load() finds the punches left before a reboot: they are
+ *	the valid slots after the header one, in order. Used by SodaqNBIoT (NB-IoT) & MqttUplink.
+ *
+ *	CRC-16 is CCITT (polynomial 0x1021, initial value 0xFFFF), like in SerialInterface
+ *	frames and in the batches of punches.
+*/
+/*********************************************************************************************/
+
+
+#ifndef __PUNCHOUTBOX_H__
+#define __PUNCHOUTBOX_H__
+
+
+#include "Arduino.h"
+#include <AT24CX.h>						// I2C EEPROM in RTC module management library
+
+
+#define PUNCH_UID_MIN		4			// Shortest UID of ISO14443A cards
+#define PUNCH_UID_MAX		7			// Longest UID of ISO14443A cards
+#define PUNCH_MAC_SIZE		11			// Size of MAC in each punch record in user's card
+
+#define OUTBOX_EEPROM_ADDR	0x57		// I2C Address of EEPROM integrated in RTC module
+#define OUTBOX_ADDR			0			// AT24C32 address of outbox header
+#define OUTBOX_SLOT_SIZE	32			// A page of AT24C32 per punch: one write each
+#define OUTBOX_PUNCHES		126			// Slots after header & before station wrap key
+#define OUTBOX_MAGIC		0x4F42		// "OB" in outbox header
+
+
+// Punch waiting in outbox
+struct QueuedPunch {
+	uint8_t uidLength;
+	uint8_t uid [PUNCH_UID_MAX];
+	uint8_t data [1 + 4 + PUNCH_MAC_SIZE];	// IDS, time & MAC
+};
+
+
+class PunchOutbox {
+public:
+	PunchOutbox ();
+	uint16_t load ();					// Finds punches left before reboot. Returns them
+	bool push (const QueuedPunch &punch);	// False if full
+	bool read (uint16_t sequence, QueuedPunch &punch);	// False if slot isn't valid
+	void release (uint16_t next);		// Punches before next leave outbox
+	void truncate (uint16_t end);		// Outbox ends before a lost slot
+	uint16_t first ();					// Sequence number of oldest punch
+	uint16_t end ();					// Sequence number of next punch pushed
+	uint16_t size ();
+
+	static uint16_t crc16 (uint16_t crc, const uint8_t *data, uint8_t len);
+	static uint16_t crc16 (uint16_t crc, uint8_t data);	// Updates CRC-16 with one byte
+
+
+private:
+	// Punch in a slot. CRC detects slots half written when power was lost
+	struct OutboxSlot {
+		uint16_t sequence;
+		QueuedPunch punch;
+		uint16_t crc;
+	};
+
+	// First page of outbox
+	struct OutboxHeader {
+		uint16_t magic;
+		uint16_t firstSequence;			// Oldest punch in outbox
+		uint8_t firstSlot;				// Its slot
+		uint8_t reserved;
+		uint16_t crc;
+	};
+
+	AT24CX eeprom;						// Manages I2C EEPROM in RTC module
+	uint16_t firstSequence;
+	uint8_t firstSlot;
+	uint16_t nextSequence;
+
+	void saveHeader ();
+	unsigned int slotAddress (uint16_t sequence);
+
+};
+
+
+#endif
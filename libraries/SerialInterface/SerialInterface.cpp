@@ -13,9 +13,14 @@
 
 #include <SerialInterface.h>
 
+
+uint8_t SerialInterface::mode = SERIAL_MODE_TEXT;	// Text mode until PC asks for binary
+
+
 SerialInterface::SerialInterface () {
 
 	Serial.setTimeout(100);				// Max timeout that serial port waits for data
+	frameOpen = false;					// No frame is being sent
 
 }
 
@@ -25,6 +30,11 @@ uint8_t SerialInterface::sendStationIdReceiveChoice (uint8_t staID) {
 
 	uint8_t choice;
 
+	if (mode == SERIAL_MODE_BINARY) {
+		sendFrame (MSG_STATION_ID, &staID, 1);
+		return receiveByteFrame (MSG_CHOICE);
+	}
+
 	Serial.println(staID);				// Sends the station ID to PC
 
 	while (!Serial.available());		// Waits until serial data is detected
@@ -44,6 +54,10 @@ uint8_t SerialInterface::receiveChoice () {
 
 	uint8_t choice;
 
+	if (mode == SERIAL_MODE_BINARY) {
+		return receiveByteFrame (MSG_CHOICE);
+	}
+
 	while (!Serial.available());		// Waits until serial data is detected
 	delay(10);							// Waits serial buffer receives all data
 	choice = Serial.read();				// Saves user choice
@@ -58,6 +72,13 @@ uint8_t SerialInterface::receiveChoice () {
 uint8_t SerialInterface::receiveChoiceSendAck () {
 
 	uint8_t choice;
+	uint8_t ack = '1';
+
+	if (mode == SERIAL_MODE_BINARY) {
+		choice = receiveByteFrame (MSG_CHOICE);
+		sendFrame (MSG_ACK, &ack, 1);	// Send ACK
+		return choice;
+	}
 
 	while (!Serial.available());		// Waits until serial data is detected
 	delay(10);							// Waits serial buffer receives all data
@@ -72,11 +93,39 @@ uint8_t SerialInterface::receiveChoiceSendAck () {
 }
 
 
+// Master device receives a number in decimal format (i.e. how many stations set up)
+uint8_t SerialInterface::receiveNumber () {
+
+	uint8_t number [NUMBER_SIZE];		// Digits of the number
+	uint8_t count;						// A simple counter
+
+	if (mode == SERIAL_MODE_BINARY) {
+		return receiveByteFrame (MSG_NUMBER);
+	}
+
+	while (!Serial.available());		// Waits until serial data is detected
+	delay(10);							// Waits serial buffer receives all data
+	count = Serial.readBytes(number, NUMBER_SIZE-1);	// Read digits and saves them
+	number[count]='\0';					// Put null terminated
+	while (Serial.available()) {		// Clean the serial buffer
+		Serial.read();
+	}
+
+	return atoi((char*)number);
+
+}
+
+
 // Master device receives user name by USB serial port
 void SerialInterface::receiveName ( uint8_t *name ) {
 
 	uint8_t count;						// A simple counter
 
+	if (mode == SERIAL_MODE_BINARY) {
+		receiveTextFrame (name, NAME_SIZE);
+		return;
+	}
+
 	while (!Serial.available());		// Waits until serial data is detected
 	delay(10);							// Waits serial buffer receives all data
 	count = Serial.readBytes(name, NAME_SIZE-1);	// Read user name and saves it
@@ -93,6 +142,11 @@ void SerialInterface::receiveCategory ( uint8_t *category) {
 
 	uint8_t count;						// A simple counter
 
+	if (mode == SERIAL_MODE_BINARY) {
+		receiveTextFrame (category, CAT_SIZE);
+		return;
+	}
+
 	while (!Serial.available());		// Waits until serial data is detected
 	delay(10);							// Waits serial buffer receives all data
 	count = Serial.readBytes (category, CAT_SIZE-1);// Read user category and saves it
@@ -107,6 +161,11 @@ void SerialInterface::receiveCategory ( uint8_t *category) {
 // Master device recives date by Serial in format "mmm dd yyyy"
 void SerialInterface::receiveDate ( uint8_t *dateReceived ) {
 
+	if (mode == SERIAL_MODE_BINARY) {
+		receiveFrame (MSG_TEXT, dateReceived, STRING_DATE_SIZE);
+		return;
+	}
+
 	while (!Serial.available());		// Waits until serial data is detected
 	delay(10);							// Waits serial buffer receives all data
 	Serial.readBytes(dateReceived, STRING_DATE_SIZE);// Read time and saves it
@@ -117,6 +176,11 @@ void SerialInterface::receiveDate ( uint8_t *dateReceived ) {
 // Master device recives time by Serial in format "hh:mm:ss"
 void SerialInterface::receiveTime ( uint8_t *timeReceived ) {
 
+	if (mode == SERIAL_MODE_BINARY) {
+		receiveFrame (MSG_TEXT, timeReceived, STRING_TIME_SIZE);
+		return;
+	}
+
 	while (!Serial.available());		// Waits until serial data is detected
 	delay(10);							// Waits serial buffer receives all data
 	Serial.readBytes(timeReceived, STRING_TIME_SIZE);// Read time and saves it
@@ -126,12 +190,20 @@ void SerialInterface::receiveTime ( uint8_t *timeReceived ) {
 
 // Master device send a byte with any value by USB
 void SerialInterface::sendChar (uint8_t character) {
+	if (mode == SERIAL_MODE_BINARY) {
+		sendFrame (MSG_CHAR, &character, 1);
+		return;
+	}
 	Serial.println(character);
 }
 
 
 // Master device sends a String by USB serial
 void SerialInterface::sendString (uint8_t *string) {
+	if (mode == SERIAL_MODE_BINARY) {
+		sendFrame (MSG_TEXT, string, strlen((char*)string));
+		return;
+	}
 	Serial.println((char*)string);
 }
 
@@ -139,6 +211,10 @@ void SerialInterface::sendString (uint8_t *string) {
 
 // Master device sends a hexadecimal array in the correct way
 void SerialInterface::sendHexString(uint8_t array[], uint8_t len) {
+	if (mode == SERIAL_MODE_BINARY) {
+		sendFrame (MSG_HEX, array, len);	// Raw bytes, PC formats them
+		return;
+	}
 	char buffer [(len*2)+1];
 	for (uint8_t i = 0; i < len; i++) {
 		byte nib1 = (array[i] >> 4) & 0x0F;
@@ -154,6 +230,16 @@ void SerialInterface::sendHexString(uint8_t array[], uint8_t len) {
 
 // Master device sends a String with data about a punch
 void SerialInterface::sendPunchData (uint8_t ids, uint8_t *punchTime, uint8_t validated) {
+	if (mode == SERIAL_MODE_BINARY) {
+		uint8_t record [PUNCH_REC_SIZE] = { ids, punchTime[0], punchTime[1], punchTime[2],
+			(uint8_t)(validated ? 1 : 0) };
+		if (frameOpen) {				// Punch is part of a card readout frame
+			writeFrame (record, sizeof(record));
+		} else {
+			sendFrame (MSG_PUNCH, record, sizeof(record));
+		}
+		return;
+	}
 	Serial.println (ids);
 	if (punchTime[0] < 10) {
 		Serial.print("0");
@@ -180,9 +266,268 @@ void SerialInterface::sendPunchData (uint8_t ids, uint8_t *punchTime, uint8_t va
 
 // Send if there are more blocks to show
 void SerialInterface::sendContinue (uint8_t continueWithBlocks) {
+	if (mode == SERIAL_MODE_BINARY) {
+		// Each punch is a record of the frame, so only the end of the card is notified
+		if (!continueWithBlocks) {
+			if (frameOpen) {
+				endFrame ();			// All punches sent: closes card readout frame
+			} else {
+				sendFrame (MSG_CARD_END, NULL, 0);
+			}
+		}
+		return;
+	}
 	if (continueWithBlocks) {
 		Serial.println('1');
 	} else {
 		Serial.println('0');
 	}
-}	
\ No newline at end of file
+}	
+
+
+/* Master device sends station setup result in one line: "ID;status;ms" (status is 1 if Ok,
+  0 if failed or 2 if there was no room for its key)*/
+void SerialInterface::sendStationStatus (uint8_t staID, uint8_t status, uint32_t elapsed) {
+	if (mode == SERIAL_MODE_BINARY) {
+		uint8_t record [6] = { staID, status };
+		memcpy (&record[2], &elapsed, sizeof(elapsed));	// Little endian in AVR
+		sendFrame (MSG_STATION_STATUS, record, sizeof(record));
+		return;
+	}
+	Serial.print (staID);
+	Serial.print (";");
+	Serial.print (status);
+	Serial.print (";");
+	Serial.println (elapsed);
+}
+
+// Master device sends UID, name & category of a card
+void SerialInterface::sendCardHeader (uint8_t *uid, uint8_t *name, uint8_t *category) {
+	if (mode == SERIAL_MODE_BINARY) {
+		beginFrame (MSG_CARD_HEADER, CARD_HEADER_SIZE);
+		writeFrame (uid, UID_SIZE);
+		writeFrame (name, NAME_SIZE);
+		writeFrame (category, CAT_SIZE);
+		endFrame ();
+		return;
+	}
+	sendHexString (uid, UID_SIZE);
+	sendString (name);
+	sendString (category);
+}
+
+
+/* Master device starts sending a whole card in one frame. In binary mode each following
+sendPunchData adds a record to this frame and sendContinue(false) closes it, so the card is
+sent in a single burst without waiting for the PC. In text mode only header is sent. */
+void SerialInterface::beginCardReadout (uint8_t *uid, uint8_t *name, uint8_t *category,
+	uint8_t punches) {
+
+	if (mode == SERIAL_MODE_BINARY) {
+		beginFrame (MSG_CARD_READOUT, CARD_HEADER_SIZE + 1 + punches * PUNCH_REC_SIZE);
+		writeFrame (uid, UID_SIZE);
+		writeFrame (name, NAME_SIZE);
+		writeFrame (category, CAT_SIZE);
+		writeFrame (&punches, 1);
+		return;
+	}
+	sendCardHeader (uid, name, category);
+}
+
+
+/* Master device sends a fake card with TEST_PUNCHES punches as fast as possible, so PC can
+measure how many punches per second can be sent in current mode and baudrate */
+void SerialInterface::sendTestReadout () {
+
+	uint8_t uid [UID_SIZE] = { 0 };
+	uint8_t name [NAME_SIZE] = "Test";
+	uint8_t category [CAT_SIZE] = "Test";
+	uint8_t punchTime [3] = { 12, 34, 56 };
+
+	beginCardReadout (uid, name, category, TEST_PUNCHES);
+	for (uint8_t i = 0; i < TEST_PUNCHES; i++) {
+		sendContinue (true);
+		sendPunchData (i + 1, punchTime, true);
+	}
+	sendContinue (false);
+
+}
+
+
+/* Master device receives next entry of a start list: UID (all 0 for any card), name and
+category in one frame. An empty frame ends the list. Start lists are only streamed in binary
+mode, so in text mode the list is always empty. Returns false at the end of the list */
+uint8_t SerialInterface::receiveStartEntry (uint8_t *uid, uint8_t *name, uint8_t *category) {
+
+	uint8_t entry [CARD_HEADER_SIZE];	// UID, name & category
+
+	if (mode != SERIAL_MODE_BINARY) {
+		return false;
+	}
+
+	if (receiveFrame (MSG_START_ENTRY, entry, sizeof(entry)) != sizeof(entry)) {
+		return false;
+	}
+	memcpy (uid, entry, UID_SIZE);
+	memcpy (name, &entry[UID_SIZE], NAME_SIZE);
+	memcpy (category, &entry[UID_SIZE + NAME_SIZE], CAT_SIZE);
+	name[NAME_SIZE - 1] = '\0';			// Same limits as receiveName & receiveCategory
+	category[CAT_SIZE - 1] = '\0';
+
+	return true;
+
+}
+
+
+// Master device sends the result of programming a card in one line: "UID;status"
+void SerialInterface::sendFormatStatus (uint8_t *uid, uint8_t status) {
+	if (mode == SERIAL_MODE_BINARY) {
+		uint8_t payload [UID_SIZE + 1];
+		memcpy (payload, uid, UID_SIZE);
+		payload[UID_SIZE] = status;
+		sendFrame (MSG_FORMAT_STATUS, payload, sizeof(payload));
+		return;
+	}
+	for (uint8_t i = 0; i < UID_SIZE; i++) {
+		if (uid[i] < 0x10) {
+			Serial.print ('0');
+		}
+		Serial.print (uid[i], HEX);
+	}
+	Serial.print (";");
+	Serial.println (status);
+}
+
+
+// Changes between text & binary mode. Mode is shared by all the instances
+void SerialInterface::setMode (uint8_t newMode) {
+	mode = newMode;
+}
+
+
+// Returns the current mode
+uint8_t SerialInterface::getMode () {
+	return mode;
+}
+
+
+// Sends a whole binary frame
+void SerialInterface::sendFrame (uint8_t type, uint8_t *payload, uint16_t len) {
+	beginFrame (type, len);
+	writeFrame (payload, len);
+	endFrame ();
+}
+
+
+/* Waits for a binary frame of the given type and saves its payload. Frames with wrong CRC,
+other type or longer payload are answered with NAK and discarded. Returns payload length */
+uint16_t SerialInterface::receiveFrame (uint8_t type, uint8_t *payload, uint16_t maxLen) {
+
+	uint8_t rxType;						// Type of received frame
+	uint16_t len;						// Length of payload of received frame
+	uint16_t crc;						// CRC calculated over received bytes
+	uint16_t rxCrc;						// CRC received at the end of the frame
+	uint8_t data;						// Received byte
+
+	while (true) {
+
+		while (readByte() != FRAME_SYNC);	// Searches start of frame
+
+		rxType = readByte();
+		crc = crc16 (0xFFFF, rxType);
+		data = readByte();
+		crc = crc16 (crc, data);
+		len = data;
+		data = readByte();
+		crc = crc16 (crc, data);
+		len |= ((uint16_t)data) << 8;
+
+		if (len > maxLen) {				// Can't be saved: may be noise, so resync
+			sendFrame (MSG_NAK, &rxType, 1);
+			continue;
+		}
+
+		for (uint16_t i = 0; i < len; i++) {
+			payload[i] = readByte();
+			crc = crc16 (crc, payload[i]);
+		}
+		rxCrc = readByte();
+		rxCrc |= ((uint16_t)readByte()) << 8;
+
+		if ((rxCrc == crc) && (rxType == type)) {
+			return len;
+		}
+		sendFrame (MSG_NAK, &rxType, 1);
+	}
+
+}
+
+
+// Sends header of a frame whose payload will be sent with writeFrame
+void SerialInterface::beginFrame (uint8_t type, uint16_t len) {
+
+	uint8_t header [4] = { FRAME_SYNC, type, (uint8_t)len, (uint8_t)(len >> 8) };
+
+	Serial.write (header, sizeof(header));
+	txCrc = 0xFFFF;
+	for (uint8_t i = 1; i < sizeof(header); i++) {
+		txCrc = crc16 (txCrc, header[i]);
+	}
+	frameOpen = true;
+
+}
+
+
+// Sends part of the payload of the current frame
+void SerialInterface::writeFrame (uint8_t *data, uint16_t len) {
+
+	Serial.write (data, len);
+	for (uint16_t i = 0; i < len; i++) {
+		txCrc = crc16 (txCrc, data[i]);
+	}
+
+}
+
+
+// Sends the CRC of the current frame
+void SerialInterface::endFrame () {
+	uint8_t crc [2] = { (uint8_t)txCrc, (uint8_t)(txCrc >> 8) };
+	Serial.write (crc, sizeof(crc));
+	frameOpen = false;
+}
+
+
+// Waits for a byte from serial port and returns it. No sleeps: returns as soon as it arrives
+uint8_t SerialInterface::readByte () {
+	while (!Serial.available());
+	return Serial.read();
+}
+
+
+// Receives a frame with one byte of payload (choices, numbers...) and returns that byte
+uint8_t SerialInterface::receiveByteFrame (uint8_t type) {
+	uint8_t value = 0;
+	receiveFrame (type, &value, 1);
+	return value;
+}
+
+
+// Receives a string frame and puts null terminated
+void SerialInterface::receiveTextFrame (uint8_t *text, uint8_t size) {
+	uint16_t count = receiveFrame (MSG_TEXT, text, size - 1);
+	text[count] = '\0';
+}
+
+
+// Updates CRC-16 CCITT (polynomial 0x1021) with one byte
+uint16_t SerialInterface::crc16 (uint16_t crc, uint8_t data) {
+	crc ^= ((uint16_t)data) << 8;
+	for (uint8_t i = 0; i < 8; i++) {
+		if (crc & 0x8000) {
+			crc = (crc << 1) ^ 0x1021;
+		} else {
+			crc <<= 1;
+		}
+	}
+	return crc;
+}
@@ -7,6 +7,14 @@
  *  This library is used for establishing a communication with PC by serial port and allows
  *	users to interact with Arduino easily. Serial interface is an abstraction opened to be 
  *	implemented.
+ *
+ *	Two modes are available. Text mode sends each field in a line and is the default one.
+ *	Binary mode sends each message in a frame:
+ *
+ *		SYNC (0x7E) | TYPE | LEN (2 bytes, LSB first) | PAYLOAD | CRC-16 (2 bytes, LSB first)
+ *
+ *	CRC-16 is CCITT (polynomial 0x1021, initial value 0xFFFF) over TYPE, LEN and PAYLOAD.
+ *	Frames with wrong CRC or unexpected type are answered with a NAK frame.
 */
 /*********************************************************************************************/
 
@@ -25,6 +33,38 @@
 #define NAME_SIZE			16			// Size in bytes of player name field in card
 #define STRING_TIME_SIZE	8			// Size in bytes of time in format hh:mm:ss
 #define STRING_DATE_SIZE	11			// Size in bytes of date in format mmm dd yyyy
+#define NUMBER_SIZE			4			// Max digits of a number received from PC + '\0'
+#define SERIAL_BAUDRATE		115200		// Baudrate of serial port with PC
+
+#define SERIAL_MODE_TEXT	0			// Messages are sent in text lines
+#define SERIAL_MODE_BINARY	1			// Messages are sent in binary frames with CRC
+#define SERIAL_TEXT_CHOICE	'T'			// PC choice for changing to text mode
+#define SERIAL_BINARY_CHOICE	'B'		// PC choice for changing to binary mode
+
+#define FRAME_SYNC			0x7E		// First byte of each binary frame
+#define PUNCH_REC_SIZE		5			// IDS, hour, minute, second & validated
+#define UID_SIZE			4			// Size in bytes of UID of Mifare Classic cards
+#define TEST_PUNCHES		45			// Punches of a full Mifare Classic 1k card
+#define SERIAL_TEST_CHOICE	'5'			// PC choice for measuring serial throughput
+#define CARD_HEADER_SIZE	(UID_SIZE + NAME_SIZE + CAT_SIZE)	// Size of card header message
+
+#define MSG_ACK				0x01		// Acknowledge. Payload: value of ack
+#define MSG_NAK				0x02		// Frame rejected. Payload: type of rejected frame
+#define MSG_CHOICE			0x03		// User's choice. Payload: choice
+#define MSG_NUMBER			0x04		// Number. Payload: value
+#define MSG_TEXT			0x05		// String. Payload: chars without '\0'
+#define MSG_CHAR			0x06		// Byte. Payload: value
+#define MSG_HEX				0x07		// Byte array. Payload: bytes
+#define MSG_STATION_ID		0x10		// Next station ID. Payload: ID
+#define MSG_STATION_STATUS	0x11		// Setup result. Payload: ID, status, ms (4 bytes)
+#define MSG_CARD_HEADER		0x20		// Card header. Payload: UID, name, category
+#define MSG_CARD_READOUT	0x21		// Whole card. Payload: header, # punches, punches
+#define MSG_PUNCH			0x22		// Single punch. Payload: punch record
+#define MSG_CARD_END		0x23		// No more punches. Empty payload
+#define MSG_CARD_IMAGE		0x24		// Raw card. Payload: UID & 64 blocks of 16 bytes
+#define MSG_KEY_TABLE		0x25		// Station keys. Payload: # stations & 32 bytes keys
+#define MSG_START_ENTRY		0x26		// Start list entry. Payload: UID, name, category
+#define MSG_FORMAT_STATUS	0x27		// Card programmed. Payload: UID & status
 
 
 class SerialInterface {
@@ -33,6 +73,7 @@ public:
 	uint8_t sendStationIdReceiveChoice (uint8_t staID);	// Master sends to PC station ID
 	uint8_t receiveChoice ();			// Master receives a byte with user's choice
 	uint8_t receiveChoiceSendAck();		// Master receives user's choice and sends ACK
+	uint8_t receiveNumber ();			// Master receives a number in decimal format
 	void receiveName ( uint8_t *name );	// Master receives a user name for card by USB
 	void receiveCategory ( uint8_t *category );	// Master receives a user name for card by USB
 	void receiveTime ( uint8_t *timeReceived );	// Master receives time 
@@ -42,9 +83,29 @@ public:
 	void sendHexString(uint8_t array[], uint8_t len); // Master sends a hex string to PC
 	void sendPunchData (uint8_t ids, uint8_t *punchTime, uint8_t validated); // Show punch
 	void sendContinue (uint8_t continueWithBlocks);	// Send if there are more blocks to show
+	void sendStationStatus (uint8_t staID, uint8_t status, uint32_t elapsed); // Setup result
+	void sendCardHeader (uint8_t *uid, uint8_t *name, uint8_t *category);	// Card owner
+	void beginCardReadout (uint8_t *uid, uint8_t *name, uint8_t *category, uint8_t punches);
+	void sendTestReadout ();			// Sends a fake full card for measuring throughput
+	uint8_t receiveStartEntry (uint8_t *uid, uint8_t *name, uint8_t *category);	// Bulk format
+	void sendFormatStatus (uint8_t *uid, uint8_t status);	// Result of programming a card
+	static void setMode (uint8_t newMode);	// Changes between text & binary mode
+	static uint8_t getMode ();			// Returns the current mode
+	void sendFrame (uint8_t type, uint8_t *payload, uint16_t len);	// Sends a binary frame
+	void beginFrame (uint8_t type, uint16_t len);	// Sends header of a frame
+	void writeFrame (uint8_t *data, uint16_t len);	// Sends part of the payload of a frame
+	void endFrame ();					// Sends the CRC of a frame
+	uint16_t receiveFrame (uint8_t type, uint8_t *payload, uint16_t maxLen); // Receives frame
 
 private:
+	static uint8_t mode;				// Current mode, shared by all instances
+	uint16_t txCrc;						// CRC of frame that is being sent
+	uint8_t frameOpen;					// True while a frame is being sent
 
+	uint8_t readByte ();				// Waits for a byte from serial port and returns it
+	uint8_t receiveByteFrame (uint8_t type);	// Receives a frame with 1 byte payload
+	void receiveTextFrame (uint8_t *text, uint8_t size);	// Receives a string frame
+	static uint16_t crc16 (uint16_t crc, uint8_t data);	// Updates CRC-16 with one byte
 
 };
 
@@ -8,7 +8,9 @@
  *	Some of this methods are destinated to Master device and the other ones are destinated to
  * 	Stations devices.
  *
- *	Stations' setup is done by NFC P2P.
+ *	Stations' setup is done by NFC P2P. Since protocol V2, station answers Master's challenge
+ *	in the same P2P exchange with its public key & a truncated HMAC. Master detects V1 stations
+ *	by their empty answer and falls back to the previous flow.
  *
  *	Compatible boards with this library: Arduino UNO & Arduino Leonardo.
 */
@@ -46,9 +48,12 @@ void MasterSetUpStations::startNewEvent () {
 	EEPROM.update (NUM_STATIONS_ADDR, 0);	// Deletes the number of stations of previous event
 	stationID = 0;						// Updates the variable of next station identifier
 
-	// Generates a key pair for this event and saves Secret Key in EEPROM
-	Curve25519::dh1 (masterPk, masterSk);	// Generates public and secret keys for this event
+	// Generates a key pair for this event and saves both keys in EEPROM
+	EEPROM.update (PK_FLAG_ADDR, 0);	// Invalidates cached public key of previous event
+	Curve25519::dh1FixedBase (masterPk, masterSk);	// Generates public and secret keys for this event
 	EEPROM.put (SK_ADDR, masterSk);		// Saves master secret key in Arduino EEPROM
+	EEPROM.put (PK_ADDR, masterPk);		// Caches master public key in Arduino EEPROM
+	EEPROM.update (PK_FLAG_ADDR, PK_CACHED);	// Marks cached public key as valid
 
 	setUpProcess ();					// Starts setting up new stations
 
@@ -60,43 +65,72 @@ void MasterSetUpStations::continuePreviousEvent () {
 	
 	EEPROM.get (NUM_STATIONS_ADDR, stationID);	// Take the next station ID for setup
 	
-	// Generates the master public key from EEPROM saved master secret key
+	// Loads the master keys saved in EEPROM
 	EEPROM.get (SK_ADDR, masterSk);		// Load from Arduino EEPROM master secret key
-	Curve25519::eval (masterPk, masterSk, 0); // Generates master public key
+
+	if (EEPROM.read (PK_FLAG_ADDR) == PK_CACHED) {
+		EEPROM.get (PK_ADDR, masterPk);	// Load from Arduino EEPROM master public key
+	} else {
+		// Event created without cached public key: generates it once and caches it
+		Curve25519::evalFixedBase (masterPk, masterSk);
+		EEPROM.put (PK_ADDR, masterPk);
+		EEPROM.update (PK_FLAG_ADDR, PK_CACHED);
+	}
 
 	setUpProcess ();					// Starts setting up new stations
 
 }
 
 
+/* Sends to PC the keys of all the stations of this event in a binary frame, so PC can verify
+the punches of raw card images. It's done once per event, after setting up the stations */
+void MasterSetUpStations::exportStationKeys () {
+
+	uint8_t numStations;				// Number of stations of this event
+	uint8_t key [STATION_REC_SIZE];		// Key of current station
+
+	EEPROM.get (NUM_STATIONS_ADDR, numStations);
+
+	usb.beginFrame (MSG_KEY_TABLE, 1 + numStations * STATION_REC_SIZE);
+	usb.writeFrame (&numStations, 1);
+	for (uint8_t ids = 0; ids < numStations; ids++) {
+		i2cEeprom.read ((unsigned int)ids * STATION_REC_SIZE, key, STATION_REC_SIZE);
+		usb.writeFrame (key, STATION_REC_SIZE);
+	}
+	usb.endFrame ();
+
+	memset (key, 0, sizeof(key));		// Cleans key from memory
+
+}
+
+
 // Sets up each station one by one until user ends the process.
 void MasterSetUpStations::setUpProcess () {
 
 	uint8_t choice;						// User's choose
 	uint8_t flag;						// Control flag
 
-	choice = '1';						// Enters in the loop one time at least
+	choice = SETUP_ONE_CHOICE;			// Enters in the loop one time at least
 
-	while ( choice == '1' ) {			// If user chooses set up a new station...
+	// If user chooses set up a new station or a batch of them...
+	while ( (choice == SETUP_ONE_CHOICE) || (choice == SETUP_BATCH_CHOICE) ) {
 
 		choice = usb.sendStationIdReceiveChoice (stationID);
 
-		if (choice == '1') {
-			sendP2P ();					// Sends challenge to the station
-			receiveP2P();				// Receives station public key and HMAC
-			calculateSharedKey();		// Calculates keys of station & saves in I2C EEPROM
-			flag = checkHMAC();			// Checks HMAC received
+		if (choice == SETUP_ONE_CHOICE) {
+			// Sets up the station on reader if its key fits in I2C EEPROM
+			flag = (stationID < MASTER_MAX_STATIONS) ? setUpStation (false) : false;
 
+			// Ask for a new station or finish setup process 
 			if ( flag ) {
-				// Ask for a new station or finish setup process 
-				EEPROM [NUM_STATIONS_ADDR] += 1;	// Update the # of stations in Arduino EEPROM
-				EEPROM.get (NUM_STATIONS_ADDR, stationID);	// Loads the next station number
 				usb.sendChar('1');
 			} else {
 				usb.sendChar ('0');
 			}
 
-			
+		} else if (choice == SETUP_BATCH_CHOICE) {
+			batchSetUp (usb.receiveNumber());	// PC sends how many stations will be set up
+
 		} else {
 			usb.sendChar (choice);
 		}		
@@ -105,11 +139,74 @@ void MasterSetUpStations::setUpProcess () {
 }
 
 
+/* Sets up count stations one after another without waiting for the PC. After each station
+  Master sends to PC a status record with station ID, result & elapsed milliseconds. When
+  the I2C EEPROM can't hold more keys, the rest of stations are refused with status
+  SETUP_STATUS_FULL, so PC still receives count records*/
+void MasterSetUpStations::batchSetUp (uint8_t count) {
+
+	uint8_t currentID;					// ID assigned to the station on reader
+	uint8_t flag;						// Control flag
+	uint32_t startTime;					// For measuring time per station
+
+	for (uint8_t i = 0; i < count; i++) {
+
+		if (stationID >= MASTER_MAX_STATIONS) {	// Key would overwrite station 0's one
+			usb.sendStationStatus (stationID, SETUP_STATUS_FULL, 0);
+			continue;
+		}
+
+		startTime = millis();
+		currentID = stationID;
+
+		// Next station is searched by PN532 while this one's key is computed
+		flag = setUpStation ( (i+1 < count) && (stationID+1 < MASTER_MAX_STATIONS) );
+
+		usb.sendStationStatus (currentID, flag ? SETUP_STATUS_OK : SETUP_STATUS_ERROR,
+			millis()-startTime);
+	}
+
+}
+
+
+/* Sets up the station placed on reader: exchanges data by P2P, calculates & stores the station
+  key and checks the HMAC. If armNext is true, PN532 starts looking for the next station before
+  the key is calculated, so the exchange with it begins as soon as it is placed on reader.
+  Return true if station HMAC is correct*/
+uint8_t MasterSetUpStations::setUpStation (uint8_t armNext) {
+
+	uint8_t flag;						// Control flag
+
+	if ( !sendP2P () ) {				// Sends challenge to the station
+		receiveP2P();					// V1 station: receives public key and HMAC apart
+	}
+
+	if (armNext) {
+		p2p.P2PInitiatorInit();			// Only sends InJumpForDEP. sendP2P polls the answer
+	}
+
+	calculateSharedKey();				// Calculates keys of station & saves in I2C EEPROM
+	flag = checkHMAC();					// Checks HMAC received
+
+	if ( flag ) {
+		EEPROM [NUM_STATIONS_ADDR] += 1;	// Update the # of stations in Arduino EEPROM
+		EEPROM.get (NUM_STATIONS_ADDR, stationID);	// Loads the next station number
+	}
+
+	return flag;
+
+}
+
+
 /* Master device starts a communication with station by NFC P2P. Master sends the assigned 
-  station ID, its public key and a challenge built with current time and random bytes.*/
+  station ID, its public key and a challenge built with current time and random bytes.
+  Return true if station answered with its public key & HMAC in the same exchange (V2) or
+  false if answer was empty (V1 station) */
 uint8_t MasterSetUpStations::sendP2P () {
 
 	uint8_t tx_buf [MASTER_TX_BUF_SIZE];// Buffer that will be sent
+	uint8_t rx_buf [STATION_TX_BUF_SIZE];// Buffer that will be received
+	uint8_t rx_len;						// Size of data received
 	uint32_t timeStamp;					// Buffer that will contain time stamp
 	uint8_t randomNumber [CHALLENGE_SIZE - TIME_SIZE];	// Buffer for random generation
 	uint8_t flag;						// Control flag
@@ -127,16 +224,26 @@ uint8_t MasterSetUpStations::sendP2P () {
 	memcpy(&tx_buf[1], challenge, sizeof(challenge));	// Challenge
 	memcpy(&tx_buf[17], masterPk, sizeof(masterPk));	// Master public key
 
-	// Sends station ID, challenge and master public key by NFC P2P
+	// Sends station ID, challenge and master public key by NFC P2P. Waits for the answer
 	flag = false;
 	while (!flag) {
 		if (p2p.P2PInitiatorInit()) {	// Waits until the station is detected
-			if (p2p.P2PInitiatorTxRx(tx_buf, sizeof(tx_buf), 0, 0)) {	// Sends data
+			if (p2p.P2PInitiatorTxRx(tx_buf, sizeof(tx_buf), rx_buf, &rx_len, SETUP_RESP_TIMEOUT)) {
 				flag = true;
 			}
 		}
 	}
-	return 1;
+
+	// V2 station answers with its public key & HMAC. V1 station answers nothing
+	if (rx_len == STATION_TX_BUF_SIZE) {
+		memcpy (stationPk, rx_buf, KEY_SIZE);	// Copies station public key in memory
+		memcpy (hmac, &rx_buf[KEY_SIZE], SETUP_HMAC_SIZE);	// Copies HMAC in memory
+		hmacSize = SETUP_HMAC_SIZE;
+		return true;
+	} else {
+		hmacSize = KEY_SIZE;
+		return false;
+	}
 
 }
 
@@ -192,7 +299,7 @@ void MasterSetUpStations::calculateSharedKey() {
 				// }
 				// Serial.println();
 
-	uint8_t position = (stationID * STATION_REC_SIZE);
+	unsigned int position = (stationID * STATION_REC_SIZE);	// 8 bits overflow at station 8
 
 	i2cEeprom.write (position, sharedKey, STATION_REC_SIZE); 
   
@@ -217,8 +324,8 @@ uint8_t MasterSetUpStations::checkHMAC () {
 	sha256.update(stationPk, sizeof(stationPk));	// Introduces station public key
 	sha256.finalizeHMAC(sharedKey, sizeof(sharedKey), calculatedHMAC, sizeof(calculatedHMAC));
 
-	// Check hmac calculated and received is the same
-	if (  memcmp (hmac, calculatedHMAC, sizeof(hmac)) == 0  ) {
+	// Check hmac calculated and received is the same (V2 stations send it truncated)
+	if (  memcmp (hmac, calculatedHMAC, hmacSize) == 0  ) {
 		return true;
 	} else {
 		return false;
@@ -237,29 +344,58 @@ uint8_t MasterSetUpStations::checkHMAC () {
 // Class constructor
 StationNewSetUp::StationNewSetUp () {
 
+#ifdef SETUP_DEBUG
+	uint32_t startTime;					// For measuring key generation time
+#endif
+
 	rtc.begin();						// Inits Real Time Clock hardware
 	p2p.begin();						// Configures & resets PN532 module
 	p2p.SAMConfiguration();				// Configure the Secure Access Module of PN532 for P2P
+	i2cEeprom=AT24C32(I2C_EEPROM_ADDR);	// Inits I2C EEPROM in RTC module in I2C address
 	RNG.begin (RNG_APP_TAG_STATI, RNG_SEED_ADDR);	// Saves new seed for generating random
-	Curve25519::dh1 (stationPk, stationSk_HMAC);	// Gen public-secret keys for this station
+
+	// Key pair is generated now only if it wasn't precomputed after previous setup
+	if ( !loadKeys() ) {
+#ifdef SETUP_DEBUG
+		startTime = millis();
+#endif
+		Curve25519::dh1 (stationPk, stationSk_HMAC);	// Gen public-secret keys for this station
+#ifdef SETUP_DEBUG
+		Serial.print ("dh1 time (ms): ");
+		Serial.println (millis()-startTime);
+#endif
+	}
 
 }
 
 
-// Station erases previous data from EEPROM & start setup with data from Master by NFC P2P
-void StationNewSetUp::startNewSetUp () {
+/* Station erases previous data from EEPROM & start setup with data from Master by NFC P2P.
+  SETUP_PROTOCOL_V1 must be used with Masters that don't wait for the answer */
+void StationNewSetUp::startNewSetUp (uint8_t protocol) {
 
 	uint32_t realTime;					// For storing received real time
+#ifdef SETUP_DEBUG
+	uint32_t startTime;					// For measuring shared key calculation time
+#endif
 
 	// If MASTER setup process is detected before timeout
-	if ( receiveP2P () ) {				// Receives setup message and parse its data
+	if ( receiveP2P (protocol) ) {		// Receives setup message and parse its data
+
+		EEPROM.update (PRECOMP_FLAG_ADDR, 0);	// Precomputed key pair is never used twice
 
 		// Adjust RTC with the 4 firsts bytes from received challenge
 		memcpy (&realTime, challenge, sizeof(realTime));// Challenge contains the real time
 		rtc.adjust(realTime);			// Adjusts the RTC
 
 		// Calculates the Diffie-Hellman shared key. This will be the station key
+#ifdef SETUP_DEBUG
+		startTime = millis();
+#endif
 		Curve25519::dh2 (masterPk_Shared, stationSk_HMAC);	// Generates DH key & erases secret key
+#ifdef SETUP_DEBUG
+		Serial.print ("dh2 time (ms): ");	// Only wait of setup that station can't avoid
+		Serial.println (millis()-startTime);
+#endif
 		EEPROM.put (STATION_ID_ADDR, stationID);			// Saves in EEPROM the station ID
 		
 
@@ -276,8 +412,12 @@ void StationNewSetUp::startNewSetUp () {
 		EEPROM.put (SHARED_KEY_ADDR, masterPk_Shared);		// Saves in EEPROM the shared key
 
 		calculateHMAC ();				// Calculates HMAC & saves it in stationSk_HMAC
-	  
-		sendP2P();						// Sends HMAC & Station public key to master
+
+		if (protocol == SETUP_PROTOCOL_V2) {
+			answerP2P();				// Answers HMAC & public key in the same exchange
+		} else {
+			sendP2P();					// Sends HMAC & Station public key to master
+		}
 	
 	}					
 
@@ -285,9 +425,72 @@ void StationNewSetUp::startNewSetUp () {
 }
 
 
+/* Station generates the key pair for next setup and saves it in EEPROM, so only dh2 is done
+while station is on Master. Secret key is encrypted with a new random key that is saved in
+the I2C EEPROM of RTC module, so Arduino EEPROM alone doesn't reveal it. Must be called when
+station is idle, i.e. when setup has finished*/
+void StationNewSetUp::precomputeKeys () {
+
+	uint8_t wrapKey [KEY_SIZE];			// Key that encrypts secret key
+	uint8_t iv [WRAP_IV_SIZE];			// Wrap key is used once, so IV can be constant
+	uint8_t encryptedSk [KEY_SIZE];		// Secret key encrypted
+
+	if (EEPROM.read (PRECOMP_FLAG_ADDR) == PRECOMP_VALID) {
+		return;							// Setup timed out and key pair wasn't used
+	}
+
+	Curve25519::dh1 (stationPk, stationSk_HMAC);	// Gen public-secret keys for next setup
+
+	RNG.rand (wrapKey, sizeof(wrapKey));
+	memset (iv, 0, sizeof(iv));
+	chacha.setKey (wrapKey, sizeof(wrapKey));
+	chacha.setIV (iv, sizeof(iv));
+	chacha.encrypt (encryptedSk, stationSk_HMAC, sizeof(encryptedSk));
+	chacha.clear ();
+
+	i2cEeprom.write (WRAP_KEY_ADDR, wrapKey, sizeof(wrapKey));	// Saves wrap key in RTC module
+	EEPROM.put (PRECOMP_PK_ADDR, stationPk);	// Saves public key
+	EEPROM.put (PRECOMP_SK_ADDR, encryptedSk);	// Saves encrypted secret key
+	EEPROM.update (PRECOMP_FLAG_ADDR, PRECOMP_VALID);	// Key pair is ready for next setup
+
+	memset (wrapKey, 0, sizeof(wrapKey));
+
+}
+
+
+/* Station loads & decrypts the key pair saved by precomputeKeys.
+Return true if there was an unused key pair or false otherwise*/
+uint8_t StationNewSetUp::loadKeys () {
+
+	uint8_t wrapKey [KEY_SIZE];			// Key that encrypts secret key
+	uint8_t iv [WRAP_IV_SIZE];			// Wrap key is used once, so IV can be constant
+	uint8_t encryptedSk [KEY_SIZE];		// Secret key encrypted
+
+	if (EEPROM.read (PRECOMP_FLAG_ADDR) != PRECOMP_VALID) {
+		return false;
+	}
+
+	i2cEeprom.read (WRAP_KEY_ADDR, wrapKey, sizeof(wrapKey));	// Loads wrap key from RTC module
+	EEPROM.get (PRECOMP_PK_ADDR, stationPk);	// Loads public key
+	EEPROM.get (PRECOMP_SK_ADDR, encryptedSk);	// Loads encrypted secret key
+
+	memset (iv, 0, sizeof(iv));
+	chacha.setKey (wrapKey, sizeof(wrapKey));
+	chacha.setIV (iv, sizeof(iv));
+	chacha.decrypt (stationSk_HMAC, encryptedSk, sizeof(encryptedSk));
+	chacha.clear ();
+
+	memset (wrapKey, 0, sizeof(wrapKey));
+
+	return true;
+
+}
+
+
 /* Station waits until receives challenge message or timeout. Parse the data received.
+With SETUP_PROTOCOL_V2 the exchange is left open so answerP2P can respond to Master.
 Return true if challenge message is received or false if timeout*/
-uint8_t StationNewSetUp::receiveP2P () {
+uint8_t StationNewSetUp::receiveP2P (uint8_t protocol) {
 
 	uint8_t rx_buf [MASTER_TX_BUF_SIZE];// Buffer that will be received
 	uint8_t rx_len;						// Size of data received
@@ -300,14 +503,18 @@ uint8_t StationNewSetUp::receiveP2P () {
 	while ( (!flag) && ((millis()-startTime) < (SETUP_TIMEOUT*1000) ) ) {
 
 		if(p2p.P2PTargetInit()){
-			if(p2p.P2PTargetTxRx(0, 0, rx_buf, &rx_len)){ 
+			if (protocol == SETUP_PROTOCOL_V2) {
+				flag = p2p.P2PTargetRx(rx_buf, &rx_len);	// Master waits for our answer
+			} else {
+				flag = p2p.P2PTargetTxRx(0, 0, rx_buf, &rx_len);
+			}
+
+			if(flag){
 
 				// Copy station ID, challenge and master public key
 				stationID = rx_buf[0];
 				memcpy (challenge, &rx_buf[1], sizeof(challenge));
 				memcpy (masterPk_Shared, &rx_buf[17], sizeof(masterPk_Shared));
- 
-				flag = true;
 
 			}
 		}
@@ -361,4 +568,19 @@ void StationNewSetUp::sendP2P () {
 		}
 	}
 
+}
+
+
+
+/* Station answers Master's challenge in the same P2P exchange opened by receiveP2P with its
+public key & the first SETUP_HMAC_SIZE bytes of HMAC. 64 bytes don't fit in a PN532 frame*/
+void StationNewSetUp::answerP2P () {
+
+	uint8_t tx_buf [STATION_TX_BUF_SIZE];// Buffer that will be sent
+
+	memcpy (tx_buf, stationPk, sizeof(stationPk));	// Station public key
+	memcpy (&tx_buf[KEY_SIZE], stationSk_HMAC, SETUP_HMAC_SIZE);	// Truncated HMAC
+
+	p2p.P2PTargetTx (tx_buf, sizeof(tx_buf));	// Master is waiting in P2PInitiatorTxRx
+
 }
\ No newline at end of file
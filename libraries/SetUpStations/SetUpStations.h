@@ -8,7 +8,9 @@
  *	Some of this methods are destinated to Master device and the other ones are destinated to
  * 	Stations devices.
  *
- *	Stations' setup is done by NFC P2P.
+ *	Stations' setup is done by NFC P2P. Since protocol V2, station answers Master's challenge
+ *	in the same P2P exchange with its public key & a truncated HMAC. Master detects V1 stations
+ *	by their empty answer and falls back to the previous flow.
  *
  *	Compatible boards with this library: Arduino UNO & Arduino Leonardo.
 */
@@ -29,6 +31,7 @@
 #include <EEPROM.h>						// Arduino EEPROM management library
 #include <RNG.h>						// Random Number Generator library
 #include <SHA256.h>						// HMAC SHA256 library
+#include <ChaCha.h>						// ChaCha stream cipher library
 #include <Curve25519.h>					// Diffie-Hellman library
 #include <RTClib.h>						// Real Time Clock library
 #include <AT24CX.h>						// I2C EEPROM in RTC module management library
@@ -43,17 +46,41 @@
 #define CHALLENGE_SIZE		16			// Size in bytes of generated challenge
 #define KEY_SIZE			32			// Size in bytes of keys used
 #define STATION_REC_SIZE	32			// Size in bytes of each station record
+#define I2C_EEPROM_SIZE		4096		// Size in bytes of AT24C32 in RTC module
+#define MASTER_MAX_STATIONS	(I2C_EEPROM_SIZE / STATION_REC_SIZE)	// Keys master can store
 #define MASTER_RX_BUF_SIZE	32			// Max bytes of message that MASTER can receive
 #define MASTER_TX_BUF_SIZE	49			// Max bytes of message that MASTER can send
+#define STATION_TX_BUF_SIZE	48			// Bytes of station response in one round-trip setup
+#define SETUP_HMAC_SIZE		16			// Bytes of HMAC sent in one round-trip setup
+#define SETUP_RESP_TIMEOUT	15000		// Max time in ms Master waits for station response
+#define SETUP_PROTOCOL_V1	1			// Station answers in two extra P2P exchanges
+#define SETUP_PROTOCOL_V2	2			// Station answers in the same P2P exchange
+#define SETUP_ONE_CHOICE	'1'			// PC choice for setting up one station
+#define SETUP_BATCH_CHOICE	'3'			// PC choice for setting up N stations unattended
+#define SETUP_STATUS_ERROR	0			// Station setup failed (wrong HMAC or timeout)
+#define SETUP_STATUS_OK		1			// Station set up
+#define SETUP_STATUS_FULL	2			// Not set up: no room for more keys in I2C EEPROM
+#define EXPORT_KEYS_CHOICE	'7'			// PC choice for exporting the station keys
 #define NUM_STATIONS_ADDR	0			// EEPROM address where master saves the # of stations
 #define RNG_SEED_ADDR		1			// EEPROM address where master & station saves RNGseed
 #define SK_ADDR				50			// EEPROM address where master saves secret key
+#define PK_FLAG_ADDR		82			// EEPROM address where master marks a cached public key
+#define PK_ADDR				83			// EEPROM address where master caches its public key
+#define PK_CACHED			0x5A		// Value of flag when cached public key matches secret key
 #define STATION_ID_ADDR		0			// EEPROM address where station saves its identifier
 #define SHARED_KEY_ADDR		50			// EEPROM address where station saves its shared key
+#define PRECOMP_FLAG_ADDR	100			// EEPROM address where station marks a precomputed key
+#define PRECOMP_PK_ADDR		101			// EEPROM address of precomputed station public key
+#define PRECOMP_SK_ADDR		133			// EEPROM address of precomputed encrypted secret key
+#define PRECOMP_VALID		0xA5		// Value of flag when precomputed key pair is unused
+#define WRAP_KEY_ADDR		4064		// I2C EEPROM address of key that encrypts secret key
+#define WRAP_IV_SIZE		8			// Size in bytes of ChaCha IV
 #define I2C_EEPROM_ADDR		0x57		// I2C Address of EEPROM integrated in RTC module
 #define RNG_APP_TAG_MASTER	"master"	// Name unique of master for taking RNG seed
 #define RNG_APP_TAG_STATI	"stati"		// Name unique of station for taking RNG seed
 
+//#define SETUP_DEBUG						// Station prints by Serial the ms of dh1 & dh2
+
 
 // Class for Master devices
 class MasterSetUpStations {
@@ -61,6 +88,7 @@ public:
 	MasterSetUpStations ();
 	void startNewEvent ();				// Erases previous data of EEPROM & generates new keys
 	void continuePreviousEvent();		// Loads data of previous event from EEPROM
+	void exportStationKeys();			// Sends the keys of all stations to PC
 
 private:
 	P2PPN532 p2p;						// Manages NFC P2P connection
@@ -72,13 +100,16 @@ private:
 	uint8_t stationID;					// ID of current station
 	uint8_t challenge[CHALLENGE_SIZE];	// For stores the challenge
 	uint8_t hmac [KEY_SIZE];			// HMAC received from station
+	uint8_t hmacSize;					// Bytes of HMAC received (depends on protocol)
 	uint8_t masterPk [KEY_SIZE];		// Master Diffie-Hellman public key
 	uint8_t masterSk [KEY_SIZE];		// Master Diffie-Hellman secret key
 	uint8_t stationPk [KEY_SIZE];		// Station public key received
 
 	void setUpProcess();				// Set up stations
-	uint8_t sendP2P();					// Master sends to Station some data & a challenge 
-	void receiveP2P();					// Master receives response from station by P2P
+	void batchSetUp(uint8_t count);		// Set up count stations without asking the PC
+	uint8_t setUpStation(uint8_t armNext);	// Set up one station. True if HMAC is correct
+	uint8_t sendP2P();					// Master sends challenge. True if station answered
+	void receiveP2P();					// Master receives response from V1 station by P2P
 	void calculateSharedKey();			// Master calculates & stores the station key
 	uint8_t checkHMAC ();				// Master checks received HMAC
 };
@@ -88,13 +119,17 @@ private:
 class StationNewSetUp {
 public:
 	StationNewSetUp();
-	void startNewSetUp ();				// Erases previous data & start setup by NFC P2P
+	// Erases previous data & start setup by NFC P2P
+	void startNewSetUp (uint8_t protocol = SETUP_PROTOCOL_V2);
+	void precomputeKeys ();				// Generates & saves key pair for next setup
 
 
 private:
 	P2PPN532 p2p;						// Object that manages NFC P2P connection
 	SHA256 sha256;						// Object that manages HMAC & SHA256 functionalities
 	RTC_DS3231 rtc;						// Object that manages Real Time Clock
+	AT24CX i2cEeprom;					// Manages I2C EEPROM in RTC module
+	ChaCha chacha;						// Encrypts precomputed secret key in EEPROM
 
 	uint8_t stationID;					// ID of current station
 	uint8_t challenge[CHALLENGE_SIZE];	// Array for generating the challenge
@@ -102,9 +137,11 @@ private:
 	uint8_t stationSk_HMAC [KEY_SIZE];	// Station Diffie-Hellman secret key or HMAC
 	uint8_t masterPk_Shared[KEY_SIZE];	// Can have two values: Master public key & shared key
 
-	uint8_t receiveP2P();				// Waits until receivING challenge message or timeout
+	uint8_t loadKeys();					// Loads precomputed key pair. True if there was one
+	uint8_t receiveP2P(uint8_t protocol);	// Waits until receivING challenge message or timeout
 	void calculateHMAC();				// Calculates data received HMAC & station public key
 	void sendP2P();						// Station sends to Master its public key & HMAC
+	void answerP2P();					// Station answers challenge in the same exchange
 
 };
 
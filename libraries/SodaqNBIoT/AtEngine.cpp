@@ -0,0 +1,239 @@
+/*********************************************************************************************/
+/*
+ * AT command engine
+ *
+ *  Non-blocking engine for AT commands of ublox N211.
+*/
+/*********************************************************************************************/
+
+
+#include <AtEngine.h>
+
+
+// Result of a blocking command
+struct BlockingResult {
+	uint8_t result;
+	char *info;
+	uint8_t infoSize;
+};
+
+
+AtEngine::AtEngine (Stream &port, Stream *debug) : port (port), debug (debug) {
+	head = count = 0;
+	inFlight = false;
+	sentTime = 0;
+	lineLength = 0;
+	info[0] = '\0';
+	numUrcs = 0;
+}
+
+
+/* Queue a command. It's written when previous ones finish and callback is called with its
+	result. Return false if the queue is full or the command too long */
+bool AtEngine::send (const char *command, unsigned long timeOut, AtCallback callback,
+	void *context, AtWriter writer, void *writerContext) {
+
+	Command *queued;
+
+	if (count == AT_QUEUE_SIZE || strlen (command) >= AT_COMMAND_MAX) {
+		return false;
+	}
+
+	queued = &queue[(head + count) % AT_QUEUE_SIZE];
+	strcpy (queued->text, command);
+	queued->timeOut = timeOut;
+	queued->callback = callback;
+	queued->context = context;
+	queued->writer = writer;
+	queued->writerContext = writerContext;
+	count++;
+
+	if (!inFlight) {
+		writeHead ();
+	}
+
+	return true;
+
+}
+
+
+/* Send a command and wait for its result, handling other lines & commands meanwhile.
+	Info line is copied in info if it isn't NULL */
+uint8_t AtEngine::execute (const char *command, unsigned long timeOut, char *info,
+	uint8_t infoSize, AtWriter writer, void *writerContext) {
+
+	BlockingResult done = { AT_PENDING, info, infoSize };
+
+	// Waits for room in the queue, so command isn't lost
+	while (count == AT_QUEUE_SIZE) {
+		poll ();
+	}
+
+	if (!send (command, timeOut, storeResult, &done, writer, writerContext)) {
+		return AT_ERROR;
+	}
+
+	while (done.result == AT_PENDING) {
+		poll ();
+	}
+
+	return done.result;
+
+}
+
+
+// Call handler with each line starting with prefix. Return false if there's no room
+bool AtEngine::onUrc (const char *prefix, AtUrcHandler handler, void *context) {
+
+	if (numUrcs == AT_URC_MAX) {
+		return false;
+	}
+
+	urcs[numUrcs].prefix = prefix;
+	urcs[numUrcs].length = strlen (prefix);
+	urcs[numUrcs].handler = handler;
+	urcs[numUrcs].context = context;
+	numUrcs++;
+
+	return true;
+
+}
+
+
+/* Read the bytes received since last call, handle complete lines and finish the command in
+	flight if its time out has passed. Never waits */
+void AtEngine::poll () {
+
+	while (port.available()) {
+		char c = port.read ();
+
+		if (c == '\n') {
+			handleLine ();
+			lineLength = 0;
+		} else if (c != '\r' && lineLength < AT_LINE_MAX) {
+			line[lineLength++] = c;
+		}
+	}
+
+	if (inFlight && (millis() - sentTime) > queue[head].timeOut) {
+		finish (AT_TIMEOUT);
+	}
+
+}
+
+
+// Return true if there is no command queued or in flight
+bool AtEngine::idle () {
+	return count == 0;
+}
+
+
+// Drop every command without calling callbacks. Partial line is dropped too
+void AtEngine::clear () {
+	head = count = 0;
+	inFlight = false;
+	lineLength = 0;
+}
+
+
+
+
+
+
+
+
+// Write the command at head of queue and its data
+void AtEngine::writeHead () {
+
+	Command &command = queue[head];
+
+	if (debug != NULL) {
+		debug->print ("-- ");			// Print AT command sended without its data
+		debug->println (command.text);
+	}
+
+	port.print (command.text);
+	if (command.writer != NULL) {
+		command.writer (port, command.writerContext);
+	}
+	port.print ('\r');
+
+	info[0] = '\0';
+	inFlight = true;
+	sentTime = millis();				// Time out starts after data has been written
+
+}
+
+
+
+/* Handle a complete line: unsolicited result codes go to their handler, final result codes
+	finish the command in flight and the first other line is kept as its information */
+void AtEngine::handleLine () {
+
+	line[lineLength] = '\0';
+
+	if (lineLength == 0) {
+		return;
+	}
+
+	if (debug != NULL) {
+		debug->println (line);			// DEBUG: Print response from ublox module
+	}
+
+	for (uint8_t i = 0; i < numUrcs; i++) {
+		if (strncmp (line, urcs[i].prefix, urcs[i].length) == 0) {
+			urcs[i].handler (urcs[i].context, line);
+			return;
+		}
+	}
+
+	if (!inFlight) {
+		return;							// Boot messages or response after time out
+	}
+
+	if (strcmp (line, "OK") == 0) {
+		finish (AT_OK);
+	} else if (strcmp (line, "ERROR") == 0 || strncmp (line, "+CME ERROR", 10) == 0) {
+		finish (AT_ERROR);
+	} else if (info[0] == '\0' && strncmp (line, "AT", 2) != 0) {	// Echo isn't info
+		strcpy (info, line);
+	}
+
+}
+
+
+
+/* Finish the command in flight: removes it from queue before calling its callback, so
+	callback can queue more commands, and writes the next one */
+void AtEngine::finish (uint8_t result) {
+
+	Command done = queue[head];
+
+	head = (head + 1) % AT_QUEUE_SIZE;
+	count--;
+	inFlight = false;
+
+	if (done.callback != NULL) {
+		done.callback (done.context, result, info);
+	}
+
+	if (!inFlight && count > 0) {
+		writeHead ();
+	}
+
+}
+
+
+
+// Callback of blocking commands. Saves result & info in a BlockingResult
+void AtEngine::storeResult (void *context, uint8_t result, const char *info) {
+
+	BlockingResult *done = (BlockingResult *)context;
+
+	if (done->info != NULL && done->infoSize > 0) {
+		strncpy (done->info, info, done->infoSize - 1);
+		done->info[done->infoSize - 1] = '\0';
+	}
+	done->result = result;
+
+}
@@ -0,0 +1,99 @@
+/*********************************************************************************************/
+/*
+ * AT command engine
+ *
+ *  Non-blocking engine for AT commands of ublox N211. Commands are queued with send() and
+ *	written one by one; poll() reads what the UART interrupt has buffered, splits it in
+ *	lines and finishes the command in flight when "OK", "ERROR" or its time out arrives,
+ *	calling its callback with the result and its first information line. Lines starting
+ *	with a registered prefix (unsolicited result codes like +CEREG or +NSONMI) are given
+ *	to their handler whenever they arrive.
+ *
+ *	Long data (hex of AT+NSOST) isn't kept in the queue: the command has a writer that
+ *	streams it to the port after the text of the command.
+ *
+ *	poll() must be called often: HardwareSerial buffers 64 bytes, 66 ms at 9600 baud.
+*/
+/*********************************************************************************************/
+
+
+#ifndef __ATENGINE_H__
+#define __ATENGINE_H__
+
+
+#include "Arduino.h"
+
+
+#define AT_QUEUE_SIZE		4			// Commands waiting to be written
+#define AT_COMMAND_MAX		64			// Text of a command (without streamed data)
+#define AT_LINE_MAX			80			// Longest line received; longer ones are truncated
+#define AT_URC_MAX			4			// Unsolicited result codes with handler
+
+#define AT_PENDING			0			// Results of a command
+#define AT_OK				1
+#define AT_ERROR			2
+#define AT_TIMEOUT			3
+
+
+// Called when a command finishes. Info is its first information line ("" if none)
+typedef void (*AtCallback) (void *context, uint8_t result, const char *info);
+// Called with each line starting with a registered prefix
+typedef void (*AtUrcHandler) (void *context, const char *line);
+// Writes the data of a command after its text. "\r" is written by the engine
+typedef void (*AtWriter) (Stream &port, void *context);
+
+
+class AtEngine {
+public:
+	AtEngine (Stream &port, Stream *debug = NULL);
+	bool send (const char *command, unsigned long timeOut, AtCallback callback = NULL,
+		void *context = NULL, AtWriter writer = NULL, void *writerContext = NULL);
+	uint8_t execute (const char *command, unsigned long timeOut, char *info = NULL,
+		uint8_t infoSize = 0, AtWriter writer = NULL, void *writerContext = NULL);	// Blocking
+	bool onUrc (const char *prefix, AtUrcHandler handler, void *context);
+	void poll ();						// Reads responses & writes next command
+	bool idle ();						// True if no command is queued or in flight
+	void clear ();						// Drops queued commands (after module reset)
+
+
+private:
+	// Command in queue
+	struct Command {
+		char text [AT_COMMAND_MAX];
+		unsigned long timeOut;
+		AtCallback callback;
+		void *context;					// Given to callback
+		AtWriter writer;
+		void *writerContext;
+	};
+
+	// Handler of unsolicited result code
+	struct Urc {
+		const char *prefix;
+		uint8_t length;					// Length of prefix
+		AtUrcHandler handler;
+		void *context;
+	};
+
+	Stream &port;						// UART of ublox module
+	Stream *debug;						// Port where commands & responses are printed
+	Command queue [AT_QUEUE_SIZE];		// Ring buffer; the head is the one in flight
+	uint8_t head;
+	uint8_t count;
+	bool inFlight;						// Head has been written & waits its response
+	unsigned long sentTime;				// millis() when head was written
+	char line [AT_LINE_MAX + 1];		// Line being received
+	uint8_t lineLength;
+	char info [AT_LINE_MAX + 1];		// First information line of command in flight
+	Urc urcs [AT_URC_MAX];
+	uint8_t numUrcs;
+
+	void writeHead ();					// Writes command at head of queue
+	void handleLine ();					// Handles a complete line
+	void finish (uint8_t result);		// Finishes command in flight & calls its callback
+	static void storeResult (void *context, uint8_t result, const char *info);
+
+};
+
+
+#endif
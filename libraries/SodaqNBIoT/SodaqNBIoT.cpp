@@ -13,15 +13,106 @@
 
 #include <SodaqNBIoT.h>
 
-SodaqNBIoT::SodaqNBIoT () { 
-	IP = "";
-	imei = "";
+
+// Data streamed in hex after an AT command
+struct HexData {
+	const uint8_t *data;
+	uint16_t length;
+};
+
+
+// Return the value of an hexadecimal digit
+static uint8_t hexValue (char digit) {
+	if (digit >= 'a') {
+		return digit - 'a' + 10;
+	} else if (digit >= 'A') {
+		return digit - 'A' + 10;
+	}
+	return digit - '0';
 }
 
 
-// Start ublox n211 module
+// Commands sent by set up, in order. After AT+COPS it waits for registration in network
+#define SETUP_ALIVE			0
+#define SETUP_RESET			1
+#define SETUP_COPS			6
+#define SETUP_IP			7
+#define SETUP_IMEI			8
+#define SETUP_CLOSE			9
+#define SETUP_SOCKET		10
+#define SETUP_STEPS			11
+
+static const char *setUpCommands [SETUP_STEPS] = { "AT", "AT+NRB", "AT+CEREG=2",
+	"AT+CSCON=0", "AT+CFUN=1", "AT+CGDCONT=0,\"IP\",\"\"",
+	"AT+COPS=1,2,\"" networkOperator "\"", "AT+CGPADDR", "AT+CGSN=1", "AT+NSOCL=0",
+	"AT+NSOCR=DGRAM,17," };
+static const unsigned long setUpTimeOuts [SETUP_STEPS] = { 1000, 10000, 500, 500, 6000, 500,
+	REGISTRATION_TIMEOUT, 500, 500, 1000, 5000 };
+
+// Fast start: settings asked first (AT+CFUN? ...) & only set if the answer differs
+#define FAST_CHECKED		(1 << 3 | 1 << 4 | 1 << 5 | 1 << SETUP_COPS)
+#define QUERY_TIMEOUT		500
+
+
+SodaqNBIoT::SodaqNBIoT () : at (UBLOX, &DEBUG) { 
+	IP[0] = '\0';
+	imei[0] = '\0';
+	state = NB_STATE_OFF;
+	setUpStep = SETUP_ALIVE;
+	stepDue = stepSent = stepQuery = stepChecked = false;
+	fastStart = fastSetUp = false;
+	stepTime = stepDelay = registrationTime = ceregTime = 0;
+	registered = false;
+	localPort = 0;
+	sock = -1;
+	downlinkSocket = 0;
+	downlinkBytes = 0;
+	readPending = false;
+	sendSequence = highestSent = 0;
+	outboxLoaded = false;
+	ramHead = ramCount = 0;
+	oldestTime = lastAttempt = 0;
+	retryPending = false;
+	ackTime = 0;
+	ackTimeout = UPLINK_ACK_TIMEOUT;
+	batchInFlight = false;
+	batchCount = 0;
+	batchSequence = 0;
+	batchLength = 0;
+	batchSocket = -1;
+	batchPunches = UPLINK_BATCH_PUNCHES;
+	batchDelay = UPLINK_BATCH_DELAY;
+	compactBatches = false;
+	memset (batchHeads, 0, sizeof(batchHeads));
+	memset (dictionary, 0, sizeof(dictionary));
+	dictionaryNext = 0;
+	memset (&stats, 0, sizeof(stats));
+
+	at.onUrc ("+CEREG:", ceregHandler, this);	// Registration status
+	at.onUrc ("+NSONMI:", nsonmiHandler, this);	// Datagram received
+}
+
+
+/* Start ublox n211 module and wait until it's registered in network.
+	Return true if connection is successful or false otherwise */
 bool SodaqNBIoT::begin () {
 
+	start ();
+
+	while (state != NB_STATE_READY && state != NB_STATE_FAILED) {
+		process ();
+	}
+
+	return (state == NB_STATE_READY);
+
+}
+
+
+/* Turn ublox n211 module on and start its set up: reset, NB-IoT parameters, registration,
+	IP, IMEI and socket in localPort (if it isn't 0). Set up goes on in process(). With fast
+	start the module isn't reset unless last set up failed (see setFastStart) */
+void SodaqNBIoT::start (int localPort) {
+
 	pinMode(powerPin, OUTPUT);
 	digitalWrite(powerPin, HIGH);		// Turn the NB-IoT module on
 
@@ -30,19 +121,108 @@ bool SodaqNBIoT::begin () {
 
 	while(!UBLOX);						// Wait until ublox's serial connection is stablished
 
-	return setUpUblox ( );				// Start the setting up of ublox module
+	if (!outboxLoaded) {
+		loadOutbox ();					// Punches not acknowledged before a reboot
+	}
+
+	at.clear ();
+	fastSetUp = fastStart && state != NB_STATE_FAILED;
+	this->localPort = localPort;
+	sock = -1;
+	registered = false;
+	downlinkBytes = 0;					// Module reset drops received datagrams
+	readPending = false;
+	if (batchInFlight) {
+		batchInFlight = false;
+		retryPending = true;			// Its result is lost with the module reset
+	}
+	state = NB_STATE_STARTING;
+	setUpStep = SETUP_ALIVE;
+	stepSent = stepQuery = stepChecked = false;
+	stepDue = true;
+	stepDelay = 0;
+
+}
+
+
+/* Handle responses of ublox module and go on with set up. Call it often from loop(): it
+	never waits, but module responses are lost if UART buffer fills up */
+void SodaqNBIoT::process () {
+
+	at.poll ();
+
+	if (state == NB_STATE_REGISTERING && !stepSent) {
+		if (registered) {
+			state = NB_STATE_ATTACHING;
+			setUpStep = SETUP_IP;
+			stepDue = true;
+			stepDelay = 0;
+		} else if ((millis() - registrationTime) > REGISTRATION_TIMEOUT) {
+			state = NB_STATE_FAILED;
+		} else if (at.idle() && (millis() - ceregTime) > CEREG_POLL_DELAY) {
+			at.send ("AT+CEREG?", 500);	// In case +CEREG was lost while UART was full
+			ceregTime = millis();
+		}
+	}
+
+	if (stepDue && (millis() - stepTime) >= stepDelay) {
+		sendSetUpStep ();
+	}
+
+	// Acknowledgements are read between batches, so queue doesn't change while one is sent
+	if (state == NB_STATE_READY && downlinkBytes > 0 && !readPending && !batchInFlight) {
+		char atCommand [AT_COMMAND_MAX];
+
+		appendNumber (appendText (appendNumber (appendText (atCommand, "AT+NSORF="),
+			downlinkSocket), ","), NSORF_MAX);
+		readPending = at.send (atCommand, NSORF_TIMEOUT, nsorfCallback, this);
+	}
 
 }
 
 
+/* Enable or disable fast start. Instead of resetting the module and setting it up again,
+	start() asks its settings and only sends the ones that differ, so a station that
+	reboots while the module stays on & registered is ready in a few commands. The socket
+	left open by the last start() (socket 0) is closed first. After a failed set up, start()
+	resets the module anyway */
+void SodaqNBIoT::setFastStart (bool enabled) {
+	fastStart = enabled;
+}
+
+
+// Return the state of set up (NB_STATE_*)
+uint8_t SodaqNBIoT::getState () {
+	return state;
+}
+
+
+// Return true if network has said that module is registered
+bool SodaqNBIoT::isRegistered () {
+	return registered;
+}
+
+
+// Return the socket opened by start() or -1
+int SodaqNBIoT::getSocket () {
+	return sock;
+}
+
+
+// Return the bytes that ublox has received and not read yet
+uint16_t SodaqNBIoT::pendingDownlink () {
+	return downlinkBytes;
+}
+
+
 
 // Return the IP that network assigns to the NB-IoT module
-String SodaqNBIoT::getIP() {
+const char *SodaqNBIoT::getIP() {
 	return IP;
 }
 
 // Return the IP that network assigns to the NB-IoT module
-String SodaqNBIoT::getIMEI() {
+const char *SodaqNBIoT::getIMEI() {
 	return imei;
 }
 
@@ -50,463 +230,938 @@ String SodaqNBIoT::getIMEI() {
 // Open an UDP socket in port passed by parameter. Return the ID of socket
 int SodaqNBIoT::openSocket (int port) {
 
-	String atCommand = "AT+NSOCR=DGRAM,17,";
-	atCommand += String (port);
-	atCommand += ",1";
+	char atCommand [AT_COMMAND_MAX];
+	char info [AT_LINE_MAX + 1];
 
-	sendIt(atCommand);
+	appendText (appendNumber (appendText (atCommand, "AT+NSOCR=DGRAM,17,"), port), ",1");
 
-	return checkRespForSocket ( 5000 );
+	if (at.execute (atCommand, 5000, info, sizeof(info)) != AT_OK) {
+		return -1;
+	}
+
+	return parseSocket (info);
 
 }
 
 
-/* Send data to remote IP and Port. Data must be a String
+/* Send length bytes of data to remote IP and Port.
 	Return true if send data is correct or false if error */
-bool SodaqNBIoT::sendData (String data, int sock, String ip, String port) {
+bool SodaqNBIoT::sendData (const uint8_t *data, uint16_t length, int sock, const char *ip,
+	uint16_t port) {
 
-	int dataSended;
+	char atCommand [AT_COMMAND_MAX];
+	char info [AT_LINE_MAX + 1];
+	HexData hex = { data, length };
 
-	String atCommand ="AT+NSOST=";
-	atCommand += sock;
-	atCommand += ",";
-	atCommand += ip;
-	atCommand += ",";
-	atCommand += port;
-	atCommand += ",";
-	atCommand += String(data.length());
-	atCommand += ",";
-	atCommand += stringToHexString(data);
+	if (!buildNsost (atCommand, sock, ip, port, hex.length)) {
+		return false;
+	}
 
-	sendIt(atCommand);
+	if (at.execute (atCommand, NSOST_TIMEOUT, info, sizeof(info), hexWriter, &hex) != AT_OK) {
+		return false;
+	}
 
-	dataSended = checkRespForDataSended (500, sock);
+	return (parseSent (info, sock) == ((int)length));
 
-	return (dataSended == ((int)data.length()));
+}
+
+
+/* Queue a punch and send it at once with the punches waiting before it, waiting for the
+	result of ublox module. It's sent again until server acknowledges it, like queued ones.
+	Return false if outbox is full */
+bool SodaqNBIoT::sendPunch (const uint8_t *data, const uint8_t *idUser, int sock,
+	const char *ip, uint16_t port, uint8_t uidLength) {
+
+	if (!queuePunch (data, idUser, uidLength)) {
+		return false;
+	}
+
+	flushQueue (sock, ip, port, true);
+	while (batchInFlight) {
+		at.poll ();
+	}
+
+	return true;
 
 }
 
 
-/* Send punch to remote IP and Port. Data must be a String
-	Return true if punch data is correct or false if error */
-bool SodaqNBIoT::sendPunch (uint8_t *data, uint8_t *idUser, int sock, String ip, String port) {
 
-	int dataSended;
-	uint32_t punchTime;
-	String atCommand = "";
-	String message = "";
+/* Set the bounds of batches: a batch is sent when it has these punches (up to the window &
+	NSOST_DATA_MAX) or when its oldest punch has waited delayMs */
+void SodaqNBIoT::setBatch (uint8_t punches, unsigned long delayMs) {
 
-	memcpy (&punchTime, &data[1], sizeof(punchTime));
+	if (punches < 1) {
+		punches = 1;
+	} else if (punches > UPLINK_WINDOW) {
+		punches = UPLINK_WINDOW;
+	}
+	batchPunches = punches;
+	batchDelay = delayMs;
 
-	DateTime dateTime (punchTime);
+}
 
-	message += "Player: ";
-	for (int i = 0; i < 4; i++) {
-		if ( idUser[i] < 0x10 ) {
-			message += "0";
-		}
-		message += String (idUser[i],HEX);		
+
+/* Enable or disable compact batches (version 4): about 4 bytes less per punch, 8 less when
+	the UID was sent before. The server must decode them (PunchServer) */
+void SodaqNBIoT::setCompactBatches (bool enabled) {
+	compactBatches = enabled;
+}
+
+
+/* Queue a punch for sending it in next batch. Data is the punch block written in user's
+	card. It's saved in outbox of AT24C32 until server acknowledges it. Return false if
+	outbox is full */
+bool SodaqNBIoT::queuePunch (const uint8_t *data, const uint8_t *idUser, uint8_t uidLength) {
+
+	QueuedPunch punch;
+
+	if (uidLength < PUNCH_UID_MIN || uidLength > PUNCH_UID_MAX) {
+		return false;
+	}
+	if (!outboxLoaded) {
+		loadOutbox ();
 	}
 
-	message += " | Station: ";
-	message += String(data[0]);
+	memset (&punch, 0, sizeof(punch));
+	punch.uidLength = uidLength;
+	memcpy (punch.uid, idUser, uidLength);
+	memcpy (punch.data, data, sizeof(punch.data));
+	if (!outbox.push (punch)) {
+		stats.dropped++;				// Outbox is full
+		return false;
+	}
 
-	message += " | Time: ";
-	if (dateTime.hour() < 10) {
-		message += " ";
+	if ((uint16_t)(outbox.end() - 1) == highestSent) {
+		oldestTime = millis();			// First punch not sent yet
 	}
-	message += String(dateTime.hour());
-	message += ":";
-	if (dateTime.minute() < 10) {
-		message += "0";
+	if (ramCount == queueDepth() - 1 && ramCount < UPLINK_RAM_PUNCHES) {
+		ramQueue[(ramHead + ramCount) % UPLINK_RAM_PUNCHES] = punch;
+		ramCount++;
 	}
-	message += String(dateTime.minute());
-	message += ":";
-	if (dateTime.second() < 10) {
-		message += "0";
+
+	stats.queued++;
+	if (queueDepth() > stats.maxDepth) {
+		stats.maxDepth = queueDepth();
 	}
-	message += String(dateTime.second());
 
-	atCommand +="AT+NSOST=";
-	atCommand += sock;
-	atCommand += ",";
-	atCommand += ip;
-	atCommand += ",";
-	atCommand += port;
-	atCommand += ",";
-	atCommand += String(message.length());
-	atCommand += ",";
-	atCommand += stringToHexString(message);
+	return true;
+
+}
+
+
+/* Send a batch of queued punches if it's full, if its oldest punch has waited the max delay
+	or if force is true. Punches sent again after an acknowledgement time out go at once.
+	Call it often from loop(): the batch is written to ublox module and its result is handled
+	by process(). After a failed batch it waits UPLINK_RETRY_DELAY before trying again.
+	Return false if a batch couldn't be queued */
+bool SodaqNBIoT::flushQueue (int sock, const char *ip, uint16_t port, bool force) {
 
-	sendIt(atCommand);
+	char atCommand [AT_COMMAND_MAX];
+	uint16_t unsent;
 
-	dataSended = checkRespForDataSended (500, sock);
+	if (batchInFlight || readPending || state != NB_STATE_READY) {
+		return true;
+	}
 
-	return (dataSended == ((int)message.length()));
+	// No acknowledgement: go back to oldest punch & wait twice as long next time
+	if (highestSent != outbox.first() && (millis() - ackTime) > ackTimeout) {
+		sendSequence = outbox.first();
+		ackTime = millis();
+		ackTimeout = (ackTimeout * 2 > UPLINK_ACK_TIMEOUT_MAX) ? UPLINK_ACK_TIMEOUT_MAX :
+			ackTimeout * 2;
+		stats.timeouts++;
+	}
+
+	unsent = outbox.end() - sendSequence;
+	if (unsent == 0 || (uint16_t)(sendSequence - outbox.first()) >= UPLINK_WINDOW) {
+		return true;					// Nothing to send or waiting for acknowledgement
+	}
+	if (!force && sendSequence == highestSent && unsent < batchPunches &&
+		(millis() - oldestTime) < batchDelay) {
+		return true;
+	}
+	if (retryPending && (millis() - lastAttempt) < UPLINK_RETRY_DELAY) {
+		return true;
+	}
+
+	batchSequence = sendSequence;
+	batchLength = planBatch ();
+
+	if (!buildNsost (atCommand, sock, ip, port, batchLength)) {
+		return false;
+	}
+
+	// Datagram is streamed in hex to ublox module by writeBatch, so it isn't kept in RAM
+	batchSocket = sock;
+	batchInFlight = true;
+	if (!at.send (atCommand, NSOST_TIMEOUT, batchCallback, this, batchWriter, this)) {
+		batchInFlight = false;
+		retryPending = true;
+		lastAttempt = millis();
+		return false;
+	}
+
+	return true;
 
 }
 
 
+// Return the number of punches in outbox, not acknowledged yet
+uint16_t SodaqNBIoT::queueDepth () {
+	return outbox.size();
+}
+
+
+// Return statistics of queued uplink
+const UplinkStats &SodaqNBIoT::uplinkStats () {
+	return stats;
+}
+
 
 
 
 
 
 
-/* Set the NB-IoT module up sending AT commands. Register in the network and saves the IMEI 
-	of the device.
-	Return true if connection is successful or false otherwise*/
-bool SodaqNBIoT::setUpUblox ( ) {
 
-	bool flag;							// Flag for check the connection
 
-	flag = isAlive();					// Check if there are connection with nbiot module
 
-	while (!flag) {
-		delay(500);
-		flag = isAlive();
-	}	
+// Queue the next command of set up, unless its turn hasn't arrived
+void SodaqNBIoT::sendSetUpStep () {
 
-	if (flag) {
-		flag = resetModule ();
+	char atCommand [AT_COMMAND_MAX];
+	char *equal;
+
+	// Reset isn't needed in fast start. Closing is only needed in it, before first socket
+	if ((setUpStep == SETUP_RESET && fastSetUp) ||
+		(setUpStep == SETUP_CLOSE && (!fastSetUp || localPort == 0 || sock >= 0))) {
+		setUpStep++;
 	}
-	if (flag) {
-		flag = confNbiotConnection ();
+
+	if (setUpStep == SETUP_SOCKET && (localPort == 0 || sock >= 0)) {
+		stepDue = false;				// No socket wanted or kept after registration loss
+		state = NB_STATE_READY;
+		return;
 	}
-	if (flag) {
-		flag = networkRegistration ();
+
+	appendText (atCommand, setUpCommands[setUpStep]);
+
+	// Fast start asks the setting first: "AT+CFUN=1" becomes "AT+CFUN?"
+	if (fastSetUp && !stepChecked && (FAST_CHECKED & (1 << setUpStep))) {
+		equal = strchr (atCommand, '=');
+		appendText (equal, "?");
+		if (!at.send (atCommand, QUERY_TIMEOUT, setUpCallback, this)) {
+			return;
+		}
+		stepDue = false;
+		stepSent = stepQuery = true;
+		return;
 	}
-	if (flag) {
-		flag = askForIp ();
+
+	if (setUpStep == SETUP_SOCKET) {
+		appendText (appendNumber (atCommand + strlen (atCommand), localPort), ",1");
 	}
-	if (flag) {
-		flag = askForImei ();
+
+	if (!at.send (atCommand, setUpTimeOuts[setUpStep], setUpCallback, this)) {
+		return;							// Queue full, tried again in next process()
 	}
 
-	return flag;
+	stepDue = stepChecked = false;
+	stepSent = true;
+	if (setUpStep == SETUP_COPS) {
+		state = NB_STATE_REGISTERING;
+		registrationTime = ceregTime = millis();
+	}
 
 }
 
 
 
-// Return true if ublox module responds to AT commands or false otherwise
-bool SodaqNBIoT::isAlive() {
+/* Go on with set up after the result of its last command. The module is asked with AT until
+	it answers. Any other failure stops set up */
+void SodaqNBIoT::setUpResult (uint8_t result, const char *info) {
+
+	stepSent = false;
+	stepTime = millis();
+	stepDelay = 0;
+
+	// Answer of a setting asked in fast start: the command is skipped if it's already set
+	if (stepQuery) {
+		stepQuery = false;
+		stepChecked = true;
+		stepDue = true;
+		if (result != AT_OK || !isSet (setUpCommands[setUpStep], info)) {
+			return;
+		}
+		stepChecked = false;
+		if (setUpStep == SETUP_COPS) {
+			state = NB_STATE_REGISTERING;	// Maybe registered: asked at once in process()
+			registrationTime = millis();
+			ceregTime = millis() - CEREG_POLL_DELAY - 1;
+			stepDue = false;
+			return;
+		}
+		setUpStep++;
+		return;
+	}
+
+	if (setUpStep == SETUP_CLOSE) {
+		result = AT_OK;					// ERROR if there was no socket open
+	}
+
+	if (setUpStep == SETUP_ALIVE && result != AT_OK) {
+		stepDue = true;
+		stepDelay = ALIVE_RETRY_DELAY;
+		return;
+	}
 
-	sendIt ("AT");						// Send AT command
+	if (setUpStep == SETUP_COPS) {
+		// Registration is waited in process(). Module may answer after time out
+		if (result == AT_ERROR) {
+			state = NB_STATE_FAILED;
+		}
+		return;
+	}
 
-	return checkRespForOk ( 1000 );		// Check the response during time out
+	if (result != AT_OK) {
+		state = NB_STATE_FAILED;
+		return;
+	}
+
+	if (setUpStep == SETUP_IP) {		// "+CGPADDR:0,10.0.0.1"
+		if (!copyValue (IP, info, ',', sizeof(IP))) {
+			state = NB_STATE_FAILED;
+			return;
+		}
+	} else if (setUpStep == SETUP_IMEI) {	// "+CGSN:357517080000000"
+		if (!copyValue (imei, info, ':', sizeof(imei))) {
+			state = NB_STATE_FAILED;
+			return;
+		}
+	} else if (setUpStep == SETUP_SOCKET) {
+		sock = parseSocket (info);
+		if (sock < 0) {
+			state = NB_STATE_FAILED;
+			return;
+		}
+	}
+
+	if (setUpStep == SETUP_ALIVE) {
+		state = NB_STATE_CONFIGURING;
+	}
+
+	setUpStep++;
+	if (setUpStep == SETUP_STEPS) {
+		state = NB_STATE_READY;
+	} else {
+		stepDue = true;
+	}
 
 }
 
 
-// Reset the module. Return true if successful
-bool SodaqNBIoT::resetModule() {
 
-	sendIt ("AT+NRB");					// Send AT command
+/* Save registration status of "+CEREG:stat[,tac,ci,act]" (unsolicited) or of
+	"+CEREG:n,stat[,...]" (answer of AT+CEREG?). Stat 1 is home network & 5 roaming */
+void SodaqNBIoT::registrationChanged (const char *line) {
 
-	return checkRespForOk ( 10000 );	// Check the response during time out
+	const char *field = line + 7;		// After "+CEREG:"
+	int stat;
+
+	while (*field == ' ') {
+		field++;
+	}
+	stat = atoi (field);
+
+	field = strchr (field, ',');
+	if (field != NULL && field[1] >= '0' && field[1] <= '9') {
+		stat = atoi (field + 1);		// Second field isn't a quoted TAC: it's the answer
+	}
+
+	registered = (stat == 1 || stat == 5);
+
+	// Network lost: waits registration again, then IP is asked again
+	if (!registered && (state == NB_STATE_READY || state == NB_STATE_ATTACHING)) {
+		state = NB_STATE_REGISTERING;
+		registrationTime = ceregTime = millis();
+		stepDue = false;
+	}
 
 }
 
 
-// Configure parameters on the module for NB-IoT Connection
-bool SodaqNBIoT::confNbiotConnection () {
 
-	bool flag = true;					// Flag for checking correct working of AT commands
+// Save the bytes announced by "+NSONMI:socket,length"
+void SodaqNBIoT::downlinkArrived (const char *line) {
 
-	if (flag) {
-		sendIt("AT+CEREG=2");
-		flag = checkRespForOk (500);
+	const char *length = strchr (line, ',');
+
+	downlinkSocket = atoi (line + 8);	// After "+NSONMI:"
+	if (length != NULL) {
+		downlinkBytes += atoi (length + 1);
 	}
 
-	if (flag) {
-		sendIt("AT+CSCON=0");
-		flag = checkRespForOk (500);
+}
+
+
+
+/* Advance to the next punches if ublox sent the whole batch in flight, or retry it later.
+	Punches stay in outbox until server acknowledges them */
+void SodaqNBIoT::batchResult (uint8_t result, const char *info) {
+
+	batchInFlight = false;
+
+	if (result != AT_OK || parseSent (info, batchSocket) != batchLength) {
+		stats.errors++;
+		retryPending = true;
+		lastAttempt = millis();
+		return;
+	}
+
+	retryPending = false;
+	stats.sent += batchCount;
+	stats.bytes += batchLength;
+	stats.batches++;
+	if (batchCount > stats.maxBatch) {
+		stats.maxBatch = batchCount;
+	}
+
+	if (sendSequence != batchSequence) {
+		return;							// Time out went back while batch was written
 	}
-	if (flag) {
-		sendIt("AT+CFUN=1");
-		flag = checkRespForOk (6000);
+	if (highestSent == outbox.first()) {
+		ackTime = millis();				// Acknowledgement is waited from now
 	}
-	if (flag) {
-		sendIt("AT+CGDCONT=0,\"IP\",\"\"");
-		flag = checkRespForOk (500);
+	sendSequence += batchCount;
+	if ((uint16_t)(sendSequence - outbox.first()) > (uint16_t)(highestSent - outbox.first())) {
+		highestSent = sendSequence;
+		if (outbox.end() != highestSent) {
+			oldestTime = millis();		// Rest waits for next batch
+		}
 	}
 
-	return flag;
+}
+
+
+
+/* Handle the answer "socket,ip,port,length,data,remaining" of AT+NSORF. Datagrams that
+	aren't acknowledgements are dropped */
+void SodaqNBIoT::downlinkRead (uint8_t result, const char *info) {
+
+	uint8_t datagram [NSORF_MAX];
+	const char *field = info;
+	int length;
+
+	readPending = false;
+
+	for (uint8_t i = 0; i < 4 && field != NULL; i++) {
+		field = strchr (field, ',');	// Data is after the 4th comma
+		if (field != NULL) {
+			field++;
+		}
+	}
+
+	if (result != AT_OK || field == NULL) {
+		downlinkBytes = 0;				// Nothing left to read
+		return;
+	}
+
+	length = decodeHex (field, datagram, sizeof(datagram));
+	if (length <= 0) {
+		downlinkBytes = 0;
+		return;
+	}
+
+	downlinkBytes = (length < downlinkBytes) ? downlinkBytes - length : 0;
+	acknowledge (datagram, length);
 
 }
 
 
-// Select the operator and register SIM in the network
-bool SodaqNBIoT::networkRegistration () {
 
-	String atCommand = "AT+COPS=1,2,\"";// Building AT Command
-	atCommand += networkOperator;		// Network operator is defined in .h
-	atCommand += "\"";
-	sendIt (atCommand);					// Send AT command
+/* Remove from outbox the punches acknowledged by server. Acknowledgements of punches not
+	sent yet, old or damaged ones are ignored */
+void SodaqNBIoT::acknowledge (const uint8_t *datagram, uint8_t length) {
+
+	uint16_t next;
+	uint16_t acked;
 
-	return checkRespForReg ( 180000 );	// Check the response during time out
+	if (length != PUNCH_ACK_SIZE || datagram[0] != (PUNCH_ACK_VERSION << 4) ||
+		PunchOutbox::crc16 (0xFFFF, datagram, 3) != (datagram[3] | (datagram[4] << 8))) {
+		return;
+	}
+
+	next = datagram[1] | (datagram[2] << 8);
+	acked = next - outbox.first();
+	if (acked == 0 || acked > (uint16_t)(highestSent - outbox.first())) {
+		return;
+	}
+
+	for (uint16_t i = (acked > UPLINK_DICTIONARY) ? acked - UPLINK_DICTIONARY : 0; i < acked;
+		i++) {
+		rememberUid (outbox.first() + i, ramPunch (outbox.first() + i));
+	}
+	outbox.release (next);				// Writes outbox header
+	ramHead = (ramHead + acked) % UPLINK_RAM_PUNCHES;
+	ramCount -= acked;					// Sent punches are always in RAM
+	if ((uint16_t)(sendSequence - next) > OUTBOX_PUNCHES) {
+		sendSequence = next;			// It had gone back behind this acknowledgement
+	}
+	refillRam ();
+
+	ackTime = millis();
+	ackTimeout = UPLINK_ACK_TIMEOUT;
+	stats.acked += acked;
+	stats.acks++;
 
 }
 
 
-// Saves the IP that NB-IoT network gives to ublox module
-bool SodaqNBIoT::askForIp ( ) {
 
-	String receivedIp;
+// Stream the batch in flight in hex to ublox module (data of its AT+NSOST)
+void SodaqNBIoT::writeBatch (Stream &port) {
 
-	sendIt("AT+CGPADDR");				// Send AT command
+	uint8_t header [4];					// Version, count & sequence
+	uint8_t varint [5];
+	uint16_t crc = 0xFFFF;
 
-	receivedIp = checkRespForIp (500);	// Receive and parse the IP
+	header[0] = (compactBatches ? PUNCH_COMPACT_VERSION : PUNCH_BATCH_VERSION) << 4;
+	header[1] = batchCount;
+	header[2] = batchSequence & 0xFF;
+	header[3] = batchSequence >> 8;
+	sendHex (port, header, sizeof(header), crc);
 
-	if ( receivedIp.length() > 0 ) {
-		IP = receivedIp;
-		return true;
-	} else {
+	if (compactBatches) {
+		sendHex (port, ramPunch (batchSequence).data, 1 + 4, crc);	// IDS & time of first
+	}
+
+	for (uint8_t i = 0; i < batchCount; i++) {
+		QueuedPunch &punch = ramPunch (batchSequence + i);
+		if (!compactBatches) {
+			sendHex (port, &punch.uidLength, 1 + punch.uidLength, crc);
+			sendHex (port, punch.data, sizeof(punch.data), crc);
+			continue;
+		}
+		sendHex (port, &batchHeads[i], 1, crc);
+		if (batchHeads[i] == punch.uidLength) {
+			sendHex (port, punch.uid, punch.uidLength, crc);
+		}
+		if (i > 0) {
+			sendHex (port, varint, encodeVarint (varint, timeDelta (ramPunch (batchSequence +
+				i - 1), punch)), crc);
+		}
+		sendHex (port, &punch.data[1 + 4], PUNCH_MAC_SIZE, crc);
+	}
+
+	header[0] = crc & 0xFF;
+	header[1] = crc >> 8;
+	sendHex (port, header, 2, crc);
+
+}
+
+
+
+// Callbacks of AtEngine. Context is the SodaqNBIoT object
+void SodaqNBIoT::setUpCallback (void *context, uint8_t result, const char *info) {
+	((SodaqNBIoT *)context)->setUpResult (result, info);
+}
+
+void SodaqNBIoT::batchCallback (void *context, uint8_t result, const char *info) {
+	((SodaqNBIoT *)context)->batchResult (result, info);
+}
+
+void SodaqNBIoT::nsorfCallback (void *context, uint8_t result, const char *info) {
+	((SodaqNBIoT *)context)->downlinkRead (result, info);
+}
+
+void SodaqNBIoT::ceregHandler (void *context, const char *line) {
+	((SodaqNBIoT *)context)->registrationChanged (line);
+}
+
+void SodaqNBIoT::nsonmiHandler (void *context, const char *line) {
+	((SodaqNBIoT *)context)->downlinkArrived (line);
+}
+
+void SodaqNBIoT::batchWriter (Stream &port, void *context) {
+	((SodaqNBIoT *)context)->writeBatch (port);
+}
+
+
+
+// Stream a HexData in hex, in chunks so no buffer of the whole data is needed
+void SodaqNBIoT::hexWriter (Stream &port, void *context) {
+
+	HexData *hex = (HexData *)context;
+	uint16_t crc = 0;					// Not used
+	uint16_t sent = 0;
+
+	while (sent < hex->length) {
+		uint8_t chunk = (hex->length - sent > PUNCH_RECORD_SIZE) ? PUNCH_RECORD_SIZE :
+			hex->length - sent;
+		sendHex (port, &hex->data[sent], chunk, crc);
+		sent += chunk;
+	}
+
+}
+
+
+
+/* Write "AT+NSOST=socket,ip,port,length," in atCommand. Data is streamed after it.
+	Return false if it doesn't fit */
+bool SodaqNBIoT::buildNsost (char *atCommand, int sock, const char *ip, uint16_t port,
+	uint16_t length) {
+
+	char *end = atCommand;				// End of AT command written
+
+	if (strlen (ip) >= IP_SIZE || length > NSOST_DATA_MAX) {
 		return false;
 	}
 
+	end = appendText (end, "AT+NSOST=");
+	end = appendNumber (end, sock);
+	end = appendText (end, ",");
+	end = appendText (end, ip);
+	end = appendText (end, ",");
+	end = appendNumber (end, port);
+	end = appendText (end, ",");
+	end = appendNumber (end, length);
+	end = appendText (end, ",");
+
+	return true;
+
 }
 
-// Saves the IMEI of SIM card
-bool SodaqNBIoT::askForImei ( ) {
 
-	String receivedImei;
 
-	sendIt("AT+CGSN=1");				// Send AT command
+// Return the bytes sent from the answer "socket,length" of AT+NSOST, or -1 if error
+int SodaqNBIoT::parseSent (const char *info, int sock) {
 
-	receivedImei = checkRespForImei (500);	// Receive and parse the IMEI
+	const char *length = strchr (info, ',');
 
-	if ( receivedImei.length() > 0 ) {
-		imei = receivedImei;
-		return true;
-	} else {
+	if (length == NULL || atoi (info) != sock) {
+		return -1;
+	}
+
+	return atoi (length + 1);
+
+}
+
+
+
+/* Return true if the answer of "AT+NAME?" shows the setting of command "AT+NAME=VALUE":
+	it's "+NAME:VALUE", maybe followed by more fields */
+bool SodaqNBIoT::isSet (const char *command, const char *info) {
+
+	const char *equal = strchr (command, '=');
+	uint8_t nameLength = equal - command - 2;	// Without "AT"
+	uint8_t valueLength = strlen (equal + 1);
+
+	if (strncmp (info, command + 2, nameLength) != 0 || info[nameLength] != ':') {
 		return false;
 	}
+	info += nameLength + 1;
+	while (*info == ' ') {
+		info++;
+	}
+
+	return strncmp (info, equal + 1, valueLength) == 0 &&
+		(info[valueLength] == '\0' || info[valueLength] == ',');
+
 }
 
 
+/* Copy the value after the first separator of an information line, like the IP of
+	"+CGPADDR:0,10.0.0.1". Return false if there's no separator or value doesn't fit */
+bool SodaqNBIoT::copyValue (char *to, const char *info, char separator, uint8_t size) {
 
+	const char *value = strchr (info, separator);
 
+	if (value == NULL || strlen (value + 1) >= size) {
+		return false;
+	}
+	strcpy (to, value + 1);
+
+	return true;
 
+}
 
 
-/* Check for OK in the response from ublox module
-	return true if OK is in the response or false if time out */
-bool SodaqNBIoT::checkRespForOk ( int timeOut ) {
 
-	String response;
-	bool ok = false;
-	unsigned long startTime = millis();	// Take time at start for time out
+// Return the socket of the answer of AT+NSOCR, or -1 if it isn't valid
+int SodaqNBIoT::parseSocket (const char *info) {
 
-	// Check every char string received for "OK" response
-	while ( !ok && ((millis()-startTime) <= (unsigned long) timeOut) ) {
-		response = receiveIt();
-		ok = (response.indexOf("\r\nOK\r\n") >= 0);	// Check if "OK" is in the response
+	int socket = atoi (info);
+
+	if (info[0] < '0' || info[0] > '9' || socket >= 7) {
+		return -1;
 	}
 
-	return ok;
+	return socket;
+
 }
 
 
-/* Check for network registration in the response from ublox module
-	return true if registration is done or false if time out */
-bool SodaqNBIoT::checkRespForReg ( int timeOut ) {
 
-	String response;
-	bool ok = false;
-	unsigned long startTime = millis();	// Take time at start for time out
 
-	// Check every char string received for "OK" response
-	while ( !ok && ((millis()-startTime) <= (unsigned long) timeOut) ) {
-		response = receiveIt();
-		ok = (response.indexOf("\r\n+CEREG:5,") >= 0);	// Check if "OK" is in the response
+// Copy a text at the end of a char array. Return the new end (where the null char is)
+char *SodaqNBIoT::appendText (char *to, const char *text) {
+
+	while (*text != '\0') {
+		*to++ = *text++;
 	}
+	*to = '\0';
+
+	return to;
 
-	return ok;
 }
 
 
 
-/* Check for IP given by network in the response from ublox module
-	return the IP in string format */
-String SodaqNBIoT::checkRespForIp ( int timeOut ) {
+// Write a number in decimal at the end of a char array. Return the new end
+char *SodaqNBIoT::appendNumber (char *to, unsigned int number) {
 
-	String response;
-	String receivedIp = "";
-	bool ok = false;
-	unsigned long startTime = millis();	// Take time at start for time out
+	char digits [6];					// Up to 65535
+	uint8_t count = 0;
 
-	while ( !ok && ((millis()-startTime) <= (unsigned long) timeOut) ) {
-		response += receiveIt();
-		if (response.indexOf("\r\nOK\r\n") >= 0) {	// Check all the response is received
-			if (response.indexOf("\r\n+CGPADDR:") >= 0) {
-				receivedIp = response.substring((1+response.indexOf(",")));
-				receivedIp = receivedIp.substring(0,receivedIp.indexOf("\r\n"));
-			}
-		}
+	do {
+		digits[count++] = '0' + number % 10;
+		number /= 10;
+	} while (number > 0);
+
+	while (count > 0) {
+		*to++ = digits[--count];
 	}
+	*to = '\0';
 
-	return receivedIp;
+	return to;
 
 }
 
 
 
-/* Check for socket opened in the response from ublox module
-	return the socket identifier or -1 if error*/
-int SodaqNBIoT::checkRespForSocket ( int timeOut ) {
+// Write bytes in hexadecimal at the end of a char array. Return the new end
+char *SodaqNBIoT::appendHex (char *to, const uint8_t *data, uint8_t len) {
+
+	static const char hexDigits [] = "0123456789ABCDEF";
+
+	for (uint8_t i = 0; i < len; i++) {
+		*to++ = hexDigits[data[i] >> 4];
+		*to++ = hexDigits[data[i] & 0x0F];
+	}
+	*to = '\0';
+
+	return to;
 
-	String response;
-	String receivedSocket;
-	bool ok = false;
-	unsigned long startTime = millis();	// Take time at start for time out
+}
 
-	while ( !ok && ((millis()-startTime) <= (unsigned long) timeOut) ) {
-		response += receiveIt();
 
-		if (response.indexOf("\r\nOK\r\n") >= 0) {	// Check all the response is received
 
-			// Parse the response
-			receivedSocket = response.substring(2+response.indexOf("\r\n"));
-			receivedSocket = receivedSocket.substring(0, receivedSocket.indexOf("\r\n"));
+/* Decode the hexadecimal text at the start of hex into data. Return the bytes decoded or -1
+	if the text doesn't fit or has an odd number of digits */
+int SodaqNBIoT::decodeHex (const char *hex, uint8_t *data, uint8_t size) {
 
-			// Check if it's a valid value
-			if (receivedSocket.toInt() >= 0 && receivedSocket.toInt() < 7) {
-				ok = true;
-			}
+	int length = 0;
 
+	while (isxdigit (hex[0])) {
+		if (!isxdigit (hex[1]) || length == size) {
+			return -1;
 		}
+		data[length++] = (hexValue (hex[0]) << 4) | hexValue (hex[1]);
+		hex += 2;
 	}
 
-	if (ok) {
-		return receivedSocket.toInt();
-	} else {
-		return -1;
-	}
+	return length;
 
 }
 
 
-/* Check for IMEI's card in the response from ublox module
-	Return the IMEI in string format */
-String SodaqNBIoT::checkRespForImei ( int timeOut ) {
 
-	String response;
-	String receivedImei = "";
-	bool ok = false;
-	unsigned long startTime = millis();	// Take time at start for time out
+/* Plan the batch starting at batchSequence: the punches that fit in a datagram (they are in
+	RAM because the window isn't bigger than RAM queue) and, if it's compact, their HEADs.
+	Compact batches end where IDS changes. Return the bytes of the batch */
+uint16_t SodaqNBIoT::planBatch () {
+
+	uint16_t length = compactBatches ? 4 + 1 + 4 + 2 : 4 + 2;	// Header & CRC
+	uint8_t first = batchSequence - outbox.first();	// Position in RAM queue
+	uint8_t varint [5];
+
+	batchCount = 0;
+	while (first + batchCount < ramCount && first + batchCount < UPLINK_WINDOW &&
+		batchCount < batchPunches) {
+		QueuedPunch &punch = ramPunch (batchSequence + batchCount);
+		uint16_t size = 1 + punch.uidLength + 1 + 4 + PUNCH_MAC_SIZE;
 
-	while ( !ok && ((millis()-startTime) <= (unsigned long) timeOut) ) {
-		response += receiveIt();
-		if (response.indexOf("\r\nOK\r\n") >= 0) {	// Check all the response is received
-			if (response.indexOf("\r\n+CGSN:") >= 0) {
-				receivedImei = response.substring((1+response.indexOf(":")));
-				receivedImei = receivedImei.substring(0,receivedImei.indexOf("\r\n"));
+		if (compactBatches) {
+			if (batchCount > 0 && punch.data[0] != ramPunch (batchSequence).data[0]) {
+				break;					// Another station: next batch
 			}
+			batchHeads[batchCount] = findUid (batchCount);
+			size = 1 + ((batchHeads[batchCount] & 0x80) ? 0 : punch.uidLength) +
+				PUNCH_MAC_SIZE;
+			if (batchCount > 0) {
+				size += encodeVarint (varint, timeDelta (ramPunch (batchSequence + batchCount -
+					1), punch));
+			}
+		}
+		if (length + size > NSOST_DATA_MAX) {
+			break;
 		}
+		length += size;
+		batchCount++;
 	}
 
-	return receivedImei;
+	return length;
 
 }
 
 
 
+/* Return the HEAD of the punch index of the compact batch being planned: the distance to
+	the nearest punch with the same UID, earlier in the batch or acknowledged (in dictionary),
+	or its UID length. Distances aren't used while acknowledgements are missing (back off):
+	the server may have lost the punches */
+uint8_t SodaqNBIoT::findUid (uint8_t index) {
 
-/* Check for confirmation of correct sending in the response from ublox module.
-	Return number of bytes ublox sent or -1 if error */
-int SodaqNBIoT::checkRespForDataSended (int timeOut, int sock) {
+	QueuedPunch &punch = ramPunch (batchSequence + index);
+	uint16_t sequence = batchSequence + index;
+	uint16_t distance;
 
-	String response;
-	String receivedSocket="";
-	String receivedLength="";
-
-	bool ok = false;
-	unsigned long startTime = millis();	// Take time at start for time out
+	if (ackTimeout != UPLINK_ACK_TIMEOUT) {
+		return punch.uidLength;
+	}
 
-	while ( !ok && ((millis()-startTime) <= (unsigned long) timeOut) ) {
-		response += receiveIt();
-		if (response.indexOf("\r\nOK\r\n") >= 0) {	// Check all the response is received
-			receivedSocket = response.substring((2+response.indexOf("\r\n")));
-			receivedSocket = receivedSocket.substring(0,receivedSocket.indexOf(","));
-			receivedLength = response.substring((1+response.indexOf(",")));
-			receivedLength = receivedLength.substring(0,receivedLength.indexOf("\r\n"));
+	for (uint8_t i = index; i > 0; i--) {
+		QueuedPunch &other = ramPunch (batchSequence + i - 1);
+		if (other.uidLength == punch.uidLength &&
+			memcmp (other.uid, punch.uid, punch.uidLength) == 0) {
+			return 0x80 | (index - (i - 1));
 		}
 	}
 
-	if ((receivedSocket.toInt() == sock)) {
-		return receivedLength.toInt();
-	} else {
-		return -1;
+	for (uint8_t i = 0; i < UPLINK_DICTIONARY; i++) {
+		distance = sequence - dictionary[i].sequence;
+		if (dictionary[i].uidLength == punch.uidLength && dictionary[i].ids == punch.data[0] &&
+			distance >= 1 && distance <= UPLINK_DISTANCE_MAX &&
+			memcmp (dictionary[i].uid, punch.uid, punch.uidLength) == 0) {
+			return 0x80 | distance;
+		}
 	}
 
+	return punch.uidLength;
+
 }
-	
 
 
 
+/* Keep the UID of an acknowledged punch for compact batches. Server keeps UIDs by station,
+	so entries have its IDS too. A UID in dictionary gets the new sequence number; a new one
+	replaces the oldest entry */
+void SodaqNBIoT::rememberUid (uint16_t sequence, const QueuedPunch &punch) {
 
+	DictionaryEntry *entry = &dictionary[dictionaryNext];
 
+	for (uint8_t i = 0; i < UPLINK_DICTIONARY; i++) {
+		if (dictionary[i].uidLength == punch.uidLength && dictionary[i].ids == punch.data[0] &&
+			memcmp (dictionary[i].uid, punch.uid, punch.uidLength) == 0) {
+			dictionary[i].sequence = sequence;
+			return;
+		}
+	}
+
+	entry->sequence = sequence;
+	entry->ids = punch.data[0];
+	entry->uidLength = punch.uidLength;
+	memcpy (entry->uid, punch.uid, PUNCH_UID_MAX);
+	dictionaryNext = (dictionaryNext + 1) % UPLINK_DICTIONARY;
 
+}
 
-// Send an AT command to ublox module
-void SodaqNBIoT::sendIt ( String atCommand ) {
 
-	printIt("-- "+atCommand);			// Print AT command sended
-	UBLOX.print (atCommand+"\r");		// Send AT command to ublox module
 
+// Return the punch of a sequence number cached in RAM queue
+QueuedPunch &SodaqNBIoT::ramPunch (uint16_t sequence) {
+	return ramQueue[(ramHead + (uint16_t)(sequence - outbox.first())) % UPLINK_RAM_PUNCHES];
 }
 
 
 
-// Receive the response from ublox module. Return it and print it by debug serial port
-String SodaqNBIoT::receiveIt ( ) {
+/* Return the time of a punch minus the time of the previous one, zigzag encoded so small
+	differences back in time are small too */
+uint32_t SodaqNBIoT::timeDelta (const QueuedPunch &previous, const QueuedPunch &punch) {
 
-	String received;
+	uint32_t before;
+	uint32_t time;
+	int32_t delta;
 
-	// Save data received from ublox module
-	while (UBLOX.available()) {
-		delay(10);						// Neccesary for don't split strings
-		received += (char)UBLOX.read ();
-	}
+	memcpy (&before, &previous.data[1], sizeof(before));	// Little endian like in card
+	memcpy (&time, &punch.data[1], sizeof(time));
+	delta = (int32_t)(time - before);
 
-	printIt (received);					// DEBUG: Print response from ublox module
+	return ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
 
-	return received;					// Return string received
-  
 }
 
 
 
-// Print something by DEBUG serial port
-void SodaqNBIoT::printIt ( String text ) {
+// Write a number in a varint: 7 bits per byte, low ones first, bit 7 set if more follow
+uint8_t SodaqNBIoT::encodeVarint (uint8_t *to, uint32_t value) {
 
-	if (text.length() > 0) {			// If string is not empty...
-		DEBUG.println(text);			// Send by debug serial port the string
+	uint8_t length = 0;
+
+	while (value >= 0x80) {
+		to[length++] = (value & 0x7F) | 0x80;
+		value >>= 7;
 	}
+	to[length++] = value;
+
+	return length;
+
 }
 
 
 
-// Conversion from string to hexadecimal string
-String SodaqNBIoT::stringToHexString (String str) {
+/* Find the punches left in outbox before a reboot, which weren't acknowledged. They are
+	sent again with their sequence numbers */
+void SodaqNBIoT::loadOutbox () {
 
-	String hexString;
+	outboxLoaded = true;
+	stats.recovered = outbox.load ();
 
-	char high_nibble;
-	char low_nibble;
+	ramHead = ramCount = 0;
+	refillRam ();
+	sendSequence = highestSent = outbox.first();
+	oldestTime = millis();
 
-	for (int i = 0; i < str.length(); i++) {
-		high_nibble = ((str[i] >> 4) & 0x0F);
-		high_nibble = ((high_nibble <= 9) ? ('0' + high_nibble) : ('A' - 10 + high_nibble));
-		low_nibble = (str[i] & 0x0F);
-		low_nibble = ((low_nibble <= 9) ? ('0' + low_nibble) : ('A' - 10 + low_nibble));
-		hexString += String(high_nibble);
-		hexString += String(low_nibble);
-	}
+}
 
-	return hexString;
+
+
+// Cache in RAM the outbox punches after the ones there, while there is room
+void SodaqNBIoT::refillRam () {
+
+	while (ramCount < UPLINK_RAM_PUNCHES && ramCount < queueDepth()) {
+		if (!outbox.read (outbox.first() + ramCount,
+			ramQueue[(ramHead + ramCount) % UPLINK_RAM_PUNCHES])) {
+			outbox.truncate (outbox.first() + ramCount);	// Lost slot: outbox ends before it
+			break;
+		}
+		ramCount++;
+	}
 
 }
 
+
+
+// Send bytes in hexadecimal to ublox module, updating the CRC of the datagram
+void SodaqNBIoT::sendHex (Stream &port, const uint8_t *data, uint8_t len, uint16_t &crc) {
+
+	char hex [2 * PUNCH_RECORD_SIZE + 1];
+
+	appendHex (hex, data, len);
+	port.print (hex);
+	for (uint8_t i = 0; i < len; i++) {
+		crc = PunchOutbox::crc16 (crc, data[i]);
+	}
+
+}
@@ -6,6 +6,52 @@
  * 
  *  This library manages communication with SODAQ NB-IOT SHIELD.
  *
+ *	Punches are queued (queuePunch) in an outbox in the AT24C32 of the RTC module, so they
+ *	survive reboots, and sent in batches by flushQueue, called from loop(). A batch is sent
+ *	when it has the punches set with setBatch or when its oldest punch has waited the max
+ *	delay, in one AT+NSOST (all fields LSB first, like in user's card):
+ *
+ *		BATCH VERSION << 4 | COUNT | SEQUENCE (2) | COUNT x (UID LENGTH | UID | IDS | TIME |
+ *		MAC) | CRC (2)
+ *
+ *	TIME is the Unix time of the punch & MAC the one written in user's card, so server can
+ *	verify the punch with the key of the station. SEQUENCE is the number of the first punch;
+ *	the rest are consecutive. CRC-16 is CCITT (polynomial 0x1021, initial value 0xFFFF) over
+ *	the previous fields, like in SerialInterface frames.
+ *
+ *	Server answers each batch with a cumulative acknowledgement, read with AT+NSORF when
+ *	ublox announces it with +NSONMI:
+ *
+ *		ACK VERSION << 4 | NEXT SEQUENCE (2) | CRC (2)
+ *
+ *	With setCompactBatches, batches carry the IDS once and times as differences, and a UID
+ *	sent before is replaced by its distance in sequence numbers (see PunchServer/Datagram.h):
+ *
+ *		COMPACT VERSION << 4 | COUNT | SEQUENCE (2) | IDS | TIME (4) | COUNT x (HEAD | UID |
+ *		DELTA | MAC) | CRC (2)
+ *
+ *	HEAD is the UID length (UID follows) or 0x80 | distance to a punch with the same UID,
+ *	earlier in the batch or among the last UPLINK_DICTIONARY acknowledged ones (the server
+ *	surely has them). DELTA, from the second punch on, is the time minus the previous one,
+ *	zigzag encoded in a varint. A batch has punches of one IDS only. After an ACK time out,
+ *	batches are sent without distances until an acknowledgement arrives, so a server that
+ *	lost the punches referred to still gets them.
+ *
+ *	NEXT SEQUENCE is the oldest punch server hasn't received; older ones leave the outbox.
+ *	Up to UPLINK_WINDOW punches are sent without acknowledgement. If none arrives in the
+ *	ACK time out, punches are sent again from the oldest one (go-back-N) & time out doubles
+ *	up to UPLINK_ACK_TIMEOUT_MAX. Server discards punches received twice.
+ *
+ *	AT commands go through AtEngine. start() sets the module up & registers it in the network
+ *	in background while process() is called from loop(), so the station keeps punching
+ *	during the minutes registration may take. Batches are sent in background too. begin(),
+ *	openSocket(), sendData() & sendPunch() still wait for their result. With setFastStart,
+ *	start() doesn't reset the module: it keeps its settings & registration if they're right.
+ *
+ *	No memory is allocated: commands are built in fixed buffers, responses are parsed in
+ *	place and data is given as bytes & length, so the heap doesn't fragment during events of
+ *	many hours. NBIoTSoak checks it on PC.
+ *
  *	Compatible boards with this library: Arduino MEGA.
 */
 /*********************************************************************************************/
@@ -16,7 +62,8 @@
 
 
 #include "Arduino.h"
-#include "RTClib.h"
+#include <PunchOutbox.h>					// Punches kept in AT24C32 until acknowledged
+#include <AtEngine.h>					// Non-blocking AT commands
 
 
 #define DEBUG 			Serial			// Serial port for DEBUG
@@ -24,43 +71,185 @@
 #define powerPin 		7				// Pin to turn on/off the NB-IoT module
 #define networkOperator "21401"			// Vodafone network operator code
 
+#define NSOST_DATA_MAX		512			// Max bytes of a datagram sent by ublox N211
+#define IP_SIZE				16			// IPv4 in text with null char
+#define IMEI_SIZE			16			// 15 digits & null char
+
+#define PUNCH_BATCH_VERSION	2			// Version of binary batch of punches
+#define PUNCH_COMPACT_VERSION	4		// Version of compact batch of punches
+#define PUNCH_ACK_VERSION	3			// Version of acknowledgement sent by server
+#define PUNCH_ACK_SIZE		5
+#define PUNCH_RECORD_SIZE	(1 + PUNCH_UID_MAX + 1 + 4 + PUNCH_MAC_SIZE)	// Queued punch
+#define NSORF_MAX			16			// Bytes read by each AT+NSORF
+
+#define UPLINK_RAM_PUNCHES	16			// Oldest punches of outbox cached in RAM
+#define UPLINK_WINDOW		16			// Max punches sent & not acknowledged
+#define UPLINK_DICTIONARY	8			// UIDs of acknowledged punches for compact batches
+#define UPLINK_DISTANCE_MAX	127			// Max distance of a UID in compact batches
+#define UPLINK_BATCH_PUNCHES	8		// Default punches per batch
+#define UPLINK_BATCH_DELAY	5000		// Default max ms a punch waits in queue
+#define UPLINK_RETRY_DELAY	2000		// Ms between attempts after a failed batch
+#define UPLINK_ACK_TIMEOUT	4000		// Ms waiting for acknowledgement before sending again
+#define UPLINK_ACK_TIMEOUT_MAX	64000	// Limit of back off
+
+#define NB_STATE_OFF		0			// States of module set up by start() & process()
+#define NB_STATE_STARTING	1			// Waiting for module to answer AT
+#define NB_STATE_CONFIGURING	2		// Reset & NB-IoT parameters
+#define NB_STATE_REGISTERING	3		// Waiting for network registration
+#define NB_STATE_ATTACHING	4			// Asking IP & IMEI & opening socket
+#define NB_STATE_READY		5
+#define NB_STATE_FAILED		6			// A command failed. start() again for retrying
+
+#define ALIVE_RETRY_DELAY	500			// Ms between AT while module doesn't answer
+#define REGISTRATION_TIMEOUT	180000	// Max ms waiting for network registration
+#define CEREG_POLL_DELAY	5000		// Ms between AT+CEREG? while registering
+#define NSOST_TIMEOUT		1000		// Max ms ublox takes to answer AT+NSOST
+#define NSORF_TIMEOUT		1000		// Max ms ublox takes to answer AT+NSORF
+
+
+// Statistics of queued uplink
+struct UplinkStats {
+	unsigned long queued;				// Punches queued
+	unsigned long sent;					// Punches sent in batches, also again
+	unsigned long batches;				// Batches sent (mean size is sent / batches)
+	unsigned long errors;				// Batches not sent by ublox module
+	unsigned long acked;				// Punches acknowledged by server
+	unsigned long acks;					// Valid acknowledgements read
+	unsigned long timeouts;				// Times punches were sent again from oldest one
+	unsigned long dropped;				// Punches lost because outbox was full
+	unsigned long bytes;				// Bytes of batches sent (on the air, not in hex)
+	uint8_t maxBatch;					// Largest batch sent
+	uint16_t maxDepth;					// Most punches waiting at once
+	uint16_t recovered;					// Punches found in outbox at start
+};
+
 
 class SodaqNBIoT {
 public:
 	SodaqNBIoT ();
 	bool begin ();						// Init serial port and turn module on
-	String getIP();						// Return IP of ublox module
-	String getIMEI();					// Return IMEI of card inserted in SODAQ module
+	void start (int localPort = 0);		// Same in background. Opens socket if port isn't 0
+	void setFastStart (bool enabled);	// start() keeps module settings & registration
+	void process ();					// Handles responses & set up. Call it from loop()
+	uint8_t getState ();				// One of NB_STATE_*
+	bool isRegistered ();				// Last registration status sent by network
+	int getSocket ();					// Socket opened by start() or -1
+	uint16_t pendingDownlink ();		// Bytes announced by +NSONMI & not read yet
+	const char *getIP();				// Return IP of ublox module
+	const char *getIMEI();				// Return IMEI of card inserted in SODAQ module
 	int openSocket (int port);			// Open an UDP socket in designated port
-	bool sendData (String data, int sock, String ip, String port);	// Send data to ip and port
-	bool sendPunch (uint8_t *data, uint8_t *idUser, int sock, String ip, String port);
+	bool sendData (const uint8_t *data, uint16_t length, int sock, const char *ip,
+		uint16_t port);					// Send data to ip and port
+	bool sendPunch (const uint8_t *data, const uint8_t *idUser, int sock, const char *ip,
+		uint16_t port, uint8_t uidLength = PUNCH_UID_MIN);	// Queue & flush now
+
+	void setBatch (uint8_t punches, unsigned long delayMs);	// Bounds of batches
+	void setCompactBatches (bool enabled);	// Compact format (version 4)
+	bool queuePunch (const uint8_t *data, const uint8_t *idUser,
+		uint8_t uidLength = PUNCH_UID_MIN);
+	bool flushQueue (int sock, const char *ip, uint16_t port, bool force = false);	// Background
+	uint16_t queueDepth ();				// Punches not acknowledged yet
+	const UplinkStats &uplinkStats ();
 
 
 private:
-	String IP;							// IP that network give to ublox module
-	String imei;						// IMEI of SIM card inserted in SODAQ module
-
-	bool setUpUblox ( );				// Start sending AT commands for module configuration
-
-	bool isAlive ();					// Check if ublox module responds to commands
-	bool resetModule ();				// Reset ublox module and check OK in response
-	bool confNbiotConnection ();		// Configure parameters for NB-IoT connection
-	bool networkRegistration ();		// Select the operator and register SIM in network
-	bool askForIp ();					// Take IP of ublox module from the network
-	bool askForImei ();					// Take IMEI's SIM from ublox module
-
-	bool checkRespForOk (int timeOut);	// Check if OK is in the response from ublox module 
-	bool checkRespForReg (int timeOut);	// Check response looking for network registration
-	String checkRespForIp(int timeOut);	// Check response looking for IP given by network
-	int checkRespForSocket(int timeOut);// Check response looking for socket opened
-	String checkRespForImei(int timeOut);// Check response looking for IMEI
-	int checkRespForDataSended(int timeOut, int sock);	// Check # of bytes sent in response
-
-	void sendIt (String atCommand);		// Send an AT command to ublox module
-	String receiveIt ();				// Receive data sended by ublox module
-	void printIt (String text);			// Print a string by debug serial port
-
-	String stringToHexString(String str);// Conversion from string to hexadecimal string
+	char IP [IP_SIZE];					// IP that network give to ublox module
+	char imei [IMEI_SIZE];				// IMEI of SIM card inserted in SODAQ module
+	AtEngine at;						// Sends AT commands & parses responses
+
+	uint8_t state;						// One of NB_STATE_*
+	uint8_t setUpStep;					// Next command of set up
+	bool stepDue;						// Next command is sent after stepDelay
+	bool stepSent;						// Waiting for result of a set up command
+	bool stepQuery;						// The command sent asks the setting (fast start)
+	bool stepChecked;					// Setting asked & different: command is sent
+	bool fastStart;						// Set by setFastStart
+	bool fastSetUp;						// Set up in progress is a fast one
+	unsigned long stepTime;
+	unsigned long stepDelay;
+	unsigned long registrationTime;		// millis() when registration started
+	unsigned long ceregTime;			// millis() of last AT+CEREG?
+	bool registered;
+	int localPort;						// Port of socket opened by start()
+	int sock;
+	uint8_t downlinkSocket;				// Socket of last +NSONMI
+	uint16_t downlinkBytes;
+	bool readPending;					// AT+NSORF sent, waiting for its result
+
+	// Outbox holds punches not acknowledged, from outbox.first() to outbox.end();
+	// sendSequence is the next one written to ublox. The first UPLINK_RAM_PUNCHES are also
+	// cached in RAM
+	PunchOutbox outbox;
+	uint16_t sendSequence;
+	uint16_t highestSent;				// Next punch never sent. Older ones go at once
+	bool outboxLoaded;
+	QueuedPunch ramQueue [UPLINK_RAM_PUNCHES];	// Ring buffer starting at outbox.first()
+	uint8_t ramHead;
+	uint8_t ramCount;
+	unsigned long oldestTime;			// millis() when oldest punch not sent was queued
+	unsigned long lastAttempt;			// millis() of last failed batch
+	bool retryPending;
+	unsigned long ackTime;				// millis() of last sending or acknowledgement
+	unsigned long ackTimeout;			// Grows with back off
+	bool batchInFlight;					// Batch written, waiting for its result
+	uint8_t batchCount;					// Punches of batch in flight
+	uint16_t batchLength;				// Bytes of batch in flight
+	uint16_t batchSequence;				// Sequence number of its first punch
+	int batchSocket;
+	uint8_t batchPunches;
+	unsigned long batchDelay;
+	bool compactBatches;				// Set by setCompactBatches
+	uint8_t batchHeads [UPLINK_WINDOW];	// HEAD of each punch of compact batch in flight
+	UplinkStats stats;
+
+	// UID of an acknowledged punch, which compact batches can refer to
+	struct DictionaryEntry {
+		uint16_t sequence;
+		uint8_t ids;					// Station ID of punch
+		uint8_t uidLength;				// 0: empty
+		uint8_t uid [PUNCH_UID_MAX];
+	};
+
+	DictionaryEntry dictionary [UPLINK_DICTIONARY];	// Ring of last different UIDs
+	uint8_t dictionaryNext;				// Entry replaced by next new UID
+
+	void sendSetUpStep ();				// Queues next command of set up
+	void setUpResult (uint8_t result, const char *info);	// Advances set up
+	void registrationChanged (const char *line);	// +CEREG
+	void downlinkArrived (const char *line);	// +NSONMI
+	void batchResult (uint8_t result, const char *info);
+	void writeBatch (Stream &port);		// Streams batch in flight in hex
+	void downlinkRead (uint8_t result, const char *info);	// AT+NSORF answer
+	void acknowledge (const uint8_t *datagram, uint8_t length);	// Server acknowledgement
+
+	static void setUpCallback (void *context, uint8_t result, const char *info);
+	static void batchCallback (void *context, uint8_t result, const char *info);
+	static void nsorfCallback (void *context, uint8_t result, const char *info);
+	static void ceregHandler (void *context, const char *line);
+	static void nsonmiHandler (void *context, const char *line);
+	static void batchWriter (Stream &port, void *context);
+	static void hexWriter (Stream &port, void *context);	// Streams a HexData
+
+	bool buildNsost (char *atCommand, int sock, const char *ip, uint16_t port,
+		uint16_t length);				// "AT+NSOST=..." without data. False if too long
+	static int parseSent (const char *info, int sock);	// Bytes sent or -1
+	static int parseSocket (const char *info);	// Socket opened or -1
+	static bool copyValue (char *to, const char *info, char separator, uint8_t size);
+	static bool isSet (const char *command, const char *info);	// Query answer shows command
+
+	void loadOutbox ();					// Finds punches left in outbox before reboot
+	void refillRam ();					// Caches outbox punches in RAM while there's room
+	uint16_t planBatch ();				// Punches & HEADs of next batch. Returns its bytes
+	uint8_t findUid (uint8_t index);	// HEAD of a punch of compact batch being planned
+	void rememberUid (uint16_t sequence, const QueuedPunch &punch);	// Acknowledged punch
+	QueuedPunch &ramPunch (uint16_t sequence);	// Punch cached in RAM
+	static int decodeHex (const char *hex, uint8_t *data, uint8_t size);	// Bytes or -1
+	static uint32_t timeDelta (const QueuedPunch &previous, const QueuedPunch &punch);
+	static uint8_t encodeVarint (uint8_t *to, uint32_t value);	// Bytes written, up to 5
+	static void sendHex (Stream &port, const uint8_t *data, uint8_t len, uint16_t &crc);
+	static char *appendText (char *to, const char *text);	// Return end of text written
+	static char *appendNumber (char *to, unsigned int number);
+	static char *appendHex (char *to, const uint8_t *data, uint8_t len);
 
 	
 };